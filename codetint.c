@@ -2,12 +2,36 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <tree_sitter/api.h>
 
 #include "modules/theme.h"
+#include "modules/theme_cache.h"
+#include "modules/html_output.h"
+#include "modules/highlight.h"
+#include "modules/render.h"
+#include "modules/html_virtual.h"
+#include "modules/progressive.h"
+#include "modules/parallel.h"
+#include "modules/injection.h"
+#include "modules/arena.h"
+#include "modules/writer.h"
+#include "modules/gzip.h"
+#include "modules/span_file.h"
+#include "modules/diff.h"
+#include "modules/line_index.h"
+#include "modules/chunked.h"
+#include "modules/grammar.h"
+#include "modules/daemon.h"
+#include "modules/stdio_server.h"
 #include "libcodeimage.h"
 
-// External Tree-sitter language functions
+// Grammars linked into the binary when built with -DCODETINT_STATIC_GRAMMARS (together
+// with their parser.c and scanner.c); otherwise each one is loaded from <name>.so on the
+// grammar path the first time it is needed (grammar.h)
+#ifdef CODETINT_STATIC_GRAMMARS
 const TSLanguage *tree_sitter_python(void);
 const TSLanguage *tree_sitter_c(void);
 const TSLanguage *tree_sitter_cpp(void);
@@ -16,40 +40,98 @@ const TSLanguage *tree_sitter_html(void);
 const TSLanguage *tree_sitter_css(void);
 const TSLanguage *tree_sitter_rust(void);
 const TSLanguage *tree_sitter_bash(void);
-// const TSLanguage *tree_sitter_lua(void);
+#define LINKED_GRAMMAR(function) function
+#else
+#define LINKED_GRAMMAR(function) NULL
+#endif
 
 // Structure to hold language information and associated parser and default query
 typedef struct {
     const char *name;
     const char *extension;
-    const TSLanguage *(*language_function)(void);
+    const TSLanguage *(*language_function)(void); // Linked-in grammar (NULL = loaded from <name>.so)
     const char *default_query_path;
+    const char *injection_query_path; // Regions written in other languages, or NULL
 } LanguageInfo;
 
 LanguageInfo supported_languages[] = {
-    {"python", ".py", tree_sitter_python, "queries/python.scm"},
-    {"c", ".c",  tree_sitter_c, "queries/c.scm"},
-    {"cpp", ".cpp", tree_sitter_cpp, "queries/cpp.scm"},
-    {"javascript", ".js", tree_sitter_javascript, "queries/javascript.scm"},
-    {"html", ".html", tree_sitter_html, "queries/html.scm"},
-    {"css", ".css", tree_sitter_css, "queries/css.scm"},
-    {"rust", ".rs", tree_sitter_rust, "queries/rust.scm"},
-    {"bash", ".sh", tree_sitter_bash, "queries/bash.scm"},
-    // {"lua", ".lua", tree_sitter_lua, "queries/lua.scm"},
-    {NULL, NULL, NULL, NULL}
+    {"python", ".py", LINKED_GRAMMAR(tree_sitter_python), "queries/python.scm", NULL},
+    {"c", ".c",  LINKED_GRAMMAR(tree_sitter_c), "queries/c.scm", NULL},
+    {"cpp", ".cpp", LINKED_GRAMMAR(tree_sitter_cpp), "queries/cpp.scm", NULL},
+    {"javascript", ".js", LINKED_GRAMMAR(tree_sitter_javascript), "queries/javascript.scm", NULL},
+    {"html", ".html", LINKED_GRAMMAR(tree_sitter_html), "queries/html.scm", "queries/html-injections.scm"},
+    {"css", ".css", LINKED_GRAMMAR(tree_sitter_css), "queries/css.scm", NULL},
+    {"rust", ".rs", LINKED_GRAMMAR(tree_sitter_rust), "queries/rust.scm", NULL},
+    {"bash", ".sh", LINKED_GRAMMAR(tree_sitter_bash), "queries/bash.scm", NULL},
+    {"lua", ".lua", NULL, "queries/lua.scm", NULL}, // Never linked in: loaded from grammars/lua.so
+    {NULL, NULL, NULL, NULL, NULL}
 };
 
 
 // Print usage help
 void print_usage(const char *progname) {
-    fprintf(stderr, "Usage: %s [options] <file_path>\n\n", progname);
+    fprintf(stderr, "Usage: %s [options] <file_path>\n", progname);
+    fprintf(stderr, "       %s --daemon SOCKET [--workers N] [--idle-timeout SECONDS] [--theme-dir DIR] [--theme-cache FILE] [--grammar-path DIRS]\n", progname);
+    fprintf(stderr, "       %s --client SOCKET [options] <file_path>\n", progname);
+    fprintf(stderr, "       %s --batch DIR [options] < FILE_LIST\n", progname);
+    fprintf(stderr, "       %s --stdio-server [--theme-dir DIR] [--theme-cache FILE] [--grammar-path DIRS]\n\n", progname);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -q FILE    Use external query file for highlights\n");
     fprintf(stderr, "  -c THEME   Select color theme (default: default)\n");
+    fprintf(stderr, "  --theme-dir DIR           Load additional themes from the *.theme files in DIR (default: themes/ if present)\n");
+    fprintf(stderr, "  --theme-cache FILE        Compiled theme cache to use (default: themes.cache in the theme directory)\n");
     fprintf(stderr, "  -l LANG    Explicitly set language (e.g., 'python', 'c', 'javascript'). Overrides file extension detection.\n");
-    fprintf(stderr, "  -o FILE    Output to file instead of stdout\n");
+    fprintf(stderr, "             Other languages load from LANG.so on the grammar path and use queries/LANG.scm\n");
+    fprintf(stderr, "  --grammar-path DIRS       Directories (':'-separated) searched for grammar shared objects NAME.so (default: %s)\n", GRAMMAR_DEFAULT_PATH);
+    fprintf(stderr, "  -o FILE    Output to file instead of stdout (gzip-compressed if FILE ends in .gz)\n");
+    fprintf(stderr, "  --gzip                    Compress the HTML/ANSI output with gzip as it is written\n");
+    fprintf(stderr, "  --gzip-level N            Compression level for --gzip, 0-9 (default: %d, implies --gzip)\n", GZIP_DEFAULT_LEVEL);
     fprintf(stderr, "  --html     Output HTML instead of ANSI colors\n");
-    fprintf(stderr, "  -n, --line-numbers Show line numbers\n\n");
+    fprintf(stderr, "  --ansi-out FILE[:THEME]   Also write ANSI output to FILE; with several outputs the file is parsed once\n");
+    fprintf(stderr, "                            and each output is written on its own thread (-o and --image-out join them)\n");
+    fprintf(stderr, "  --html-out FILE[:THEME]   Also write an HTML page to FILE (opening in THEME)\n");
+    fprintf(stderr, "  --html-compact-out FILE[:THEME]  Also write a compact HTML page to FILE\n");
+    fprintf(stderr, "  --html-compact            Output compact HTML (merged runs, short class names, lighter line markup)\n");
+    fprintf(stderr, "  --html-virtual            Output HTML that draws only the visible lines from a chunked data payload (for huge files)\n");
+    fprintf(stderr, "  --html-chunk-lines N      Lines per data chunk for --html-virtual (default: %d)\n", HTML_VIRTUAL_DEFAULT_CHUNK_LINES);
+    fprintf(stderr, "  --html-chunks DIR         Write the --html-virtual data chunks into DIR and load them on demand (implies --html-virtual)\n");
+    fprintf(stderr, "  --html-assets DIR         Write shared codetint.css/codetint.js into DIR and link to them instead of inlining\n");
+    fprintf(stderr, "  --html-assets-url URL     URL prefix used to link the shared assets (default: path from the output file to DIR)\n");
+    fprintf(stderr, "  -n, --line-numbers Show line numbers\n");
+    fprintf(stderr, "  --progressive             Show the first screen right away, then highlight and flush the rest window by window\n");
+    fprintf(stderr, "  --progressive-kb N        Window size in KB for --progressive (default: %d, implies --progressive)\n", PROGRESSIVE_DEFAULT_WINDOW_KB);
+    fprintf(stderr, "  --emit-spans FILE         Save the highlight spans to FILE (compact binary) instead of writing output\n");
+    fprintf(stderr, "  --from-spans FILE         Render from spans saved by --emit-spans instead of parsing the source\n");
+    fprintf(stderr, "  --diff FILE               Show the changes of a unified diff to <file_path> (its new version), highlighted\n");
+    fprintf(stderr, "  --diff-old FILE           Old version of the file for --diff (default: rebuilt by undoing the diff)\n");
+    fprintf(stderr, "  --chunked                 Read, parse and highlight the file in chunks with bounded memory (for multi-GB files;\n");
+    fprintf(stderr, "                            on by itself for files of 4 GB and more)\n");
+    fprintf(stderr, "  --chunk-mb N              Chunk size in MB for --chunked (default: %d, implies --chunked)\n", CHUNKED_DEFAULT_CHUNK_MB);
+    fprintf(stderr, "  -j, --jobs N              Threads used to highlight large files and render image pages (default: 0, one per CPU)\n");
+    fprintf(stderr, "  --alloc-stats             Print allocation counters to stderr on exit\n");
+    fprintf(stderr, "  --image-out FILE          Generate a PNG image instead of text output\n");
+    fprintf(stderr, "  --image-max-lines N       Split the image into numbered pages of at most N lines (FILE-001.png, ...)\n");
+    fprintf(stderr, "  --image-max-height PX     Split the image into numbered pages no taller than PX pixels\n");
+    fprintf(stderr, "  --image-manifest FILE     Write a JSON index of the pages and their line ranges\n");
+    fprintf(stderr, "  --image-subpixel N        Horizontal glyph positions per pixel, 1-16 (default: %d, 1 disables)\n", CODE_IMAGE_DEFAULT_SUBPIXEL_PHASES);
+    fprintf(stderr, "  --svg-out FILE[:THEME]    Also write an SVG laid out like --image-out, each glyph outline (and each\n");
+    fprintf(stderr, "                            repeated word) defined once and reused\n");
+    fprintf(stderr, "  --svg-text                Write --svg-out text as <text> runs in the font's family instead of outlines\n\n");
+    fprintf(stderr, "Batch:\n");
+    fprintf(stderr, "  --batch DIR               Highlight each file named on stdin (one path per line) with the other options\n");
+    fprintf(stderr, "                            into DIR/<path>.html or .ansi, in one process that loads grammars, queries\n");
+    fprintf(stderr, "                            and themes once and resets its allocation arenas after every file;\n");
+    fprintf(stderr, "                            --html-chunks CHUNKS writes each file's chunks into CHUNKS/<path>\n\n");
+    fprintf(stderr, "Daemon:\n");
+    fprintf(stderr, "  --daemon SOCKET           Serve runs on the Unix socket SOCKET with grammars, queries, themes and fonts\n");
+    fprintf(stderr, "                            loaded once; --workers N runs at once (default: one per CPU), exits after\n");
+    fprintf(stderr, "                            --idle-timeout SECONDS without requests (default: %d, 0 = never)\n", DAEMON_DEFAULT_IDLE_SECONDS);
+    fprintf(stderr, "  --client SOCKET           Run the rest of the command line in the daemon at SOCKET, with this\n");
+    fprintf(stderr, "                            process's stdin, stdout, stderr and directory; plain runs do the same\n");
+    fprintf(stderr, "                            whenever %s names a socket a daemon is listening on\n\n", DAEMON_ENV_SOCKET);
+    fprintf(stderr, "Editors:\n");
+    fprintf(stderr, "  --stdio-server            Serve an editor over JSON-RPC on stdin and stdout: open documents, apply\n");
+    fprintf(stderr, "                            edits incrementally and send the spans of changed and visible lines\n\n");
     fprintf(stderr, "Available themes: ");
     for (size_t i = 0; i < THEMES_COUNT; i++) {
         fprintf(stderr, "%s%s", themes[i].name, (i < THEMES_COUNT - 1) ? ", " : "\n");
@@ -60,14 +142,38 @@ void print_usage(const char *progname) {
     }
 }
 
+// Reads a stream that cannot seek (a pipe, e.g. /dev/stdin) to its end into a malloc'ed buffer
+static char *load_stream(FILE *fp, size_t *out_size) {
+    size_t capacity = 64 * 1024;
+    size_t size = 0;
+    char *buf = malloc(capacity + 1);
+    while (buf) {
+        size += fread(buf + size, 1, capacity - size, fp);
+        if (size < capacity) break;
+        capacity *= 2;
+        char *grown = realloc(buf, capacity + 1);
+        if (!grown) free(buf);
+        buf = grown;
+    }
+    if (buf && ferror(fp)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    if (!buf) return NULL;
+
+    buf[size] = '\0';
+    if (out_size) *out_size = size;
+    return buf;
+}
+
 // Load the content of a file into a malloc'ed buffer
 char *load_file(const char *filename, size_t *out_size) {
     FILE *fp = fopen(filename, "rb");
     if (!fp) return NULL;
     
     if (fseek(fp, 0, SEEK_END) != 0) {
-        fclose(fp);
-        return NULL;
+        return load_stream(fp, out_size);
     }
     
     long sz = ftell(fp);
@@ -114,62 +220,644 @@ LanguageInfo* get_language_info_from_name(const char* lang_name) {
     return NULL; // Language not found
 }
 
-// Helper function to print a section of text, handling line numbers and HTML escaping
-void print_code_section(FILE *out,
-                        const char *code_buffer,
-                        size_t start_byte,
-                        size_t end_byte, 
-                        bool show_line_numbers,
-                        int line_num_padding, 
-                        uint32_t *current_line_num_ptr,
-                        bool *at_line_start_ptr, 
-                        bool output_html
-                        ) {
-    for (size_t i = start_byte; i < end_byte; ++i) {
-        if (show_line_numbers && *at_line_start_ptr) {
-            if (output_html) {
-                if (*current_line_num_ptr > 1) {
-                    fprintf(out, "</span></div>\n");
-                }
-                fprintf(out, "<div class=\"line\" id=\"L%u\">", *current_line_num_ptr);
-                fprintf(out, "<span class=\"line-number\">%*u</span>", line_num_padding, *current_line_num_ptr);
-                fprintf(out, "<span class=\"code-line-content\">");
-            } else { // ANSI BLOCK
-                fprintf(out, "%s%*u │%s ",
-                    selected_theme->ansi_line_number,
-                    line_num_padding,
-                    *current_line_num_ptr,
-                    selected_theme->ansi_reset
-                );
+// Languages beyond the table, named with -l: NAME.so on the grammar path, highlighted
+// with queries/NAME.scm. Returns NULL if there is no such grammar.
+static LanguageInfo *get_external_language_info(const char *lang_name) {
+    static LanguageInfo external;
+    static char query_path[GRAMMAR_NAME_MAX + 16];
+    if (!grammar_name_valid(lang_name) || !grammar_load(lang_name, NULL)) return NULL;
+    snprintf(query_path, sizeof(query_path), "queries/%s.scm", lang_name);
+    external = (LanguageInfo){lang_name, NULL, NULL, query_path, NULL};
+    return &external;
+}
+
+// The grammar of `lang`, linked in or loaded on first use. Prints the problem and returns NULL if it is missing.
+static const TSLanguage *language_of(const LanguageInfo *lang) {
+    return grammar_load(lang->name, lang->language_function);
+}
+
+static void print_alloc_stats(void) {
+    arena_print_stats(stderr);
+}
+
+// Prints the allocation counters at exit, once however many runs (--batch) ask for it
+static void request_alloc_stats(void) {
+    static bool requested;
+    if (!requested) atexit(print_alloc_stats);
+    requested = true;
+}
+
+// --- Queries ---
+
+// A query compiled together with the capture styles and text predicates rendering
+// needs from it. Default queries are compiled once per process and then shared,
+// read-only, by every thread and every file that uses them (embedded languages
+// included); a query given with -q belongs to the run that loaded it.
+typedef struct CompiledQuery {
+    struct CompiledQuery *next;
+    char *path;                  // Query file it was compiled from
+    const TSLanguage *language;
+    TSQuery *query;
+    uint8_t *capture_styles;
+    QueryPredicates *predicates;
+    bool shared;                 // Kept in query_cache for the rest of the process
+} CompiledQuery;
+
+static pthread_mutex_t query_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CompiledQuery *query_cache;
+
+static void compiled_query_free(CompiledQuery *compiled) {
+    query_predicates_free(compiled->predicates);
+    free(compiled->capture_styles);
+    if (compiled->query) ts_query_delete(compiled->query);
+    free(compiled->path);
+    free(compiled);
+}
+
+// Compiles `source`, the query text read from `path`, for `language`.
+// Prints the problem and returns NULL on failure.
+static CompiledQuery *compile_query(const char *path, const TSLanguage *language, const char *source, size_t source_size) {
+    CompiledQuery *compiled = calloc(1, sizeof(CompiledQuery));
+    if (!compiled || !(compiled->path = strdup(path))) {
+        fprintf(stderr, "Failed to allocate query memory!\n");
+        free(compiled);
+        return NULL;
+    }
+    compiled->language = language;
+
+    TSQueryError error_type;
+    uint32_t error_offset;
+    compiled->query = ts_query_new(language, source, (uint32_t)source_size, &error_offset, &error_type);
+    if (!compiled->query) {
+        fprintf(stderr, "Query parse error in %s at offset %u, error type: %d\n", path, error_offset, error_type);
+        compiled_query_free(compiled);
+        return NULL;
+    }
+    compiled->capture_styles = highlight_capture_styles(compiled->query);
+    compiled->predicates = query_predicates_new(compiled->query); // Reports its own errors
+    if (!compiled->capture_styles || !compiled->predicates) {
+        if (!compiled->capture_styles) fprintf(stderr, "Failed to allocate highlight spans\n");
+        compiled_query_free(compiled);
+        return NULL;
+    }
+    return compiled;
+}
+
+// The `kind` ("default" or "injection") query of `lang_name` at `path`, compiled for
+// `language` the first time it is asked for and shared after that.
+// Prints the problem and returns NULL on failure; failures are not kept.
+static CompiledQuery *cached_query(const char *kind, const char *lang_name, const char *path, const TSLanguage *language) {
+    pthread_mutex_lock(&query_cache_lock);
+    CompiledQuery *compiled = query_cache;
+    while (compiled && (compiled->language != language || strcmp(compiled->path, path) != 0)) {
+        compiled = compiled->next;
+    }
+    if (!compiled) {
+        size_t source_size;
+        char *source = load_file(path, &source_size);
+        if (source) {
+            arena_keep_begin(); // Outlives the file being highlighted, and --batch resets
+            compiled = compile_query(path, language, source, source_size);
+            arena_keep_end();
+            free(source);
+        } else {
+            fprintf(stderr, "Failed to load %s query for %s from %s\n", kind, lang_name, path);
+        }
+        if (compiled) {
+            compiled->shared = true;
+            compiled->next = query_cache;
+            query_cache = compiled;
+        }
+    }
+    pthread_mutex_unlock(&query_cache_lock);
+    return compiled;
+}
+
+// Frees a query loaded for one run; shared ones stay
+static void compiled_query_release(CompiledQuery *compiled) {
+    if (compiled && !compiled->shared) compiled_query_free(compiled);
+}
+
+// The highlight query of `lang`, whose grammar is `language`: `query_file` compiled for
+// this run, or the language's default query. Prints the problem and returns NULL on failure.
+static CompiledQuery *load_highlight_query(const LanguageInfo *lang, const TSLanguage *language, const char *query_file) {
+    if (!query_file) {
+        if (!lang->default_query_path) {
+            fprintf(stderr, "No default query path defined for language '%s'\n", lang->name);
+            return NULL;
+        }
+        return cached_query("default", lang->name, lang->default_query_path, language);
+    }
+
+    size_t query_size;
+    char *query_str = load_file(query_file, &query_size);
+    if (!query_str) {
+        perror("Failed to open query file");
+        return NULL;
+    }
+    CompiledQuery *compiled = compile_query(query_file, language, query_str, query_size);
+    free(query_str);
+    return compiled;
+}
+
+// The injection query of `lang`, whose grammar is `language` (shared).
+// Prints the problem and returns NULL on failure.
+static CompiledQuery *load_injection_query(const LanguageInfo *lang, const TSLanguage *language) {
+    return cached_query("injection", lang->name, lang->injection_query_path, language);
+}
+
+// InjectionLookup for the embedded languages of a file: any supported or external language, with its default query
+static bool lookup_injection_language(const char *name, InjectionLanguage *out) {
+    LanguageInfo *info = get_language_info_from_name(name);
+    char external_query_path[GRAMMAR_NAME_MAX + 16];
+    const char *query_path = info ? info->default_query_path : external_query_path;
+    if (!info) {
+        if (!grammar_name_valid(name)) return false;
+        snprintf(external_query_path, sizeof(external_query_path), "queries/%s.scm", name);
+    }
+    if (!query_path) return false;
+    const TSLanguage *language = grammar_load(name, info ? info->language_function : NULL);
+    if (!language) return false;
+
+    const CompiledQuery *compiled = cached_query("default", name, query_path, language);
+    if (!compiled) return false;
+    *out = (InjectionLanguage){language, compiled->query, compiled->capture_styles, compiled->predicates};
+    return true;
+}
+
+// --- Output ---
+
+typedef struct {
+    const char *output_file;   // NULL for stdout
+    OutputFormat format;
+    bool html_virtual;
+    int html_chunk_lines;
+    const char *html_chunks_dir;
+    const char *html_assets_dir;
+    const char *html_assets_url;
+    bool show_line_numbers;
+    bool gzip;
+    int gzip_level;
+    const ColorTheme *theme;
+    const LineIndex *lines;    // Line index of the code, shared by all outputs
+} OutputOptions;
+
+// Highlighting still to be done while rendering (progressive and parallel output);
+// spans are resolved up front when range_count is 1 and progressive is off
+typedef struct {
+    TSParser *parser;
+    TSTree **tree;
+    TSQuery *query;
+    TSQueryCursor *cursor;
+    const uint8_t *capture_styles;
+    const QueryPredicates *predicates;
+    InjectionSet *injections;
+    bool progressive;
+    uint32_t parse_size;
+    uint32_t window_bytes;
+    unsigned range_count;
+    const Diff *diff;          // Render only these hunks (NULL = the whole file)
+    const DiffSide *diff_old;  // Old version of the file for `diff`
+    FILE *chunked_input;       // Read and highlight this chunk by chunk instead of `code` (NULL = code is loaded)
+    const ChunkedOptions *chunked;
+} DeferredHighlight;
+
+// Writes the HTML page or ANSI text for code[0, code_size). `deferred` is NULL when
+// `spans` already cover the whole file. Returns 0 on success, 1 on failure.
+static int write_output(const OutputOptions *options, const char *code, size_t code_size,
+                        const SpanList *spans, const DeferredHighlight *deferred) {
+    const char *output_file = options->output_file;
+    bool output_html = options->format != OUTPUT_ANSI;
+    bool html_compact = options->format == OUTPUT_HTML_COMPACT;
+    bool diff_view = deferred && deferred->diff;
+    bool show_line_numbers = options->show_line_numbers && !diff_view; // Diff lines carry their own numbers
+
+    // Open output file or stdout
+    FILE *out = stdout;
+    if (output_file) {
+        out = fopen(output_file, "w");
+        if (!out) {
+            perror("Failed to open output file");
+            return 1;
+        }
+    }
+
+    // Compress on the way out: -o *.gz, or --gzip
+    bool gzip_output = options->gzip;
+    size_t output_file_len = output_file ? strlen(output_file) : 0;
+    if (output_file_len > 3 && strcmp(output_file + output_file_len - 3, ".gz") == 0) gzip_output = true;
+    GzipStream *gzip_stream = NULL;
+    if (gzip_output) {
+        FILE *compressed = gzip_open(out, options->gzip_level, output_file != NULL, &gzip_stream);
+        if (!compressed) {
+            fprintf(stderr, "Failed to set up gzip output\n");
+            if (output_file) fclose(out);
+            return 1;
+        }
+        out = compressed;
+    }
+    bool close_out = output_file || gzip_stream;
+
+    int line_num_padding = 0;
+    if (show_line_numbers) {
+        // Chunked input is never held whole, so its lines are counted in a pass of their own
+        size_t total_lines = 0;
+        if (options->lines) {
+            total_lines = options->lines->line_count;
+        } else if (!chunked_count_lines(deferred->chunked_input, &total_lines)) {
+            if (close_out) fclose(out);
+            return 1;
+        }
+        char temp_buffer[24];
+        line_num_padding = snprintf(temp_buffer, sizeof(temp_buffer), "%zu", total_lines);
+        if (line_num_padding < 4) line_num_padding = 4;
+    }
+
+    char *html_assets_href = NULL;
+    if (output_html) {
+        bool header_ok = true;
+        if (options->html_assets_dir) {
+            header_ok = html_write_assets(options->html_assets_dir) == 0;
+            if (header_ok) {
+                html_assets_href = options->html_assets_url ? strdup(options->html_assets_url)
+                                                            : html_assets_href_for(output_file, options->html_assets_dir);
+                header_ok = html_assets_href != NULL;
             }
-            *at_line_start_ptr = false;
         }
 
-        char c = code_buffer[i];
-        if (output_html) {
-            if (c == '&') fputs("&amp;", out);
-            else if (c == '<') fputs("&lt;", out);
-            else if (c == '>') fputs("&gt;", out);
-            else fputc(c, out);
+        HtmlPageOptions page_options = {show_line_numbers, line_num_padding, html_compact, options->html_virtual, html_assets_href, options->theme, diff_view};
+        if (!header_ok || !html_write_page_header(out, &page_options)) {
+            fprintf(stderr, "Failed to build HTML header\n");
+            free(html_assets_href);
+            if (close_out) fclose(out);
+            return 1;
+        }
+    }
+
+    int body_result = 0;
+    Writer *writer = options->html_virtual ? NULL : malloc(sizeof(Writer)); // Kept off the stack (~80 KB)
+    if (options->html_virtual) {
+        HtmlVirtualOptions virtual_options = {show_line_numbers, (uint32_t)options->html_chunk_lines, options->html_chunks_dir, NULL, output_file, options->lines};
+        body_result = html_virtual_write_body(out, code, code_size, spans->items, spans->count, &virtual_options);
+    } else if (!writer) {
+        fprintf(stderr, "Failed to allocate output buffer\n");
+        body_result = 1;
+    } else {
+        // The body goes straight to the output descriptor with writev, mostly as
+        // references into `code` (or into the compressor, which reads them in place);
+        // whatever stdio holds (the page header) goes first
+        fflush(out);
+        if (gzip_stream) writer_init_sink(writer, gzip_write_iov, gzip_stream);
+        else writer_init(writer, fileno(out));
+
+        Renderer renderer;
+        renderer_init(&renderer, out, options->format, show_line_numbers, line_num_padding);
+        if (options->theme) renderer_set_theme(&renderer, options->theme);
+        renderer.writer = writer;
+        renderer_begin(&renderer);
+        if (deferred && deferred->chunked_input) {
+            if (!render_chunked(&renderer, deferred->chunked_input, deferred->chunked)) {
+                body_result = 1;
+            }
+        } else if (deferred && deferred->progressive) {
+            renderer_flush(&renderer); // Page header and first markup go out before the parse of the rest
+            if (!render_progressive(&renderer, deferred->parser, deferred->tree, deferred->query, deferred->cursor,
+                                    deferred->capture_styles, deferred->predicates, deferred->injections,
+                                    code, code_size, deferred->parse_size, deferred->window_bytes)) {
+                body_result = 1;
+            }
+        } else if (diff_view) {
+            DiffSide new_side = {code, code_size, *deferred->tree, deferred->injections};
+            if (!diff_render(&renderer, deferred->diff, deferred->diff_old, &new_side, deferred->query, deferred->cursor,
+                             deferred->capture_styles, deferred->predicates, options->show_line_numbers)) {
+                body_result = 1;
+            }
+        } else if (deferred && deferred->range_count > 1) {
+            if (!render_parallel(&renderer, *deferred->tree, deferred->query, deferred->cursor, deferred->capture_styles,
+                                 deferred->predicates, deferred->injections, code, code_size, options->lines, deferred->range_count)) {
+                body_result = 1;
+            }
         } else {
-            fputc(c, out);
+            render_spans(&renderer, code, 0, code_size, spans->items, spans->count);
+        }
+        renderer_finish(&renderer);
+        if (!writer_flush(writer)) {
+            fprintf(stderr, "Failed to write output\n");
+            body_result = 1;
         }
+    }
+
+    if (output_html) {
+        HtmlPageOptions page_options = {show_line_numbers, line_num_padding, html_compact, options->html_virtual, html_assets_href, options->theme, diff_view};
+        size_t footer_len;
+        const char *footer = html_page_footer(&page_options, &footer_len);
+        fwrite(footer, 1, footer_len, out);
+    }
+    free(writer);
+    free(html_assets_href);
+
+    if (close_out && fclose(out) != 0) {
+        fprintf(stderr, "Failed to write output\n");
+        body_result = 1;
+    }
+    return body_result;
+}
 
-        if (c == '\n') {
-            (*current_line_num_ptr)++;
-            *at_line_start_ptr = true;
+// Sets up `image_options` to draw code_size bytes of `code` (NULL = read the input file)
+// in `theme`. With spans at hand the text is drawn in the theme's colors, from the
+// returned runs (to be freed after drawing); otherwise in its foreground.
+static CodeImageColorRun *theme_image_options(CodeImageOptions *image_options, const ColorTheme *theme,
+                                              const char *code, size_t code_size, const SpanList *spans) {
+    memcpy(image_options->code_background, theme->rgb_background, sizeof(image_options->code_background));
+    memcpy(image_options->text_color, theme->rgb[HL_NONE], sizeof(image_options->text_color));
+    image_options->code = code;
+    image_options->code_size = code_size;
+
+    CodeImageColorRun *color_runs = spans->count ? malloc(spans->count * sizeof(CodeImageColorRun)) : NULL;
+    if (color_runs) {
+        for (size_t i = 0; i < spans->count; i++) {
+            color_runs[i].start = spans->items[i].start;
+            color_runs[i].end = spans->items[i].end;
+            memcpy(color_runs[i].rgb, theme->rgb[spans->items[i].style], sizeof(color_runs[i].rgb));
         }
+        image_options->color_runs = color_runs;
+        image_options->color_run_count = spans->count;
     }
+    return color_runs;
 }
 
+// Draws code_size bytes of `code` (NULL = read `input_file`) as a PNG in `theme`
+static int write_image(const char *input_file, const char *image_path, const CodeImageOptions *base_options,
+                       const ColorTheme *theme, const char *code, size_t code_size, const SpanList *spans) {
+    CodeImageOptions image_options = *base_options;
+    CodeImageColorRun *color_runs = theme_image_options(&image_options, theme, code, code_size, spans);
 
-int main(int argc, char **argv) {
+    int result = code_to_image_generate_ex(input_file, image_path, &image_options);
+    if (result == 0 && (image_options.max_lines_per_page > 0 || image_options.max_page_height > 0)) {
+        printf("Successfully generated paged images for '%s' from '%s'.\n", image_path, input_file);
+    } else if (result == 0) {
+        printf("Successfully generated image '%s' from '%s'.\n", image_path, input_file);
+    } else {
+        fprintf(stderr, "Failed to generate image '%s'.\n", image_path);
+    }
+    free(color_runs);
+    return result;
+}
+
+// Draws code_size bytes of `code` (NULL = read `input_file`) as an SVG in `theme`
+static int write_svg(const char *input_file, const char *svg_path, const CodeImageOptions *base_options,
+                     const ColorTheme *theme, const char *code, size_t code_size, const SpanList *spans) {
+    CodeImageOptions image_options = *base_options;
+    CodeImageColorRun *color_runs = theme_image_options(&image_options, theme, code, code_size, spans);
+
+    int result = code_to_svg_generate(input_file, svg_path, &image_options);
+    if (result == 0) {
+        printf("Successfully generated SVG '%s' from '%s'.\n", svg_path, input_file);
+    } else {
+        fprintf(stderr, "Failed to generate SVG '%s'.\n", svg_path);
+    }
+    free(color_runs);
+    return result;
+}
+
+// --- Multiple Outputs ---
+
+#define MAX_OUTPUTS 16
+
+typedef enum {
+    TARGET_TEXT, // ANSI or HTML, in `format`
+    TARGET_PNG,
+    TARGET_SVG
+} TargetKind;
+
+// One of several outputs made from a single parse (--ansi-out, --html-out, ...)
+typedef struct {
+    const char *path;
+    OutputFormat format;
+    TargetKind kind;
+    const char *theme_name; // NULL = the selected theme
+} OutputTarget;
+
+typedef struct {
+    const OutputTarget *target;
+    const OutputOptions *text_options;
+    const CodeImageOptions *image_options;
+    const char *input_file;
+    const char *code;
+    size_t code_size;
+    const SpanList *spans;
+    int result;
+} OutputJob;
+
+// Adds an output given as FILE or FILE:THEME; the theme is split off `spec` in place.
+static bool add_output_target(OutputTarget *targets, size_t *target_count, char *spec, OutputFormat format, TargetKind kind) {
+    if (*target_count == MAX_OUTPUTS) {
+        fprintf(stderr, "Error: At most %d outputs can be written at once.\n", MAX_OUTPUTS);
+        return false;
+    }
+    char *colon = strrchr(spec, ':');
+    if (colon) *colon = '\0';
+    targets[(*target_count)++] = (OutputTarget){spec, format, kind, colon ? colon + 1 : NULL};
+    return true;
+}
+
+static void *output_worker(void *arg) {
+    OutputJob *job = arg;
+    const OutputTarget *target = job->target;
+    const ColorTheme *theme = target->theme_name ? find_theme(target->theme_name) : selected_theme;
+    if (target->kind == TARGET_PNG) {
+        job->result = write_image(job->input_file, target->path, job->image_options, theme,
+                                  job->code, job->code_size, job->spans);
+    } else if (target->kind == TARGET_SVG) {
+        job->result = write_svg(job->input_file, target->path, job->image_options, theme,
+                                job->code, job->code_size, job->spans);
+    } else {
+        OutputOptions options = *job->text_options;
+        options.output_file = target->path;
+        options.format = target->format;
+        options.theme = theme;
+        job->result = write_output(&options, job->code, job->code_size, job->spans, NULL);
+    }
+    return NULL;
+}
+
+// Writes every target from the same resolved spans, each on its own thread.
+// Returns 0 if all of them succeeded, 1 otherwise.
+static int write_outputs(const OutputTarget *targets, size_t target_count,
+                         const OutputOptions *text_options, const CodeImageOptions *image_options,
+                         const char *input_file, const char *code, size_t code_size, const SpanList *spans) {
+    OutputJob jobs[MAX_OUTPUTS];
+    pthread_t threads[MAX_OUTPUTS];
+    bool started[MAX_OUTPUTS] = {false};
+    for (size_t i = 0; i < target_count; i++) {
+        jobs[i] = (OutputJob){&targets[i], text_options, image_options, input_file, code, code_size, spans, 0};
+        started[i] = pthread_create(&threads[i], NULL, output_worker, &jobs[i]) == 0;
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < target_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            output_worker(&jobs[i]); // Threads unavailable
+        }
+        if (jobs[i].result != 0) result = 1;
+    }
+    return result;
+}
+
+// --- Diffs ---
+
+// Reads the hunks of `input_file` from `diff_file` and the old version of the file:
+// `old_file`, or the new version with the hunks undone. Both versions must agree with
+// the diff. Returns false (with the problem printed and nothing left allocated) on failure.
+static bool load_diff(const char *diff_file, const char *old_file, const char *input_file,
+                      const char *code, size_t code_size, char **diff_text, Diff *diff,
+                      char **old_code, size_t *old_code_size) {
+    size_t diff_size;
+    *diff_text = load_file(diff_file, &diff_size);
+    if (!*diff_text) {
+        perror("Failed to open diff file");
+        return false;
+    }
+    if (!diff_parse(*diff_text, diff_size, input_file, diff)) {
+        free(*diff_text);
+        *diff_text = NULL;
+        return false;
+    }
+
+    if (old_file) {
+        *old_code = load_file(old_file, old_code_size);
+        if (!*old_code) perror("Failed to open old version of the file");
+    } else {
+        *old_code = diff_old_source(diff, code, code_size, old_code_size);
+    }
+    bool ok = *old_code != NULL;
+    if (ok && old_file) {
+        ok = diff_matches(diff, '+', code, code_size) && diff_matches(diff, '-', *old_code, *old_code_size);
+    }
+    if (!ok) {
+        free(*old_code);
+        *old_code = NULL;
+        diff_free(diff);
+        free(*diff_text);
+        *diff_text = NULL;
+    }
+    return ok;
+}
+
+// --- Chunked Input ---
+
+// Writes the output for `input_file` in `lang` (whose grammar is `language`) read chunk
+// by chunk (render_chunked), for files too big to load and parse whole. Returns 0 on success, 1 on failure.
+static int write_chunked(const OutputOptions *options, const LanguageInfo *lang, const TSLanguage *language,
+                         const char *query_file, const char *input_file, size_t chunk_bytes, int jobs) {
+    CompiledQuery *highlight = load_highlight_query(lang, language, query_file);
+    if (!highlight) return 1;
+
+    const CompiledQuery *injection = lang->injection_query_path ? load_injection_query(lang, language) : NULL;
+    FILE *input = fopen(input_file, "rb");
+    int result = 1;
+    if (!input) {
+        perror("Failed to open input file");
+    } else if (injection || !lang->injection_query_path) { // Otherwise already reported
+        ChunkedOptions chunked = {
+            .language = language,
+            .query = highlight->query,
+            .capture_styles = highlight->capture_styles,
+            .predicates = highlight->predicates,
+            .injection_query = injection ? injection->query : NULL,
+            .injection_lookup = lookup_injection_language,
+            .chunk_bytes = chunk_bytes,
+            .jobs = jobs,
+        };
+        DeferredHighlight deferred = {
+            .chunked_input = input,
+            .chunked = &chunked,
+        };
+        result = write_output(options, NULL, 0, NULL, &deferred);
+    }
+
+    if (input) fclose(input);
+    compiled_query_release(highlight);
+    return result;
+}
+
+// --- Daemon ---
+
+// Prepared once by --daemon before it forks a worker for each request. Workers inherit
+// it together with the loaded grammars and the compiled default queries, so a request
+// skips all of that; the worker's run takes warm_parser over.
+static TSParser *warm_parser;
+static bool themes_warm;
+static const char *warm_theme_dir;
+static const char *warm_theme_cache;
+
+static bool same_option(const char *a, const char *b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// Loads the themes for every later run with the same --theme-dir and --theme-cache.
+// Returns false if they cannot be loaded.
+static bool warm_themes(const char *theme_dir, const char *theme_cache_path) {
+    if (themes_load_dir(theme_dir ? theme_dir : THEME_DEFAULT_DIR, theme_cache_path, theme_dir != NULL) != 0) {
+        return false;
+    }
+    themes_warm = true;
+    warm_theme_dir = theme_dir;
+    warm_theme_cache = theme_cache_path;
+    return true;
+}
+
+// Loads the themes, every grammar that is linked in or on the grammar path with its
+// default and injection queries, and the fonts. Returns false if the themes cannot be loaded.
+static bool warm_up(const char *theme_dir, const char *theme_cache_path) {
+    if (!warm_themes(theme_dir, theme_cache_path)) return false;
+
+    for (int i = 0; supported_languages[i].name != NULL; i++) {
+        const LanguageInfo *lang = &supported_languages[i];
+        if (!grammar_available(lang->name, lang->language_function)) continue; // Reported if a request needs it
+        const TSLanguage *language = language_of(lang);
+        if (!language) continue;
+        if (lang->default_query_path) cached_query("default", lang->name, lang->default_query_path, language);
+        if (lang->injection_query_path) load_injection_query(lang, language);
+    }
+    warm_parser = ts_parser_new();
+    code_image_preload_fonts();
+    return true;
+}
+
+static int codetint_main(int argc, char **argv) {
     const char *input_file = NULL;
     const char *query_file = NULL;
     const char *output_file = NULL;
+    bool gzip_output = false;
+    int gzip_level = GZIP_DEFAULT_LEVEL;
     const char *explicit_lang_name = NULL;
     bool output_html = false;
+    bool html_compact = false;
+    bool html_virtual = false;
+    int html_chunk_lines = HTML_VIRTUAL_DEFAULT_CHUNK_LINES;
+    const char *html_chunks_dir = NULL; // Sidecar directory for virtual page data (default: inline)
+    bool progressive = false;
+    int progressive_window_kb = PROGRESSIVE_DEFAULT_WINDOW_KB;
+    int jobs = 0; // Worker threads (0 = one per online CPU)
+    bool chunked = false; // Read and highlight the input chunk by chunk
+    int chunk_mb = CHUNKED_DEFAULT_CHUNK_MB;
+    const char *html_assets_dir = NULL; // Write shared codetint.css/js here and link to them
+    const char *html_assets_url = NULL; // URL prefix for the shared assets (default: relative path to the directory)
     bool show_line_numbers = false;
+    const char *theme_name = NULL;
+    const char *theme_dir = NULL;        // Directory of *.theme files (default: themes/ if present)
+    const char *theme_cache_path = NULL; // Compiled theme cache (default: <theme dir>/themes.cache)
+    const char *grammar_path = NULL;     // Directories of grammar shared objects (default: GRAMMAR_DEFAULT_PATH)
+    const char *emit_spans_file = NULL; // Save the spans here instead of rendering
+    const char *from_spans_file = NULL; // Render from these saved spans instead of parsing
+    const char *diff_file = NULL;       // Show only the hunks of this unified diff
+    const char *diff_old_file = NULL;   // Old version for --diff (default: rebuilt from the diff)
+    OutputTarget targets[MAX_OUTPUTS];  // --ansi-out, --html-out, --html-compact-out, --svg-out (and then -o, --image-out)
+    size_t target_count = 0;
+    bool show_help = false;
 
     // Variables for image output
     bool generate_image = false;
@@ -178,6 +866,11 @@ int main(int argc, char **argv) {
     float image_font_size = 18.0f;
     int image_width = 0; // 0 means auto
     int image_height = 0; // 0 means auto
+    int image_max_lines = 0; // 0 means a single image
+    int image_max_height = 0; // 0 means no pixel limit per page
+    const char *image_manifest_path = NULL;
+    int image_subpixel_phases = CODE_IMAGE_DEFAULT_SUBPIXEL_PHASES;
+    bool svg_text = false; // --svg-out as <text> instead of glyph outlines
 
     LanguageInfo *current_lang_info = NULL;
 
@@ -186,19 +879,74 @@ int main(int argc, char **argv) {
         if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
             query_file = argv[++i];
         } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
-            const char *theme_name = argv[++i];
-            if (!set_selected_theme(theme_name)) {
-                fprintf(stderr, "Unknown theme '%s'\n", theme_name);
-                print_usage(argv[0]);
-                return 1;
-            }
+            theme_name = argv[++i];
+        } else if (strcmp(argv[i], "--theme-dir") == 0 && i + 1 < argc) {
+            theme_dir = argv[++i];
+        } else if (strcmp(argv[i], "--theme-cache") == 0 && i + 1 < argc) {
+            theme_cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--grammar-path") == 0 && i + 1 < argc) {
+            grammar_path = argv[++i];
         } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
             explicit_lang_name = argv[++i];
         }
         else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
             output_file = argv[++i];
+        } else if (strcmp(argv[i], "--gzip") == 0) {
+            gzip_output = true;
+        } else if (strcmp(argv[i], "--gzip-level") == 0 && i + 1 < argc) {
+            gzip_level = atoi(argv[++i]);
+            gzip_output = true;
+        } else if (strcmp(argv[i], "--ansi-out") == 0 && i + 1 < argc) {
+            if (!add_output_target(targets, &target_count, argv[++i], OUTPUT_ANSI, TARGET_TEXT)) return 1;
+        } else if (strcmp(argv[i], "--html-out") == 0 && i + 1 < argc) {
+            if (!add_output_target(targets, &target_count, argv[++i], OUTPUT_HTML, TARGET_TEXT)) return 1;
+        } else if (strcmp(argv[i], "--html-compact-out") == 0 && i + 1 < argc) {
+            if (!add_output_target(targets, &target_count, argv[++i], OUTPUT_HTML_COMPACT, TARGET_TEXT)) return 1;
+        } else if (strcmp(argv[i], "--svg-out") == 0 && i + 1 < argc) {
+            if (!add_output_target(targets, &target_count, argv[++i], OUTPUT_ANSI, TARGET_SVG)) return 1;
+        } else if (strcmp(argv[i], "--svg-text") == 0) {
+            svg_text = true;
         } else if (strcmp(argv[i], "--html") == 0) {
             output_html = true;
+        } else if (strcmp(argv[i], "--html-compact") == 0) {
+            output_html = true;
+            html_compact = true;
+        } else if (strcmp(argv[i], "--html-virtual") == 0) {
+            output_html = true;
+            html_virtual = true;
+        } else if (strcmp(argv[i], "--html-chunk-lines") == 0 && i + 1 < argc) {
+            html_chunk_lines = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--html-chunks") == 0 && i + 1 < argc) {
+            html_chunks_dir = argv[++i];
+            output_html = true;
+            html_virtual = true;
+        } else if (strcmp(argv[i], "--html-assets") == 0 && i + 1 < argc) {
+            html_assets_dir = argv[++i];
+            output_html = true;
+        } else if (strcmp(argv[i], "--html-assets-url") == 0 && i + 1 < argc) {
+            html_assets_url = argv[++i];
+        } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            request_alloc_stats();
+        } else if (strcmp(argv[i], "--progressive") == 0) {
+            progressive = true;
+        } else if (strcmp(argv[i], "--progressive-kb") == 0 && i + 1 < argc) {
+            progressive_window_kb = atoi(argv[++i]);
+            progressive = true;
+        } else if (strcmp(argv[i], "--chunked") == 0) {
+            chunked = true;
+        } else if (strcmp(argv[i], "--chunk-mb") == 0 && i + 1 < argc) {
+            chunk_mb = atoi(argv[++i]);
+            chunked = true;
+        } else if (strcmp(argv[i], "--emit-spans") == 0 && i + 1 < argc) {
+            emit_spans_file = argv[++i];
+        } else if (strcmp(argv[i], "--from-spans") == 0 && i + 1 < argc) {
+            from_spans_file = argv[++i];
+        } else if (strcmp(argv[i], "--diff") == 0 && i + 1 < argc) {
+            diff_file = argv[++i];
+        } else if (strcmp(argv[i], "--diff-old") == 0 && i + 1 < argc) {
+            diff_old_file = argv[++i];
         } else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--line-numbers") == 0) {
             show_line_numbers = true;
         }
@@ -213,10 +961,17 @@ int main(int argc, char **argv) {
             image_width = atoi(argv[++i]);
         } else if (strcmp(argv[i], "--image-h") == 0 && i + 1 < argc) {
             image_height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--image-max-lines") == 0 && i + 1 < argc) {
+            image_max_lines = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--image-max-height") == 0 && i + 1 < argc) {
+            image_max_height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--image-manifest") == 0 && i + 1 < argc) {
+            image_manifest_path = argv[++i];
+        } else if (strcmp(argv[i], "--image-subpixel") == 0 && i + 1 < argc) {
+            image_subpixel_phases = atoi(argv[++i]);
         }
         else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
-            print_usage(argv[0]);
-            return 0;
+            show_help = true;
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Unknown option '%s'\n", argv[i]);
             print_usage(argv[0]);
@@ -226,38 +981,194 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Themes from theme files join the built-in ones before -c is resolved (a --daemon worker has them already)
+    bool themes_ready = themes_warm && same_option(theme_dir, warm_theme_dir) && same_option(theme_cache_path, warm_theme_cache);
+    if (!themes_ready && themes_load_dir(theme_dir ? theme_dir : THEME_DEFAULT_DIR, theme_cache_path, theme_dir != NULL) != 0) {
+        return 1;
+    }
+
+    if (show_help) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    if (grammar_path) grammar_set_search_path(grammar_path);
+
+    if (theme_name && !set_selected_theme(theme_name)) {
+        fprintf(stderr, "Unknown theme '%s'\n", theme_name);
+        print_usage(argv[0]);
+        return 1;
+    }
+
     if (!input_file) {
         print_usage(argv[0]);
         return 1;
     }
 
+    if (html_chunk_lines < 1) {
+        fprintf(stderr, "Error: --html-chunk-lines must be at least 1.\n");
+        return 1;
+    }
+
+    if (progressive && progressive_window_kb < 1) {
+        fprintf(stderr, "Error: --progressive-kb must be at least 1.\n");
+        return 1;
+    }
+
+    if (jobs < 0) {
+        fprintf(stderr, "Error: --jobs must not be negative.\n");
+        return 1;
+    }
+
+    if (chunk_mb < 1 || chunk_mb > CHUNKED_MAX_CHUNK_MB) {
+        fprintf(stderr, "Error: --chunk-mb must be between 1 and %d.\n", CHUNKED_MAX_CHUNK_MB);
+        return 1;
+    }
+
+    // Tree-sitter offsets are 32-bit, so files of 4 GB and more can only be read in chunks
+    struct stat input_stat;
+    if (stat(input_file, &input_stat) == 0 && (uint64_t)input_stat.st_size > UINT32_MAX) {
+        chunked = true;
+    }
+
+    if (chunked && (progressive || html_virtual || emit_spans_file || from_spans_file || diff_file || generate_image || target_count > 0)) {
+        fprintf(stderr, "Error: --chunked (needed for files of 4 GB and more) cannot be combined with --progressive, --html-virtual, --emit-spans, --from-spans, --diff, --image-out or several outputs.\n");
+        return 1;
+    }
+
+    if (progressive && html_virtual) {
+        fprintf(stderr, "Error: --progressive cannot be combined with --html-virtual.\n");
+        return 1;
+    }
+
+    if (emit_spans_file && (from_spans_file || progressive || generate_image)) {
+        fprintf(stderr, "Error: --emit-spans cannot be combined with --from-spans, --progressive or --image-out.\n");
+        return 1;
+    }
+
+    if (diff_old_file && !diff_file) {
+        fprintf(stderr, "Error: --diff-old requires --diff.\n");
+        return 1;
+    }
+
+    if (diff_file && (progressive || html_virtual || emit_spans_file || from_spans_file || generate_image || target_count > 0)) {
+        fprintf(stderr, "Error: --diff cannot be combined with --progressive, --html-virtual, --emit-spans, --from-spans, --image-out or several outputs.\n");
+        return 1;
+    }
+
+    // Several outputs share one parse: -o and --image-out join those named with
+    // --ansi-out, --html-out, --html-compact-out and --svg-out
+    bool multi_output = target_count > 0;
+    if (multi_output && (progressive || html_virtual || emit_spans_file)) {
+        fprintf(stderr, "Error: --progressive, --html-virtual and --emit-spans cannot be combined with --ansi-out, --html-out, --html-compact-out or --svg-out.\n");
+        return 1;
+    }
+    for (size_t t = 0; t < target_count; t++) {
+        if (targets[t].theme_name && !find_theme(targets[t].theme_name)) {
+            fprintf(stderr, "Unknown theme '%s' for output '%s'\n", targets[t].theme_name, targets[t].path);
+            return 1;
+        }
+    }
+    if (multi_output && target_count + (output_file != NULL) + (generate_image && image_output_path) > MAX_OUTPUTS) {
+        fprintf(stderr, "Error: At most %d outputs can be written at once.\n", MAX_OUTPUTS);
+        return 1;
+    }
+    if (multi_output && output_file) {
+        OutputFormat format = output_html ? (html_compact ? OUTPUT_HTML_COMPACT : OUTPUT_HTML) : OUTPUT_ANSI;
+        targets[target_count++] = (OutputTarget){output_file, format, TARGET_TEXT, NULL};
+    }
+    if (multi_output && generate_image && image_output_path) {
+        targets[target_count++] = (OutputTarget){image_output_path, OUTPUT_ANSI, TARGET_PNG, NULL};
+    }
+
+    // Spans saved by an earlier --emit-spans replace tree-sitter altogether
+    char *code = NULL;
+    size_t code_size = 0;
+    SpanList spans = {0};
+    LineIndex lines = {0}; // Built once the code is loaded; gutters, ranges, pages and images read it
+    if (from_spans_file) {
+        code = load_file(input_file, &code_size);
+        if (!code) {
+            perror("Failed to open input file");
+            return 1;
+        }
+        size_t span_data_size;
+        char *span_data = load_file(from_spans_file, &span_data_size);
+        if (!span_data) {
+            perror("Failed to open span file");
+            free(code);
+            return 1;
+        }
+        bool spans_ok = span_file_read((const unsigned char *)span_data, span_data_size, code, code_size, &spans);
+        free(span_data);
+        if (spans_ok && !line_index_build(&lines, code, code_size)) {
+            fprintf(stderr, "Failed to allocate line index memory!\n");
+            spans_ok = false;
+        }
+        if (!spans_ok) {
+            span_list_free(&spans);
+            free(code);
+            return 1;
+        }
+    }
+
+    CodeImageOptions image_options;
+    code_image_options_init(&image_options);
+    image_options.font_name = image_font_name;
+    image_options.font_size = image_font_size;
+    image_options.img_width = image_width;
+    image_options.img_height = image_height;
+    image_options.max_lines_per_page = image_max_lines;
+    image_options.max_page_height = image_max_height;
+    image_options.manifest_path = image_manifest_path;
+    image_options.subpixel_phases = image_subpixel_phases;
+    image_options.svg_mode = svg_text ? CODE_IMAGE_SVG_TEXT : CODE_IMAGE_SVG_GLYPHS;
+    image_options.threads = jobs;
+    if (from_spans_file) image_options.lines = &lines;
+
     // --- Image Generation Logic ---
-    if (generate_image) {
+    if (generate_image && !multi_output) {
         if (!image_output_path) {
             fprintf(stderr, "Error: --image-out requires an output file path.\n");
             print_usage(argv[0]);
+            span_list_free(&spans);
+            free(code);
             return 1;
         }
-        // Call the library function
-        int result = code_to_image_generate(
-            input_file,
-            image_output_path,
-            image_font_name,
-            image_font_size,
-            image_width,
-            image_height
-        );
-        if (result == 0) {
-            printf("Successfully generated image '%s' from '%s'.\n", image_output_path, input_file);
-        } else {
-            fprintf(stderr, "Failed to generate image '%s'.\n", image_output_path);
-        }
+        int result = write_image(input_file, image_output_path, &image_options, selected_theme, code, code_size, &spans);
+        line_index_free(&lines);
+        span_list_free(&spans);
+        free(code);
+        return result;
+    }
+
+    OutputOptions output_options = {
+        .output_file = output_file,
+        .format = output_html ? (html_compact ? OUTPUT_HTML_COMPACT : OUTPUT_HTML) : OUTPUT_ANSI,
+        .html_virtual = html_virtual,
+        .html_chunk_lines = html_chunk_lines,
+        .html_chunks_dir = html_chunks_dir,
+        .html_assets_dir = html_assets_dir,
+        .html_assets_url = html_assets_url,
+        .show_line_numbers = show_line_numbers,
+        .gzip = gzip_output,
+        .gzip_level = gzip_level,
+        .lines = &lines,
+    };
+
+    if (from_spans_file) {
+        int result = multi_output ? write_outputs(targets, target_count, &output_options, &image_options, input_file, code, code_size, &spans)
+                                  : write_output(&output_options, code, code_size, &spans, NULL);
+        line_index_free(&lines);
+        span_list_free(&spans);
+        free(code);
         return result;
     }
 
     // --- HTML/ANSI Generation Logic (only if not generating image) ---
     if (explicit_lang_name) {
         current_lang_info = get_language_info_from_name(explicit_lang_name);
+        if (!current_lang_info) current_lang_info = get_external_language_info(explicit_lang_name);
         if (!current_lang_info) {
             fprintf(stderr, "Error: Unknown language '%s' specified with -l flag.\n", explicit_lang_name);
             print_usage(argv[0]);
@@ -273,380 +1184,458 @@ int main(int argc, char **argv) {
         }
     }
 
+    const TSLanguage *language = language_of(current_lang_info);
+    if (!language) return 1;
+
+    if (chunked) {
+        output_options.lines = NULL; // The file is never held whole
+        return write_chunked(&output_options, current_lang_info, language, query_file, input_file, (size_t)chunk_mb * 1024 * 1024, jobs);
+    }
+
     // Load source code
-    size_t code_size;
-    char *code = load_file(input_file, &code_size);
+    code = load_file(input_file, &code_size);
     if (!code) {
         perror("Failed to open input file");
         return 1;
     }
 
-    // Load query string
-    char *query_str = NULL;
-    if (query_file) {
-        size_t query_size;
-        query_str = load_file(query_file, &query_size);
-        if (!query_str) {
-            perror("Failed to open query file");
-            free(code);
-            return 1;
-        }
-    } else {
-        if (current_lang_info->default_query_path) {
-            size_t query_size;
-            query_str = load_file(current_lang_info->default_query_path, &query_size);
-            if (!query_str) {
-                fprintf(stderr, "Failed to load default query for %s from %s\n", current_lang_info->name, current_lang_info->default_query_path);
-                free(code);
-                return 1;
-            }
-        } else {
-            fprintf(stderr, "No default query path defined for language '%s'\n", current_lang_info->name);
-            free(code);
-            return 1;
-        }
+    // Default queries come compiled from the cache (already warm in a --daemon worker)
+    CompiledQuery *highlight = load_highlight_query(current_lang_info, language, query_file);
+    if (!highlight) {
+        free(code);
+        return 1;
     }
+    TSQuery *query = highlight->query;
+    const uint8_t *capture_styles = highlight->capture_styles;
+    const QueryPredicates *predicates = highlight->predicates; // #match? and friends, checked as matches stream out
 
-    // Initialize parser
-    TSParser *parser = ts_parser_new();
+    // Initialize parser (a --daemon worker takes the one made before it was forked)
+    TSParser *parser = warm_parser ? warm_parser : ts_parser_new();
+    warm_parser = NULL;
     if (!parser) {
         fprintf(stderr, "Failed to create parser\n");
+        compiled_query_release(highlight);
         free(code);
-        free(query_str);
         return 1;
     }
     
-    if (!ts_parser_set_language(parser, current_lang_info->language_function())) {
+    if (!ts_parser_set_language(parser, language)) {
         fprintf(stderr, "Failed to set language for %s. Version mismatch?\n", current_lang_info->name);
         ts_parser_delete(parser);
+        compiled_query_release(highlight);
         free(code);
-        free(query_str);
         return 1;
     }
 
-    TSTree *tree = ts_parser_parse_string(parser, NULL, code, code_size);
+    // Progressive output parses just the first window up front; the rest follows once it is shown.
+    // Embedded languages are found in the tree of the whole file, so those files are parsed at once.
+    uint32_t window_bytes = (uint32_t)progressive_window_kb * 1024;
+    uint32_t parse_size = (uint32_t)code_size;
+    if (progressive && !current_lang_info->injection_query_path) {
+        parse_size = progressive_line_end_after(code, code_size, window_bytes);
+    }
+    TSTree *tree = ts_parser_parse_string(parser, NULL, code, parse_size);
     if (!tree) {
         fprintf(stderr, "Failed to parse code\n");
         ts_parser_delete(parser);
+        compiled_query_release(highlight);
         free(code);
-        free(query_str);
         return 1;
     }
     
     TSNode root = ts_tree_root_node(tree);
 
-    // Compile query
-    TSQueryError error_type;
-    uint32_t error_offset;
-    TSQuery *query = ts_query_new(current_lang_info->language_function(), query_str, strlen(query_str), &error_offset, &error_type);
-    if (!query) {
-        fprintf(stderr, "Query parse error at offset %u, error type: %d\n", error_offset, error_type);
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    if (!cursor) {
+        fprintf(stderr, "Failed to create query cursor\n");
         ts_tree_delete(tree);
         ts_parser_delete(parser);
+        compiled_query_release(highlight);
         free(code);
-        free(query_str);
         return 1;
     }
-
-    // Open output file or stdout
-    FILE *out = stdout;
-    if (output_file) {
-        out = fopen(output_file, "w");
-        if (!out) {
-            perror("Failed to open output file");
-            ts_query_delete(query);
+    
+    // The old version of a diffed file is parsed with the same parser
+    char *diff_text = NULL;
+    Diff diff = {0};
+    char *old_code = NULL;
+    size_t old_code_size = 0;
+    TSTree *old_tree = NULL;
+    if (diff_file) {
+        bool diff_ok = load_diff(diff_file, diff_old_file, input_file, code, code_size, &diff_text, &diff, &old_code, &old_code_size);
+        if (diff_ok) {
+            old_tree = ts_parser_parse_string(parser, NULL, old_code, (uint32_t)old_code_size);
+            if (!old_tree) fprintf(stderr, "Failed to parse the old version of the file\n");
+        }
+        if (!old_tree) {
+            diff_free(&diff);
+            free(old_code);
+            free(diff_text);
+            ts_query_cursor_delete(cursor);
             ts_tree_delete(tree);
             ts_parser_delete(parser);
+            compiled_query_release(highlight);
             free(code);
-            free(query_str);
             return 1;
         }
     }
 
-    TSQueryCursor *cursor = ts_query_cursor_new();
-    if (!cursor) {
-        fprintf(stderr, "Failed to create query cursor\n");
-        if (output_file) fclose(out);
-        ts_query_delete(query);
+    // Large files are queried and rendered in ranges on several threads
+    unsigned range_count = (progressive || html_virtual || emit_spans_file || multi_output || diff_file) ? 1 : parallel_range_count(code_size, jobs);
+
+    // Resolve highlight spans for the whole file (progressive and parallel output resolve them per range, diffs per hunk)
+    uint32_t span_cursor = 0;
+    bool spans_ok = true;
+    if (!progressive && range_count == 1 && !diff_file) {
+        ts_query_cursor_exec(cursor, query, root);
+        spans_ok = highlight_collect(cursor, capture_styles, predicates, code, code_size, &span_cursor, &spans);
+    }
+    if (!spans_ok) {
+        fprintf(stderr, "Failed to allocate highlight spans\n");
+        span_list_free(&spans);
+        if (old_tree) ts_tree_delete(old_tree);
+        diff_free(&diff);
+        free(old_code);
+        free(diff_text);
+        ts_query_cursor_delete(cursor);
         ts_tree_delete(tree);
         ts_parser_delete(parser);
+        compiled_query_release(highlight);
         free(code);
-        free(query_str);
         return 1;
     }
-    
-    ts_query_cursor_exec(cursor, query, root);
-
-    size_t current_byte = 0;
-    TSQueryMatch match;
 
-    // Line number related variables
-    uint32_t current_line_num = 1;
-    bool at_line_start = true;
+    // Embedded languages (e.g. <script> and <style> bodies in HTML) get their own parsers
+    InjectionSet injections = {0};
+    InjectionSet old_injections = {0};
+    if (current_lang_info->injection_query_path) {
+        const CompiledQuery *injection = load_injection_query(current_lang_info, language);
+        bool injections_ok = injection &&
+                             injection_collect(&injections, tree, injection->query, code, code_size, lookup_injection_language);
+        if (injections_ok && old_tree) {
+            injections_ok = injection_collect(&old_injections, old_tree, injection->query, old_code, old_code_size, lookup_injection_language);
+        }
+        if (injections_ok && !progressive && range_count == 1 && !diff_file) {
+            SpanList scratch = {0};
+            injections_ok = injection_apply(&injections, 0, (uint32_t)code_size, &spans, &scratch);
+            span_list_free(&scratch);
+            if (!injections_ok) fprintf(stderr, "Failed to allocate highlight spans\n");
+        }
+        if (!injections_ok) {
+            injection_set_free(&injections);
+            injection_set_free(&old_injections);
+            span_list_free(&spans);
+            if (old_tree) ts_tree_delete(old_tree);
+            diff_free(&diff);
+            free(old_code);
+            free(diff_text);
+            ts_query_cursor_delete(cursor);
+            ts_tree_delete(tree);
+            ts_parser_delete(parser);
+            compiled_query_release(highlight);
+            free(code);
+            return 1;
+        }
+    }
 
-    int line_num_padding = 0;
-    if (show_line_numbers) {
-        uint32_t total_lines = 1;
-        for (size_t i = 0; i < code_size; ++i) {
-            if (code[i] == '\n') {
-                total_lines++;
+    int result = 0;
+    if (!emit_spans_file && !line_index_build(&lines, code, code_size)) {
+        fprintf(stderr, "Failed to allocate line index memory!\n");
+        result = 1;
+    } else if (emit_spans_file) {
+        FILE *span_out = fopen(emit_spans_file, "wb");
+        if (!span_out) {
+            perror("Failed to open span file");
+            result = 1;
+        } else {
+            bool written = span_file_write(span_out, code, code_size, spans.items, spans.count);
+            if (fclose(span_out) != 0 || !written) {
+                fprintf(stderr, "Failed to write span file '%s'\n", emit_spans_file);
+                result = 1;
             }
         }
-        
-        char temp_buffer[16];
-        line_num_padding = snprintf(temp_buffer, sizeof(temp_buffer), "%u", total_lines);
-        if (line_num_padding < 4) line_num_padding = 4;
+    } else if (multi_output) {
+        image_options.lines = &lines;
+        result = write_outputs(targets, target_count, &output_options, &image_options, input_file, code, code_size, &spans);
+    } else {
+        DiffSide old_side = {old_code, old_code_size, old_tree, &old_injections};
+        DeferredHighlight deferred = {
+            .parser = parser,
+            .tree = &tree,
+            .query = query,
+            .cursor = cursor,
+            .capture_styles = capture_styles,
+            .predicates = predicates,
+            .injections = &injections,
+            .progressive = progressive,
+            .parse_size = parse_size,
+            .window_bytes = window_bytes,
+            .range_count = range_count,
+            .diff = diff_file ? &diff : NULL,
+            .diff_old = &old_side,
+        };
+        result = write_output(&output_options, code, code_size, &spans, &deferred);
     }
 
-    if (output_html) {
-        fprintf(out, "<!DOCTYPE html>\n<html><head><title>Highlighted Code</title>\n");
-        fprintf(out, "<meta charset=\"utf-8\">\n");
-        fprintf(out, "<style>\n");
-        fprintf(out, "body { background-color: #1a1a1a; color: #e0e0e0; font-family: 'JetBrains Mono', 'Fira Code', 'Consolas', monospace; margin: 20px; }\n");
-        fprintf(out, "pre { margin: 0; line-height: 1.4; white-space: pre-wrap; word-wrap: break-word; }\n");
-        fprintf(out, ".code-container { background-color: #0d0d0d; border: 1px solid #333; padding: 10px; border-radius: 5px; overflow-x: auto; box-shadow: 0 4px 8px rgba(0, 0, 0, 0.2); }\n");
-        fprintf(out, ".line { display: flex; align-items: baseline; }\n");
-        fprintf(out, ".line:hover { background-color: rgba(255, 255, 255, 0.05); }\n");
-
-        if (show_line_numbers) {
-            fprintf(out,
-                ".line-number { "
-                "color: %s; "
-                "text-align: right; "
-                "user-select: none; -webkit-user-select: none; "
-                "display: inline-block; "
-                "min-width: %dch; "
-                "padding-right: 1em; "
-                "margin-right: 1em; "
-                "border-right: 1px solid #333; "
-                "}\n",
-                selected_theme->html_line_number,
-                line_num_padding
-            );
-            // Style for the span that holds actual code content
-            fprintf(out, ".code-line-content { display: block; flex-grow: 1; }\n");
-        }
-        
-        // Base highlighting styles
-        fprintf(out, "/* Base highlighting styles (will be overridden by theme-specific rules) */\n");
-        fprintf(out, ".function-builtin { color: %s; }\n", themes[0].html_function_builtin);
-        fprintf(out, ".function { color: %s; }\n", themes[0].html_function);
-        fprintf(out, ".string { color: %s; }\n", themes[0].html_string);
-        fprintf(out, ".comment { color: %s; font-style: italic; }\n", themes[0].html_comment);
-        fprintf(out, ".keyword { color: %s; }\n", themes[0].html_keyword);
-        fprintf(out, ".keyword-control { color: %s; font-weight: bold; }\n", themes[0].html_keyword_control);
-        fprintf(out, ".type { color: %s; }\n", themes[0].html_type);
-        fprintf(out, ".variable { color: %s; }\n", themes[0].html_variable);
-        fprintf(out, ".constant { color: %s; }\n", themes[0].html_constant);
-        fprintf(out, ".literal { color: %s; }\n", themes[0].html_literal);
-
-        // Generate all theme CSS classes
-        for (size_t t = 0; t < THEMES_COUNT; t++) {
-            fprintf(out, ".theme-%s body { background: ", themes[t].name);
-            if (strcmp(themes[t].name, "gruvbox") == 0) fprintf(out, "#282828; color: #ebdbb2; }\n");
-            else if (strcmp(themes[t].name, "dracula") == 0) fprintf(out, "#282a36; color: #f8f8f2; }\n");
-            else if (strcmp(themes[t].name, "nord") == 0) fprintf(out, "#2E3440; color: #D8DEE9; }\n");
-            else if (strcmp(themes[t].name, "one-dark") == 0) fprintf(out, "#282C34; color: #ABB2BF; }\n");
-            else if (strcmp(themes[t].name, "tokyonight-night") == 0) fprintf(out, "#1a1b26; color: #a9b1d6; }\n");
-            else if (strcmp(themes[t].name, "tokyonight-storm") == 0) fprintf(out, "#24283b; color: #c0caf5; }\n");
-            else if (strcmp(themes[t].name, "catppuccin-mocha") == 0) fprintf(out, "#1E1E2E; color: #CDD6F4; }\n");
-            else if (strcmp(themes[t].name, "solarized-dark") == 0) fprintf(out, "#002b36; color: #839496; }\n");
-            else if (strcmp(themes[t].name, "solarized-light") == 0) fprintf(out, "#fdf6e3; color: #586e75; }\n");
-            else if (strcmp(themes[t].name, "monokai") == 0) fprintf(out, "#272822; color: #F8F8F2; }\n");
-            else if (strcmp(themes[t].name, "github-dark") == 0) fprintf(out, "#22272E; color: #ADBAC7; }\n");
-            else fprintf(out, "#1e1e1e; color: #d4d4d4; }\n"); // Default fallback
-            
-            // Generation for specific capture types using HTML colors
-            fprintf(out, ".theme-%s .function-builtin { color: %s; }\n", themes[t].name, themes[t].html_function_builtin);
-            fprintf(out, ".theme-%s .function { color: %s; }\n", themes[t].name, themes[t].html_function);
-            fprintf(out, ".theme-%s .string { color: %s; }\n", themes[t].name, themes[t].html_string);
-            fprintf(out, ".theme-%s .comment { color: %s; font-style: italic; }\n", themes[t].name, themes[t].html_comment);
-            fprintf(out, ".theme-%s .keyword { color: %s; }\n", themes[t].name, themes[t].html_keyword);
-            fprintf(out, ".theme-%s .keyword-control { color: %s; font-weight: bold; }\n", themes[t].name, themes[t].html_keyword_control);
-            fprintf(out, ".theme-%s .type { color: %s; }\n", themes[t].name, themes[t].html_type);
-            fprintf(out, ".theme-%s .variable { color: %s; }\n", themes[t].name, themes[t].html_variable);
-            fprintf(out, ".theme-%s .constant { color: %s; }\n", themes[t].name, themes[t].html_constant);
-            fprintf(out, ".theme-%s .literal { color: %s; }\n", themes[t].name, themes[t].html_literal);
-            fprintf(out, ".theme-%s .line-number { color: %s; }\n", themes[t].name, themes[t].html_line_number);
-        }
-        
-        fprintf(out, "</style>\n");
-
-        // JavaScript for Copy-to-Clipboard and Theme Switcher
-        fprintf(out, "<script>\n");
-        // Function to show a temporary message box for feedback
-        fprintf(out, "function showMessage(message, isError = false) {\n");
-        fprintf(out, "  let msgBox = document.getElementById('copyMessageBox');\n");
-        fprintf(out, "  if (!msgBox) {\n");
-        fprintf(out, "    msgBox = document.createElement('div');\n");
-        fprintf(out, "    msgBox.id = 'copyMessageBox';\n");
-        fprintf(out, "    msgBox.style.cssText = 'position: fixed; top: 20px; right: 20px; padding: 10px 20px; background-color: #333; color: white; border-radius: 5px; z-index: 1000; opacity: 0; transition: opacity 0.5s ease-in-out;';\n");
-        fprintf(out, "    document.body.appendChild(msgBox);\n");
-        fprintf(out, "  }\n");
-        fprintf(out, "  msgBox.textContent = message;\n");
-        fprintf(out, "  msgBox.style.backgroundColor = isError ? '#dc3545' : '#28a745'; // Red for error, green for success\n");
-        fprintf(out, "  msgBox.style.opacity = '1';\n");
-        fprintf(out, "  setTimeout(() => {\n");
-        fprintf(out, "    msgBox.style.opacity = '0';\n");
-        fprintf(out, "  }, 2000);\n");
-        fprintf(out, "}\n");
-        fprintf(out, "\n");
-        // Function to copy code, prioritizing modern Clipboard API
-        fprintf(out, "function copyCode() {\n");
-        fprintf(out, "  const codeElement = document.getElementById('code-content');\n");
-        fprintf(out, "  if (codeElement) {\n");
-        fprintf(out, "    const textToCopy = Array.from(codeElement.children)\n");
-        fprintf(out, "      .map(lineDiv => {\n");
-        fprintf(out, "        const codeContentSpan = lineDiv.querySelector('.code-line-content');\n");
-        fprintf(out, "        return codeContentSpan ? codeContentSpan.textContent : '';\n");
-        fprintf(out, "      })\n");
-        fprintf(out, "      .join('\\n');\n");
-        fprintf(out, "\n");
-        fprintf(out, "    if (navigator.clipboard && navigator.clipboard.writeText) {\n");
-        fprintf(out, "      navigator.clipboard.writeText(textToCopy)\n");
-        fprintf(out, "        .then(() => {\n");
-        fprintf(out, "          showMessage('Code copied to clipboard!');\n");
-        fprintf(out, "        })\n");
-        fprintf(out, "        .catch(err => {\n");
-        fprintf(out, "          console.error('Failed to copy code (Clipboard API): ', err);\n");
-        fprintf(out, "          showMessage('Failed to copy code. Please try manually.', true);\n");
-        fprintf(out, "        });\n");
-        fprintf(out, "    } else {\n");
-        fprintf(out, "      // Fallback for older browsers or restricted environments (less reliable)\n");
-        fprintf(out, "      const tempTextArea = document.createElement('textarea');\n");
-        fprintf(out, "      tempTextArea.value = textToCopy;\n");
-        fprintf(out, "      document.body.appendChild(tempTextArea);\n");
-        fprintf(out, "      tempTextArea.select();\n");
-        fprintf(out, "      try {\n");
-        fprintf(out, "        const successful = document.execCommand('copy');\n");
-        fprintf(out, "        if (successful) {\n");
-        fprintf(out, "          showMessage('Code copied (fallback)!');\n");
-        fprintf(out, "        } else {\n");
-        fprintf(out, "          showMessage('Failed to copy code. Manual copy required.', true);\n");
-        fprintf(out, "        }\n");
-        fprintf(out, "      } catch (err) {\n");
-        fprintf(out, "        console.error('Failed to copy code (execCommand): ', err);\n");
-        fprintf(out, "        showMessage('Failed to copy code. Manual copy required.', true);\n");
-        fprintf(out, "      }\n");
-        fprintf(out, "      document.body.removeChild(tempTextArea);\n");
-        fprintf(out, "    }\n");
-        fprintf(out, "  }\n");
-        fprintf(out, "}\n");
-        fprintf(out, "\n");
-        // Function to apply selected theme to the body class
-        fprintf(out, "function applyTheme(themeName) {\n");
-        fprintf(out, "  document.body.className = 'theme-' + themeName;\n");
-        fprintf(out, "  localStorage.setItem('selectedTheme', themeName);\n");
-        fprintf(out, "}\n");
-        fprintf(out, "\n");
-        // Event listener to apply saved theme on DOM load
-        fprintf(out, "document.addEventListener('DOMContentLoaded', () => {\n");
-        fprintf(out, "  const savedTheme = localStorage.getItem('selectedTheme');\n");
-        fprintf(out, "  if (savedTheme) {\n");
-        fprintf(out, "    applyTheme(savedTheme);\n");
-        fprintf(out, "  } else {\n");
-        fprintf(out, "    applyTheme('%s'); // Apply default theme on first load\n", selected_theme->name);
-        fprintf(out, "  }\n");
-        fprintf(out, "});\n");
-        fprintf(out, "</script>\n");
-        fprintf(out, "</head>\n");
-
-        fprintf(out, "<body class=\"theme-%s\">\n", selected_theme->name);
-        fprintf(out, "<div>\n"); // Controls container
-        fprintf(out, "  <button onclick=\"copyCode()\" style=\"margin-right: 10px; padding: 8px 15px;\">Copy Code</button>\n");
-        fprintf(out, "  <label for=\"theme-select\">Theme:</label>\n");
-        fprintf(out, "  <select id=\"theme-select\" onchange=\"applyTheme(this.value)\" style=\"padding: 8px; border-radius: 4px;\">\n");
-        for (size_t t = 0; t < THEMES_COUNT; t++) {
-            fprintf(out, "    <option value=\"%s\"%s>%s</option>\n", 
-                            themes[t].name, 
-                            (strcmp(themes[t].name, selected_theme->name) == 0 ? " selected" : ""),
-                            themes[t].name);
-        }
-        fprintf(out, "  </select>\n");
-        fprintf(out, "</div>\n");
-        fprintf(out, "<br>\n");
-
-        fprintf(out, "<div class=\"code-container\">\n");
-        fprintf(out, "<pre><code id=\"code-content\">");
-
-        // Initial line div for the very first line if line numbers are enabled
-        if (show_line_numbers) {
-            fprintf(out, "<div class=\"line\" id=\"L%u\">", current_line_num);
-            fprintf(out, "<span class=\"line-number\">%*u</span>", line_num_padding, current_line_num);
-            fprintf(out, "<span class=\"code-line-content\">");
-            at_line_start = false; // Reset to false after printing first line number
-        }
-    }
-
-    while (ts_query_cursor_next_match(cursor, &match)) {
-        TSQueryCapture sorted_captures[match.capture_count];
-        memcpy(sorted_captures, match.captures, match.capture_count * sizeof(TSQueryCapture));
-
-        for (uint32_t i = 0; i < match.capture_count; i++) {
-            for (uint32_t j = i + 1; j < match.capture_count; j++) {
-                if (ts_node_start_byte(sorted_captures[j].node) < ts_node_start_byte(sorted_captures[i].node)) {
-                    TSQueryCapture temp = sorted_captures[i];
-                    sorted_captures[i] = sorted_captures[j];
-                    sorted_captures[j] = temp;
-                }
-            }
+    line_index_free(&lines);
+    injection_set_free(&injections);
+    injection_set_free(&old_injections);
+    span_list_free(&spans);
+    if (old_tree) ts_tree_delete(old_tree);
+    diff_free(&diff);
+    free(old_code);
+    free(diff_text);
+
+    ts_query_cursor_delete(cursor);
+    ts_tree_delete(tree);
+    ts_parser_delete(parser);
+    compiled_query_release(highlight);
+    free(code);
+
+    return result;
+}
+
+// codetint --daemon SOCKET [--workers N] [--idle-timeout SECONDS] [--theme-dir DIR] [--theme-cache FILE] [--grammar-path DIRS]
+static int run_daemon(int argc, char **argv) {
+    DaemonOptions options = {
+        .socket_path = argc > 2 ? argv[2] : NULL,
+        .workers = 0,
+        .idle_seconds = DAEMON_DEFAULT_IDLE_SECONDS,
+    };
+    const char *theme_dir = NULL;
+    const char *theme_cache_path = NULL;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            options.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            options.idle_seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--theme-dir") == 0 && i + 1 < argc) {
+            theme_dir = argv[++i];
+        } else if (strcmp(argv[i], "--theme-cache") == 0 && i + 1 < argc) {
+            theme_cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--grammar-path") == 0 && i + 1 < argc) {
+            grammar_set_search_path(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown daemon option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
         }
+    }
+    if (!options.socket_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (options.workers < 0 || options.idle_seconds < 0) {
+        fprintf(stderr, "Error: --workers and --idle-timeout must not be negative.\n");
+        return 1;
+    }
 
-        for (uint32_t i = 0; i < match.capture_count; i++) {
-            TSQueryCapture capture = sorted_captures[i];
+    if (!warm_up(theme_dir, theme_cache_path)) return 1;
+    return daemon_serve(&options, codetint_main);
+}
+
+// --- Batch ---
 
-            uint32_t name_len;
-            const char *name = ts_query_capture_name_for_id(query, capture.index, &name_len);
-            if (!name) continue;
+// Creates the directories leading up to `path`
+static bool make_parent_dirs(char *path) {
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made) {
+            fprintf(stderr, "Error: Could not create directory for '%s': %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
 
-            TSNode node = capture.node;
-            uint32_t start = ts_node_start_byte(node);
-            uint32_t end = ts_node_end_byte(node);
+// Where --batch writes the output for `path`: DIR/<path><extension>, NULL (with the
+// problem printed) if `path` would lead out of DIR
+static char *batch_output_path(const char *dir, const char *path, const char *extension) {
+    while (*path == '/') path++;
+    for (const char *part = path; *part; ) {
+        size_t len = strcspn(part, "/");
+        if (len == 2 && part[0] == '.' && part[1] == '.') {
+            fprintf(stderr, "Error: --batch does not write outside its directory, skipping '%s'\n", path);
+            return NULL;
+        }
+        part += len;
+        while (*part == '/') part++;
+    }
+    size_t size = strlen(dir) + strlen(path) + strlen(extension) + 2;
+    char *output = malloc(size);
+    if (!output) {
+        fprintf(stderr, "Failed to allocate memory for the output path!\n");
+        return NULL;
+    }
+    snprintf(output, size, "%s/%s%s", dir, path, extension);
+    if (!make_parent_dirs(output)) {
+        free(output);
+        return NULL;
+    }
+    return output;
+}
 
-            if (start < current_byte) continue;
-            if (start >= end || end > code_size) continue;
+// codetint --batch DIR [options] < FILE_LIST
+// Runs the options on every file named on stdin, one after another. Grammars, themes and
+// the shared queries are loaded by the first file that needs them and kept (the queries
+// in the kept arena); all else a file allocates from the arenas is dead once its run
+// returns, so the arenas are reset and the next file reuses their memory.
+static int run_batch(int argc, char **argv) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char *dir = argv[2];
+    const char *theme_dir = NULL;
+    const char *theme_cache_path = NULL;
+    const char *chunks_dir = NULL;
+    int chunks_arg = 0; // Where the --html-chunks directory goes in each run's argv
+    bool html = false;
+    bool gzip = false;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0) {
+            fprintf(stderr, "Error: --batch names the output files itself and cannot be combined with -o.\n");
+            return 1;
+        }
+        if (strcmp(argv[i], "--theme-dir") == 0 && i + 1 < argc) theme_dir = argv[i + 1];
+        if (strcmp(argv[i], "--theme-cache") == 0 && i + 1 < argc) theme_cache_path = argv[i + 1];
+        if (strcmp(argv[i], "--html-chunks") == 0 && i + 1 < argc) {
+            chunks_dir = argv[i + 1];
+            chunks_arg = i - 3 + 2;
+        }
+        if (strcmp(argv[i], "--html") == 0 || strcmp(argv[i], "--html-compact") == 0 || strcmp(argv[i], "--html-virtual") == 0 ||
+            strcmp(argv[i], "--html-chunks") == 0 || strcmp(argv[i], "--html-assets") == 0) {
+            html = true;
+        }
+        if (strcmp(argv[i], "--gzip") == 0 || strcmp(argv[i], "--gzip-level") == 0) gzip = true;
+    }
+    const char *extension = html ? (gzip ? ".html.gz" : ".html") : (gzip ? ".ansi.gz" : ".ansi");
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create directory '%s': %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (!warm_themes(theme_dir, theme_cache_path)) return 1;
 
-            print_code_section(out, code, current_byte, start, show_line_numbers, line_num_padding, &current_line_num, &at_line_start, output_html);
+    // Each run's argv: the program name and options, then -o OUTPUT and the file
+    int run_argc = argc - 3 + 4;
+    char **run_argv = malloc((size_t)(run_argc + 1) * sizeof(char *));
+    if (!run_argv) {
+        fprintf(stderr, "Failed to allocate memory for the batch!\n");
+        return 1;
+    }
+    run_argv[0] = argv[0];
+    memcpy(run_argv + 1, argv + 3, (size_t)(argc - 3) * sizeof(char *));
+    run_argv[run_argc - 3] = "-o";
+    run_argv[run_argc] = NULL;
 
-            if (output_html) {
-                const char *cls = get_html_class(name);
-                if (cls) fprintf(out, "<span class=\"%s\">", cls);
-                print_code_section(out, code, start, end, show_line_numbers, line_num_padding, &current_line_num, &at_line_start, output_html);
-                if (cls) fprintf(out, "</span>");
-            } else {
-                fprintf(out, "%s", get_ansi_color(name));
-                print_code_section(out, code, start, end, show_line_numbers, line_num_padding, &current_line_num, &at_line_start, output_html);
-                fprintf(out, "%s", selected_theme->ansi_reset);
-            }
+    int result = 0;
+    size_t file_count = 0, failed_count = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_capacity, stdin)) >= 0) {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) line[--line_len] = '\0';
+        if (line_len == 0) continue;
+        file_count++;
 
-            current_byte = end;
+        // Each file's chunks go to their own directory, CHUNKS/<path>, or the pages
+        // would overwrite each other's chunk-00000.js
+        char *output = batch_output_path(dir, line, extension);
+        char *chunks = (output && chunks_dir) ? batch_output_path(chunks_dir, line, "") : NULL;
+        int status = 1;
+        if (output && (chunks || !chunks_dir)) {
+            if (chunks) run_argv[chunks_arg] = chunks;
+            run_argv[run_argc - 2] = output;
+            run_argv[run_argc - 1] = line;
+            status = codetint_main(run_argc, run_argv);
+        }
+        free(chunks);
+        free(output);
+        arena_reset_all(); // The run's trees, spans and line index are gone
+        if (status != 0) {
+            fprintf(stderr, "Failed to highlight '%s'\n", line);
+            failed_count++;
+            result = 1;
         }
     }
+    free(line);
+    free(run_argv);
+    if (failed_count) fprintf(stderr, "%zu of %zu files failed\n", failed_count, file_count);
+    return result;
+}
+
+// --- Editor Server ---
 
-    if (current_byte < code_size) {
-        print_code_section(out, code, current_byte, code_size, show_line_numbers, line_num_padding, &current_line_num, &at_line_start, output_html);
+// ServerLanguageLookup for --stdio-server: a supported or external language with its default queries
+static bool lookup_server_language(const char *name, const char *path, ServerLanguage *out) {
+    LanguageInfo *lang = name ? get_language_info_from_name(name) : get_language_info_from_path(path);
+    if (!lang && name) lang = get_external_language_info(name);
+    if (!lang) {
+        if (!name) fprintf(stderr, "No supported language for '%s'\n", path); // A missing grammar is reported already
+        return false;
     }
-    
-    if (output_html && show_line_numbers) {
-        if (!at_line_start || current_line_num == 1) { // Current_line_num == 1 implies it was possibly a single-line file
-            fprintf(out, "</span></div>\n");
+    const TSLanguage *language = language_of(lang);
+    const CompiledQuery *highlight = language ? load_highlight_query(lang, language, NULL) : NULL;
+    const CompiledQuery *injection = (highlight && lang->injection_query_path) ? load_injection_query(lang, language) : NULL;
+    if (!highlight || (lang->injection_query_path && !injection)) return false;
+    *out = (ServerLanguage){language, highlight->query, highlight->capture_styles, highlight->predicates,
+                            injection ? injection->query : NULL};
+    return true;
+}
+
+// codetint --stdio-server [--theme-dir DIR] [--theme-cache FILE] [--grammar-path DIRS]
+static int run_stdio_server(int argc, char **argv) {
+    const char *theme_dir = NULL;
+    const char *theme_cache_path = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--theme-dir") == 0 && i + 1 < argc) {
+            theme_dir = argv[++i];
+        } else if (strcmp(argv[i], "--theme-cache") == 0 && i + 1 < argc) {
+            theme_cache_path = argv[++i];
+        } else if (strcmp(argv[i], "--grammar-path") == 0 && i + 1 < argc) {
+            grammar_set_search_path(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown server option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
         }
     }
 
-    if (output_html) {
-        fprintf(out, "</code></pre>\n");
-        fprintf(out, "</div>\n");
-        fprintf(out, "</body></html>\n");
+    if (themes_load_dir(theme_dir ? theme_dir : THEME_DEFAULT_DIR, theme_cache_path, theme_dir != NULL) != 0) {
+        return 1;
     }
+    return stdio_server_run(stdin, stdout, lookup_server_language, lookup_injection_language);
+}
 
-    ts_query_cursor_delete(cursor);
-    ts_query_delete(query);
-    ts_tree_delete(tree);
-    ts_parser_delete(parser);
-    free(code);
-    free(query_str);
+int main(int argc, char **argv) {
+    arena_install(); // Before any tree-sitter object exists
 
-    if (output_file) fclose(out);
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+        return run_daemon(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--stdio-server") == 0) {
+        return run_stdio_server(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc, argv);
+    }
 
-    return 0;
+    // A client forwards the rest of its arguments; without a daemon there is nothing to do
+    int status;
+    if (argc > 2 && strcmp(argv[1], "--client") == 0) {
+        const char *socket_path = argv[2];
+        argv[2] = argv[0]; // The request's argv: the program name, then the options after SOCKET
+        if (daemon_forward(socket_path, argc - 2, argv + 2, &status)) return status;
+        fprintf(stderr, "No daemon is listening on %s (start one with --daemon)\n", socket_path);
+        return 1;
+    }
+
+    // With CODETINT_DAEMON set, plain runs go to that daemon when it is up and run here otherwise
+    const char *socket_path = getenv(DAEMON_ENV_SOCKET);
+    if (socket_path && socket_path[0] && daemon_forward(socket_path, argc, argv, &status)) {
+        return status;
+    }
+    return codetint_main(argc, argv);
 }
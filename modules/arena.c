@@ -0,0 +1,315 @@
+#include "arena.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tree_sitter/api.h>
+
+// --- Blocks ---
+//
+// Every block starts with a 16-byte header, so the memory handed out keeps the
+// 16-byte alignment of the chunks and of malloc. Small blocks are 32 << class
+// bytes including the header.
+
+#define ARENA_CLASS_COUNT 13 // 32 bytes .. 128 KB
+#define ARENA_LARGE_CLASS UINT32_MAX
+#define ARENA_BLOCK_MAGIC 0xC0DE7147u // From a thread arena
+#define ARENA_KEPT_MAGIC 0xC0DE4B50u  // From the kept arena
+
+typedef struct {
+    _Alignas(16) size_t size; // Usable bytes after the header
+    uint32_t size_class;      // Index into the free lists, or ARENA_LARGE_CLASS
+    uint32_t magic;           // Which arena the block belongs to
+} BlockHeader;
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    _Alignas(16) unsigned char data[];
+} ArenaChunk;
+
+#define CHUNK_DATA_SIZE (ARENA_CHUNK_SIZE - offsetof(ArenaChunk, data))
+
+typedef struct Arena {
+    struct Arena *next; // In the list of all arenas
+    bool in_use;        // Owned by a live thread
+    ArenaChunk *chunks; // Every chunk of this arena, in the order they were taken
+    ArenaChunk *current;
+    size_t offset;      // First unused byte of `current`
+    void *free_lists[ARENA_CLASS_COUNT];
+    ArenaStats counters; // Written only by the owning thread (see count), read by arena_get_stats
+} Arena;
+
+// Freed large block waiting in the cache; it lives in the block's own memory
+typedef struct CachedBlock {
+    struct CachedBlock *next;
+} CachedBlock;
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static Arena *all_arenas;
+static CachedBlock *large_cache;
+static ArenaStats shared_counters; // Large block cache, arena count and resets; guarded by arena_lock
+static Arena kept_arena;           // Never reset; guarded by arena_lock
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+static __thread Arena *thread_arena;
+static __thread int keep_depth; // Nesting of arena_keep_begin on this thread
+
+// Adds to a counter of an arena. Only one thread writes each counter, so a relaxed
+// load and store suffice; they keep arena_get_stats' reads from other threads defined.
+static void count(size_t *counter, size_t amount) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static BlockHeader *header_of(void *ptr) {
+    return (BlockHeader *)ptr - 1;
+}
+
+// --- Thread Arenas ---
+
+// Runs when a thread exits. Its blocks stay valid (other threads may still hold
+// them) until the next arena_reset_all; the arena is handed to the next new thread.
+static void arena_release(void *arg) {
+    Arena *arena = arg;
+    pthread_mutex_lock(&arena_lock);
+    arena->in_use = false;
+    pthread_mutex_unlock(&arena_lock);
+}
+
+static void arena_key_create(void) {
+    pthread_key_create(&arena_key, arena_release);
+}
+
+static Arena *current_arena(void) {
+    if (thread_arena) return thread_arena;
+    pthread_once(&arena_key_once, arena_key_create);
+
+    pthread_mutex_lock(&arena_lock);
+    Arena *arena = all_arenas;
+    while (arena && arena->in_use) arena = arena->next;
+    if (!arena) {
+        arena = calloc(1, sizeof(Arena));
+        if (arena) {
+            arena->next = all_arenas;
+            all_arenas = arena;
+            shared_counters.arena_count++;
+        }
+    }
+    if (arena) arena->in_use = true;
+    pthread_mutex_unlock(&arena_lock);
+
+    if (arena) {
+        pthread_setspecific(arena_key, arena);
+        thread_arena = arena;
+    }
+    return arena;
+}
+
+// --- Small Blocks ---
+
+static uint32_t size_class_for(size_t size) {
+    size_t total = size + sizeof(BlockHeader);
+    uint32_t size_class = 0;
+    while (((size_t)32 << size_class) < total) size_class++;
+    return size_class;
+}
+
+static void *small_alloc(Arena *arena, uint32_t size_class, uint32_t magic) {
+    BlockHeader *header;
+    if (arena->free_lists[size_class]) {
+        void *ptr = arena->free_lists[size_class];
+        arena->free_lists[size_class] = *(void **)ptr;
+        header = header_of(ptr);
+    } else {
+        size_t total = (size_t)32 << size_class;
+        if (!arena->current || arena->offset + total > CHUNK_DATA_SIZE) {
+            // Move on to the next chunk, which after a reset is already there
+            ArenaChunk *next = arena->current ? arena->current->next : arena->chunks;
+            if (!next) {
+                next = malloc(ARENA_CHUNK_SIZE);
+                if (!next) return NULL;
+                next->next = NULL;
+                if (arena->current) arena->current->next = next;
+                else arena->chunks = next;
+                count(&arena->counters.system_allocations, 1);
+                count(&arena->counters.chunk_count, 1);
+                count(&arena->counters.chunk_bytes, ARENA_CHUNK_SIZE);
+            }
+            arena->current = next;
+            arena->offset = 0;
+        }
+        header = (BlockHeader *)(arena->current->data + arena->offset);
+        arena->offset += total;
+        header->size = total - sizeof(BlockHeader);
+        header->size_class = size_class;
+        header->magic = magic;
+    }
+    return header + 1;
+}
+
+// --- Large Blocks ---
+
+static void *large_alloc(Arena *arena, size_t size, uint32_t magic) {
+    count(&arena->counters.large_allocations, 1);
+
+    // Smallest cached block that fits without wasting more than half of it
+    pthread_mutex_lock(&arena_lock);
+    CachedBlock **best = NULL;
+    for (CachedBlock **link = &large_cache; *link; link = &(*link)->next) {
+        size_t cached = header_of(*link)->size;
+        if (cached >= size && cached / 2 <= size && (!best || cached < header_of(*best)->size)) best = link;
+    }
+    BlockHeader *header = NULL;
+    if (best) {
+        header = header_of(*best);
+        *best = (*best)->next;
+        shared_counters.large_cached_bytes -= header->size;
+        shared_counters.large_cache_hits++;
+    }
+    pthread_mutex_unlock(&arena_lock);
+
+    if (!header) {
+        header = malloc(sizeof(BlockHeader) + size);
+        if (!header) return NULL;
+        count(&arena->counters.system_allocations, 1);
+        header->size = size;
+        header->size_class = ARENA_LARGE_CLASS;
+    }
+    header->magic = magic; // Large blocks outlive resets either way; this only tells reallocs where to go
+    return header + 1;
+}
+
+static void large_free(BlockHeader *header) {
+    pthread_mutex_lock(&arena_lock);
+    if (shared_counters.large_cached_bytes + header->size <= ARENA_LARGE_CACHE_BYTES) {
+        CachedBlock *block = (CachedBlock *)(header + 1);
+        block->next = large_cache;
+        large_cache = block;
+        shared_counters.large_cached_bytes += header->size;
+        header = NULL;
+    }
+    pthread_mutex_unlock(&arena_lock);
+    free(header);
+}
+
+// --- Public Interface ---
+
+static void *arena_alloc(size_t size, bool kept) {
+    Arena *arena = current_arena();
+    if (!arena) return NULL;
+    if (size == 0) size = 1;
+
+    count(&arena->counters.allocations, 1);
+    count(&arena->counters.bytes_requested, size);
+    uint32_t magic = kept ? ARENA_KEPT_MAGIC : ARENA_BLOCK_MAGIC;
+    if (size > ARENA_LARGE_SIZE - sizeof(BlockHeader)) return large_alloc(arena, size, magic);
+    if (!kept) return small_alloc(arena, size_class_for(size), magic);
+
+    // The kept arena is shared by every thread
+    pthread_mutex_lock(&arena_lock);
+    void *ptr = small_alloc(&kept_arena, size_class_for(size), magic);
+    pthread_mutex_unlock(&arena_lock);
+    return ptr;
+}
+
+void *arena_malloc(size_t size) {
+    return arena_alloc(size, keep_depth > 0);
+}
+
+void *arena_calloc(size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *ptr = arena_malloc(count * size);
+    if (ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *arena_realloc(void *ptr, size_t size) {
+    if (!ptr) return arena_malloc(size);
+    BlockHeader *header = header_of(ptr);
+    Arena *arena = current_arena();
+    if (arena) count(&arena->counters.reallocs, 1);
+    if (size <= header->size) return ptr;
+
+    // A kept block stays kept however it grows, e.g. inside an object made under arena_keep_begin
+    void *grown = arena_alloc(size, header->magic == ARENA_KEPT_MAGIC);
+    if (!grown) return NULL;
+    memcpy(grown, ptr, header->size);
+    arena_free(ptr);
+    return grown;
+}
+
+void arena_free(void *ptr) {
+    if (!ptr) return;
+    BlockHeader *header = header_of(ptr);
+    Arena *arena = current_arena();
+    if (arena) count(&arena->counters.frees, 1);
+
+    if (header->size_class == ARENA_LARGE_CLASS) {
+        large_free(header);
+    } else if (header->magic == ARENA_KEPT_MAGIC) {
+        pthread_mutex_lock(&arena_lock);
+        *(void **)ptr = kept_arena.free_lists[header->size_class];
+        kept_arena.free_lists[header->size_class] = ptr;
+        pthread_mutex_unlock(&arena_lock);
+    } else if (arena) {
+        // Chunks stay until the next reset, so a block may go on any thread's free list
+        *(void **)ptr = arena->free_lists[header->size_class];
+        arena->free_lists[header->size_class] = ptr;
+    }
+}
+
+void arena_install(void) {
+    ts_set_allocator(arena_malloc, arena_calloc, arena_realloc, arena_free);
+}
+
+void arena_keep_begin(void) {
+    keep_depth++;
+}
+
+void arena_keep_end(void) {
+    if (keep_depth > 0) keep_depth--;
+}
+
+void arena_reset_all(void) {
+    pthread_mutex_lock(&arena_lock);
+    for (Arena *arena = all_arenas; arena; arena = arena->next) {
+        arena->current = NULL;
+        arena->offset = 0;
+        memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    }
+    shared_counters.resets++;
+    pthread_mutex_unlock(&arena_lock);
+}
+
+static void add_counters(ArenaStats *stats, const Arena *arena) {
+    const ArenaStats *counters = &arena->counters;
+    stats->allocations += __atomic_load_n(&counters->allocations, __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n(&counters->frees, __ATOMIC_RELAXED);
+    stats->reallocs += __atomic_load_n(&counters->reallocs, __ATOMIC_RELAXED);
+    stats->bytes_requested += __atomic_load_n(&counters->bytes_requested, __ATOMIC_RELAXED);
+    stats->large_allocations += __atomic_load_n(&counters->large_allocations, __ATOMIC_RELAXED);
+    stats->system_allocations += __atomic_load_n(&counters->system_allocations, __ATOMIC_RELAXED);
+    stats->chunk_count += __atomic_load_n(&counters->chunk_count, __ATOMIC_RELAXED);
+    stats->chunk_bytes += __atomic_load_n(&counters->chunk_bytes, __ATOMIC_RELAXED);
+}
+
+void arena_get_stats(ArenaStats *stats) {
+    pthread_mutex_lock(&arena_lock);
+    *stats = shared_counters;
+    for (Arena *arena = all_arenas; arena; arena = arena->next) add_counters(stats, arena);
+    add_counters(stats, &kept_arena);
+    pthread_mutex_unlock(&arena_lock);
+}
+
+void arena_print_stats(FILE *out) {
+    ArenaStats stats;
+    arena_get_stats(&stats);
+    fprintf(out, "Allocations: %zu (%zu bytes requested), reallocs: %zu, frees: %zu\n",
+            stats.allocations, stats.bytes_requested, stats.reallocs, stats.frees);
+    fprintf(out, "Large blocks: %zu allocated, %zu from cache, %zu bytes cached\n",
+            stats.large_allocations, stats.large_cache_hits, stats.large_cached_bytes);
+    fprintf(out, "System allocations: %zu (%zu chunks, %zu bytes), arenas: %zu, resets: %zu\n",
+            stats.system_allocations, stats.chunk_count, stats.chunk_bytes, stats.arena_count, stats.resets);
+}
@@ -0,0 +1,61 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Per-thread arenas for everything a run allocates while highlighting a file:
+// tree-sitter's parsers, trees and cursors (through ts_set_allocator), span lists
+// and line indexes. Small blocks come out of 1 MB chunks in power-of-two size
+// classes and go back onto per-thread free lists; large blocks are kept in a
+// shared cache once freed. Between the files of a batch (--batch), arena_reset_all()
+// rewinds every arena in one step, so later files run without asking the system for
+// memory again. What outlives a file (compiled queries shared by every file) is made
+// between arena_keep_begin() and arena_keep_end() and comes from a kept arena instead.
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define ARENA_LARGE_SIZE (128 * 1024)              // Blocks above this bypass the size classes
+#define ARENA_LARGE_CACHE_BYTES (256 * 1024 * 1024) // Freed large blocks kept for reuse, at most
+
+// Allocation counters, summed over all arenas
+typedef struct {
+    size_t allocations;        // malloc/calloc calls, and reallocs that moved the block
+    size_t frees;
+    size_t reallocs;
+    size_t bytes_requested;
+    size_t large_allocations;  // Allocations above ARENA_LARGE_SIZE
+    size_t large_cache_hits;   // ... served from freed large blocks
+    size_t system_allocations; // Chunks and large blocks taken from the system allocator
+    size_t chunk_count;
+    size_t chunk_bytes;
+    size_t large_cached_bytes; // Freed large blocks currently held for reuse
+    size_t arena_count;        // Arenas created (one per thread that has allocated)
+    size_t resets;
+} ArenaStats;
+
+// Routes tree-sitter's allocations through the arenas. Call before creating any
+// tree-sitter object.
+void arena_install(void);
+
+// malloc-compatible interface; blocks can be freed from any thread. Reallocating a
+// kept block keeps it, and freeing it returns it to the kept arena.
+void *arena_malloc(size_t size);
+void *arena_calloc(size_t count, size_t size);
+void *arena_realloc(void *ptr, size_t size);
+void arena_free(void *ptr);
+
+// Allocations this thread makes in between come from the kept arena, which
+// arena_reset_all() leaves alone. Calls nest.
+void arena_keep_begin(void);
+void arena_keep_end(void);
+
+// Rewinds every thread arena, keeping its chunks for reuse. All memory they handed out
+// must be dead (a tree-sitter parser keeps freed nodes for reuse, so no parser may
+// survive it either), and no other thread may be allocating (e.g. between files).
+void arena_reset_all(void);
+
+// Safe to call while other threads allocate, though their latest counts may not show yet
+void arena_get_stats(ArenaStats *stats);
+void arena_print_stats(FILE *out);
+
+#endif // ARENA_H
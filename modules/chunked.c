@@ -0,0 +1,276 @@
+#include "chunked.h"
+#include "highlight.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COUNT_BLOCK_BYTES (1024 * 1024)
+
+// One chunk of the batch buffer, parsed, highlighted and (when it can be) rendered by a worker thread
+typedef struct {
+    const ChunkedOptions *options;
+    const char *code;   // The chunk and its lookahead, code[0, parse_size)
+    size_t parse_size;
+    size_t start;       // Offset of `code` in the batch buffer
+    size_t end;         // Nominal end of the chunk in `code`; where it was cut once parsed
+    bool render;        // Render here: the chunk starts on a fresh line, or where the output stands
+    Renderer renderer;  // Renderer state at the chunk start; holds the state at `end` once done
+
+    char *buffer;       // Rendered output of code[0, end)
+    size_t buffer_len;
+    SpanList spans;     // Spans of code[0, end) when the chunk is rendered on the calling thread
+    bool ok;
+} ChunkJob;
+
+bool chunked_count_lines(FILE *input, size_t *out_lines) {
+    char *block = malloc(COUNT_BLOCK_BYTES);
+    if (!block) {
+        fprintf(stderr, "Failed to allocate input buffer\n");
+        return false;
+    }
+    size_t lines = 1;
+    size_t read_size;
+    while ((read_size = fread(block, 1, COUNT_BLOCK_BYTES, input)) > 0) {
+        const char *end = block + read_size;
+        for (const char *p = block; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++) {
+            lines++;
+        }
+    }
+    bool ok = !ferror(input);
+    free(block);
+    rewind(input);
+    if (!ok) {
+        perror("Failed to read input file");
+        return false;
+    }
+    *out_lines = lines;
+    return true;
+}
+
+// --- Cutting ---
+
+// Nominal end of a chunk that should end near `target`: after the first blank line in
+// [target, limit), else after the first line break there, else after the last one
+// before `target`. A line longer than the chunk is cut after a space or comma, where
+// tokens usually end, or failing that at `target`, between characters.
+static size_t chunk_cut(const char *buffer, size_t start, size_t target, size_t limit) {
+    const char *end = buffer + limit;
+    const char *first_break = NULL;
+    for (const char *p = buffer + target; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++) {
+        if (!first_break) first_break = p;
+        if (p + 1 < end && p[1] == '\n') return (size_t)(p + 2 - buffer);
+    }
+    if (first_break) return (size_t)(first_break + 1 - buffer);
+
+    for (size_t i = target; i > start + 1; i--) {
+        if (buffer[i - 1] == '\n') return i;
+    }
+    for (size_t i = target; i > start + 1; i--) {
+        char c = buffer[i - 1];
+        if (c == ' ' || c == '\t' || c == ',') return i;
+    }
+    while (target > start + 1 && (buffer[target] & 0xC0) == 0x80) target--; // UTF-8 continuation byte
+    return target;
+}
+
+// Moves a cut at `cut` that falls inside a top-level node back to the line the node
+// starts on, so that the node is highlighted whole with the next chunk. A node starting
+// in the first half of the chunk is too big for that and is cut where it is.
+static size_t safe_cut(TSNode root, const char *code, size_t cut) {
+    TSNode child = ts_node_first_child_for_byte(root, (uint32_t)cut);
+    if (ts_node_is_null(child) || ts_node_start_byte(child) >= cut) return cut;
+
+    size_t line_start = ts_node_start_byte(child);
+    while (line_start > 0 && code[line_start - 1] != '\n') line_start--;
+    return (line_start * 2 >= cut) ? line_start : cut;
+}
+
+static void *chunk_worker(void *arg) {
+    ChunkJob *job = arg;
+    const ChunkedOptions *options = job->options;
+    TSParser *parser = ts_parser_new();
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    TSTree *tree = NULL;
+    InjectionSet injections = {0};
+    SpanList scratch = {0};
+
+    job->ok = parser && cursor && ts_parser_set_language(parser, options->language);
+    if (job->ok) {
+        tree = ts_parser_parse_string(parser, NULL, job->code, (uint32_t)job->parse_size);
+        job->ok = tree != NULL;
+    }
+    if (job->ok) {
+        // The lookahead past `end` only shows whether the cut splits a node; it belongs to the next chunk
+        TSNode root = ts_tree_root_node(tree);
+        if (job->end < job->parse_size) job->end = safe_cut(root, job->code, job->end);
+        job->ok = highlight_collect_range(cursor, options->query, root, options->capture_styles, options->predicates,
+                                          job->code, job->parse_size, 0, (uint32_t)job->end, &job->spans) &&
+                  (!options->injection_query ||
+                   (injection_collect(&injections, tree, options->injection_query, job->code, job->parse_size,
+                                      options->injection_lookup) &&
+                    injection_apply(&injections, 0, (uint32_t)job->end, &job->spans, &scratch)));
+    }
+    if (job->ok && job->render) {
+        FILE *out = open_memstream(&job->buffer, &job->buffer_len);
+        if (out) {
+            job->renderer.out = out;
+            job->renderer.writer = NULL;
+            render_spans(&job->renderer, job->code, 0, job->end, job->spans.items, job->spans.count);
+            span_list_free(&job->spans);
+        }
+        if (!out || fclose(out) != 0) job->ok = false;
+    }
+
+    injection_set_free(&injections);
+    span_list_free(&scratch);
+    if (tree) ts_tree_delete(tree);
+    if (cursor) ts_query_cursor_delete(cursor);
+    if (parser) ts_parser_delete(parser);
+    return NULL;
+}
+
+// --- Batches ---
+
+// Fills buffer[*len, capacity) from `input`. Returns false on a read error.
+static bool fill_buffer(FILE *input, char *buffer, size_t capacity, size_t *len, bool *eof) {
+    while (!*eof && *len < capacity) {
+        size_t read_size = fread(buffer + *len, 1, capacity - *len, input);
+        *len += read_size;
+        if (read_size == 0) {
+            if (ferror(input)) {
+                perror("Failed to read input file");
+                return false;
+            }
+            *eof = true;
+        }
+    }
+    return true;
+}
+
+bool render_chunked(Renderer *renderer, FILE *input, const ChunkedOptions *options) {
+    size_t job_count = (size_t)options->jobs;
+    if (job_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        job_count = (cpus > 0) ? (size_t)cpus : 1;
+    }
+    size_t chunk_bytes = options->chunk_bytes;
+    size_t lookahead = chunk_bytes / 4; // Half of it for finding the cut, half parsed past it
+    size_t capacity = job_count * (chunk_bytes + lookahead / 2) + lookahead / 2;
+
+    char *buffer = malloc(capacity);
+    ChunkJob *jobs = calloc(job_count, sizeof(ChunkJob));
+    pthread_t *threads = calloc(job_count, sizeof(pthread_t));
+    bool *started = calloc(job_count, sizeof(bool));
+    if (!buffer || !jobs || !threads || !started) {
+        fprintf(stderr, "Failed to allocate input buffer\n");
+        free(buffer);
+        free(jobs);
+        free(threads);
+        free(started);
+        return false;
+    }
+
+    FILE *out = renderer->out;
+    Writer *writer = renderer->writer;
+    size_t len = 0;
+    bool eof = false;
+    bool ok = true;
+    while (ok && fill_buffer(input, buffer, capacity, &len, &eof) && len > 0) {
+        // --- Split Into Chunks ---
+        // Every chunk but the first starts where the previous one is expected to end;
+        // if parsing moves that cut back, the chunks after it wait for the next batch
+        size_t count = 0;
+        size_t start = 0;
+        uint32_t line = renderer->line;
+        while (count < job_count && start < len) {
+            size_t end = len;
+            size_t parse_end = len;
+            if (!eof || len - start > chunk_bytes + lookahead) {
+                if (len - start < chunk_bytes + lookahead) break; // Short of lookahead: next batch
+                end = chunk_cut(buffer, start, start + chunk_bytes, start + chunk_bytes + lookahead / 2);
+                parse_end = end + lookahead / 2;
+            }
+
+            ChunkJob *job = &jobs[count++];
+            memset(job, 0, sizeof(*job));
+            job->options = options;
+            job->code = buffer + start;
+            job->parse_size = parse_end - start;
+            job->start = start;
+            job->end = end - start;
+            if (start == 0) {
+                job->renderer = *renderer;
+                job->render = true;
+            } else {
+                // Chunks on a fresh line carry nothing over but the line number
+                renderer_init(&job->renderer, NULL, renderer->format, renderer->show_line_numbers, renderer->line_num_padding);
+                renderer_set_theme(&job->renderer, renderer->theme);
+                job->renderer.line = line;
+                job->render = buffer[start - 1] == '\n';
+            }
+
+            for (const char *p = buffer + start; (p = memchr(p, '\n', (size_t)(buffer + end - p))) != NULL; p++) {
+                line++;
+            }
+            start = end;
+        }
+
+        for (size_t i = 1; i < count; i++) { // Chunk 0 runs on this thread
+            started[i] = pthread_create(&threads[i], NULL, chunk_worker, &jobs[i]) == 0;
+        }
+
+        // --- Write Chunks In Order ---
+        size_t done = 0; // Bytes of the buffer written out
+        bool stale = false;
+        for (size_t i = 0; i < count; i++) {
+            ChunkJob *job = &jobs[i];
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+                started[i] = false;
+            } else {
+                chunk_worker(job); // Chunk 0, or threads unavailable
+            }
+            if (!ok || stale || job->start != done) {
+                stale = true; // Started at a cut that did not hold; redone in the next batch
+            } else if (!job->ok) {
+                fprintf(stderr, "Failed to highlight the input\n");
+                ok = false;
+            } else if (job->render) {
+                if (writer) {
+                    // Out before the buffer is freed and before the renderer (whose escapes
+                    // the writer may still reference) is overwritten
+                    writer_ref(writer, job->buffer, job->buffer_len);
+                    writer_flush(writer);
+                } else {
+                    fwrite(job->buffer, 1, job->buffer_len, out);
+                }
+                *renderer = job->renderer;
+                renderer->out = out;
+                renderer->writer = writer;
+                done += job->end;
+            } else {
+                render_spans(renderer, job->code, 0, job->end, job->spans.items, job->spans.count);
+                done += job->end;
+            }
+            free(job->buffer);
+            span_list_free(&job->spans);
+        }
+
+        // The rest of the buffer moves to its front, so nothing may still point into it:
+        // whitespace held back by compact HTML (only ever there within a line longer than a chunk)
+        // is written out, and the writer's references are flushed
+        if (renderer->pending_ws_len) renderer_write_markup(renderer, "", 0);
+        renderer_flush(renderer);
+        memmove(buffer, buffer + done, len - done);
+        len -= done;
+    }
+    if (!eof) ok = false; // Read error, reported by fill_buffer
+
+    free(buffer);
+    free(jobs);
+    free(threads);
+    free(started);
+    return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef CHUNKED_H
+#define CHUNKED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <tree_sitter/api.h>
+
+#include "injection.h"
+#include "predicate.h"
+#include "render.h"
+
+// Files are read, parsed and highlighted this many MB at a time (--chunk-mb)
+#define CHUNKED_DEFAULT_CHUNK_MB 16
+#define CHUNKED_MAX_CHUNK_MB 1024 // Keeps a chunk and its lookahead within tree-sitter's 32-bit offsets
+
+// What render_chunked needs to highlight a chunk on its own
+typedef struct {
+    const TSLanguage *language;
+    const TSQuery *query;
+    const uint8_t *capture_styles;
+    const QueryPredicates *predicates;
+    const TSQuery *injection_query;   // Embedded languages (NULL = none)
+    InjectionLookup injection_lookup;
+    size_t chunk_bytes;
+    int jobs;                         // Chunks highlighted at once (0 = one per online CPU)
+} ChunkedOptions;
+
+// Number of lines in `input` as the renderer numbers them (newlines + 1), read from the
+// start in small blocks; the stream is rewound afterwards. Returns false on a read error.
+bool chunked_count_lines(FILE *input, size_t *out_lines);
+
+// Renders all of `input` with `renderer` (after renderer_begin, before renderer_finish)
+// without holding more than a batch of chunks in memory, for files too big to load or
+// beyond tree-sitter's 4 GB limit. Each chunk is parsed on its own together with some
+// lookahead, and is cut at a blank line or line break after its nominal size, moved
+// back to the start of a top-level node that the cut would split. Up to `jobs` chunks
+// are parsed and rendered concurrently and written out in order. A construct larger
+// than a chunk (e.g. a file that is one JSON array) is cut at a line break inside it,
+// where the highlighting of the next chunk may start off slightly wrong.
+// Returns false on failure.
+bool render_chunked(Renderer *renderer, FILE *input, const ChunkedOptions *options);
+
+#endif // CHUNKED_H
@@ -0,0 +1,605 @@
+#define _GNU_SOURCE // struct ucred (SO_PEERCRED)
+#include "daemon.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAEMON_MAGIC 0x31445443u            // "CTD1"
+#define DAEMON_MAX_REQUEST (1024 * 1024)    // Bytes of working directory and arguments
+#define DAEMON_REQUEST_TIMEOUT_SECONDS 10   // A client has this long to send its request
+#define DAEMON_MAX_PENDING 64               // Connections accepted but not yet handed to a worker
+
+// Sent first, with the client's file descriptors 0-2 attached (SCM_RIGHTS). `size`
+// bytes follow: the working directory, then each argument, all NUL-terminated. The
+// reply is the request's exit status as an int32_t.
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+} RequestHeader;
+
+typedef struct {
+    int fds[3];  // The client's stdin, stdout and stderr (-1 = not received)
+    char *data;  // Working directory, then the arguments
+    char **argv; // Points into `data`, NULL-terminated
+    int argc;
+} Request;
+
+// A connection whose request is still arriving, or is complete and waits for a worker.
+// Its socket is non-blocking, and the request is read as it comes in.
+typedef struct {
+    int connection;         // -1 = free slot
+    long long deadline;     // Monotonic ms by which the request must be complete
+    RequestHeader header;
+    size_t header_received;
+    size_t data_received;
+    bool complete;
+    Request request;
+} Pending;
+
+// A request being served by a forked worker process
+typedef struct {
+    pid_t pid;      // 0 = free slot
+    int connection; // Where the exit status goes
+    bool cancelled; // The client went away; the status is not sent
+} Worker;
+
+static volatile sig_atomic_t stop_requested;
+static int wake_pipe[2] = {-1, -1}; // SIGCHLD writes here so that poll() wakes up to reap
+
+static void on_child_exit(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    ssize_t written = write(wake_pipe[1], "", 1); // Full pipe: a wake-up is already pending
+    (void)written;
+    errno = saved_errno;
+}
+
+static void on_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// False on end of file, error or timeout
+static bool read_all(int fd, void *data, size_t size) {
+    char *p = data;
+    while (size > 0) {
+        ssize_t received = read(fd, p, size);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        p += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+static bool socket_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long\n", path);
+        return false;
+    }
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+// --- Requests ---
+
+static void request_free(Request *request) {
+    for (int i = 0; i < 3; i++) {
+        if (request->fds[i] >= 0) close(request->fds[i]);
+    }
+    free(request->data);
+    free(request->argv);
+}
+
+static void pending_init(Pending *pending, int connection, long long deadline) {
+    memset(pending, 0, sizeof(*pending));
+    pending->connection = connection;
+    pending->deadline = deadline;
+    for (int i = 0; i < 3; i++) pending->request.fds[i] = -1;
+}
+
+static void pending_close(Pending *pending) {
+    request_free(&pending->request);
+    close(pending->connection);
+    pending->connection = -1;
+}
+
+// Reads the header, and the client's descriptors that come with it, as far as it has
+// arrived. Returns false if the client went away.
+static bool read_request_header(Pending *pending) {
+    Request *request = &pending->request;
+    union {
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {(char *)&pending->header + pending->header_received, sizeof(RequestHeader) - pending->header_received};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    ssize_t received;
+    do {
+        received = recvmsg(pending->connection, &message, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (received == 0) return false;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (i < 3 && request->fds[i] < 0) request->fds[i] = fd;
+            else close(fd); // Only 0-2 are forwarded
+        }
+    }
+    if (message.msg_flags & MSG_CTRUNC) return false;
+    pending->header_received += (size_t)received;
+    return true;
+}
+
+// Splits the request's data into the working directory and argv. Returns false if it is malformed.
+static bool parse_request(Request *request, size_t size) {
+    if (request->data[size - 1] != '\0') return false;
+    size_t strings = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (request->data[i] == '\0') strings++;
+    }
+    if (strings < 2) return false; // The working directory and argv[0] at least
+
+    request->argc = (int)(strings - 1);
+    request->argv = calloc(strings, sizeof(char *));
+    if (!request->argv) return false;
+    const char *p = request->data + strlen(request->data) + 1;
+    for (int i = 0; i < request->argc; i++) {
+        request->argv[i] = (char *)p;
+        p += strlen(p) + 1;
+    }
+    return true;
+}
+
+// Reads whatever has arrived of the request on `pending`, without blocking, and marks
+// it complete once all of it is in. Returns false if it is malformed or the client went away.
+static bool read_request(Pending *pending) {
+    Request *request = &pending->request;
+    if (pending->header_received < sizeof(RequestHeader)) {
+        if (!read_request_header(pending)) return false;
+        if (pending->header_received < sizeof(RequestHeader)) return true;
+        const RequestHeader *header = &pending->header;
+        if (header->magic != DAEMON_MAGIC || header->size == 0 || header->size > DAEMON_MAX_REQUEST || request->fds[2] < 0) {
+            return false;
+        }
+        request->data = malloc(header->size);
+        if (!request->data) return false;
+    }
+
+    size_t size = pending->header.size;
+    while (pending->data_received < size) {
+        ssize_t received = read(pending->connection, request->data + pending->data_received, size - pending->data_received);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (received <= 0) return false;
+        pending->data_received += (size_t)received;
+    }
+    if (!parse_request(request, size)) return false;
+    pending->complete = true;
+    return true;
+}
+
+// Forks the worker for `request`. In the worker, the client's descriptors replace
+// 0-2, everything else the daemon holds is closed, and `handler` runs in the
+// client's working directory; the worker exits with its status. Returns the worker's
+// pid, or -1 if it could not be started.
+static pid_t start_worker(const Request *request, int connection, int listener, const Worker *workers,
+                          size_t worker_count, const Pending *pending, DaemonHandler handler) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(listener);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    close(connection);
+    for (size_t i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0) close(workers[i].connection);
+    }
+    for (size_t i = 0; i < DAEMON_MAX_PENDING; i++) {
+        if (pending[i].connection < 0 || pending[i].connection == connection) continue;
+        close(pending[i].connection);
+        for (int fd = 0; fd < 3; fd++) {
+            if (pending[i].request.fds[fd] >= 0 && &pending[i].request != request) close(pending[i].request.fds[fd]);
+        }
+    }
+
+    // Moved above 2 first, in case the daemon itself runs without some of 0-2
+    int moved[3];
+    for (int i = 0; i < 3; i++) {
+        moved[i] = fcntl(request->fds[i], F_DUPFD, 3);
+        if (moved[i] < 0) _exit(1);
+    }
+    for (int i = 0; i < 3; i++) close(request->fds[i]);
+    for (int i = 0; i < 3; i++) {
+        if (dup2(moved[i], i) < 0) _exit(1);
+        close(moved[i]);
+    }
+
+    if (chdir(request->data) != 0) {
+        fprintf(stderr, "Failed to change to '%s': %s\n", request->data, strerror(errno));
+        _exit(1);
+    }
+    exit(handler(request->argc, request->argv)); // Flushes stdout into the client's
+}
+
+// --- Serving ---
+
+static int listen_on(const char *path) {
+    struct sockaddr_un address;
+    if (!socket_address(path, &address)) return -1;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("Failed to create socket");
+        return -1;
+    }
+
+    // Workers run with the daemon's rights, so only its own user may connect: the
+    // socket is created for its owner only (and accept_request checks the peer's uid too)
+    mode_t old_mask = umask(0077);
+    int bound = bind(listener, (struct sockaddr *)&address, sizeof(address));
+    if (bound != 0 && errno == EADDRINUSE) {
+        // Left behind by a daemon that did not shut down cleanly, unless one still answers
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool alive = probe >= 0 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0;
+        if (probe >= 0) close(probe);
+        if (alive) {
+            umask(old_mask);
+            fprintf(stderr, "A daemon is already listening on %s\n", path);
+            close(listener);
+            return -1;
+        }
+        unlink(path);
+        bound = bind(listener, (struct sockaddr *)&address, sizeof(address));
+    }
+    int bind_error = errno;
+    umask(old_mask);
+    errno = bind_error;
+    if (bound != 0 || listen(listener, SOMAXCONN) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+static int32_t exit_status_of(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+// Collects the workers that have exited and sends their clients the exit status.
+// Returns how many slots were freed.
+static size_t reap_workers(Worker *workers, size_t worker_count) {
+    size_t freed = 0;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < worker_count; i++) {
+            Worker *worker = &workers[i];
+            if (worker->pid != pid) continue;
+            int32_t code = exit_status_of(status);
+            if (!worker->cancelled) write_all(worker->connection, &code, sizeof(code)); // The client may be gone
+            close(worker->connection);
+            worker->pid = 0;
+            freed++;
+            break;
+        }
+    }
+    return freed;
+}
+
+// Accepts one connection into a free pending slot; its request is read as it arrives.
+// Returns false if there was none after all.
+static bool accept_request(int listener, Pending *pending) {
+    int connection = accept(listener, NULL, NULL);
+    if (connection < 0) return false; // Interrupted, or the client already gave up
+    struct ucred peer;
+    socklen_t peer_size = sizeof(peer);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) != 0 || peer.uid != geteuid()) {
+        fprintf(stderr, "Refused a connection from another user\n");
+        close(connection);
+        return false;
+    }
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) | O_NONBLOCK);
+
+    for (size_t i = 0; i < DAEMON_MAX_PENDING; i++) {
+        if (pending[i].connection >= 0) continue;
+        pending_init(&pending[i], connection, monotonic_ms() + DAEMON_REQUEST_TIMEOUT_SECONDS * 1000);
+        return true;
+    }
+    close(connection); // Not reached: the listener is only watched while a slot is free
+    return false;
+}
+
+// Starts a worker for the complete request in `pending`, in the free worker slot `slot`
+static void start_request(Pending *pending, Worker *slot, int listener, Worker *workers, size_t worker_count,
+                          const Pending *all_pending, DaemonHandler handler, size_t *busy) {
+    int connection = pending->connection;
+    fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) & ~O_NONBLOCK); // For sending the exit status
+    pid_t pid = start_worker(&pending->request, connection, listener, workers, worker_count, all_pending, handler);
+    request_free(&pending->request);
+    pending->connection = -1;
+    if (pid < 0) {
+        perror("Failed to start a worker");
+        int32_t code = 1;
+        write_all(connection, &code, sizeof(code));
+        close(connection);
+        return;
+    }
+    *slot = (Worker){pid, connection, false};
+    (*busy)++;
+}
+
+int daemon_serve(const DaemonOptions *options, DaemonHandler handler) {
+    size_t worker_count = (size_t)options->workers;
+    if (worker_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (cpus > 0) ? (size_t)cpus : 1;
+    }
+    Worker *workers = calloc(worker_count, sizeof(Worker));
+    struct pollfd *polls = calloc(worker_count + DAEMON_MAX_PENDING + 2, sizeof(struct pollfd));
+    Worker **watched = calloc(worker_count, sizeof(Worker *)); // Worker of polls[2 + i]
+    if (!workers || !polls || !watched) {
+        fprintf(stderr, "Failed to allocate worker memory!\n");
+        free(workers);
+        free(polls);
+        free(watched);
+        return 1;
+    }
+    if (pipe(wake_pipe) != 0) {
+        perror("Failed to create pipe");
+        free(workers);
+        free(polls);
+        free(watched);
+        return 1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    int listener = listen_on(options->socket_path);
+    int result = listener < 0 ? 1 : 0;
+    if (listener >= 0) {
+        struct sigaction action = {0};
+        sigemptyset(&action.sa_mask);
+        action.sa_handler = on_child_exit;
+        action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        sigaction(SIGCHLD, &action, NULL);
+        action.sa_handler = on_stop;
+        action.sa_flags = 0; // Interrupts poll()
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    Pending pending[DAEMON_MAX_PENDING];
+    Pending *reading[DAEMON_MAX_PENDING]; // Pending request of polls[2 + watched_count + i]
+    for (size_t i = 0; i < DAEMON_MAX_PENDING; i++) pending[i].connection = -1;
+    size_t busy = 0;
+    size_t pending_count = 0;
+    bool idle = true;
+    long long idle_since = monotonic_ms();
+    while (listener >= 0 && !stop_requested) {
+        long long now = monotonic_ms();
+        int timeout = -1;
+        if (busy == 0 && pending_count == 0 && options->idle_seconds > 0) {
+            long long remaining = idle_since + (long long)options->idle_seconds * 1000 - now;
+            if (remaining <= 0) break; // Idle for too long
+            timeout = remaining > INT_MAX ? INT_MAX : (int)remaining;
+        }
+
+        // The listening socket is only watched while a pending slot is free; clients
+        // beyond that wait in its queue. Connections of running requests are watched
+        // for the client going away, and those of arriving requests for their data.
+        nfds_t poll_count = 2;
+        polls[0] = (struct pollfd){wake_pipe[0], POLLIN, 0};
+        polls[1] = (struct pollfd){listener, pending_count < DAEMON_MAX_PENDING ? POLLIN : 0, 0};
+        for (size_t i = 0; i < worker_count; i++) {
+            if (workers[i].pid == 0 || workers[i].cancelled) continue;
+            watched[poll_count - 2] = &workers[i];
+            polls[poll_count++] = (struct pollfd){workers[i].connection, POLLIN, 0};
+        }
+        nfds_t watched_count = poll_count - 2;
+        for (size_t i = 0; i < DAEMON_MAX_PENDING; i++) {
+            if (pending[i].connection < 0 || pending[i].complete) continue;
+            long long remaining = pending[i].deadline - now;
+            if (remaining < 0) remaining = 0;
+            if (timeout < 0 || remaining < timeout) timeout = (int)remaining;
+            reading[poll_count - 2 - watched_count] = &pending[i];
+            polls[poll_count++] = (struct pollfd){pending[i].connection, POLLIN, 0};
+        }
+        int ready = poll(polls, poll_count, timeout);
+        if (ready < 0 && errno != EINTR) {
+            perror("Failed to wait for requests");
+            result = 1;
+            break;
+        }
+
+        // Clients send nothing after their request, so anything readable means it went away
+        for (nfds_t i = 2; ready > 0 && i < 2 + watched_count; i++) {
+            Worker *worker = watched[i - 2];
+            if ((polls[i].revents & (POLLIN | POLLHUP | POLLERR)) && worker->pid > 0) {
+                kill(worker->pid, SIGTERM);
+                worker->cancelled = true;
+            }
+        }
+        now = monotonic_ms();
+        for (nfds_t i = 2 + watched_count; i < poll_count; i++) {
+            Pending *request = reading[i - 2 - watched_count];
+            bool ok = true;
+            if (ready > 0 && polls[i].revents) ok = read_request(request);
+            if (ok && !request->complete && request->deadline > now) continue;
+            if (!ok || !request->complete) {
+                fprintf(stderr, "Ignoring a malformed or incomplete request\n");
+                pending_close(request);
+                pending_count--;
+            }
+        }
+        if (ready > 0 && (polls[0].revents & POLLIN)) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+            busy -= reap_workers(workers, worker_count);
+        }
+        if (ready > 0 && (polls[1].revents & POLLIN) && pending_count < DAEMON_MAX_PENDING) {
+            if (accept_request(listener, pending)) pending_count++;
+        }
+
+        // Complete requests start as worker slots free up, the longest waiting first
+        while (busy < worker_count) {
+            Pending *next = NULL;
+            for (size_t i = 0; i < DAEMON_MAX_PENDING; i++) {
+                if (pending[i].connection < 0 || !pending[i].complete) continue;
+                if (!next || pending[i].deadline < next->deadline) next = &pending[i];
+            }
+            if (!next) break;
+            size_t slot = 0;
+            while (workers[slot].pid != 0) slot++;
+            start_request(next, &workers[slot], listener, workers, worker_count, pending, handler, &busy);
+            pending_count--;
+        }
+        bool now_idle = busy == 0 && pending_count == 0;
+        if (now_idle && !idle) idle_since = monotonic_ms();
+        idle = now_idle;
+    }
+
+    // Requests still running are cancelled; their clients see the connection close
+    for (size_t i = 0; i < worker_count; i++) {
+        if (workers[i].pid <= 0) continue;
+        kill(workers[i].pid, SIGTERM);
+        waitpid(workers[i].pid, NULL, 0);
+        close(workers[i].connection);
+    }
+    for (size_t i = 0; i < DAEMON_MAX_PENDING; i++) {
+        if (pending[i].connection >= 0) pending_close(&pending[i]);
+    }
+    if (listener >= 0) {
+        close(listener);
+        unlink(options->socket_path);
+    }
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    free(workers);
+    free(polls);
+    free(watched);
+    return result;
+}
+
+// --- Client ---
+
+bool daemon_forward(const char *socket_path, int argc, char **argv, int *out_status) {
+    struct sockaddr_un address;
+    if (!socket_address(socket_path, &address)) return false;
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) return false;
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(connection);
+        return false;
+    }
+
+    *out_status = 1;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("Failed to get the working directory");
+        close(connection);
+        return true;
+    }
+    size_t size = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++) size += strlen(argv[i]) + 1;
+    char *data = size <= DAEMON_MAX_REQUEST ? malloc(size) : NULL;
+    if (!data) {
+        fprintf(stderr, "The arguments are too long to forward to the daemon\n");
+        close(connection);
+        return true;
+    }
+    size_t offset = strlen(cwd) + 1;
+    memcpy(data, cwd, offset);
+    for (int i = 0; i < argc; i++) {
+        memcpy(data + offset, argv[i], strlen(argv[i]) + 1);
+        offset += strlen(argv[i]) + 1;
+    }
+
+    RequestHeader header = {DAEMON_MAGIC, (uint32_t)size};
+    int fds[3] = {0, 1, 2};
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {&header, sizeof(header)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(connection, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    int32_t code;
+    if (sent != (ssize_t)sizeof(header) || !write_all(connection, data, size)) {
+        fprintf(stderr, "Failed to send the request to the daemon: %s\n", strerror(errno));
+    } else if (!read_all(connection, &code, sizeof(code))) {
+        fprintf(stderr, "The daemon closed the connection before the request finished\n");
+    } else {
+        *out_status = code;
+    }
+    free(data);
+    close(connection);
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+
+// A daemon exits after this many seconds without a request (--idle-timeout)
+#define DAEMON_DEFAULT_IDLE_SECONDS 600
+#define DAEMON_ENV_SOCKET "CODETINT_DAEMON" // Socket that plain invocations forward to when set
+
+typedef struct {
+    const char *socket_path;
+    int workers;      // Requests served at once (0 = one per online CPU); more wait for a free one
+    int idle_seconds; // Exit after this long with no request (0 = never)
+} DaemonOptions;
+
+// Runs one forwarded invocation and returns its exit status. It is called in a worker
+// process forked from the daemon, with the client's stdin, stdout and stderr as its
+// own and the client's working directory as its own, so it can behave exactly like a
+// separate run while inheriting everything the daemon prepared before serving.
+typedef int (*DaemonHandler)(int argc, char **argv);
+
+// Serves requests on the Unix domain socket `socket_path` until SIGINT or SIGTERM, or
+// until it has been idle for `idle_seconds`. Each request is the client's argv, working
+// directory and its stdin, stdout and stderr (passed with SCM_RIGHTS); it runs in a
+// worker forked for it, whose output goes straight to the client, and the client is
+// sent the exit status. A client that disconnects first cancels its request (the
+// worker is sent SIGTERM). Returns 0 after a clean shutdown, 1 on failure.
+int daemon_serve(const DaemonOptions *options, DaemonHandler handler);
+
+// Client side: forwards argv (argv[0] included), the working directory and file
+// descriptors 0-2 to the daemon at `socket_path`, then waits for the exit status.
+// Returns false without sending anything if no daemon accepts the connection, so the
+// caller can run the request itself; otherwise true, with the status (1 if the daemon
+// went away) in *out_status.
+bool daemon_forward(const char *socket_path, int argc, char **argv, int *out_status);
+
+#endif // DAEMON_H
@@ -0,0 +1,464 @@
+#include "diff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Parsing ---
+
+// End of the line starting at `pos` (without its break); `next` receives the start of the following line
+static size_t line_end_at(const char *text, size_t size, size_t pos, size_t *next) {
+    const char *newline = memchr(text + pos, '\n', size - pos);
+    size_t end = newline ? (size_t)(newline - text) : size;
+    *next = newline ? end + 1 : size;
+    return end;
+}
+
+static bool starts_with(const char *line, size_t len, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    return len >= prefix_len && memcmp(line, prefix, prefix_len) == 0;
+}
+
+static bool parse_number(const char **p, const char *end, uint32_t *value) {
+    const char *digits = *p;
+    uint64_t number = 0;
+    while (*p < end && **p >= '0' && **p <= '9' && number <= UINT32_MAX) {
+        number = number * 10 + (uint64_t)(**p - '0');
+        (*p)++;
+    }
+    if (*p == digits || number > UINT32_MAX) return false;
+    *value = (uint32_t)number;
+    return true;
+}
+
+// "-12,3" or "+12" (a count of 1)
+static bool parse_range(const char **p, const char *end, char sign, uint32_t *start, uint32_t *count) {
+    if (*p >= end || **p != sign) return false;
+    (*p)++;
+    if (!parse_number(p, end, start)) return false;
+    *count = 1;
+    if (*p < end && **p == ',') {
+        (*p)++;
+        return parse_number(p, end, count);
+    }
+    return true;
+}
+
+// "@@ -12,3 +12,4 @@ optional section heading"
+static bool parse_hunk_header(const char *line, size_t len, DiffHunk *hunk) {
+    const char *p = line + 3;
+    const char *end = line + len;
+    if (!parse_range(&p, end, '-', &hunk->old_start, &hunk->old_count)) return false;
+    if (p >= end || *p++ != ' ') return false;
+    if (!parse_range(&p, end, '+', &hunk->new_start, &hunk->new_count)) return false;
+    return end - p >= 3 && memcmp(p, " @@", 3) == 0;
+}
+
+// Whether a "+++ b/dir/file.c" name and `path` are the same file: one ends with the other after a '/'
+static bool names_match(const char *name, size_t name_len, const char *path) {
+    if (name_len > 2 && (name[0] == 'a' || name[0] == 'b') && name[1] == '/') {
+        name += 2;
+        name_len -= 2;
+    }
+    size_t path_len = strlen(path);
+    if (name_len == 0 || path_len == 0) return false;
+    if (name_len <= path_len) {
+        return memcmp(path + path_len - name_len, name, name_len) == 0 &&
+               (name_len == path_len || path[path_len - name_len - 1] == '/');
+    }
+    return memcmp(name + name_len - path_len, path, path_len) == 0 && name[name_len - path_len - 1] == '/';
+}
+
+static bool malformed(Diff *diff, unsigned line) {
+    fprintf(stderr, "Malformed diff at line %u\n", line);
+    diff_free(diff);
+    return false;
+}
+
+bool diff_parse(const char *text, size_t text_size, const char *path, Diff *diff) {
+    memset(diff, 0, sizeof(*diff));
+    diff->text = text;
+    diff->text_size = text_size;
+
+    // Hunks of every file are read, each tagged with its file (0 before any "+++" line)
+    size_t capacity = 0;
+    unsigned *files = NULL;
+    unsigned file_count = 0;
+    unsigned match = 0;
+    unsigned line_number = 0;
+    size_t pos = 0;
+    while (pos < text_size) {
+        size_t next;
+        size_t end = line_end_at(text, text_size, pos, &next);
+        const char *line = text + pos;
+        size_t len = end - pos;
+        line_number++;
+        if (len && line[len - 1] == '\r') len--;
+
+        if (starts_with(line, len, "+++ ")) {
+            file_count++;
+            size_t name_len = 0;
+            while (4 + name_len < len && line[4 + name_len] != '\t') name_len++;
+            if (!match && names_match(line + 4, name_len, path)) match = file_count;
+        } else if (starts_with(line, len, "@@ ")) {
+            DiffHunk hunk = {0};
+            if (!parse_hunk_header(line, len, &hunk)) {
+                free(files);
+                return malformed(diff, line_number);
+            }
+            hunk.header = pos;
+            hunk.header_len = len;
+            hunk.body = next;
+
+            // The header's counts say where the hunk ends
+            uint32_t old_left = hunk.old_count;
+            uint32_t new_left = hunk.new_count;
+            next = hunk.body;
+            while (old_left || new_left || (next < text_size && text[next] == '\\')) {
+                if (next >= text_size) {
+                    free(files);
+                    return malformed(diff, line_number);
+                }
+                size_t body_line = next;
+                size_t body_end = line_end_at(text, text_size, body_line, &next);
+                line_number++;
+                char kind = body_end > body_line ? text[body_line] : ' '; // Blank context lines may have lost their space
+                bool fits = (kind == ' ' && old_left && new_left) || (kind == '-' && old_left) ||
+                            (kind == '+' && new_left) || kind == '\\';
+                if (!fits) {
+                    free(files);
+                    return malformed(diff, line_number);
+                }
+                if (kind == ' ' || kind == '-') old_left--;
+                if (kind == ' ' || kind == '+') new_left--;
+            }
+            hunk.body_end = next;
+
+            if (diff->hunk_count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                DiffHunk *grown = realloc(diff->hunks, capacity * sizeof(DiffHunk));
+                unsigned *grown_files = realloc(files, capacity * sizeof(unsigned));
+                if (grown) diff->hunks = grown;
+                if (grown_files) files = grown_files;
+                if (!grown || !grown_files) {
+                    fprintf(stderr, "Failed to allocate diff hunks\n");
+                    free(files);
+                    diff_free(diff);
+                    return false;
+                }
+            }
+            files[diff->hunk_count] = file_count;
+            diff->hunks[diff->hunk_count++] = hunk;
+        }
+        pos = next;
+    }
+
+    // Keep the hunks of `path`, or of the only file
+    if (!match && file_count > 1) {
+        fprintf(stderr, "Diff has no changes for '%s'\n", path);
+        free(files);
+        diff_free(diff);
+        return false;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < diff->hunk_count; i++) {
+        if (!match || files[i] == match) diff->hunks[kept++] = diff->hunks[i];
+    }
+    diff->hunk_count = kept;
+    free(files);
+    if (kept == 0) {
+        fprintf(stderr, "Diff has no changes for '%s'\n", path);
+        diff_free(diff);
+        return false;
+    }
+    return true;
+}
+
+void diff_free(Diff *diff) {
+    free(diff->hunks);
+    diff->hunks = NULL;
+    diff->hunk_count = 0;
+}
+
+// --- Walking Hunks And Files ---
+
+typedef struct {
+    const char *text;
+    size_t pos;
+    size_t end;
+} HunkReader;
+
+// Next line of a hunk: its kind (' ', '-' or '+') and its content without the marker
+// and line break. `no_newline` is set when a "\ No newline at end of file" follows.
+static bool next_hunk_line(HunkReader *reader, char *kind, const char **content, size_t *content_len, bool *no_newline) {
+    while (reader->pos < reader->end) {
+        size_t start = reader->pos;
+        size_t end = line_end_at(reader->text, reader->end, start, &reader->pos);
+        if (end > start && reader->text[start] == '\\') continue;
+
+        *kind = end > start ? reader->text[start] : ' ';
+        *content = reader->text + start + (end > start);
+        *content_len = end - start - (end > start);
+        *no_newline = reader->pos < reader->end && reader->text[reader->pos] == '\\';
+        return true;
+    }
+    return false;
+}
+
+// Forward-only position in one version of the file
+typedef struct {
+    const char *code;
+    size_t size;
+    uint32_t line; // 1-based line starting at `offset`
+    size_t offset;
+} LineCursor;
+
+// Offset where `line` starts, or the end of the code for lines past the last one
+static size_t line_offset(LineCursor *cursor, uint32_t line) {
+    while (cursor->line < line && cursor->offset < cursor->size) {
+        const char *newline = memchr(cursor->code + cursor->offset, '\n', cursor->size - cursor->offset);
+        cursor->offset = newline ? (size_t)(newline - cursor->code) + 1 : cursor->size;
+        cursor->line++;
+    }
+    return cursor->offset;
+}
+
+// Offset just past the line starting at `offset`, including its line break
+static size_t next_line_offset(const char *code, size_t size, size_t offset) {
+    const char *newline = memchr(code + offset, '\n', size - offset);
+    return newline ? (size_t)(newline - code) + 1 : size;
+}
+
+// First line of a hunk on one side; a count of 0 means the hunk sits after line `start`
+static uint32_t first_line(uint32_t start, uint32_t count) {
+    return count ? start : start + 1;
+}
+
+bool diff_matches(const Diff *diff, char side, const char *code, size_t code_size) {
+    LineCursor cursor = {code, code_size, 1, 0};
+    for (size_t h = 0; h < diff->hunk_count; h++) {
+        const DiffHunk *hunk = &diff->hunks[h];
+        uint32_t line = side == '-' ? first_line(hunk->old_start, hunk->old_count)
+                                    : first_line(hunk->new_start, hunk->new_count);
+        size_t offset = line_offset(&cursor, line);
+
+        HunkReader reader = {diff->text, hunk->body, hunk->body_end};
+        char kind;
+        const char *content;
+        size_t content_len;
+        bool no_newline;
+        while (next_hunk_line(&reader, &kind, &content, &content_len, &no_newline)) {
+            if (kind != ' ' && kind != side) continue;
+            size_t end = next_line_offset(code, code_size, offset);
+            size_t len = end - offset - (end > offset && code[end - 1] == '\n');
+            if (offset >= code_size || len != content_len || memcmp(code + offset, content, len) != 0) {
+                fprintf(stderr, "Diff does not match the %s version of the file at line %u\n",
+                        side == '-' ? "old" : "new", line);
+                return false;
+            }
+            offset = end;
+            line++;
+        }
+        cursor.offset = offset;
+        cursor.line = line;
+    }
+    return true;
+}
+
+char *diff_old_source(const Diff *diff, const char *new_code, size_t new_size, size_t *old_size) {
+    if (!diff_matches(diff, '+', new_code, new_size)) return NULL;
+
+    // The old lines of each hunk are at most as long as its body in the diff
+    size_t capacity = new_size;
+    for (size_t h = 0; h < diff->hunk_count; h++) {
+        capacity += diff->hunks[h].body_end - diff->hunks[h].body;
+    }
+    char *old_code = malloc(capacity + 1);
+    if (!old_code) {
+        fprintf(stderr, "Failed to allocate the old version of the file\n");
+        return NULL;
+    }
+
+    LineCursor cursor = {new_code, new_size, 1, 0};
+    size_t copied = 0; // New code before this is accounted for
+    size_t len = 0;
+    for (size_t h = 0; h < diff->hunk_count; h++) {
+        const DiffHunk *hunk = &diff->hunks[h];
+        uint32_t line = first_line(hunk->new_start, hunk->new_count);
+        size_t offset = line_offset(&cursor, line);
+        memcpy(old_code + len, new_code + copied, offset - copied);
+        len += offset - copied;
+
+        HunkReader reader = {diff->text, hunk->body, hunk->body_end};
+        char kind;
+        const char *content;
+        size_t content_len;
+        bool no_newline;
+        while (next_hunk_line(&reader, &kind, &content, &content_len, &no_newline)) {
+            if (kind != '+') {
+                memcpy(old_code + len, content, content_len);
+                len += content_len;
+                if (!no_newline) old_code[len++] = '\n';
+            }
+            if (kind != '-') offset = next_line_offset(new_code, new_size, offset);
+        }
+        copied = offset;
+        cursor.offset = offset;
+        cursor.line = line + hunk->new_count;
+    }
+    memcpy(old_code + len, new_code + copied, new_size - copied);
+    len += new_size - copied;
+    old_code[len] = '\0';
+    *old_size = len;
+    return old_code;
+}
+
+// --- Rendering ---
+
+#define DIFF_ANSI_ADD "\x1b[32m"
+#define DIFF_ANSI_DELETE "\x1b[31m"
+#define DIFF_ANSI_HUNK "\x1b[36m"
+#define DIFF_ANSI_RESET "\x1b[0m"
+
+// Spans of the hunk's lines on one side of the diff; returns the offset of its first line
+static bool collect_side(const DiffSide *side, LineCursor *cursor, uint32_t start, uint32_t count,
+                         const TSQuery *query, TSQueryCursor *query_cursor, const uint8_t *capture_styles,
+                         const QueryPredicates *predicates, SpanList *spans, SpanList *scratch, size_t *from) {
+    spans->count = 0;
+    uint32_t line = first_line(start, count);
+    *from = line_offset(cursor, line);
+    if (count == 0) return true;
+    size_t to = line_offset(cursor, line + count);
+    return highlight_collect_range(query_cursor, query, ts_tree_root_node(side->tree), capture_styles, predicates,
+                                   side->code, side->code_size, (uint32_t)*from, (uint32_t)to, spans) &&
+           (!side->injections || injection_apply(side->injections, (uint32_t)*from, (uint32_t)to, spans, scratch));
+}
+
+// The spans of `spans` inside [from, to), cut to it. `index` moves past spans that end before `from`.
+static bool clip_spans(const SpanList *spans, size_t *index, size_t from, size_t to, SpanList *out) {
+    out->count = 0;
+    while (*index < spans->count && spans->items[*index].end <= from) (*index)++;
+    for (size_t i = *index; i < spans->count && spans->items[i].start < to; i++) {
+        const HighlightSpan *span = &spans->items[i];
+        uint32_t start = span->start > from ? span->start : (uint32_t)from;
+        uint32_t end = span->end < to ? span->end : (uint32_t)to;
+        if (!span_list_push(out, start, end, span->capture, span->style)) return false;
+    }
+    return true;
+}
+
+static void write_hunk_header(Renderer *r, const Diff *diff, const DiffHunk *hunk) {
+    if (r->format == OUTPUT_ANSI) {
+        renderer_write_markup(r, DIFF_ANSI_HUNK, sizeof(DIFF_ANSI_HUNK) - 1);
+        renderer_write_markup(r, diff->text + hunk->header, hunk->header_len);
+        renderer_write_markup(r, DIFF_ANSI_RESET "\n", sizeof(DIFF_ANSI_RESET "\n") - 1);
+    } else {
+        static const char open[] = "<span class=\"diff-line diff-hunk\">";
+        renderer_write_markup(r, open, sizeof(open) - 1);
+        render_spans(r, diff->text, hunk->header, hunk->header + hunk->header_len, NULL, 0);
+        renderer_write_markup(r, "</span>\n", 8);
+    }
+}
+
+// One line of the diff: gutter, marker and the highlighted code[from, to), which excludes the line break
+static void write_line(Renderer *r, char kind, uint32_t old_line, uint32_t new_line, int width, bool show_line_numbers,
+                       const char *code, size_t from, size_t to, const SpanList *spans) {
+    char old_number[16] = "";
+    char new_number[16] = "";
+    if (kind != '+') snprintf(old_number, sizeof(old_number), "%u", old_line);
+    if (kind != '-') snprintf(new_number, sizeof(new_number), "%u", new_line);
+
+    char prefix[256];
+    int len = 0;
+    if (r->format == OUTPUT_ANSI) {
+        if (show_line_numbers) {
+            len += snprintf(prefix + len, sizeof(prefix) - len, "%s%*s %*s │" DIFF_ANSI_RESET " ",
+                            r->theme->ansi_line_number, width, old_number, width, new_number);
+        }
+        const char *color = kind == '+' ? DIFF_ANSI_ADD : kind == '-' ? DIFF_ANSI_DELETE : "";
+        len += snprintf(prefix + len, sizeof(prefix) - len, "%s%c%s", color, kind, *color ? DIFF_ANSI_RESET : "");
+    } else {
+        const char *cls = kind == '+' ? " diff-add" : kind == '-' ? " diff-del" : "";
+        len += snprintf(prefix + len, sizeof(prefix) - len, "<span class=\"diff-line%s\">", cls);
+        if (show_line_numbers) {
+            len += snprintf(prefix + len, sizeof(prefix) - len, "<span class=\"diff-gutter\">%*s %*s</span>",
+                            width, old_number, width, new_number);
+        }
+        len += snprintf(prefix + len, sizeof(prefix) - len, "<span class=\"diff-marker\">%c</span>", kind);
+    }
+    renderer_write_markup(r, prefix, (size_t)len < sizeof(prefix) ? (size_t)len : sizeof(prefix) - 1);
+
+    render_spans(r, code, from, to, spans->items, spans->count);
+    if (r->format == OUTPUT_ANSI) renderer_write_markup(r, "\n", 1);
+    else renderer_write_markup(r, "</span>\n", 8);
+}
+
+bool diff_render(Renderer *r, const Diff *diff, const DiffSide *old_side, const DiffSide *new_side,
+                 const TSQuery *query, TSQueryCursor *cursor, const uint8_t *capture_styles,
+                 const QueryPredicates *predicates, bool show_line_numbers) {
+    // Gutter columns wide enough for the largest line number shown
+    uint32_t max_line = 1;
+    for (size_t h = 0; h < diff->hunk_count; h++) {
+        const DiffHunk *hunk = &diff->hunks[h];
+        if (hunk->old_start + hunk->old_count > max_line) max_line = hunk->old_start + hunk->old_count;
+        if (hunk->new_start + hunk->new_count > max_line) max_line = hunk->new_start + hunk->new_count;
+    }
+    char digits[16];
+    int width = snprintf(digits, sizeof(digits), "%u", max_line);
+    if (width < 4) width = 4;
+
+    LineCursor old_cursor = {old_side->code, old_side->code_size, 1, 0};
+    LineCursor new_cursor = {new_side->code, new_side->code_size, 1, 0};
+    SpanList old_spans = {0};
+    SpanList new_spans = {0};
+    SpanList line_spans = {0};
+    SpanList scratch = {0};
+    bool ok = true;
+    for (size_t h = 0; ok && h < diff->hunk_count; h++) {
+        const DiffHunk *hunk = &diff->hunks[h];
+        size_t old_offset, new_offset;
+        ok = collect_side(old_side, &old_cursor, hunk->old_start, hunk->old_count, query, cursor, capture_styles,
+                          predicates, &old_spans, &scratch, &old_offset) &&
+             collect_side(new_side, &new_cursor, hunk->new_start, hunk->new_count, query, cursor, capture_styles,
+                          predicates, &new_spans, &scratch, &new_offset);
+        if (!ok) break;
+
+        write_hunk_header(r, diff, hunk);
+        uint32_t old_line = first_line(hunk->old_start, hunk->old_count);
+        uint32_t new_line = first_line(hunk->new_start, hunk->new_count);
+        size_t old_index = 0;
+        size_t new_index = 0;
+        HunkReader reader = {diff->text, hunk->body, hunk->body_end};
+        char kind;
+        const char *content;
+        size_t content_len;
+        bool no_newline;
+        while (ok && next_hunk_line(&reader, &kind, &content, &content_len, &no_newline)) {
+            // Removed lines come from the old version, everything else from the new one
+            size_t old_end = next_line_offset(old_side->code, old_side->code_size, old_offset);
+            size_t new_end = next_line_offset(new_side->code, new_side->code_size, new_offset);
+            const DiffSide *side = kind == '-' ? old_side : new_side;
+            size_t from = kind == '-' ? old_offset : new_offset;
+            size_t to = kind == '-' ? old_end : new_end;
+            if (to > from && side->code[to - 1] == '\n') to--;
+            ok = kind == '-' ? clip_spans(&old_spans, &old_index, from, to, &line_spans)
+                             : clip_spans(&new_spans, &new_index, from, to, &line_spans);
+            if (ok) write_line(r, kind, old_line, new_line, width, show_line_numbers, side->code, from, to, &line_spans);
+            if (kind != '+') {
+                old_offset = old_end;
+                old_line++;
+            }
+            if (kind != '-') {
+                new_offset = new_end;
+                new_line++;
+            }
+        }
+    }
+    if (!ok) fprintf(stderr, "Failed to allocate highlight spans\n");
+
+    span_list_free(&old_spans);
+    span_list_free(&new_spans);
+    span_list_free(&line_spans);
+    span_list_free(&scratch);
+    return ok;
+}
@@ -0,0 +1,67 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "highlight.h"
+#include "injection.h"
+#include "render.h"
+
+// One "@@ -old_start,old_count +new_start,new_count @@" hunk of a unified diff. Offsets
+// point into the diff text.
+typedef struct {
+    uint32_t old_start;
+    uint32_t old_count;
+    uint32_t new_start;
+    uint32_t new_count;
+    size_t header;     // The "@@" line, without its line break
+    size_t header_len;
+    size_t body;       // Lines of the hunk: [body, body_end)
+    size_t body_end;
+} DiffHunk;
+
+// The hunks of one file in a unified diff (e.g. `git diff` output). `text` is the
+// caller's and must outlive the Diff.
+typedef struct {
+    const char *text;
+    size_t text_size;
+    DiffHunk *hunks;
+    size_t hunk_count;
+} Diff;
+
+// One version of the file
+typedef struct {
+    const char *code;
+    size_t code_size;
+    const TSTree *tree;
+    const InjectionSet *injections; // May be NULL
+} DiffSide;
+
+// Reads the hunks of `path` from a unified diff: those of its only file, or of the file
+// whose "+++" name matches the end of `path`. Prints the problem and returns false if
+// there are none or the diff is malformed.
+bool diff_parse(const char *text, size_t text_size, const char *path, Diff *diff);
+
+// Checks that the lines the diff shows of one side ('-' for the old version, '+' for
+// the new one) are those of code[0, code_size). Prints the first mismatch and returns
+// false otherwise.
+bool diff_matches(const Diff *diff, char side, const char *code, size_t code_size);
+
+// Rebuilds the old version of the file by undoing the hunks on the new one. Returns a
+// malloc'ed buffer, or NULL (with the problem printed) if the diff does not match.
+char *diff_old_source(const Diff *diff, const char *new_code, size_t new_size, size_t *old_size);
+
+// Renders the hunks interleaved: context and added lines from `new_side`, removed lines
+// from `old_side`. Only each hunk's lines are queried (highlight_collect_range), so the
+// cost follows the size of the diff, not of the files. With `show_line_numbers`, lines
+// carry their old and new line numbers. Returns false on allocation failure.
+bool diff_render(Renderer *r, const Diff *diff, const DiffSide *old_side, const DiffSide *new_side,
+                 const TSQuery *query, TSQueryCursor *cursor, const uint8_t *capture_styles,
+                 const QueryPredicates *predicates, bool show_line_numbers);
+
+void diff_free(Diff *diff);
+
+#endif // DIFF_H
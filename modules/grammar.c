@@ -0,0 +1,120 @@
+#include "grammar.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A grammar name resolved once, successfully or not
+typedef struct GrammarEntry {
+    struct GrammarEntry *next;
+    char name[GRAMMAR_NAME_MAX];
+    const TSLanguage *language; // NULL when it could not be loaded
+    char error[PATH_MAX + 128]; // Why not, printed once by every process that asks for it
+    pid_t reported_by;
+} GrammarEntry;
+
+static pthread_mutex_t grammar_lock = PTHREAD_MUTEX_INITIALIZER;
+static GrammarEntry *grammars;
+static const char *search_path = GRAMMAR_DEFAULT_PATH;
+
+void grammar_set_search_path(const char *path) {
+    pthread_mutex_lock(&grammar_lock);
+    search_path = path;
+    pthread_mutex_unlock(&grammar_lock);
+}
+
+bool grammar_name_valid(const char *name) {
+    size_t len = 0;
+    for (; name[len]; ++len) {
+        char c = name[len];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        if (!ok || len + 1 >= GRAMMAR_NAME_MAX) return false;
+    }
+    return len > 0;
+}
+
+// Advances *dir through the search path to the next directory holding <name>.so and
+// writes that file's path to `path`. Returns false when there is none left.
+static bool next_shared_grammar(const char **dir, const char *name, char path[PATH_MAX]) {
+    while (**dir) {
+        size_t dir_len = strcspn(*dir, ":");
+        int path_len = snprintf(path, PATH_MAX, "%.*s/%s.so", (int)dir_len, dir_len ? *dir : ".", name);
+        *dir += dir_len;
+        if (**dir == ':') (*dir)++;
+        if (path_len >= 0 && path_len < PATH_MAX && access(path, F_OK) == 0) return true;
+    }
+    return false;
+}
+
+// Opens the first <dir>/<name>.so on the search path that resolves tree_sitter_<name>.
+// Returns NULL with the reason in `error` if there is none.
+static const TSLanguage *load_shared_grammar(const char *name, char *error, size_t error_size) {
+    char symbol[GRAMMAR_NAME_MAX + 16];
+    snprintf(symbol, sizeof(symbol), "tree_sitter_%s", name);
+    snprintf(error, error_size, "Grammar '%s' is not built in and no %s.so was found in '%s' (see --grammar-path)",
+             name, name, search_path);
+
+    const char *dir = search_path;
+    char path[PATH_MAX];
+    while (next_shared_grammar(&dir, name, path)) {
+        void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+            snprintf(error, error_size, "Failed to load grammar '%s': %s", name, dlerror());
+            continue;
+        }
+        const TSLanguage *(*language_function)(void) = (const TSLanguage *(*)(void))dlsym(handle, symbol);
+        if (!language_function) {
+            snprintf(error, error_size, "Grammar '%s' has no %s()", path, symbol);
+            dlclose(handle);
+            continue;
+        }
+        return language_function(); // The library stays open for the rest of the run
+    }
+    return NULL;
+}
+
+bool grammar_available(const char *name, const TSLanguage *(*linked)(void)) {
+    if (linked) return true;
+    if (!grammar_name_valid(name)) return false;
+    pthread_mutex_lock(&grammar_lock);
+    const char *dir = search_path;
+    char path[PATH_MAX];
+    bool found = next_shared_grammar(&dir, name, path);
+    pthread_mutex_unlock(&grammar_lock);
+    return found;
+}
+
+const TSLanguage *grammar_load(const char *name, const TSLanguage *(*linked)(void)) {
+    if (linked) return linked();
+    if (!grammar_name_valid(name)) {
+        fprintf(stderr, "Invalid grammar name '%s'\n", name);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&grammar_lock);
+    GrammarEntry *entry = grammars;
+    while (entry && strcmp(entry->name, name) != 0) entry = entry->next;
+    if (!entry) {
+        entry = calloc(1, sizeof(GrammarEntry));
+        if (entry) {
+            strcpy(entry->name, name);
+            entry->language = load_shared_grammar(name, entry->error, sizeof(entry->error));
+            entry->next = grammars;
+            grammars = entry;
+        } else {
+            fprintf(stderr, "Failed to allocate grammar table memory!\n");
+        }
+    }
+    // A process forked after the failure (a daemon worker) reports it again
+    if (entry && !entry->language && entry->reported_by != getpid()) {
+        fprintf(stderr, "%s\n", entry->error);
+        entry->reported_by = getpid();
+    }
+    const TSLanguage *language = entry ? entry->language : NULL;
+    pthread_mutex_unlock(&grammar_lock);
+    return language;
+}
@@ -0,0 +1,32 @@
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#include <stdbool.h>
+#include <tree_sitter/api.h>
+
+// Directories searched for grammar shared objects, separated by ':'
+#define GRAMMAR_DEFAULT_PATH "grammars"
+#define GRAMMAR_NAME_MAX 64
+
+// Grammars that are not linked into the binary are loaded on first use from the
+// first <dir>/<name>.so on the search path, which must export tree_sitter_<name>
+// (e.g. python.so built from tree-sitter-python's parser.c and scanner.c with
+// -shared -fPIC). Loaded grammars stay loaded, and every name is resolved once; all
+// functions may be called from any thread.
+
+// Replaces the search path (default GRAMMAR_DEFAULT_PATH). Call before the first grammar_load.
+void grammar_set_search_path(const char *path);
+
+// Whether `name` can name a grammar: letters, digits and '_', shorter than GRAMMAR_NAME_MAX
+bool grammar_name_valid(const char *name);
+
+// Whether the grammar called `name` is linked in or has a <name>.so on the search
+// path, without loading it or printing anything
+bool grammar_available(const char *name, const TSLanguage *(*linked)(void));
+
+// The grammar called `name`: `linked()` when it is linked into the binary (non-NULL),
+// otherwise the one loaded from the search path. Prints the problem (once per process)
+// and returns NULL if it cannot be found.
+const TSLanguage *grammar_load(const char *name, const TSLanguage *(*linked)(void));
+
+#endif // GRAMMAR_H
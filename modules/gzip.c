@@ -0,0 +1,606 @@
+#define _GNU_SOURCE // fopencookie
+#include "gzip.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- Deflate Parameters ---
+//
+// A deflate (RFC 1951) compressor in the usual shape: a 32 KB sliding window
+// searched through hash chains, lazy matching from level 4 up, and blocks of
+// symbols written with their own Huffman codes (or the fixed ones when those come
+// out smaller). Blocks are cut by symbol count, so input is never held beyond the
+// window. Level 0 writes stored blocks.
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define LOOKAHEAD (MAX_MATCH + MIN_MATCH + 1) // Input kept ahead of the position being matched
+#define MAX_DIST (WINDOW_SIZE - LOOKAHEAD)     // Matches reach no further back, so sliding keeps them
+#define BLOCK_SYMBOLS 16384
+#define STORED_MAX 65535
+#define OUT_BUFFER_SIZE 16384
+
+#define LITLEN_CODES 286 // 256 literals, end of block, 29 lengths
+#define DIST_CODES 30
+#define CODELEN_CODES 19
+#define END_OF_BLOCK 256
+
+typedef struct {
+    uint16_t max_chain;   // Hash chain entries tried per position
+    uint16_t nice_length; // A match this long ends the search (and, when lazy, the next one)
+    bool lazy;            // Try one position further before taking a match
+} LevelConfig;
+
+static const LevelConfig level_configs[10] = {
+    {0, 0, false},      // Stored
+    {4, 8, false},    {8, 16, false},    {32, 32, false},
+    {16, 32, true},   {32, 64, true},    {128, 128, true},
+    {256, 128, true}, {1024, 258, true}, {4096, 258, true},
+};
+
+static const uint16_t length_base[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[DIST_CODES] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                               33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                               1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[DIST_CODES] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                               6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t codelen_order[CODELEN_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+struct GzipStream {
+    FILE *dest;
+    bool close_dest;
+    bool failed;
+    LevelConfig config;
+    int level;
+
+    // Input: window[0, window_len) holds the last 32 KB before `pos` and the lookahead
+    uint8_t window[2 * WINDOW_SIZE];
+    uint32_t window_len;
+    uint32_t pos;
+    uint16_t head[HASH_SIZE];   // Latest window position with each hash; 0 = none
+    uint16_t prev[WINDOW_SIZE]; // Previous position with the same hash, by position & WINDOW_MASK
+
+    // Lazy matching carried between calls
+    bool match_available; // window[pos - 1] is still to be emitted
+    uint32_t prev_length;
+    uint32_t prev_match;
+
+    // Symbols of the current block: literal/length and distance (0 for literals)
+    uint16_t sym_litlen[BLOCK_SYMBOLS];
+    uint16_t sym_dist[BLOCK_SYMBOLS];
+    uint32_t sym_count;
+    uint32_t litlen_freq[LITLEN_CODES];
+    uint32_t dist_freq[DIST_CODES];
+
+    // Output
+    uint64_t bits;
+    int bit_count;
+    uint8_t out[OUT_BUFFER_SIZE];
+    size_t out_len;
+
+    uint32_t crc;
+    uint32_t total_in;
+};
+
+// --- CRC-32 ---
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    if (crc_table[1]) return;
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// --- Bit Output ---
+
+static void out_flush(GzipStream *z) {
+    if (z->out_len && !z->failed && fwrite(z->out, 1, z->out_len, z->dest) != z->out_len) z->failed = true;
+    z->out_len = 0;
+}
+
+static void out_byte(GzipStream *z, uint8_t byte) {
+    if (z->out_len == OUT_BUFFER_SIZE) out_flush(z);
+    z->out[z->out_len++] = byte;
+}
+
+// Appends the low `count` bits of `value`, least significant first
+static void put_bits(GzipStream *z, uint32_t value, int count) {
+    z->bits |= (uint64_t)value << z->bit_count;
+    z->bit_count += count;
+    while (z->bit_count >= 8) {
+        out_byte(z, (uint8_t)z->bits);
+        z->bits >>= 8;
+        z->bit_count -= 8;
+    }
+}
+
+static void align_byte(GzipStream *z) {
+    if (z->bit_count > 0) put_bits(z, 0, 8 - z->bit_count);
+}
+
+// --- Huffman Codes ---
+
+typedef struct {
+    uint32_t freq;
+    int16_t parent;
+} HuffNode;
+
+static bool leaf_after(uint16_t a, uint16_t b, const uint32_t *freq) {
+    return freq[a] != freq[b] ? freq[a] > freq[b] : a > b;
+}
+
+// Sorts the symbol list by frequency (insertion sort; at most 286 symbols)
+static void sort_leaves(uint16_t *symbols, int count, const uint32_t *freq) {
+    for (int i = 1; i < count; i++) {
+        uint16_t symbol = symbols[i];
+        int j = i;
+        while (j > 0 && leaf_after(symbols[j - 1], symbol, freq)) {
+            symbols[j] = symbols[j - 1];
+            j--;
+        }
+        symbols[j] = symbol;
+    }
+}
+
+// Code lengths of a Huffman code for `freq`, none longer than `limit`. Rarely used
+// symbols are made more common until the tree is shallow enough.
+static void build_lengths(const uint32_t *freq_in, int count, int limit, uint8_t *lengths) {
+    uint32_t freq[LITLEN_CODES];
+    uint16_t symbols[LITLEN_CODES];
+    memcpy(freq, freq_in, count * sizeof(uint32_t));
+    memset(lengths, 0, count);
+
+    int used = 0;
+    for (int i = 0; i < count; i++) {
+        if (freq[i]) symbols[used++] = (uint16_t)i;
+    }
+    // A code needs two symbols to be complete; decoders choke on fewer
+    for (int i = 0; used < 2 && i < count; i++) {
+        if (!freq[i]) {
+            freq[i] = 1;
+            symbols[used++] = (uint16_t)i;
+        }
+    }
+    if (used < 2) return; // Fewer than two symbols in the alphabet
+
+    for (;;) {
+        sort_leaves(symbols, used, freq);
+
+        // Two-queue merge: leaves in order, then internal nodes in the order they were made
+        HuffNode nodes[2 * LITLEN_CODES];
+        for (int i = 0; i < used; i++) nodes[i] = (HuffNode){freq[symbols[i]], -1};
+        int next_leaf = 0, next_node = used, node_count = used;
+        for (int merged = 0; merged < used - 1; merged++) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (next_leaf < used && (next_node >= node_count || nodes[next_leaf].freq <= nodes[next_node].freq)) {
+                    pick[k] = next_leaf++;
+                } else {
+                    pick[k] = next_node++;
+                }
+            }
+            nodes[node_count] = (HuffNode){nodes[pick[0]].freq + nodes[pick[1]].freq, -1};
+            nodes[pick[0]].parent = nodes[pick[1]].parent = (int16_t)node_count;
+            node_count++;
+        }
+
+        // Depths from the root down (parents always come after their children)
+        uint8_t depth[2 * LITLEN_CODES];
+        depth[node_count - 1] = 0;
+        for (int i = node_count - 2; i >= 0; i--) depth[i] = depth[nodes[i].parent] + 1;
+
+        int max_depth = 0;
+        for (int i = 0; i < used; i++) {
+            if (depth[i] > max_depth) max_depth = depth[i];
+        }
+        if (max_depth <= limit) {
+            for (int i = 0; i < used; i++) lengths[symbols[i]] = depth[i];
+            return;
+        }
+        for (int i = 0; i < used; i++) freq[symbols[i]] = (freq[symbols[i]] >> 1) | 1;
+    }
+}
+
+// Canonical codes for `lengths`, bit-reversed for the LSB-first stream
+static void build_codes(const uint8_t *lengths, int count, uint16_t *codes) {
+    uint16_t length_count[16] = {0};
+    for (int i = 0; i < count; i++) length_count[lengths[i]]++;
+    length_count[0] = 0;
+
+    uint16_t next_code[16];
+    uint16_t code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (uint16_t)((code + length_count[bits - 1]) << 1);
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < count; i++) {
+        int len = lengths[i];
+        if (!len) continue;
+        uint16_t c = next_code[len]++;
+        uint16_t reversed = 0;
+        for (int b = 0; b < len; b++) reversed |= (uint16_t)(((c >> b) & 1) << (len - 1 - b));
+        codes[i] = reversed;
+    }
+}
+
+static int length_code(uint32_t length) {
+    uint32_t l = length - MIN_MATCH;
+    if (length == MAX_MATCH) return 28;
+    if (l < 8) return (int)l;
+    int b = 31 - __builtin_clz(l);
+    return 4 * (b - 1) + (int)((l >> (b - 2)) & 3);
+}
+
+static int dist_code(uint32_t dist) {
+    uint32_t d = dist - 1;
+    if (d < 4) return (int)d;
+    int b = 31 - __builtin_clz(d);
+    return 2 * b + (int)((d >> (b - 1)) & 1);
+}
+
+// --- Blocks ---
+
+static void write_stored(GzipStream *z, const uint8_t *data, size_t len, bool last) {
+    put_bits(z, last ? 1 : 0, 3); // BFINAL, BTYPE 00
+    align_byte(z);
+    put_bits(z, (uint32_t)len, 16);
+    put_bits(z, (uint32_t)~len & 0xFFFF, 16);
+    for (size_t i = 0; i < len; i++) out_byte(z, data[i]);
+}
+
+static void write_symbols(GzipStream *z, const uint8_t *litlen_lengths, const uint16_t *litlen_codes,
+                          const uint8_t *dist_lengths, const uint16_t *dist_codes) {
+    for (uint32_t i = 0; i < z->sym_count; i++) {
+        uint32_t litlen = z->sym_litlen[i];
+        uint32_t dist = z->sym_dist[i];
+        if (dist == 0) {
+            put_bits(z, litlen_codes[litlen], litlen_lengths[litlen]);
+            continue;
+        }
+        int lc = length_code(litlen);
+        put_bits(z, litlen_codes[257 + lc], litlen_lengths[257 + lc]);
+        if (length_extra[lc]) put_bits(z, litlen - length_base[lc], length_extra[lc]);
+        int dc = dist_code(dist);
+        put_bits(z, dist_codes[dc], dist_lengths[dc]);
+        if (dist_extra[dc]) put_bits(z, dist - dist_base[dc], dist_extra[dc]);
+    }
+    put_bits(z, litlen_codes[END_OF_BLOCK], litlen_lengths[END_OF_BLOCK]);
+}
+
+// One symbol of the run-length encoded code lengths: a length, or 16-18 for repeats
+typedef struct {
+    uint8_t symbol;
+    uint8_t extra;
+} CodeLength;
+
+static int codelen_extra_bits(uint8_t symbol) {
+    return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+}
+
+// Writes the collected symbols as one block, with dynamic or fixed codes, whichever is smaller
+static void flush_block(GzipStream *z, bool last) {
+    z->litlen_freq[END_OF_BLOCK]++;
+
+    uint8_t litlen_lengths[LITLEN_CODES + 2];
+    uint8_t dist_lengths[DIST_CODES + 2];
+    build_lengths(z->litlen_freq, LITLEN_CODES, 15, litlen_lengths);
+    build_lengths(z->dist_freq, DIST_CODES, 15, dist_lengths);
+
+    int hlit = LITLEN_CODES;
+    while (hlit > 257 && litlen_lengths[hlit - 1] == 0) hlit--;
+    int hdist = DIST_CODES;
+    while (hdist > 1 && dist_lengths[hdist - 1] == 0) hdist--;
+
+    // Run-length encode both length lists as one sequence
+    uint8_t all[LITLEN_CODES + DIST_CODES];
+    memcpy(all, litlen_lengths, hlit);
+    memcpy(all + hlit, dist_lengths, hdist);
+    int total = hlit + hdist;
+    CodeLength rle[LITLEN_CODES + DIST_CODES];
+    int rle_count = 0;
+    for (int i = 0; i < total;) {
+        uint8_t len = all[i];
+        int run = 1;
+        while (i + run < total && all[i + run] == len) run++;
+        i += run;
+        if (len == 0) {
+            while (run >= 11) {
+                int n = run < 138 ? run : 138;
+                rle[rle_count++] = (CodeLength){18, (uint8_t)(n - 11)};
+                run -= n;
+            }
+            if (run >= 3) {
+                rle[rle_count++] = (CodeLength){17, (uint8_t)(run - 3)};
+                run = 0;
+            }
+        } else {
+            rle[rle_count++] = (CodeLength){len, 0};
+            run--;
+            while (run >= 3) {
+                int n = run < 6 ? run : 6;
+                rle[rle_count++] = (CodeLength){16, (uint8_t)(n - 3)};
+                run -= n;
+            }
+        }
+        while (run-- > 0) rle[rle_count++] = (CodeLength){len, 0};
+    }
+    uint32_t codelen_freq[CODELEN_CODES] = {0};
+    for (int i = 0; i < rle_count; i++) codelen_freq[rle[i].symbol]++;
+
+    uint8_t codelen_lengths[CODELEN_CODES];
+    uint16_t codelen_codes[CODELEN_CODES];
+    build_lengths(codelen_freq, CODELEN_CODES, 7, codelen_lengths);
+    build_codes(codelen_lengths, CODELEN_CODES, codelen_codes);
+    int hclen = CODELEN_CODES;
+    while (hclen > 4 && codelen_lengths[codelen_order[hclen - 1]] == 0) hclen--;
+
+    // Fixed codes
+    uint8_t fixed_litlen[288];
+    uint8_t fixed_dist[32];
+    for (int i = 0; i < 288; i++) fixed_litlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    memset(fixed_dist, 5, sizeof(fixed_dist));
+
+    // Compare sizes; extra bits are the same either way
+    uint64_t dynamic_bits = 14 + 3 * (uint64_t)hclen;
+    for (int i = 0; i < rle_count; i++) {
+        dynamic_bits += codelen_lengths[rle[i].symbol] + codelen_extra_bits(rle[i].symbol);
+    }
+    uint64_t fixed_bits = 0;
+    for (int i = 0; i < LITLEN_CODES; i++) {
+        dynamic_bits += (uint64_t)z->litlen_freq[i] * litlen_lengths[i];
+        fixed_bits += (uint64_t)z->litlen_freq[i] * fixed_litlen[i];
+    }
+    for (int i = 0; i < DIST_CODES; i++) {
+        dynamic_bits += (uint64_t)z->dist_freq[i] * dist_lengths[i];
+        fixed_bits += (uint64_t)z->dist_freq[i] * fixed_dist[i];
+    }
+
+    uint16_t litlen_codes[288];
+    uint16_t dist_codes[32];
+    if (fixed_bits <= dynamic_bits) {
+        put_bits(z, (last ? 1 : 0) | (1 << 1), 3); // BTYPE 01
+        build_codes(fixed_litlen, 288, litlen_codes);
+        build_codes(fixed_dist, 32, dist_codes);
+        write_symbols(z, fixed_litlen, litlen_codes, fixed_dist, dist_codes);
+    } else {
+        put_bits(z, (last ? 1 : 0) | (2 << 1), 3); // BTYPE 10
+        put_bits(z, hlit - 257, 5);
+        put_bits(z, hdist - 1, 5);
+        put_bits(z, hclen - 4, 4);
+        for (int i = 0; i < hclen; i++) put_bits(z, codelen_lengths[codelen_order[i]], 3);
+        for (int i = 0; i < rle_count; i++) {
+            uint8_t symbol = rle[i].symbol;
+            put_bits(z, codelen_codes[symbol], codelen_lengths[symbol]);
+            if (codelen_extra_bits(symbol)) put_bits(z, rle[i].extra, codelen_extra_bits(symbol));
+        }
+        build_codes(litlen_lengths, LITLEN_CODES, litlen_codes);
+        build_codes(dist_lengths, DIST_CODES, dist_codes);
+        write_symbols(z, litlen_lengths, litlen_codes, dist_lengths, dist_codes);
+    }
+
+    z->sym_count = 0;
+    memset(z->litlen_freq, 0, sizeof(z->litlen_freq));
+    memset(z->dist_freq, 0, sizeof(z->dist_freq));
+}
+
+static void tally_literal(GzipStream *z, uint8_t byte) {
+    z->sym_litlen[z->sym_count] = byte;
+    z->sym_dist[z->sym_count++] = 0;
+    z->litlen_freq[byte]++;
+    if (z->sym_count == BLOCK_SYMBOLS) flush_block(z, false);
+}
+
+static void tally_match(GzipStream *z, uint32_t dist, uint32_t length) {
+    z->sym_litlen[z->sym_count] = (uint16_t)length;
+    z->sym_dist[z->sym_count++] = (uint16_t)dist;
+    z->litlen_freq[257 + length_code(length)]++;
+    z->dist_freq[dist_code(dist)]++;
+    if (z->sym_count == BLOCK_SYMBOLS) flush_block(z, false);
+}
+
+// --- Matching ---
+
+static uint32_t hash_at(const uint8_t *p) {
+    uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Adds the string at `pos` to its hash chain and returns the previous chain head (0 = none)
+static uint32_t insert_string(GzipStream *z, uint32_t pos) {
+    if (pos + MIN_MATCH > z->window_len) return 0;
+    uint32_t h = hash_at(z->window + pos);
+    uint32_t previous = z->head[h];
+    z->prev[pos & WINDOW_MASK] = (uint16_t)previous;
+    z->head[h] = (uint16_t)pos;
+    return previous;
+}
+
+// Longest match for the string at `pos` along its hash chain starting at `candidate`,
+// if longer than `best`. The match position goes to `match_pos`.
+static uint32_t longest_match(GzipStream *z, uint32_t pos, uint32_t candidate, uint32_t best, uint32_t *match_pos) {
+    uint32_t max_len = z->window_len - pos;
+    if (max_len > MAX_MATCH) max_len = MAX_MATCH;
+    if (best >= max_len) return best;
+    uint32_t limit = pos > MAX_DIST ? pos - MAX_DIST : 0;
+    const uint8_t *current = z->window + pos;
+
+    for (uint32_t chain = z->config.max_chain; candidate > limit && chain > 0; chain--) {
+        const uint8_t *match = z->window + candidate;
+        if (match[best] == current[best] && match[0] == current[0] && match[1] == current[1]) {
+            uint32_t len = 2;
+            while (len < max_len && match[len] == current[len]) len++;
+            if (len > best) {
+                best = len;
+                *match_pos = candidate;
+                if (len >= z->config.nice_length || len == max_len) break;
+            }
+        }
+        candidate = z->prev[candidate & WINDOW_MASK];
+    }
+    return best;
+}
+
+// Matches the window up to `end`
+static void deflate_window(GzipStream *z, uint32_t end) {
+    while (z->pos < end) {
+        uint32_t pos = z->pos;
+        uint32_t candidate = insert_string(z, pos);
+        uint32_t match_pos = 0;
+
+        if (!z->config.lazy) {
+            uint32_t length = candidate ? longest_match(z, pos, candidate, MIN_MATCH - 1, &match_pos) : 0;
+            if (length >= MIN_MATCH) {
+                tally_match(z, pos - match_pos, length);
+                for (uint32_t i = 1; i < length; i++) insert_string(z, pos + i);
+                z->pos += length;
+            } else {
+                tally_literal(z, z->window[pos]);
+                z->pos++;
+            }
+            continue;
+        }
+
+        // Lazy: a match found for the previous position is taken only if this one does no better
+        uint32_t length = MIN_MATCH - 1;
+        if (candidate && z->prev_length < z->config.nice_length) {
+            length = longest_match(z, pos, candidate, MIN_MATCH - 1, &match_pos);
+        }
+        if (z->prev_length >= MIN_MATCH && length <= z->prev_length) {
+            uint32_t start = pos - 1;
+            tally_match(z, start - z->prev_match, z->prev_length);
+            for (uint32_t i = pos + 1; i < start + z->prev_length; i++) insert_string(z, i);
+            z->pos = start + z->prev_length;
+            z->match_available = false;
+            z->prev_length = MIN_MATCH - 1;
+            continue;
+        }
+        if (z->match_available) tally_literal(z, z->window[pos - 1]);
+        z->match_available = true;
+        z->prev_length = length;
+        z->prev_match = match_pos;
+        z->pos++;
+    }
+}
+
+// Drops the oldest half of the window once the position is past it
+static void slide_window(GzipStream *z) {
+    memmove(z->window, z->window + WINDOW_SIZE, z->window_len - WINDOW_SIZE);
+    z->window_len -= WINDOW_SIZE;
+    z->pos -= WINDOW_SIZE;
+    z->prev_match = z->prev_match >= WINDOW_SIZE ? z->prev_match - WINDOW_SIZE : 0;
+    for (int i = 0; i < HASH_SIZE; i++) z->head[i] = z->head[i] >= WINDOW_SIZE ? z->head[i] - WINDOW_SIZE : 0;
+    for (int i = 0; i < WINDOW_SIZE; i++) z->prev[i] = z->prev[i] >= WINDOW_SIZE ? z->prev[i] - WINDOW_SIZE : 0;
+}
+
+// --- Stream ---
+
+static void gzip_write(GzipStream *z, const uint8_t *data, size_t len) {
+    z->crc = crc_update(z->crc, data, len);
+    z->total_in += (uint32_t)len;
+
+    while (len > 0) {
+        uint32_t capacity = z->level == 0 ? STORED_MAX : sizeof(z->window);
+        if (z->window_len == capacity) {
+            if (z->level == 0) {
+                write_stored(z, z->window, z->window_len, false);
+                z->window_len = 0;
+            } else {
+                slide_window(z);
+            }
+        }
+        size_t n = capacity - z->window_len;
+        if (n > len) n = len;
+        memcpy(z->window + z->window_len, data, n);
+        z->window_len += (uint32_t)n;
+        data += n;
+        len -= n;
+
+        if (z->level > 0 && z->window_len > LOOKAHEAD) deflate_window(z, z->window_len - LOOKAHEAD);
+    }
+}
+
+static bool gzip_finish(GzipStream *z) {
+    if (z->level == 0) {
+        write_stored(z, z->window, z->window_len, true);
+    } else {
+        deflate_window(z, z->window_len);
+        if (z->match_available) tally_literal(z, z->window[z->pos - 1]);
+        flush_block(z, true);
+    }
+    align_byte(z);
+
+    uint32_t trailer[2] = {z->crc, z->total_in};
+    for (int i = 0; i < 2; i++) {
+        for (int b = 0; b < 4; b++) out_byte(z, (uint8_t)(trailer[i] >> (8 * b)));
+    }
+    out_flush(z);
+    return !z->failed;
+}
+
+bool gzip_write_iov(void *stream, const struct iovec *iov, int count) {
+    GzipStream *z = stream;
+    for (int i = 0; i < count; i++) gzip_write(z, iov[i].iov_base, iov[i].iov_len);
+    return !z->failed;
+}
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size) {
+    GzipStream *z = cookie;
+    gzip_write(z, (const uint8_t *)buf, size);
+    return z->failed ? 0 : (ssize_t)size;
+}
+
+static int cookie_close(void *cookie) {
+    GzipStream *z = cookie;
+    bool ok = gzip_finish(z);
+    if (z->close_dest) {
+        if (fclose(z->dest) != 0) ok = false;
+    } else if (fflush(z->dest) != 0) {
+        ok = false;
+    }
+    free(z);
+    return ok ? 0 : EOF;
+}
+
+FILE *gzip_open(FILE *dest, int level, bool close_dest, GzipStream **stream) {
+    GzipStream *z = calloc(1, sizeof(GzipStream));
+    if (!z) return NULL;
+    if (level < 0) level = 0;
+    if (level > 9) level = 9;
+    z->dest = dest;
+    z->close_dest = close_dest;
+    z->level = level;
+    z->config = level_configs[level];
+    z->prev_length = MIN_MATCH - 1;
+    crc_init();
+
+    // Header: magic, deflate, no flags, no time, extra flags for the level, Unix
+    const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, level == 9 ? 2 : level == 1 ? 4 : 0, 3};
+    for (size_t i = 0; i < sizeof(header); i++) out_byte(z, header[i]);
+
+    cookie_io_functions_t io = {.read = NULL, .write = cookie_write, .seek = NULL, .close = cookie_close};
+    FILE *file = fopencookie(z, "w", io);
+    if (!file) {
+        free(z);
+        return NULL;
+    }
+    if (stream) *stream = z;
+    return file;
+}
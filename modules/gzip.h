@@ -0,0 +1,23 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define GZIP_DEFAULT_LEVEL 6
+
+typedef struct GzipStream GzipStream;
+
+// Opens a stream that gzip-compresses everything written to it into `dest`, as it is
+// written. `level` runs from 0 (stored, no compression) to 9 (smallest output). The
+// returned FILE takes ordinary stdio writes; fclose on it writes the gzip trailer and
+// closes `dest` too if `close_dest` is set. Memory use is fixed (a few hundred KB)
+// whatever the amount of output. `stream` (may be NULL) receives the compressor for
+// gzip_write_iov. Returns NULL on failure.
+FILE *gzip_open(FILE *dest, int level, bool close_dest, GzipStream **stream);
+
+// Compresses a batch of buffers; usable as a WriterSink. Returns false on failure.
+bool gzip_write_iov(void *stream, const struct iovec *iov, int count);
+
+#endif // GZIP_H
@@ -0,0 +1,140 @@
+#include "highlight.h"
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void span_list_free(SpanList *list) {
+    arena_free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+bool span_list_push(SpanList *list, uint32_t start, uint32_t end, uint16_t capture, uint8_t style) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 1024;
+        HighlightSpan *grown = arena_realloc(list->items, sizeof(HighlightSpan) * new_capacity);
+        if (!grown) return false;
+        list->items = grown;
+        list->capacity = new_capacity;
+    }
+    HighlightSpan *span = &list->items[list->count++];
+    span->start = start;
+    span->end = end;
+    span->capture = capture;
+    span->style = style;
+    return true;
+}
+
+uint8_t *highlight_capture_styles(const TSQuery *query) {
+    uint32_t capture_count = ts_query_capture_count(query);
+    uint8_t *styles = calloc(capture_count ? capture_count : 1, sizeof(uint8_t));
+    if (!styles) return NULL;
+
+    for (uint32_t i = 0; i < capture_count; i++) {
+        uint32_t name_len;
+        const char *name = ts_query_capture_name_for_id(query, i, &name_len);
+        styles[i] = name ? (uint8_t)get_highlight_style(name) : HL_NONE;
+    }
+    return styles;
+}
+
+bool highlight_collect(TSQueryCursor *cursor, const uint8_t *capture_styles, const QueryPredicates *predicates,
+                       const char *code, size_t code_size, uint32_t *current_byte, SpanList *out) {
+    TSQueryMatch match;
+
+    while (ts_query_cursor_next_match(cursor, &match)) {
+        if (!query_predicates_accept(predicates, &match, code, code_size)) continue;
+
+        TSQueryCapture sorted_captures[match.capture_count];
+        memcpy(sorted_captures, match.captures, match.capture_count * sizeof(TSQueryCapture));
+
+        for (uint32_t i = 0; i < match.capture_count; i++) {
+            for (uint32_t j = i + 1; j < match.capture_count; j++) {
+                if (ts_node_start_byte(sorted_captures[j].node) < ts_node_start_byte(sorted_captures[i].node)) {
+                    TSQueryCapture temp = sorted_captures[i];
+                    sorted_captures[i] = sorted_captures[j];
+                    sorted_captures[j] = temp;
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < match.capture_count; i++) {
+            TSQueryCapture capture = sorted_captures[i];
+
+            TSNode node = capture.node;
+            uint32_t start = ts_node_start_byte(node);
+            uint32_t end = ts_node_end_byte(node);
+
+            if (start < *current_byte) continue;
+            if (start >= end || end > code_size) continue;
+
+            if (!span_list_push(out, start, end, (uint16_t)capture.index, capture_styles[capture.index])) {
+                return false;
+            }
+            *current_byte = end;
+        }
+    }
+    return true;
+}
+
+bool highlight_collect_window(TSQueryCursor *cursor, const TSQuery *query, TSNode root,
+                              const uint8_t *capture_styles, const QueryPredicates *predicates,
+                              const char *code, size_t code_size, uint32_t from, uint32_t to,
+                              uint32_t *current_byte, SpanList *carry, SpanList *out) {
+    out->count = 0;
+
+    // Spans accepted by an earlier window come first; new ones all start after them
+    for (size_t i = 0; i < carry->count; i++) {
+        const HighlightSpan *span = &carry->items[i];
+        if (!span_list_push(out, span->start, span->end, span->capture, span->style)) return false;
+    }
+    carry->count = 0;
+
+    ts_query_cursor_set_byte_range(cursor, from, to);
+    ts_query_cursor_exec(cursor, query, root);
+    if (!highlight_collect(cursor, capture_styles, predicates, code, code_size, current_byte, out)) return false;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < out->count; i++) {
+        HighlightSpan *span = &out->items[i];
+        if (span->end > to) {
+            uint32_t rest = span->start > to ? span->start : to;
+            if (!span_list_push(carry, rest, span->end, span->capture, span->style)) return false;
+            if (span->start >= to) continue;
+            span->end = to;
+        }
+        out->items[kept++] = *span;
+    }
+    out->count = kept;
+    return true;
+}
+
+bool highlight_collect_range(TSQueryCursor *cursor, const TSQuery *query, TSNode root,
+                             const uint8_t *capture_styles, const QueryPredicates *predicates,
+                             const char *code, size_t code_size, uint32_t from, uint32_t to, SpanList *out) {
+    out->count = 0;
+
+    // No span reaches into a top-level node from before it, so a query that starts
+    // where the node containing `from` starts sees what a whole-file pass sees
+    TSNode child = ts_node_first_child_for_byte(root, from);
+    uint32_t query_from = from;
+    if (!ts_node_is_null(child) && ts_node_start_byte(child) < from) query_from = ts_node_start_byte(child);
+
+    uint32_t current_byte = query_from;
+    ts_query_cursor_set_byte_range(cursor, query_from, to);
+    ts_query_cursor_exec(cursor, query, root);
+    if (!highlight_collect(cursor, capture_styles, predicates, code, code_size, &current_byte, out)) return false;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < out->count; i++) {
+        HighlightSpan span = out->items[i];
+        if (span.end <= from || span.start >= to) continue;
+        if (span.start < from) span.start = from;
+        if (span.end > to) span.end = to;
+        out->items[kept++] = span;
+    }
+    out->count = kept;
+    return true;
+}
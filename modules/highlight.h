@@ -0,0 +1,59 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "predicate.h"
+#include "theme.h"
+
+// A highlighted byte range of the source. Spans in a SpanList are sorted and never overlap.
+// The items array lives in the arenas (arena.h).
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint16_t capture; // Query capture index
+    uint8_t style;    // HighlightStyle resolved from the capture name
+} HighlightSpan;
+
+typedef struct {
+    HighlightSpan *items;
+    size_t count;
+    size_t capacity;
+} SpanList;
+
+void span_list_free(SpanList *list);
+bool span_list_push(SpanList *list, uint32_t start, uint32_t end, uint16_t capture, uint8_t style);
+
+// Resolves every capture of `query` to a HighlightStyle. Returns a malloc'ed table
+// indexed by capture id, or NULL on allocation failure.
+uint8_t *highlight_capture_styles(const TSQuery *query);
+
+// Runs `cursor` (already exec'ed on a query) to completion and appends the resulting
+// spans to `out`. Matches failing the text predicates of their pattern (`predicates`,
+// compiled from the same query; may be NULL) are skipped. The earliest capture wins:
+// captures starting before the end of the previous span are dropped. `current_byte`
+// carries that position between calls. Returns false on allocation failure.
+bool highlight_collect(TSQueryCursor *cursor, const uint8_t *capture_styles, const QueryPredicates *predicates,
+                       const char *code, size_t code_size, uint32_t *current_byte, SpanList *out);
+
+// Collects the spans of one window, code[from, to), into `out` (cleared first), for
+// rendering a file in consecutive line-aligned pieces. Spans reaching past `to` are cut
+// there and the remainder is kept in `carry`, which must be passed unchanged to the
+// call for the next window. The concatenated windows match a single highlight_collect.
+// Returns false on allocation failure.
+bool highlight_collect_window(TSQueryCursor *cursor, const TSQuery *query, TSNode root,
+                              const uint8_t *capture_styles, const QueryPredicates *predicates,
+                              const char *code, size_t code_size, uint32_t from, uint32_t to,
+                              uint32_t *current_byte, SpanList *carry, SpanList *out);
+
+// Collects the spans of code[from, to) alone into `out` (cleared first), cut to that
+// window and the same as a whole-file highlight_collect would give there. Only the
+// top-level nodes reaching into the window are queried. Returns false on allocation failure.
+bool highlight_collect_range(TSQueryCursor *cursor, const TSQuery *query, TSNode root,
+                             const uint8_t *capture_styles, const QueryPredicates *predicates,
+                             const char *code, size_t code_size, uint32_t from, uint32_t to, SpanList *out);
+
+#endif // HIGHLIGHT_H
@@ -0,0 +1,796 @@
+#include "html_output.h"
+#include "theme.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// --- Byte Buffer ---
+
+// Growable byte buffer used to assemble header/footer blobs and asset files
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed; // Set on allocation failure; further appends are ignored
+} StrBuf;
+
+static void sb_reserve(StrBuf *sb, size_t extra) {
+    if (sb->failed || sb->len + extra + 1 <= sb->cap) return;
+    size_t new_cap = sb->cap ? sb->cap : 4096;
+    while (new_cap < sb->len + extra + 1) new_cap *= 2;
+    char *grown = realloc(sb->data, new_cap);
+    if (!grown) {
+        sb->failed = true;
+        return;
+    }
+    sb->data = grown;
+    sb->cap = new_cap;
+}
+
+static void sb_puts(StrBuf *sb, const char *str) {
+    size_t n = strlen(str);
+    sb_reserve(sb, n);
+    if (sb->failed) return;
+    memcpy(sb->data + sb->len, str, n + 1);
+    sb->len += n;
+}
+
+static void sb_printf(StrBuf *sb, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        sb->failed = true;
+        return;
+    }
+    sb_reserve(sb, (size_t)n);
+    if (sb->failed) return;
+    va_start(args, fmt);
+    vsnprintf(sb->data + sb->len, (size_t)n + 1, fmt, args);
+    va_end(args);
+    sb->len += (size_t)n;
+}
+
+// Appends `str` escaped for use inside a double-quoted HTML attribute
+static void sb_put_attr(StrBuf *sb, const char *str) {
+    for (const char *c = str; *c; ++c) {
+        switch (*c) {
+            case '&': sb_puts(sb, "&amp;"); break;
+            case '<': sb_puts(sb, "&lt;"); break;
+            case '>': sb_puts(sb, "&gt;"); break;
+            case '"': sb_puts(sb, "&quot;"); break;
+            default: {
+                char ch[2] = {*c, '\0'};
+                sb_puts(sb, ch);
+            }
+        }
+    }
+}
+
+// --- Shared CSS/JS Pieces ---
+
+static void append_base_css(StrBuf *sb) {
+    sb_puts(sb, "body { background-color: #1a1a1a; color: #e0e0e0; font-family: 'JetBrains Mono', 'Fira Code', 'Consolas', monospace; margin: 20px; }\n");
+    sb_puts(sb, "pre { margin: 0; line-height: 1.4; white-space: pre-wrap; word-wrap: break-word; }\n");
+    sb_puts(sb, ".code-container { background-color: #0d0d0d; border: 1px solid #333; padding: 10px; border-radius: 5px; overflow-x: auto; box-shadow: 0 4px 8px rgba(0, 0, 0, 0.2); }\n");
+    sb_puts(sb, ".line { display: flex; align-items: baseline; }\n");
+    sb_puts(sb, ".line:hover { background-color: rgba(255, 255, 255, 0.05); }\n");
+}
+
+// `min_width` is the CSS value used for the gutter width
+static void append_line_number_css(StrBuf *sb, const char *color, const char *min_width) {
+    sb_printf(sb,
+        ".line-number { "
+        "color: %s; "
+        "text-align: right; "
+        "user-select: none; -webkit-user-select: none; "
+        "display: inline-block; "
+        "min-width: %s; "
+        "padding-right: 1em; "
+        "margin-right: 1em; "
+        "border-right: 1px solid #333; "
+        "}\n",
+        color,
+        min_width
+    );
+    // Style for the span that holds actual code content
+    sb_puts(sb, ".code-line-content { display: block; flex-grow: 1; }\n");
+}
+
+// Compact pages: one <span class=l> per line, numbered with a CSS counter
+static void append_compact_line_css(StrBuf *sb, const char *color, const char *min_width) {
+    sb_puts(sb, "code.ln { counter-reset: ln; }\n");
+    sb_puts(sb, ".ln .l { counter-increment: ln; }\n");
+    sb_printf(sb,
+        ".ln .l::before { "
+        "content: counter(ln); "
+        "color: %s; "
+        "text-align: right; "
+        "user-select: none; -webkit-user-select: none; "
+        "display: inline-block; "
+        "min-width: %s; "
+        "padding-right: 1em; "
+        "margin-right: 1em; "
+        "border-right: 1px solid #333; "
+        "}\n",
+        color,
+        min_width
+    );
+    sb_puts(sb, ".l:target { background-color: rgba(255, 255, 255, 0.08); }\n");
+}
+
+// Short-class rules for compact pages, mirroring append_theme_css
+static void append_compact_theme_css(StrBuf *sb) {
+    for (int style = HL_NONE + 1; style < HL_STYLE_COUNT; style++) {
+        sb_printf(sb, ".%s { color: %s;%s }\n", get_style_html_short_class((HighlightStyle)style),
+                  get_style_html_color(&themes[0], (HighlightStyle)style),
+                  style == HL_COMMENT ? " font-style: italic;" : (style == HL_KEYWORD_CONTROL ? " font-weight: bold;" : ""));
+    }
+    for (size_t t = 0; t < THEMES_COUNT; t++) {
+        for (int style = HL_NONE + 1; style < HL_STYLE_COUNT; style++) {
+            sb_printf(sb, ".theme-%s .%s { color: %s; }\n", themes[t].name,
+                      get_style_html_short_class((HighlightStyle)style),
+                      get_style_html_color(&themes[t], (HighlightStyle)style));
+        }
+        sb_printf(sb, ".theme-%s .l::before { color: %s; }\n", themes[t].name, themes[t].html_line_number);
+    }
+}
+
+// Virtual pages: a fixed-height scroller holding only the visible lines, each with its own gutter
+static void append_virtual_css(StrBuf *sb, const char *color, const char *min_width) {
+    sb_puts(sb, ".vv { height: 80vh; overflow: auto; position: relative; line-height: 1.4; }\n");
+    sb_puts(sb, ".vv-spacer { position: relative; }\n");
+    sb_puts(sb, ".vv-lines { position: absolute; top: 0; left: 0; min-width: 100%; }\n");
+    sb_puts(sb, ".vv .l { white-space: pre; }\n");
+    sb_puts(sb, ".vv .l.t { background-color: rgba(255, 255, 255, 0.08); }\n");
+    sb_printf(sb,
+        ".vv .n { "
+        "color: %s; "
+        "text-align: right; "
+        "user-select: none; -webkit-user-select: none; "
+        "display: inline-block; "
+        "min-width: %s; "
+        "padding-right: 1em; "
+        "margin-right: 1em; "
+        "border-right: 1px solid #333; "
+        "}\n",
+        color,
+        min_width
+    );
+    for (size_t t = 0; t < THEMES_COUNT; t++) {
+        sb_printf(sb, ".theme-%s .vv .n { color: %s; }\n", themes[t].name, themes[t].html_line_number);
+    }
+}
+
+// Diff pages: one block per line, tinted by kind, with an unselectable gutter and marker
+static void append_diff_css(StrBuf *sb, const char *color) {
+    sb_puts(sb, ".diff-line { display: block; }\n");
+    sb_puts(sb, ".diff-add { background-color: rgba(46, 160, 67, 0.18); }\n");
+    sb_puts(sb, ".diff-del { background-color: rgba(248, 81, 73, 0.18); }\n");
+    sb_puts(sb, ".diff-hunk { color: #58a6ff; background-color: rgba(56, 139, 253, 0.1); }\n");
+    sb_printf(sb,
+        ".diff-gutter { "
+        "color: %s; "
+        "user-select: none; -webkit-user-select: none; "
+        "padding-right: 1em; "
+        "margin-right: 0.5em; "
+        "border-right: 1px solid #333; "
+        "}\n",
+        color
+    );
+    sb_puts(sb, ".diff-marker { user-select: none; -webkit-user-select: none; opacity: 0.7; padding-right: 0.5em; }\n");
+    for (size_t t = 0; t < THEMES_COUNT; t++) {
+        sb_printf(sb, ".theme-%s .diff-gutter { color: %s; }\n", themes[t].name, themes[t].html_line_number);
+    }
+}
+
+// Viewer for virtual pages. Chunk i holds lines [i * chunk_lines, (i + 1) * chunk_lines); each
+// line is an array of strings, where a number sets the style of the string that follows it.
+// Chunks come from <script type="application/json" id="ct-chunk-i"> blocks in the page or,
+// with data-chunk-src, from sidecar chunk-NNNNN.js files calling codetintChunk(i, lines).
+static void append_viewer_js(StrBuf *sb) {
+    sb_puts(sb, "const CT_CLASSES = [''");
+    for (int style = HL_NONE + 1; style < HL_STYLE_COUNT; style++) {
+        sb_printf(sb, ", '%s'", get_style_html_short_class((HighlightStyle)style));
+    }
+    sb_puts(sb, "];\n");
+    sb_puts(sb, "const codetintChunks = [];\n");
+    sb_puts(sb, "let codetintView = null;\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "function codetintChunk(index, lines) {\n");
+    sb_puts(sb, "  codetintChunks[index] = lines;\n");
+    sb_puts(sb, "  if (codetintView) codetintView.arrived();\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "function codetintText() {\n");
+    sb_puts(sb, "  const text = [];\n");
+    sb_puts(sb, "  for (const chunk of codetintChunks) {\n");
+    sb_puts(sb, "    for (const line of chunk || []) text.push(line.filter(part => typeof part === 'string').join(''));\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "  return text.join('\\n');\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+    // Runs `done` once every chunk is available (immediately on non-virtual pages)
+    sb_puts(sb, "function codetintLoadAll(done) {\n");
+    sb_puts(sb, "  if (!codetintView) { done(); return; }\n");
+    sb_puts(sb, "  codetintView.waiting = done;\n");
+    sb_puts(sb, "  codetintView.arrived();\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "function codetintStart() {\n");
+    sb_puts(sb, "  const root = document.getElementById('code-content');\n");
+    sb_puts(sb, "  if (!root || codetintView) return;\n");
+    sb_puts(sb, "  const total = Number(root.dataset.lines);\n");
+    sb_puts(sb, "  const perChunk = Number(root.dataset.chunkLines);\n");
+    sb_puts(sb, "  const chunkCount = Math.ceil(total / perChunk);\n");
+    sb_puts(sb, "  const gutter = root.dataset.gutter === '1';\n");
+    sb_puts(sb, "  const src = root.dataset.chunkSrc;\n");
+    sb_puts(sb, "  const spacer = root.firstElementChild;\n");
+    sb_puts(sb, "  const win = spacer.firstElementChild;\n");
+    sb_puts(sb, "  const requested = [];\n");
+    sb_puts(sb, "  let target = 0;\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  win.innerHTML = '<div class=\"l\"> </div>';\n");
+    sb_puts(sb, "  const lineHeight = win.firstChild.getBoundingClientRect().height || 20;\n");
+    // Browsers cap element heights, so very long files map the scroll range onto the lines
+    sb_puts(sb, "  spacer.style.height = Math.min(total * lineHeight, 8000000) + 'px';\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  function chunk(index) {\n");
+    sb_puts(sb, "    if (codetintChunks[index]) return codetintChunks[index];\n");
+    sb_puts(sb, "    const inline = document.getElementById('ct-chunk-' + index);\n");
+    sb_puts(sb, "    if (inline) return (codetintChunks[index] = JSON.parse(inline.textContent));\n");
+    sb_puts(sb, "    if (src && !requested[index]) {\n");
+    sb_puts(sb, "      requested[index] = true;\n");
+    sb_puts(sb, "      const script = document.createElement('script');\n");
+    sb_puts(sb, "      script.src = src + 'chunk-' + String(index).padStart(5, '0') + '.js';\n");
+    sb_puts(sb, "      document.head.appendChild(script);\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "    return codetintChunks[index] || null;\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  function renderLine(number, parts) {\n");
+    sb_puts(sb, "    const line = document.createElement('div');\n");
+    sb_puts(sb, "    line.className = number === target ? 'l t' : 'l';\n");
+    sb_puts(sb, "    line.id = 'L' + number;\n");
+    sb_puts(sb, "    if (gutter) {\n");
+    sb_puts(sb, "      const n = document.createElement('span');\n");
+    sb_puts(sb, "      n.className = 'n';\n");
+    sb_puts(sb, "      n.textContent = number;\n");
+    sb_puts(sb, "      line.appendChild(n);\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "    let cls = '';\n");
+    sb_puts(sb, "    for (const part of parts) {\n");
+    sb_puts(sb, "      if (typeof part === 'number') { cls = CT_CLASSES[part]; continue; }\n");
+    sb_puts(sb, "      if (cls) {\n");
+    sb_puts(sb, "        const span = document.createElement('span');\n");
+    sb_puts(sb, "        span.className = cls;\n");
+    sb_puts(sb, "        span.textContent = part;\n");
+    sb_puts(sb, "        line.appendChild(span);\n");
+    sb_puts(sb, "        cls = '';\n");
+    sb_puts(sb, "      } else {\n");
+    sb_puts(sb, "        line.appendChild(document.createTextNode(part));\n");
+    sb_puts(sb, "      }\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "    line.appendChild(document.createTextNode('\\n'));\n");
+    sb_puts(sb, "    return line;\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "\n");
+    // Fractional line shown at the top of the viewport, and its inverse
+    sb_puts(sb, "  function scrollRange() {\n");
+    sb_puts(sb, "    return [Math.max(1, spacer.offsetHeight - root.clientHeight), Math.max(0, total - root.clientHeight / lineHeight)];\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "  function topLine() {\n");
+    sb_puts(sb, "    const [maxScroll, maxLine] = scrollRange();\n");
+    sb_puts(sb, "    return Math.min(root.scrollTop, maxScroll) / maxScroll * maxLine;\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  function render() {\n");
+    sb_puts(sb, "    const top = topLine();\n");
+    sb_puts(sb, "    const first = Math.max(0, Math.floor(top) - 20);\n");
+    sb_puts(sb, "    const last = Math.min(total, Math.ceil(top + root.clientHeight / lineHeight) + 20);\n");
+    sb_puts(sb, "    const lines = document.createDocumentFragment();\n");
+    sb_puts(sb, "    for (let i = first; i < last; i++) {\n");
+    sb_puts(sb, "      const data = chunk(Math.floor(i / perChunk));\n");
+    sb_puts(sb, "      lines.appendChild(renderLine(i + 1, (data && data[i % perChunk]) || []));\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "    win.style.transform = 'translateY(' + (root.scrollTop - (top - first) * lineHeight) + 'px)';\n");
+    sb_puts(sb, "    win.replaceChildren(lines);\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  function goToHash() {\n");
+    sb_puts(sb, "    const match = /^#L(\\d+)$/.exec(location.hash);\n");
+    sb_puts(sb, "    if (!match) return;\n");
+    sb_puts(sb, "    target = Math.min(Math.max(Number(match[1]), 1), total);\n");
+    sb_puts(sb, "    const [maxScroll, maxLine] = scrollRange();\n");
+    sb_puts(sb, "    const line = Math.min(Math.max(target - 1 - root.clientHeight / lineHeight / 3, 0), maxLine);\n");
+    sb_puts(sb, "    root.scrollTop = maxLine ? line / maxLine * maxScroll : 0;\n");
+    sb_puts(sb, "    root.scrollIntoView();\n");
+    sb_puts(sb, "    render();\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  codetintView = {\n");
+    sb_puts(sb, "    waiting: null,\n");
+    sb_puts(sb, "    arrived() {\n");
+    sb_puts(sb, "      render();\n");
+    sb_puts(sb, "      if (!this.waiting) return;\n");
+    sb_puts(sb, "      for (let i = 0; i < chunkCount; i++) {\n");
+    sb_puts(sb, "        if (!chunk(i)) return;\n");
+    sb_puts(sb, "      }\n");
+    sb_puts(sb, "      const done = this.waiting;\n");
+    sb_puts(sb, "      this.waiting = null;\n");
+    sb_puts(sb, "      done();\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "  };\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "  let frame = 0;\n");
+    sb_puts(sb, "  root.addEventListener('scroll', () => {\n");
+    sb_puts(sb, "    if (!frame) frame = requestAnimationFrame(() => { frame = 0; render(); });\n");
+    sb_puts(sb, "  });\n");
+    sb_puts(sb, "  window.addEventListener('hashchange', goToHash);\n");
+    // Inline chunks after the first screen may still be arriving while the page loads
+    sb_puts(sb, "  document.addEventListener('DOMContentLoaded', () => codetintView.arrived());\n");
+    sb_puts(sb, "  if (/^#L\\d+$/.test(location.hash)) goToHash(); else render();\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+    sb_puts(sb, "function copyCode() {\n");
+    sb_puts(sb, "  codetintLoadAll(copyPageCode);\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+}
+
+static void append_theme_css(StrBuf *sb) {
+    // Base highlighting styles
+    sb_puts(sb, "/* Base highlighting styles (will be overridden by theme-specific rules) */\n");
+    sb_printf(sb, ".function-builtin { color: %s; }\n", themes[0].html_function_builtin);
+    sb_printf(sb, ".function { color: %s; }\n", themes[0].html_function);
+    sb_printf(sb, ".string { color: %s; }\n", themes[0].html_string);
+    sb_printf(sb, ".comment { color: %s; font-style: italic; }\n", themes[0].html_comment);
+    sb_printf(sb, ".keyword { color: %s; }\n", themes[0].html_keyword);
+    sb_printf(sb, ".keyword-control { color: %s; font-weight: bold; }\n", themes[0].html_keyword_control);
+    sb_printf(sb, ".type { color: %s; }\n", themes[0].html_type);
+    sb_printf(sb, ".variable { color: %s; }\n", themes[0].html_variable);
+    sb_printf(sb, ".constant { color: %s; }\n", themes[0].html_constant);
+    sb_printf(sb, ".literal { color: %s; }\n", themes[0].html_literal);
+
+    // Generate all theme CSS classes
+    for (size_t t = 0; t < THEMES_COUNT; t++) {
+        sb_printf(sb, ".theme-%s body { background: %s; color: %s; }\n", themes[t].name, themes[t].html_background, themes[t].html_foreground);
+
+        // Generation for specific capture types using HTML colors
+        sb_printf(sb, ".theme-%s .function-builtin { color: %s; }\n", themes[t].name, themes[t].html_function_builtin);
+        sb_printf(sb, ".theme-%s .function { color: %s; }\n", themes[t].name, themes[t].html_function);
+        sb_printf(sb, ".theme-%s .string { color: %s; }\n", themes[t].name, themes[t].html_string);
+        sb_printf(sb, ".theme-%s .comment { color: %s; font-style: italic; }\n", themes[t].name, themes[t].html_comment);
+        sb_printf(sb, ".theme-%s .keyword { color: %s; }\n", themes[t].name, themes[t].html_keyword);
+        sb_printf(sb, ".theme-%s .keyword-control { color: %s; font-weight: bold; }\n", themes[t].name, themes[t].html_keyword_control);
+        sb_printf(sb, ".theme-%s .type { color: %s; }\n", themes[t].name, themes[t].html_type);
+        sb_printf(sb, ".theme-%s .variable { color: %s; }\n", themes[t].name, themes[t].html_variable);
+        sb_printf(sb, ".theme-%s .constant { color: %s; }\n", themes[t].name, themes[t].html_constant);
+        sb_printf(sb, ".theme-%s .literal { color: %s; }\n", themes[t].name, themes[t].html_literal);
+        sb_printf(sb, ".theme-%s .line-number { color: %s; }\n", themes[t].name, themes[t].html_line_number);
+    }
+}
+
+// Clipboard helpers shared by the inline and external scripts
+static void append_clipboard_js(StrBuf *sb) {
+    // Function to show a temporary message box for feedback
+    sb_puts(sb, "function showMessage(message, isError = false) {\n");
+    sb_puts(sb, "  let msgBox = document.getElementById('copyMessageBox');\n");
+    sb_puts(sb, "  if (!msgBox) {\n");
+    sb_puts(sb, "    msgBox = document.createElement('div');\n");
+    sb_puts(sb, "    msgBox.id = 'copyMessageBox';\n");
+    sb_puts(sb, "    msgBox.style.cssText = 'position: fixed; top: 20px; right: 20px; padding: 10px 20px; background-color: #333; color: white; border-radius: 5px; z-index: 1000; opacity: 0; transition: opacity 0.5s ease-in-out;';\n");
+    sb_puts(sb, "    document.body.appendChild(msgBox);\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "  msgBox.textContent = message;\n");
+    sb_puts(sb, "  msgBox.style.backgroundColor = isError ? '#dc3545' : '#28a745'; // Red for error, green for success\n");
+    sb_puts(sb, "  msgBox.style.opacity = '1';\n");
+    sb_puts(sb, "  setTimeout(() => {\n");
+    sb_puts(sb, "    msgBox.style.opacity = '0';\n");
+    sb_puts(sb, "  }, 2000);\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+}
+
+// Defines `fn_name`; `text_expr` is the JS expression producing the text to copy from `codeElement`
+static void append_copy_js(StrBuf *sb, const char *fn_name, const char *text_expr) {
+    // Function to copy code, prioritizing modern Clipboard API
+    sb_printf(sb, "function %s() {\n", fn_name);
+    sb_puts(sb, "  const codeElement = document.getElementById('code-content');\n");
+    sb_puts(sb, "  if (codeElement) {\n");
+    sb_printf(sb, "    const textToCopy = %s;\n", text_expr);
+    sb_puts(sb, "\n");
+    sb_puts(sb, "    if (navigator.clipboard && navigator.clipboard.writeText) {\n");
+    sb_puts(sb, "      navigator.clipboard.writeText(textToCopy)\n");
+    sb_puts(sb, "        .then(() => {\n");
+    sb_puts(sb, "          showMessage('Code copied to clipboard!');\n");
+    sb_puts(sb, "        })\n");
+    sb_puts(sb, "        .catch(err => {\n");
+    sb_puts(sb, "          console.error('Failed to copy code (Clipboard API): ', err);\n");
+    sb_puts(sb, "          showMessage('Failed to copy code. Please try manually.', true);\n");
+    sb_puts(sb, "        });\n");
+    sb_puts(sb, "    } else {\n");
+    sb_puts(sb, "      // Fallback for older browsers or restricted environments (less reliable)\n");
+    sb_puts(sb, "      const tempTextArea = document.createElement('textarea');\n");
+    sb_puts(sb, "      tempTextArea.value = textToCopy;\n");
+    sb_puts(sb, "      document.body.appendChild(tempTextArea);\n");
+    sb_puts(sb, "      tempTextArea.select();\n");
+    sb_puts(sb, "      try {\n");
+    sb_puts(sb, "        const successful = document.execCommand('copy');\n");
+    sb_puts(sb, "        if (successful) {\n");
+    sb_puts(sb, "          showMessage('Code copied (fallback)!');\n");
+    sb_puts(sb, "        } else {\n");
+    sb_puts(sb, "          showMessage('Failed to copy code. Manual copy required.', true);\n");
+    sb_puts(sb, "        }\n");
+    sb_puts(sb, "      } catch (err) {\n");
+    sb_puts(sb, "        console.error('Failed to copy code (execCommand): ', err);\n");
+    sb_puts(sb, "        showMessage('Failed to copy code. Manual copy required.', true);\n");
+    sb_puts(sb, "      }\n");
+    sb_puts(sb, "      document.body.removeChild(tempTextArea);\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+    // Function to apply selected theme to the body class
+    sb_puts(sb, "function applyTheme(themeName) {\n");
+    sb_puts(sb, "  document.body.className = 'theme-' + themeName;\n");
+    sb_puts(sb, "  localStorage.setItem('selectedTheme', themeName);\n");
+    sb_puts(sb, "}\n");
+    sb_puts(sb, "\n");
+}
+
+static const char INLINE_COPY_TEXT_JS[] =
+    "Array.from(codeElement.children)\n"
+    "      .map(lineDiv => {\n"
+    "        const codeContentSpan = lineDiv.querySelector('.code-line-content');\n"
+    "        return codeContentSpan ? codeContentSpan.textContent : '';\n"
+    "      })\n"
+    "      .join('\\n')";
+
+static const char COMPACT_COPY_TEXT_JS[] = "codeElement.textContent";
+
+static const char VIRTUAL_COPY_TEXT_JS[] = "codetintText()";
+
+static const char EXTERNAL_COPY_TEXT_JS[] =
+    "codeElement.classList.contains('vv') ? codetintText()\n"
+    "      : codeElement.querySelector('.line')\n"
+    "      ? Array.from(codeElement.querySelectorAll('.code-line-content')).map(span => span.textContent).join('\\n')\n"
+    "      : codeElement.textContent";
+
+static void append_controls(StrBuf *sb, const ColorTheme *theme, bool populate_options) {
+    sb_puts(sb, "<div>\n"); // Controls container
+    sb_puts(sb, "  <button onclick=\"copyCode()\" style=\"margin-right: 10px; padding: 8px 15px;\">Copy Code</button>\n");
+    sb_puts(sb, "  <label for=\"theme-select\">Theme:</label>\n");
+    sb_puts(sb, "  <select id=\"theme-select\" onchange=\"applyTheme(this.value)\" style=\"padding: 8px; border-radius: 4px;\">\n");
+    if (populate_options) {
+        for (size_t t = 0; t < THEMES_COUNT; t++) {
+            sb_printf(sb, "    <option value=\"%s\"%s>%s</option>\n",
+                            themes[t].name,
+                            (strcmp(themes[t].name, theme->name) == 0 ? " selected" : ""),
+                            themes[t].name);
+        }
+    }
+    sb_puts(sb, "  </select>\n");
+    sb_puts(sb, "</div>\n");
+    sb_puts(sb, "<br>\n");
+}
+
+// --- Header Blobs ---
+
+static const ColorTheme *page_theme(const HtmlPageOptions *options) {
+    return options->theme ? options->theme : selected_theme;
+}
+
+static void append_code_open(StrBuf *sb, const HtmlPageOptions *options) {
+    if (options->virtual_view) {
+        return; // The viewer element is written with the page data by html_virtual.c
+    } else if (options->compact && options->show_line_numbers) {
+        sb_puts(sb, "<pre><code id=\"code-content\" class=\"ln\">");
+    } else {
+        sb_puts(sb, "<pre><code id=\"code-content\">");
+    }
+}
+
+// Self-contained page: every theme's CSS and the scripts are embedded in the header
+static void build_inline_header(StrBuf *sb, const HtmlPageOptions *options) {
+    const ColorTheme *theme = page_theme(options);
+    sb_puts(sb, "<!DOCTYPE html>\n<html><head><title>Highlighted Code</title>\n");
+    sb_puts(sb, "<meta charset=\"utf-8\">\n");
+    sb_puts(sb, "<style>\n");
+    append_base_css(sb);
+    char min_width[32];
+    snprintf(min_width, sizeof(min_width), "%dch", options->line_num_padding);
+    if (options->virtual_view) {
+        append_virtual_css(sb, theme->html_line_number, min_width);
+        append_compact_theme_css(sb);
+    } else if (options->compact) {
+        if (options->show_line_numbers) {
+            append_compact_line_css(sb, theme->html_line_number, min_width);
+        }
+        append_compact_theme_css(sb);
+    } else {
+        if (options->show_line_numbers) {
+            append_line_number_css(sb, theme->html_line_number, min_width);
+        }
+        append_theme_css(sb);
+    }
+    if (options->diff) {
+        append_diff_css(sb, theme->html_line_number);
+    }
+    sb_puts(sb, "</style>\n");
+
+    // JavaScript for Copy-to-Clipboard and Theme Switcher
+    sb_puts(sb, "<script>\n");
+    append_clipboard_js(sb);
+    if (options->virtual_view) {
+        append_copy_js(sb, "copyPageCode", VIRTUAL_COPY_TEXT_JS);
+        append_viewer_js(sb);
+    } else {
+        append_copy_js(sb, "copyCode", options->compact ? COMPACT_COPY_TEXT_JS : INLINE_COPY_TEXT_JS);
+    }
+    // Event listener to apply saved theme on DOM load
+    sb_puts(sb, "document.addEventListener('DOMContentLoaded', () => {\n");
+    sb_puts(sb, "  const savedTheme = localStorage.getItem('selectedTheme');\n");
+    sb_puts(sb, "  if (savedTheme) {\n");
+    sb_puts(sb, "    applyTheme(savedTheme);\n");
+    sb_puts(sb, "  } else {\n");
+    sb_printf(sb, "    applyTheme('%s'); // Apply default theme on first load\n", theme->name);
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "});\n");
+    sb_puts(sb, "</script>\n");
+    sb_puts(sb, "</head>\n");
+
+    sb_printf(sb, "<body class=\"theme-%s\">\n", theme->name);
+    append_controls(sb, theme, true);
+
+    sb_puts(sb, "<div class=\"code-container\">\n");
+    append_code_open(sb, options);
+}
+
+// Linked page: only references codetint.css/codetint.js; theme and gutter width are passed as attributes
+static void build_linked_header(StrBuf *sb, const HtmlPageOptions *options) {
+    const ColorTheme *theme = page_theme(options);
+    sb_puts(sb, "<!DOCTYPE html>\n<html><head><title>Highlighted Code</title>\n");
+    sb_puts(sb, "<meta charset=\"utf-8\">\n");
+    sb_puts(sb, "<link rel=\"stylesheet\" href=\"");
+    sb_put_attr(sb, options->assets_href);
+    sb_puts(sb, "codetint.css\">\n");
+    sb_puts(sb, "<script src=\"");
+    sb_put_attr(sb, options->assets_href);
+    sb_puts(sb, "codetint.js\"></script>\n");
+    sb_puts(sb, "</head>\n");
+
+    sb_printf(sb, "<body class=\"theme-%s\" data-default-theme=\"%s\">\n", theme->name, theme->name);
+    append_controls(sb, theme, false);
+
+    if (options->show_line_numbers) {
+        sb_printf(sb, "<div class=\"code-container\" style=\"--line-number-width: %dch\">\n", options->line_num_padding);
+    } else {
+        sb_puts(sb, "<div class=\"code-container\">\n");
+    }
+    append_code_open(sb, options);
+}
+
+static const char PAGE_FOOTER[] =
+    "</code></pre>\n"
+    "</div>\n"
+    "</body></html>\n";
+
+static const char VIRTUAL_PAGE_FOOTER[] =
+    "</div>\n"
+    "</body></html>\n";
+
+// Most recently built header and the inputs it was built from. Pages written on
+// several threads at once share it under page_lock, which also covers the asset files.
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static StrBuf cached_header;
+static HtmlPageOptions cached_options;
+static char *cached_assets_href;
+static const ColorTheme *cached_theme;
+
+const char *html_page_header(const HtmlPageOptions *options, size_t *out_len) {
+    bool same_href = (options->assets_href == NULL && cached_assets_href == NULL) ||
+                     (options->assets_href && cached_assets_href && strcmp(options->assets_href, cached_assets_href) == 0);
+    if (cached_header.data && !cached_header.failed && same_href &&
+        cached_theme == page_theme(options) &&
+        cached_options.show_line_numbers == options->show_line_numbers &&
+        cached_options.compact == options->compact &&
+        cached_options.virtual_view == options->virtual_view &&
+        cached_options.diff == options->diff &&
+        cached_options.line_num_padding == options->line_num_padding) {
+        *out_len = cached_header.len;
+        return cached_header.data;
+    }
+
+    cached_header.len = 0;
+    cached_header.failed = false;
+    free(cached_assets_href);
+    cached_assets_href = options->assets_href ? strdup(options->assets_href) : NULL;
+    cached_options = *options;
+    cached_theme = page_theme(options);
+
+    if (options->assets_href) build_linked_header(&cached_header, options);
+    else build_inline_header(&cached_header, options);
+
+    if (cached_header.failed || (options->assets_href && !cached_assets_href)) {
+        *out_len = 0;
+        return NULL;
+    }
+    *out_len = cached_header.len;
+    return cached_header.data;
+}
+
+bool html_write_page_header(FILE *out, const HtmlPageOptions *options) {
+    pthread_mutex_lock(&page_lock);
+    size_t header_len = 0;
+    const char *header = html_page_header(options, &header_len);
+    if (header) fwrite(header, 1, header_len, out);
+    pthread_mutex_unlock(&page_lock);
+    return header != NULL;
+}
+
+const char *html_page_footer(const HtmlPageOptions *options, size_t *out_len) {
+    if (options->virtual_view) {
+        *out_len = sizeof(VIRTUAL_PAGE_FOOTER) - 1;
+        return VIRTUAL_PAGE_FOOTER;
+    }
+    *out_len = sizeof(PAGE_FOOTER) - 1;
+    return PAGE_FOOTER;
+}
+
+// --- External Assets ---
+
+static void build_asset_css(StrBuf *sb) {
+    append_base_css(sb);
+    append_line_number_css(sb, themes[0].html_line_number, "var(--line-number-width, 4ch)");
+    append_theme_css(sb);
+    append_compact_line_css(sb, themes[0].html_line_number, "var(--line-number-width, 4ch)");
+    append_compact_theme_css(sb);
+    append_virtual_css(sb, themes[0].html_line_number, "var(--line-number-width, 4ch)");
+    append_diff_css(sb, themes[0].html_line_number);
+}
+
+static void build_asset_js(StrBuf *sb) {
+    sb_puts(sb, "const CODETINT_THEMES = [");
+    for (size_t t = 0; t < THEMES_COUNT; t++) {
+        sb_printf(sb, "%s'%s'", t ? ", " : "", themes[t].name);
+    }
+    sb_puts(sb, "];\n\n");
+    append_clipboard_js(sb);
+    append_copy_js(sb, "copyPageCode", EXTERNAL_COPY_TEXT_JS);
+    append_viewer_js(sb);
+    // Fill the theme selector and apply the saved (or page default) theme on DOM load
+    sb_puts(sb, "document.addEventListener('DOMContentLoaded', () => {\n");
+    sb_puts(sb, "  const theme = localStorage.getItem('selectedTheme') || document.body.dataset.defaultTheme;\n");
+    sb_puts(sb, "  const select = document.getElementById('theme-select');\n");
+    sb_puts(sb, "  if (select) {\n");
+    sb_puts(sb, "    for (const name of CODETINT_THEMES) {\n");
+    sb_puts(sb, "      select.add(new Option(name, name, false, name === theme));\n");
+    sb_puts(sb, "    }\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "  if (theme) {\n");
+    sb_puts(sb, "    applyTheme(theme);\n");
+    sb_puts(sb, "  }\n");
+    sb_puts(sb, "});\n");
+}
+
+// Writes `data` to `path` unless the file already holds exactly these bytes
+static int write_if_changed(const char *path, const char *data, size_t len) {
+    FILE *existing = fopen(path, "rb");
+    if (existing) {
+        bool same = false;
+        char *current = malloc(len + 1);
+        if (current) {
+            size_t read = fread(current, 1, len + 1, existing);
+            same = (read == len && memcmp(current, data, len) == 0);
+            free(current);
+        }
+        fclose(existing);
+        if (same) return 0;
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open '%s' for writing: %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t written = fwrite(data, 1, len, out);
+    if (fclose(out) != 0 || written != len) {
+        fprintf(stderr, "Error: Failed to write '%s'.\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int html_write_assets(const char *dir) {
+    pthread_mutex_lock(&page_lock);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create assets directory '%s': %s\n", dir, strerror(errno));
+        pthread_mutex_unlock(&page_lock);
+        return 1;
+    }
+
+    StrBuf css = {0};
+    StrBuf js = {0};
+    build_asset_css(&css);
+    build_asset_js(&js);
+
+    int result = 0;
+    if (css.failed || js.failed) {
+        fprintf(stderr, "Failed to allocate memory for HTML assets!\n");
+        result = 1;
+    } else {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/codetint.css", dir);
+        result |= write_if_changed(path, css.data, css.len);
+        snprintf(path, sizeof(path), "%s/codetint.js", dir);
+        result |= write_if_changed(path, js.data, js.len);
+    }
+
+    free(css.data);
+    free(js.data);
+    pthread_mutex_unlock(&page_lock);
+    return result;
+}
+
+static char *href_with_slash(const char *path) {
+    size_t len = strlen(path);
+    char *href = malloc(len + 2);
+    if (!href) return NULL;
+    memcpy(href, path, len);
+    if (len > 0 && path[len - 1] != '/') href[len++] = '/';
+    href[len] = '\0';
+    return href;
+}
+
+char *html_assets_href_for(const char *page_path, const char *assets_dir) {
+    char assets_real[PATH_MAX];
+    char page_dir[PATH_MAX];
+    char page_real[PATH_MAX];
+
+    if (!page_path || !realpath(assets_dir, assets_real)) {
+        return href_with_slash(assets_dir);
+    }
+
+    const char *slash = strrchr(page_path, '/');
+    if (!slash) snprintf(page_dir, sizeof(page_dir), ".");
+    else if (slash == page_path) snprintf(page_dir, sizeof(page_dir), "/");
+    else snprintf(page_dir, sizeof(page_dir), "%.*s", (int)(slash - page_path), page_path);
+    if (!realpath(page_dir, page_real)) {
+        return href_with_slash(assets_dir);
+    }
+
+    // Skip the shared leading directories, then climb out of the rest of the page's path
+    size_t common = 0;
+    size_t i = 0;
+    while (assets_real[i] && assets_real[i] == page_real[i]) {
+        i++;
+        if ((assets_real[i] == '/' || assets_real[i] == '\0') && (page_real[i] == '/' || page_real[i] == '\0')) {
+            common = i;
+        }
+    }
+
+    StrBuf href = {0};
+    sb_puts(&href, "");
+    for (const char *c = page_real + common; *c; ++c) {
+        if (*c == '/' && c[1] != '\0') sb_puts(&href, "../");
+    }
+    const char *rest = assets_real + common;
+    while (*rest == '/') rest++;
+    if (*rest) {
+        sb_puts(&href, rest);
+        sb_puts(&href, "/");
+    }
+    if (href.failed) {
+        free(href.data);
+        return NULL;
+    }
+    return href.data;
+}
@@ -0,0 +1,43 @@
+#ifndef HTML_OUTPUT_H
+#define HTML_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "theme.h"
+
+// Page-level options that shape the HTML header
+typedef struct {
+    bool show_line_numbers;
+    int line_num_padding;
+    bool compact; // Body uses short class names and <span class=l> lines (OUTPUT_HTML_COMPACT)
+    bool virtual_view; // Body is a chunked data payload drawn by the virtual scrolling viewer (html_virtual.h)
+    // NULL for a self-contained page (all CSS/JS inline). Otherwise the URL prefix
+    // under which codetint.css and codetint.js are served, e.g. "../assets/".
+    const char *assets_href;
+    const ColorTheme *theme; // Theme the page opens in (NULL = the selected theme)
+    bool diff; // Body is an interleaved diff (diff.h)
+} HtmlPageOptions;
+
+// Returns the page header, up to and including the opening <code> tag (or the code
+// container for virtual pages), as a byte blob.
+// The blob is built once and reused for as long as the options and theme stay the same.
+const char *html_page_header(const HtmlPageOptions *options, size_t *out_len);
+
+// Writes the page header to `out`; unlike html_page_header, safe to use from several
+// threads at once. Returns false if the header could not be built.
+bool html_write_page_header(FILE *out, const HtmlPageOptions *options);
+
+// Returns the page footer closing everything opened by the header.
+const char *html_page_footer(const HtmlPageOptions *options, size_t *out_len);
+
+// Writes codetint.css and codetint.js into `dir` (created if missing). Files whose
+// content is already up to date are left untouched. Returns 0 on success, 1 on failure.
+int html_write_assets(const char *dir);
+
+// Returns a malloc'ed URL prefix (ending in '/', or empty) that reaches `assets_dir`
+// from the directory of `page_path`. With no page path the directory is used as given.
+char *html_assets_href_for(const char *page_path, const char *assets_dir);
+
+#endif // HTML_OUTPUT_H
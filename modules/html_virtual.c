@@ -0,0 +1,202 @@
+#include "html_virtual.h"
+#include "html_output.h"
+#include "theme.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// --- Chunk Encoding ---
+//
+// A chunk is a JSON array of lines. Each line is an array of strings; a number
+// before a string is the HighlightStyle of that string. Adjacent pieces with the
+// same style are merged, and unstyled text carries no number at all.
+
+// Writes text[0, len) as a JSON string that can also sit inside a <script> element
+static void write_json_string(FILE *out, const char *text, size_t len) {
+    fputc('"', out);
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)text[i];
+        char escape[8];
+        if (c == '"') snprintf(escape, sizeof(escape), "\\\"");
+        else if (c == '\\') snprintf(escape, sizeof(escape), "\\\\");
+        else if (c == '\t') snprintf(escape, sizeof(escape), "\\t");
+        else if (c < 0x20 || c == '<') snprintf(escape, sizeof(escape), "\\u%04x", c);
+        else continue;
+        fwrite(text + run, 1, i - run, out);
+        fputs(escape, out);
+        run = i + 1;
+    }
+    fwrite(text + run, 1, len - run, out);
+    fputc('"', out);
+}
+
+// Pending run of one line, written once the style changes
+typedef struct {
+    FILE *out;
+    const char *code;
+    bool first;
+    uint8_t style;
+    size_t from;
+    size_t to;
+} LineRuns;
+
+static void runs_flush(LineRuns *runs) {
+    if (runs->to == runs->from) return;
+    if (!runs->first) fputc(',', runs->out);
+    if (runs->style != HL_NONE) fprintf(runs->out, "%u,", runs->style);
+    write_json_string(runs->out, runs->code + runs->from, runs->to - runs->from);
+    runs->first = false;
+}
+
+static void runs_add(LineRuns *runs, size_t from, size_t to, uint8_t style) {
+    if (to <= from) return;
+    if (style != runs->style || from != runs->to) {
+        runs_flush(runs);
+        runs->style = style;
+        runs->from = from;
+    }
+    runs->to = to;
+}
+
+// Writes code[start, end) (one line, without its line break) as a JSON array.
+// `span_index` is the first span that may reach this line and is advanced for the next one.
+static void write_line(FILE *out, const char *code, size_t start, size_t end,
+                       const HighlightSpan *spans, size_t span_count, size_t *span_index) {
+    while (*span_index < span_count && spans[*span_index].end <= start) (*span_index)++;
+
+    fputc('[', out);
+    LineRuns runs = {out, code, true, HL_NONE, start, start};
+    size_t pos = start;
+    for (size_t i = *span_index; i < span_count && spans[i].start < end; i++) {
+        size_t from = spans[i].start > start ? spans[i].start : start;
+        size_t to = spans[i].end < end ? spans[i].end : end;
+        runs_add(&runs, pos, from, HL_NONE);
+        runs_add(&runs, from, to, spans[i].style);
+        pos = to;
+    }
+    runs_add(&runs, pos, end, HL_NONE);
+    runs_flush(&runs);
+
+    fputc(']', out);
+}
+
+// Writes the lines of one chunk starting at `*pos`, leaving `*pos` at the next chunk
+static void write_chunk_lines(FILE *out, const char *code, size_t code_size, size_t *pos, uint32_t lines,
+                              const HighlightSpan *spans, size_t span_count, size_t *span_index) {
+    fputc('[', out);
+    for (uint32_t n = 0; n < lines; n++) {
+        const char *newline = memchr(code + *pos, '\n', code_size - *pos);
+        size_t end = newline ? (size_t)(newline - code) : code_size;
+        size_t text_end = (end > *pos && code[end - 1] == '\r') ? end - 1 : end;
+
+        if (n > 0) fputs(",\n", out);
+        write_line(out, code, *pos, text_end, spans, span_count, span_index);
+        *pos = newline ? end + 1 : code_size;
+    }
+    fputc(']', out);
+}
+
+// --- Page Body ---
+
+static void write_attr(FILE *out, const char *str) {
+    for (const char *c = str; *c; ++c) {
+        if (*c == '&') fputs("&amp;", out);
+        else if (*c == '<') fputs("&lt;", out);
+        else if (*c == '>') fputs("&gt;", out);
+        else if (*c == '"') fputs("&quot;", out);
+        else fputc(*c, out);
+    }
+}
+
+uint32_t html_virtual_line_count(const char *code, size_t code_size) {
+    uint32_t lines = 1;
+    for (size_t i = 0; i < code_size; ++i) {
+        if (code[i] == '\n' && i + 1 < code_size) lines++;
+    }
+    return lines;
+}
+
+static int write_sidecar_chunk(const char *dir, uint32_t index, const char *code, size_t code_size,
+                               size_t *pos, uint32_t lines,
+                               const HighlightSpan *spans, size_t span_count, size_t *span_index) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/chunk-%05u.js", dir, index);
+    FILE *chunk = fopen(path, "wb");
+    if (!chunk) {
+        fprintf(stderr, "Error: Could not open '%s' for writing: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fprintf(chunk, "codetintChunk(%u, ", index);
+    write_chunk_lines(chunk, code, code_size, pos, lines, spans, span_count, span_index);
+    fputs(");\n", chunk);
+    if (fclose(chunk) != 0) {
+        fprintf(stderr, "Error: Failed to write '%s'.\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int html_virtual_write_body(FILE *out, const char *code, size_t code_size,
+                            const HighlightSpan *spans, size_t span_count,
+                            const HtmlVirtualOptions *options) {
+    uint32_t total_lines = 0;
+    if (options->lines) {
+        total_lines = (uint32_t)options->lines->line_count;
+        if (code_size > 0 && code[code_size - 1] == '\n') total_lines--;
+    } else {
+        total_lines = html_virtual_line_count(code, code_size);
+    }
+    uint32_t chunk_lines = options->chunk_lines ? options->chunk_lines : HTML_VIRTUAL_DEFAULT_CHUNK_LINES;
+    uint32_t chunk_count = (total_lines + chunk_lines - 1) / chunk_lines;
+
+    if (options->chunk_dir && mkdir(options->chunk_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Could not create chunk directory '%s': %s\n", options->chunk_dir, strerror(errno));
+        return 1;
+    }
+
+    char *chunk_href = NULL;
+    if (options->chunk_dir) {
+        chunk_href = options->chunk_href ? strdup(options->chunk_href) : html_assets_href_for(options->page_path, options->chunk_dir);
+        if (!chunk_href) {
+            fprintf(stderr, "Failed to allocate memory for the chunk URL!\n");
+            return 1;
+        }
+    }
+
+    fprintf(out, "<div id=\"code-content\" class=\"vv\" data-lines=\"%u\" data-chunk-lines=\"%u\" data-gutter=\"%d\"",
+            total_lines, chunk_lines, options->show_line_numbers ? 1 : 0);
+    if (options->chunk_dir) {
+        fputs(" data-chunk-src=\"", out);
+        write_attr(out, chunk_href);
+        fputc('"', out);
+    }
+    fputs("><div class=\"vv-spacer\"><div class=\"vv-lines\"></div></div></div>\n", out);
+
+    size_t pos = 0;
+    size_t span_index = 0;
+    for (uint32_t index = 0; index < chunk_count; index++) {
+        uint32_t lines = total_lines - index * chunk_lines;
+        if (lines > chunk_lines) lines = chunk_lines;
+
+        if (options->chunk_dir) {
+            if (write_sidecar_chunk(options->chunk_dir, index, code, code_size, &pos, lines,
+                                    spans, span_count, &span_index) != 0) {
+                free(chunk_href);
+                return 1;
+            }
+        } else {
+            fprintf(out, "<script type=\"application/json\" id=\"ct-chunk-%u\">", index);
+            write_chunk_lines(out, code, code_size, &pos, lines, spans, span_count, &span_index);
+            fputs("</script>\n", out);
+        }
+
+        // Start the viewer as soon as the first screen's data is in the page
+        if (index == 0) fputs("<script>codetintStart();</script>\n", out);
+    }
+    free(chunk_href);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef HTML_VIRTUAL_H
+#define HTML_VIRTUAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "highlight.h"
+#include "line_index.h"
+
+#define HTML_VIRTUAL_DEFAULT_CHUNK_LINES 1000
+
+// Body options for virtual HTML pages (HtmlPageOptions.virtual_view)
+typedef struct {
+    bool show_line_numbers;
+    uint32_t chunk_lines; // Lines per data chunk
+    // NULL to embed every chunk in the page. Otherwise chunks are written to
+    // chunk_dir/chunk-NNNNN.js and the viewer loads them on demand from chunk_href
+    // (default: the path from page_path's directory to chunk_dir).
+    const char *chunk_dir;
+    const char *chunk_href;
+    const char *page_path; // NULL when the page goes to stdout
+    const LineIndex *lines; // Line index of the code (NULL = count the lines here)
+} HtmlVirtualOptions;
+
+// Number of lines the viewer shows for `code` (a trailing newline does not start a new line)
+uint32_t html_virtual_line_count(const char *code, size_t code_size);
+
+// Writes the viewer element and the span data for code[0, code_size) to `out`,
+// between html_page_header and html_page_footer. Returns 0 on success, 1 on failure.
+int html_virtual_write_body(FILE *out, const char *code, size_t code_size,
+                            const HighlightSpan *spans, size_t span_count,
+                            const HtmlVirtualOptions *options);
+
+#endif // HTML_VIRTUAL_H
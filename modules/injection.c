@@ -0,0 +1,708 @@
+#include "injection.h"
+#include "arena.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INJECTION_NAME_MAX 64
+
+// All regions of one embedded language, highlighted together on a worker thread
+typedef struct EmbeddedLanguage {
+    char name[INJECTION_NAME_MAX];
+    TSRange *ranges;
+    size_t range_count;
+    size_t range_capacity;
+
+    InjectionLanguage grammar; // Resolved by the lookup; grammar.query is NULL if it failed
+    const char *code;
+    size_t code_size;
+    SpanList spans;
+    bool active;               // Highlighted by this pass
+    bool ok;
+
+    // Kept between the updates of an InjectionDocument
+    bool resolved;             // Looked up already
+    TSParser *parser;
+    TSTree *tree;
+    TSRange *windows;          // Byte ranges to highlight again
+    size_t window_count;
+    size_t window_capacity;
+} EmbeddedLanguage;
+
+void injection_set_free(InjectionSet *set) {
+    free(set->ranges);
+    set->ranges = NULL;
+    set->range_count = 0;
+    span_list_free(&set->spans);
+}
+
+// --- Finding Embedded Regions ---
+
+// Capture ids of @injection.content and @injection.language (UINT32_MAX = none)
+static void injection_captures(const TSQuery *query, uint32_t *content_capture, uint32_t *language_capture) {
+    *content_capture = UINT32_MAX;
+    *language_capture = UINT32_MAX;
+    for (uint32_t i = 0; i < ts_query_capture_count(query); i++) {
+        uint32_t len;
+        const char *name = ts_query_capture_name_for_id(query, i, &len);
+        if (!name) continue;
+        if (strcmp(name, "injection.content") == 0) *content_capture = i;
+        else if (strcmp(name, "injection.language") == 0) *language_capture = i;
+    }
+}
+
+// Language set on a pattern with (#set! injection.language "name"), or NULL
+static const char *pattern_language(const TSQuery *query, uint32_t pattern) {
+    uint32_t step_count;
+    const TSQueryPredicateStep *steps = ts_query_predicates_for_pattern(query, pattern, &step_count);
+    uint32_t i = 0;
+    while (i < step_count) {
+        uint32_t end = i;
+        while (end < step_count && steps[end].type != TSQueryPredicateStepTypeDone) end++;
+
+        if (end - i == 3 && steps[i].type == TSQueryPredicateStepTypeString &&
+            steps[i + 1].type == TSQueryPredicateStepTypeString && steps[i + 2].type == TSQueryPredicateStepTypeString) {
+            uint32_t len;
+            const char *op = ts_query_string_value_for_id(query, steps[i].value_id, &len);
+            const char *key = ts_query_string_value_for_id(query, steps[i + 1].value_id, &len);
+            if (op && key && strcmp(op, "set!") == 0 && strcmp(key, "injection.language") == 0) {
+                return ts_query_string_value_for_id(query, steps[i + 2].value_id, &len);
+            }
+        }
+        i = end + 1;
+    }
+    return NULL;
+}
+
+static EmbeddedLanguage *embedded_language_for(EmbeddedLanguage **languages, size_t *count, const char *name) {
+    for (size_t i = 0; i < *count; i++) {
+        if (strcmp((*languages)[i].name, name) == 0) return &(*languages)[i];
+    }
+    EmbeddedLanguage *grown = realloc(*languages, sizeof(EmbeddedLanguage) * (*count + 1));
+    if (!grown) return NULL;
+    *languages = grown;
+    EmbeddedLanguage *language = &grown[(*count)++];
+    memset(language, 0, sizeof(*language));
+    snprintf(language->name, sizeof(language->name), "%s", name);
+    return language;
+}
+
+static bool embedded_language_add_range(EmbeddedLanguage *language, TSNode node) {
+    uint32_t start = ts_node_start_byte(node);
+    uint32_t end = ts_node_end_byte(node);
+    if (start >= end) return true;
+    // Included ranges must be sorted and disjoint; a region nested in the previous one is dropped
+    if (language->range_count > 0 && start < language->ranges[language->range_count - 1].end_byte) return true;
+
+    if (language->range_count == language->range_capacity) {
+        size_t new_capacity = language->range_capacity ? language->range_capacity * 2 : 16;
+        TSRange *grown = realloc(language->ranges, sizeof(TSRange) * new_capacity);
+        if (!grown) return false;
+        language->ranges = grown;
+        language->range_capacity = new_capacity;
+    }
+    TSRange *range = &language->ranges[language->range_count++];
+    range->start_byte = start;
+    range->end_byte = end;
+    range->start_point = ts_node_start_point(node);
+    range->end_point = ts_node_end_point(node);
+    return true;
+}
+
+// Adds the regions matched by `cursor` (exec'ed on the injection query) to the languages
+// they are written in. Returns false on allocation failure.
+static bool add_matched_regions(TSQueryCursor *cursor, const TSQuery *injection_query, uint32_t content_capture,
+                                uint32_t language_capture, const char *code, EmbeddedLanguage **languages,
+                                size_t *language_count) {
+    TSQueryMatch match;
+    while (ts_query_cursor_next_match(cursor, &match)) {
+        const char *name = pattern_language(injection_query, match.pattern_index);
+        char name_buffer[INJECTION_NAME_MAX];
+        TSNode content = {{0}, NULL, NULL};
+        for (uint16_t i = 0; i < match.capture_count; i++) {
+            TSNode node = match.captures[i].node;
+            if (match.captures[i].index == content_capture) {
+                content = node;
+            } else if (match.captures[i].index == language_capture) {
+                uint32_t start = ts_node_start_byte(node);
+                uint32_t len = ts_node_end_byte(node) - start;
+                if (len >= sizeof(name_buffer)) len = sizeof(name_buffer) - 1;
+                memcpy(name_buffer, code + start, len);
+                name_buffer[len] = '\0';
+                name = name_buffer;
+            }
+        }
+        if (!name || !name[0] || ts_node_is_null(content)) continue;
+
+        EmbeddedLanguage *language = embedded_language_for(languages, language_count, name);
+        if (!language || !embedded_language_add_range(language, content)) return false;
+    }
+    return true;
+}
+
+// --- Highlighting Each Language ---
+
+// Cuts `spans` down to the parts inside `ranges`; a node of the embedded tree may
+// stretch over the host text between two regions
+static bool clip_to_ranges(SpanList *spans, const TSRange *ranges, size_t range_count) {
+    SpanList clipped = {0};
+    size_t r = 0;
+    for (size_t i = 0; i < spans->count; i++) {
+        const HighlightSpan *span = &spans->items[i];
+        while (r < range_count && ranges[r].end_byte <= span->start) r++;
+        for (size_t k = r; k < range_count && ranges[k].start_byte < span->end; k++) {
+            uint32_t start = span->start > ranges[k].start_byte ? span->start : ranges[k].start_byte;
+            uint32_t end = span->end < ranges[k].end_byte ? span->end : ranges[k].end_byte;
+            if (start < end && !span_list_push(&clipped, start, end, span->capture, span->style)) {
+                span_list_free(&clipped);
+                return false;
+            }
+        }
+    }
+    span_list_free(spans);
+    *spans = clipped;
+    return true;
+}
+
+static void *embedded_language_worker(void *arg) {
+    EmbeddedLanguage *language = arg;
+    TSParser *parser = ts_parser_new();
+    TSTree *tree = NULL;
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    const InjectionLanguage *grammar = &language->grammar;
+
+    language->ok = parser && cursor && ts_parser_set_language(parser, grammar->language) &&
+                   ts_parser_set_included_ranges(parser, language->ranges, (uint32_t)language->range_count);
+    if (language->ok) {
+        tree = ts_parser_parse_string(parser, NULL, language->code, (uint32_t)language->code_size);
+        language->ok = tree != NULL;
+    }
+    if (language->ok) {
+        uint32_t current_byte = 0;
+        ts_query_cursor_exec(cursor, grammar->query, ts_tree_root_node(tree));
+        language->ok = highlight_collect(cursor, grammar->capture_styles, grammar->predicates, language->code, language->code_size,
+                                         &current_byte, &language->spans) &&
+                       clip_to_ranges(&language->spans, language->ranges, language->range_count);
+    }
+
+    if (cursor) ts_query_cursor_delete(cursor);
+    if (tree) ts_tree_delete(tree);
+    if (parser) ts_parser_delete(parser);
+    return NULL;
+}
+
+// Runs `worker` on every active language, concurrently when there are several
+static void run_language_workers(EmbeddedLanguage *languages, size_t language_count, void *(*worker)(void *)) {
+    pthread_t *threads = language_count > 1 ? calloc(language_count, sizeof(pthread_t)) : NULL;
+    bool *started = language_count > 1 ? calloc(language_count, sizeof(bool)) : NULL;
+    for (size_t i = 0; threads && started && i < language_count; i++) {
+        if (languages[i].active) started[i] = pthread_create(&threads[i], NULL, worker, &languages[i]) == 0;
+    }
+    for (size_t i = 0; i < language_count; i++) {
+        if (started && started[i]) {
+            pthread_join(threads[i], NULL);
+        } else if (languages[i].active) {
+            worker(&languages[i]);
+        }
+        if (languages[i].active && !languages[i].ok) {
+            fprintf(stderr, "Failed to highlight embedded %s code\n", languages[i].name);
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+// --- Combining Languages ---
+
+static int compare_ranges(const void *a, const void *b) {
+    const TSRange *x = a, *y = b;
+    return (x->start_byte > y->start_byte) - (x->start_byte < y->start_byte);
+}
+
+static bool combine_languages(InjectionSet *set, EmbeddedLanguage *languages, size_t language_count) {
+    size_t range_total = 0;
+    for (size_t i = 0; i < language_count; i++) {
+        if (languages[i].ok) range_total += languages[i].range_count;
+    }
+    if (range_total == 0) return true;
+
+    // Each language's regions and spans are sorted already, so they are merged in order.
+    // Regions of different languages should not overlap; if they do, the earlier one wins.
+    set->ranges = malloc(sizeof(TSRange) * range_total);
+    size_t *next = calloc(language_count, sizeof(size_t));
+    bool ok = set->ranges && next;
+    while (ok) {
+        const EmbeddedLanguage *first = NULL;
+        for (size_t i = 0; i < language_count; i++) {
+            const EmbeddedLanguage *language = &languages[i];
+            if (!language->ok || next[i] == language->range_count) continue;
+            if (!first || language->ranges[next[i]].start_byte < first->ranges[next[first - languages]].start_byte) first = language;
+        }
+        if (!first) break;
+        const TSRange *range = &first->ranges[next[first - languages]++];
+        if (set->range_count > 0 && range->start_byte < set->ranges[set->range_count - 1].end_byte) continue;
+        set->ranges[set->range_count++] = *range;
+    }
+
+    if (ok) memset(next, 0, sizeof(size_t) * language_count);
+    while (ok) {
+        const EmbeddedLanguage *first = NULL;
+        for (size_t i = 0; i < language_count; i++) {
+            const EmbeddedLanguage *language = &languages[i];
+            if (!language->ok || next[i] == language->spans.count) continue;
+            if (!first || language->spans.items[next[i]].start < first->spans.items[next[first - languages]].start) first = language;
+        }
+        if (!first) break;
+        const HighlightSpan *span = &first->spans.items[next[first - languages]++];
+        if (set->spans.count > 0 && span->start < set->spans.items[set->spans.count - 1].end) continue;
+        ok = span_list_push(&set->spans, span->start, span->end, span->capture, span->style);
+    }
+    free(next);
+    return ok;
+}
+
+bool injection_collect(InjectionSet *set, const TSTree *tree, const TSQuery *injection_query,
+                       const char *code, size_t code_size, InjectionLookup lookup) {
+    memset(set, 0, sizeof(*set));
+
+    uint32_t content_capture;
+    uint32_t language_capture;
+    injection_captures(injection_query, &content_capture, &language_capture);
+    if (content_capture == UINT32_MAX) return true; // Nothing to inject
+
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    if (!cursor) return false;
+
+    EmbeddedLanguage *languages = NULL;
+    size_t language_count = 0;
+    bool ok = true;
+
+    ts_query_cursor_exec(cursor, injection_query, ts_tree_root_node(tree));
+    ok = add_matched_regions(cursor, injection_query, content_capture, language_capture, code, &languages, &language_count);
+    ts_query_cursor_delete(cursor);
+
+    // Resolve every language here, then parse and highlight them concurrently
+    for (size_t i = 0; ok && i < language_count; i++) {
+        EmbeddedLanguage *language = &languages[i];
+        language->code = code;
+        language->code_size = code_size;
+        if (!lookup(language->name, &language->grammar)) {
+            language->grammar.query = NULL;
+            language->range_count = 0; // Unknown language: the host highlighting stays
+        }
+        language->active = language->grammar.query != NULL;
+    }
+    if (ok) run_language_workers(languages, language_count, embedded_language_worker);
+
+    if (ok) ok = combine_languages(set, languages, language_count);
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate embedded language ranges\n");
+        injection_set_free(set);
+    }
+
+    for (size_t i = 0; i < language_count; i++) {
+        free(languages[i].ranges);
+        span_list_free(&languages[i].spans);
+    }
+    free(languages);
+    return ok;
+}
+
+// --- Merging Into Host Spans ---
+
+static size_t first_range_ending_after(const InjectionSet *set, uint32_t offset) {
+    size_t low = 0, high = set->range_count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (set->ranges[mid].end_byte <= offset) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static size_t first_span_ending_after(const SpanList *spans, uint32_t offset) {
+    size_t low = 0, high = spans->count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (spans->items[mid].end <= offset) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Appends the embedded spans that start before `until`, cut to [from, to)
+static bool push_embedded_until(const InjectionSet *set, size_t *next, uint32_t until,
+                                uint32_t from, uint32_t to, SpanList *out) {
+    for (; *next < set->spans.count && set->spans.items[*next].start < until; (*next)++) {
+        const HighlightSpan *span = &set->spans.items[*next];
+        uint32_t start = span->start > from ? span->start : from;
+        uint32_t end = span->end < to ? span->end : to;
+        if (start < end && !span_list_push(out, start, end, span->capture, span->style)) return false;
+    }
+    return true;
+}
+
+bool injection_apply(const InjectionSet *set, uint32_t from, uint32_t to, SpanList *spans, SpanList *scratch) {
+    if (set->range_count == 0) return true;
+    size_t range = first_range_ending_after(set, from);
+    if (range == set->range_count || set->ranges[range].start_byte >= to) return true; // No embedded code here
+
+    size_t next = first_span_ending_after(&set->spans, from);
+    scratch->count = 0;
+    for (size_t i = 0; i < spans->count; i++) {
+        const HighlightSpan *span = &spans->items[i];
+        uint32_t start = span->start;
+        while (start < span->end) {
+            while (range < set->range_count && set->ranges[range].end_byte <= start) range++;
+            uint32_t end = span->end;
+            uint32_t resume = span->end;
+            if (range < set->range_count && set->ranges[range].start_byte < span->end) {
+                end = set->ranges[range].start_byte > start ? set->ranges[range].start_byte : start;
+                resume = set->ranges[range].end_byte;
+            }
+            if (start < end) {
+                if (!push_embedded_until(set, &next, start, from, to, scratch) ||
+                    !span_list_push(scratch, start, end, span->capture, span->style)) {
+                    return false;
+                }
+            }
+            start = resume;
+        }
+    }
+    if (!push_embedded_until(set, &next, to, from, to, scratch)) return false;
+
+    SpanList merged = *scratch;
+    *scratch = *spans;
+    *spans = merged;
+    return true;
+}
+
+// --- Edited Documents ---
+
+// Appends the byte range [start, end) to a list of them
+static bool push_byte_range(TSRange **ranges, size_t *count, size_t *capacity, uint32_t start, uint32_t end) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        TSRange *grown = realloc(*ranges, sizeof(TSRange) * new_capacity);
+        if (!grown) return false;
+        *ranges = grown;
+        *capacity = new_capacity;
+    }
+    (*ranges)[(*count)++] = (TSRange){.start_byte = start, .end_byte = end};
+    return true;
+}
+
+// Sorts byte ranges and merges those that overlap or touch. Returns how many are left.
+static size_t merge_byte_ranges(TSRange *ranges, size_t count) {
+    qsort(ranges, count, sizeof(TSRange), compare_ranges);
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && ranges[i].start_byte <= ranges[merged - 1].end_byte) {
+            if (ranges[i].end_byte > ranges[merged - 1].end_byte) ranges[merged - 1].end_byte = ranges[i].end_byte;
+        } else {
+            ranges[merged++] = ranges[i];
+        }
+    }
+    return merged;
+}
+
+// Whether `range` overlaps or touches one of the sorted byte ranges `dirty`
+static bool touches_dirty(const TSRange *range, const TSRange *dirty, size_t dirty_count) {
+    for (size_t i = 0; i < dirty_count && dirty[i].start_byte <= range->end_byte; i++) {
+        if (dirty[i].end_byte >= range->start_byte) return true;
+    }
+    return false;
+}
+
+// Moves a position of the text before `edit` to where it is after it, as ts_tree_edit
+// does; a position in the replaced text moves to the start of the edit
+static void edit_position(uint32_t *byte, TSPoint *point, const TSInputEdit *edit) {
+    if (*byte >= edit->old_end_byte) {
+        *byte = edit->new_end_byte + (*byte - edit->old_end_byte);
+        if (point && point->row == edit->old_end_point.row) {
+            *point = (TSPoint){edit->new_end_point.row, edit->new_end_point.column + (point->column - edit->old_end_point.column)};
+        } else if (point) {
+            point->row = edit->new_end_point.row + (point->row - edit->old_end_point.row);
+        }
+    } else if (*byte > edit->start_byte) {
+        *byte = edit->start_byte;
+        if (point) *point = edit->start_point;
+    }
+}
+
+static void embedded_language_free(EmbeddedLanguage *language) {
+    if (language->tree) ts_tree_delete(language->tree);
+    if (language->parser) ts_parser_delete(language->parser);
+    free(language->ranges);
+    free(language->windows);
+    span_list_free(&language->spans);
+}
+
+// Drops everything kept, so that the next update collects the document afresh
+static void injection_document_reset(InjectionDocument *doc) {
+    for (size_t i = 0; i < doc->language_count; i++) embedded_language_free(&doc->languages[i]);
+    free(doc->languages);
+    doc->languages = NULL;
+    doc->language_count = 0;
+    doc->dirty_count = 0;
+    doc->collected = false;
+    injection_set_free(&doc->set);
+}
+
+void injection_document_free(InjectionDocument *doc) {
+    injection_document_reset(doc);
+    free(doc->dirty);
+    doc->dirty = NULL;
+    doc->dirty_capacity = 0;
+}
+
+void injection_document_invalidate(InjectionDocument *doc, uint32_t start, uint32_t end) {
+    if (!doc->collected) return; // The next update looks at everything anyway
+    if (!push_byte_range(&doc->dirty, &doc->dirty_count, &doc->dirty_capacity, start, end)) {
+        injection_document_reset(doc);
+    }
+}
+
+void injection_document_edit(InjectionDocument *doc, const TSInputEdit *edit) {
+    if (!doc->collected) return;
+    for (size_t i = 0; i < doc->dirty_count; i++) {
+        edit_position(&doc->dirty[i].start_byte, NULL, edit);
+        edit_position(&doc->dirty[i].end_byte, NULL, edit);
+    }
+    for (size_t i = 0; i < doc->language_count; i++) {
+        EmbeddedLanguage *language = &doc->languages[i];
+        if (language->tree) ts_tree_edit(language->tree, edit);
+        for (size_t k = 0; k < language->range_count; k++) {
+            edit_position(&language->ranges[k].start_byte, &language->ranges[k].start_point, edit);
+            edit_position(&language->ranges[k].end_byte, &language->ranges[k].end_point, edit);
+        }
+        for (size_t k = 0; k < language->spans.count; k++) {
+            edit_position(&language->spans.items[k].start, NULL, edit);
+            edit_position(&language->spans.items[k].end, NULL, edit);
+        }
+    }
+    injection_document_invalidate(doc, edit->start_byte, edit->new_end_byte);
+}
+
+// Whether `range` overlaps one of the regions found by an update, in any language
+static bool overlaps_found(const TSRange *range, const EmbeddedLanguage *found, size_t found_count) {
+    for (size_t i = 0; i < found_count; i++) {
+        for (size_t k = 0; k < found[i].range_count; k++) {
+            if (found[i].ranges[k].start_byte < range->end_byte && found[i].ranges[k].end_byte > range->start_byte) return true;
+        }
+    }
+    return false;
+}
+
+// Replaces the regions of `language` that a dirty range reaches, or that a region found
+// there now covers, with the ones found for it (`found`, or NULL for none). If that
+// changes anything, the language is made active and what it must highlight again is
+// put in its windows.
+static bool replace_regions(EmbeddedLanguage *language, const EmbeddedLanguage *found, const EmbeddedLanguage *all_found,
+                            size_t found_count, const TSRange *dirty, size_t dirty_count) {
+    language->active = false;
+    if (!language->grammar.query) {
+        language->range_count = 0; // Unknown language: the host highlighting stays
+        return true;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < language->range_count; i++) {
+        const TSRange *range = &language->ranges[i];
+        if (touches_dirty(range, dirty, dirty_count) || overlaps_found(range, all_found, found_count)) continue;
+        language->ranges[kept++] = *range;
+    }
+    bool changed = kept < language->range_count || (found && found->range_count > 0);
+    language->range_count = kept;
+    if (!changed) return true;
+
+    for (size_t i = 0; found && i < found->range_count; i++) {
+        const TSRange *range = &found->ranges[i];
+        if (!push_byte_range(&language->ranges, &language->range_count, &language->range_capacity, 0, 0) ||
+            !push_byte_range(&language->windows, &language->window_count, &language->window_capacity,
+                             range->start_byte, range->end_byte)) {
+            return false;
+        }
+        language->ranges[language->range_count - 1] = *range;
+    }
+    // Included ranges must be sorted and disjoint; a region nested in the previous one is dropped
+    qsort(language->ranges, language->range_count, sizeof(TSRange), compare_ranges);
+    kept = 0;
+    for (size_t i = 0; i < language->range_count; i++) {
+        if (kept > 0 && language->ranges[i].start_byte < language->ranges[kept - 1].end_byte) continue;
+        language->ranges[kept++] = language->ranges[i];
+    }
+    language->range_count = kept;
+
+    for (size_t i = 0; i < dirty_count; i++) {
+        if (!push_byte_range(&language->windows, &language->window_count, &language->window_capacity,
+                             dirty[i].start_byte, dirty[i].end_byte)) {
+            return false;
+        }
+    }
+    language->active = true;
+    return true;
+}
+
+// Replaces the spans of language->windows with freshly highlighted ones. Each window is
+// widened by a byte, then to the spans it reaches into, so that no span is split.
+static bool highlight_windows(EmbeddedLanguage *language, TSQueryCursor *cursor) {
+    const InjectionLanguage *grammar = &language->grammar;
+    TSNode root = ts_tree_root_node(language->tree);
+    size_t window_count = merge_byte_ranges(language->windows, language->window_count);
+    language->window_count = 0;
+
+    const SpanList *old = &language->spans;
+    SpanList spans = {0};
+    SpanList fresh = {0};
+    size_t next = 0;
+    bool ok = true;
+    for (size_t w = 0; ok && w < window_count; w++) {
+        uint32_t from = language->windows[w].start_byte > 0 ? language->windows[w].start_byte - 1 : 0;
+        uint32_t to = language->windows[w].end_byte + 1;
+        for (; ok && next < old->count && old->items[next].end <= from; next++) {
+            const HighlightSpan *span = &old->items[next];
+            ok = span_list_push(&spans, span->start, span->end, span->capture, span->style);
+        }
+        if (next < old->count && old->items[next].start < from) from = old->items[next].start;
+        while (true) {
+            for (; next < old->count && old->items[next].start < to; next++) {
+                if (old->items[next].end > to) to = old->items[next].end;
+            }
+            if (w + 1 == window_count || language->windows[w + 1].start_byte > to) break;
+            w++;
+            if (language->windows[w].end_byte + 1 > to) to = language->windows[w].end_byte + 1;
+        }
+        if (to > language->code_size) to = (uint32_t)language->code_size;
+
+        ok = ok && highlight_collect_range(cursor, grammar->query, root, grammar->capture_styles, grammar->predicates,
+                                           language->code, language->code_size, from, to, &fresh);
+        for (size_t i = 0; ok && i < fresh.count; i++) {
+            const HighlightSpan *span = &fresh.items[i];
+            ok = span_list_push(&spans, span->start, span->end, span->capture, span->style);
+        }
+    }
+    for (; ok && next < old->count; next++) {
+        const HighlightSpan *span = &old->items[next];
+        ok = span_list_push(&spans, span->start, span->end, span->capture, span->style);
+    }
+    span_list_free(&fresh);
+    if (!ok) {
+        span_list_free(&spans);
+        return false;
+    }
+    span_list_free(&language->spans);
+    language->spans = spans;
+    return clip_to_ranges(&language->spans, language->ranges, language->range_count);
+}
+
+// Reparses one language of an InjectionDocument against its old tree, then highlights
+// again its windows and whatever parses differently now
+static void *embedded_language_update(void *arg) {
+    EmbeddedLanguage *language = arg;
+    language->ok = false;
+    if (language->range_count == 0) { // Its last region is gone
+        if (language->tree) ts_tree_delete(language->tree);
+        language->tree = NULL;
+        language->spans.count = 0;
+        language->window_count = 0;
+        language->ok = true;
+        return NULL;
+    }
+    if (!language->parser) {
+        language->parser = ts_parser_new();
+        if (!language->parser || !ts_parser_set_language(language->parser, language->grammar.language)) return NULL;
+    }
+    if (!ts_parser_set_included_ranges(language->parser, language->ranges, (uint32_t)language->range_count)) return NULL;
+    TSTree *tree = ts_parser_parse_string(language->parser, language->tree, language->code, (uint32_t)language->code_size);
+    if (!tree) return NULL;
+
+    bool ok = true;
+    if (language->tree) {
+        uint32_t changed_count;
+        TSRange *changed = ts_tree_get_changed_ranges(language->tree, tree, &changed_count);
+        for (uint32_t i = 0; ok && i < changed_count; i++) {
+            ok = push_byte_range(&language->windows, &language->window_count, &language->window_capacity,
+                                 changed[i].start_byte, changed[i].end_byte);
+        }
+        arena_free(changed); // Allocated by tree-sitter, whose allocator is the arenas (arena_install)
+        ts_tree_delete(language->tree);
+    } else {
+        language->spans.count = 0;
+        language->window_count = 0;
+        ok = push_byte_range(&language->windows, &language->window_count, &language->window_capacity, 0,
+                             (uint32_t)language->code_size);
+    }
+    language->tree = tree;
+
+    TSQueryCursor *cursor = ok ? ts_query_cursor_new() : NULL;
+    language->ok = cursor && highlight_windows(language, cursor);
+    if (cursor) ts_query_cursor_delete(cursor);
+    return NULL;
+}
+
+bool injection_document_update(InjectionDocument *doc, const TSTree *tree, const TSQuery *injection_query,
+                               const char *code, size_t code_size, InjectionLookup lookup) {
+    if (doc->collected && doc->dirty_count == 0) return true;
+    if (!doc->collected) {
+        injection_document_reset(doc);
+        if (!push_byte_range(&doc->dirty, &doc->dirty_count, &doc->dirty_capacity, 0, (uint32_t)code_size)) return false;
+    }
+    uint32_t content_capture;
+    uint32_t language_capture;
+    injection_captures(injection_query, &content_capture, &language_capture);
+    size_t dirty_count = merge_byte_ranges(doc->dirty, doc->dirty_count);
+
+    // Regions are only looked for where the document changed, and a byte around it
+    TSQueryCursor *cursor = content_capture != UINT32_MAX ? ts_query_cursor_new() : NULL;
+    EmbeddedLanguage *found = NULL;
+    size_t found_count = 0;
+    bool ok = content_capture == UINT32_MAX || cursor;
+    for (size_t i = 0; cursor && ok && i < dirty_count; i++) {
+        uint32_t start = doc->dirty[i].start_byte;
+        ts_query_cursor_set_byte_range(cursor, start > 0 ? start - 1 : 0, doc->dirty[i].end_byte + 1);
+        ts_query_cursor_exec(cursor, injection_query, ts_tree_root_node(tree));
+        ok = add_matched_regions(cursor, injection_query, content_capture, language_capture, code, &found, &found_count);
+    }
+    if (cursor) ts_query_cursor_delete(cursor);
+
+    for (size_t i = 0; ok && i < found_count; i++) {
+        EmbeddedLanguage *language = embedded_language_for(&doc->languages, &doc->language_count, found[i].name);
+        ok = language != NULL;
+        if (ok && !language->resolved) {
+            language->resolved = true;
+            if (!lookup(language->name, &language->grammar)) language->grammar.query = NULL;
+        }
+    }
+    for (size_t i = 0; ok && i < doc->language_count; i++) {
+        EmbeddedLanguage *language = &doc->languages[i];
+        const EmbeddedLanguage *language_found = NULL;
+        for (size_t k = 0; k < found_count && !language_found; k++) {
+            if (strcmp(found[k].name, language->name) == 0) language_found = &found[k];
+        }
+        language->code = code;
+        language->code_size = code_size;
+        ok = replace_regions(language, language_found, found, found_count, doc->dirty, dirty_count);
+    }
+    for (size_t i = 0; i < found_count; i++) embedded_language_free(&found[i]);
+    free(found);
+
+    if (ok) run_language_workers(doc->languages, doc->language_count, embedded_language_update);
+    bool all_ok = ok;
+    for (size_t i = 0; i < doc->language_count; i++) {
+        if (doc->languages[i].active && !doc->languages[i].ok) all_ok = false;
+    }
+    injection_set_free(&doc->set);
+    ok = ok && combine_languages(&doc->set, doc->languages, doc->language_count);
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate embedded language ranges\n");
+        injection_document_reset(doc);
+        return false;
+    }
+
+    // A language that failed is left unhighlighted until the next update starts over
+    doc->dirty_count = 0;
+    doc->collected = all_ok;
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef INJECTION_H
+#define INJECTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "highlight.h"
+#include "predicate.h"
+
+// An embedded language's grammar and compiled highlight query, with the capture styles
+// (highlight_capture_styles) and text predicates (query_predicates_new) of that query
+typedef struct {
+    const TSLanguage *language;
+    const TSQuery *query;
+    const uint8_t *capture_styles;
+    const QueryPredicates *predicates;
+} InjectionLanguage;
+
+// Resolves an embedded language named by an injection query (e.g. "javascript"). What it
+// returns is shared and read-only, and must stay valid for the rest of the process, so
+// a language is only compiled once however many files or chunks embed it.
+// Returns false if the language is unknown or its query cannot be loaded.
+typedef bool (*InjectionLookup)(const char *name, InjectionLanguage *out);
+
+// Highlighting of the regions of a file written in other languages, such as the
+// bodies of <script> and <style> elements in HTML.
+typedef struct {
+    TSRange *ranges;   // Embedded regions of every language, sorted and disjoint
+    size_t range_count;
+    SpanList spans;    // Their highlight spans, sorted and inside `ranges`; `capture` indexes the embedded language's query
+} InjectionSet;
+
+// Finds the embedded regions of `tree` with `injection_query`, which marks them with
+// @injection.content and names their language with (#set! injection.language "...")
+// or an @injection.language capture. Each language is parsed once over all of its
+// regions (ts_parser_set_included_ranges), different languages concurrently.
+// Returns false on failure; a language that cannot be resolved is left unhighlighted.
+bool injection_collect(InjectionSet *set, const TSTree *tree, const TSQuery *injection_query,
+                       const char *code, size_t code_size, InjectionLookup lookup);
+
+// Merges the embedded spans into the host spans of code[from, to): host spans are cut
+// out of the embedded regions and the embedded spans inside [from, to) take their place.
+// `scratch` is working storage that can be reused between calls. Returns false on
+// allocation failure.
+bool injection_apply(const InjectionSet *set, uint32_t from, uint32_t to, SpanList *spans, SpanList *scratch);
+
+void injection_set_free(InjectionSet *set);
+
+// --- Edited Documents ---
+
+// The injections of a document that is edited in place (the editor server). Each
+// embedded language keeps its parser and tree, which are edited along with the host
+// tree; an update looks for regions only where the document changed, reparses the
+// embedded trees against their old trees and highlights again only what changed.
+typedef struct {
+    InjectionSet set;                     // Current after injection_document_update
+    struct EmbeddedLanguage *languages;
+    size_t language_count;
+    TSRange *dirty;                       // Byte ranges changed since the last update
+    size_t dirty_count;
+    size_t dirty_capacity;
+    bool collected;                       // False until the first update, and after a failed one
+} InjectionDocument;
+
+// Moves the regions, spans and embedded trees along with an edit of the host text
+void injection_document_edit(InjectionDocument *doc, const TSInputEdit *edit);
+
+// Marks code[start, end) as changed, e.g. a range the host tree reports as changed.
+// Should that run out of memory, the next update collects everything again.
+void injection_document_invalidate(InjectionDocument *doc, uint32_t start, uint32_t end);
+
+// Brings doc->set up to date with `tree` and `code` after the edits since the last
+// update (the first update collects everything, as injection_collect). Returns false on failure.
+bool injection_document_update(InjectionDocument *doc, const TSTree *tree, const TSQuery *injection_query,
+                               const char *code, size_t code_size, InjectionLookup lookup);
+
+void injection_document_free(InjectionDocument *doc);
+
+#endif // INJECTION_H
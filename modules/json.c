@@ -0,0 +1,340 @@
+#include "json.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *p;
+    const char *end;
+    int depth;
+    char *error;
+    size_t error_size;
+} JsonParser;
+
+static bool parse_value(JsonParser *parser, JsonValue *out);
+
+static bool fail(JsonParser *parser, const char *message) {
+    if (parser->error[0] == '\0') snprintf(parser->error, parser->error_size, "%s", message);
+    return false;
+}
+
+static void skip_space(JsonParser *parser) {
+    while (parser->p < parser->end &&
+           (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r')) {
+        parser->p++;
+    }
+}
+
+static bool consume(JsonParser *parser, const char *literal) {
+    size_t len = strlen(literal);
+    if ((size_t)(parser->end - parser->p) < len || memcmp(parser->p, literal, len) != 0) return false;
+    parser->p += len;
+    return true;
+}
+
+// --- Strings ---
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Reads the 4 hex digits of a \u escape
+static bool parse_hex4(JsonParser *parser, uint32_t *out) {
+    if (parser->end - parser->p < 4) return fail(parser, "Truncated \\u escape");
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(parser->p[i]);
+        if (digit < 0) return fail(parser, "Malformed \\u escape");
+        value = value * 16 + (uint32_t)digit;
+    }
+    parser->p += 4;
+    *out = value;
+    return true;
+}
+
+static size_t encode_utf8(uint32_t code, char *out) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+// Parses the string literal at parser->p (on its opening quote) into a malloc'ed,
+// NUL-terminated buffer. The decoded text is never longer than the literal.
+static bool parse_string(JsonParser *parser, char **out, size_t *out_length) {
+    parser->p++; // Opening quote
+    const char *close = parser->p;
+    while (close < parser->end && *close != '"') close += (*close == '\\') ? 2 : 1;
+    if (close >= parser->end) return fail(parser, "Unterminated string");
+
+    char *buffer = malloc((size_t)(close - parser->p) + 1);
+    if (!buffer) return fail(parser, "Out of memory");
+    size_t len = 0;
+    while (parser->p < close) {
+        char c = *parser->p++;
+        if (c != '\\') {
+            if ((unsigned char)c < 0x20) {
+                free(buffer);
+                return fail(parser, "Control character in string");
+            }
+            buffer[len++] = c;
+            continue;
+        }
+        char escape = *parser->p++;
+        uint32_t code;
+        switch (escape) {
+            case '"': buffer[len++] = '"'; break;
+            case '\\': buffer[len++] = '\\'; break;
+            case '/': buffer[len++] = '/'; break;
+            case 'b': buffer[len++] = '\b'; break;
+            case 'f': buffer[len++] = '\f'; break;
+            case 'n': buffer[len++] = '\n'; break;
+            case 'r': buffer[len++] = '\r'; break;
+            case 't': buffer[len++] = '\t'; break;
+            case 'u':
+                if (!parse_hex4(parser, &code)) {
+                    free(buffer);
+                    return false;
+                }
+                // A surrogate pair (12 characters) encodes one 4-byte character; a lone
+                // surrogate becomes U+FFFD (3 bytes from 6 characters)
+                if (code >= 0xD800 && code < 0xDC00 && close - parser->p >= 6 && parser->p[0] == '\\' && parser->p[1] == 'u') {
+                    const char *pair = parser->p;
+                    parser->p += 2;
+                    uint32_t low;
+                    if (parse_hex4(parser, &low) && low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    } else {
+                        parser->p = pair;
+                        parser->error[0] = '\0';
+                        code = 0xFFFD;
+                    }
+                } else if (code >= 0xD800 && code < 0xE000) {
+                    code = 0xFFFD;
+                }
+                len += encode_utf8(code, buffer + len);
+                break;
+            default:
+                free(buffer);
+                return fail(parser, "Unknown escape in string");
+        }
+    }
+    parser->p = close + 1;
+    buffer[len] = '\0';
+    *out = buffer;
+    *out_length = len;
+    return true;
+}
+
+// --- Values ---
+
+static bool parse_number(JsonParser *parser, JsonValue *out) {
+    char digits[64];
+    size_t len = 0;
+    while (parser->p + len < parser->end && len < sizeof(digits) - 1 && strchr("+-.0123456789eE", parser->p[len])) {
+        digits[len] = parser->p[len];
+        len++;
+    }
+    digits[len] = '\0';
+    char *number_end;
+    out->number = strtod(digits, &number_end);
+    if (len == 0 || number_end != digits + len || !isfinite(out->number)) return fail(parser, "Malformed number");
+    out->type = JSON_NUMBER;
+    parser->p += len;
+    return true;
+}
+
+// Parses the members of an array or object (parser->p on its opening bracket)
+static bool parse_container(JsonParser *parser, JsonValue *out, bool object) {
+    char close = object ? '}' : ']';
+    out->type = object ? JSON_OBJECT : JSON_ARRAY;
+    if (++parser->depth > JSON_MAX_DEPTH) return fail(parser, "Nesting too deep");
+    parser->p++;
+    skip_space(parser);
+    if (parser->p < parser->end && *parser->p == close) {
+        parser->p++;
+        parser->depth--;
+        return true;
+    }
+
+    size_t capacity = 0;
+    while (true) {
+        if (out->count == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            JsonValue *items = realloc(out->items, capacity * sizeof(JsonValue));
+            if (items) out->items = items;
+            if (items && object) {
+                char **keys = realloc(out->keys, capacity * sizeof(char *));
+                if (keys) out->keys = keys;
+                items = keys ? items : NULL;
+            }
+            if (!items) return fail(parser, "Out of memory");
+        }
+
+        JsonValue *item = &out->items[out->count];
+        memset(item, 0, sizeof(*item));
+        if (object) {
+            size_t key_length;
+            skip_space(parser);
+            if (parser->p >= parser->end || *parser->p != '"') return fail(parser, "Expected an object key");
+            if (!parse_string(parser, &out->keys[out->count], &key_length)) return false;
+            skip_space(parser);
+            if (parser->p >= parser->end || *parser->p != ':') {
+                free(out->keys[out->count]);
+                return fail(parser, "Expected ':' after an object key");
+            }
+            parser->p++;
+        }
+        out->count++; // Counted before parsing, so json_free releases a partial member
+        if (!parse_value(parser, item)) return false;
+
+        skip_space(parser);
+        if (parser->p < parser->end && *parser->p == ',') {
+            parser->p++;
+        } else if (parser->p < parser->end && *parser->p == close) {
+            parser->p++;
+            parser->depth--;
+            return true;
+        } else {
+            return fail(parser, object ? "Expected ',' or '}'" : "Expected ',' or ']'");
+        }
+    }
+}
+
+static bool parse_value(JsonParser *parser, JsonValue *out) {
+    skip_space(parser);
+    if (parser->p >= parser->end) return fail(parser, "Unexpected end of input");
+    switch (*parser->p) {
+        case '{': return parse_container(parser, out, true);
+        case '[': return parse_container(parser, out, false);
+        case '"':
+            out->type = JSON_STRING;
+            return parse_string(parser, &out->string, &out->string_length);
+        case 't':
+            out->type = JSON_BOOL;
+            out->boolean = true;
+            return consume(parser, "true") || fail(parser, "Unexpected token");
+        case 'f':
+            out->type = JSON_BOOL;
+            return consume(parser, "false") || fail(parser, "Unexpected token");
+        case 'n':
+            out->type = JSON_NULL;
+            return consume(parser, "null") || fail(parser, "Unexpected token");
+        default:
+            return parse_number(parser, out);
+    }
+}
+
+bool json_parse(const char *text, size_t size, JsonValue *out, char *error, size_t error_size) {
+    JsonParser parser = {text, text + size, 0, error, error_size};
+    error[0] = '\0';
+    memset(out, 0, sizeof(*out));
+    bool ok = parse_value(&parser, out);
+    if (ok) {
+        skip_space(&parser);
+        if (parser.p != parser.end) ok = fail(&parser, "Trailing characters after the value");
+    }
+    if (!ok) json_free(out);
+    return ok;
+}
+
+void json_free(JsonValue *value) {
+    for (size_t i = 0; i < value->count; i++) {
+        json_free(&value->items[i]);
+        if (value->keys) free(value->keys[i]);
+    }
+    free(value->items);
+    free(value->keys);
+    free(value->string);
+    memset(value, 0, sizeof(*value));
+}
+
+const JsonValue *json_get(const JsonValue *object, const char *key) {
+    if (!object || object->type != JSON_OBJECT) return NULL;
+    for (size_t i = 0; i < object->count; i++) {
+        if (strcmp(object->keys[i], key) == 0) return &object->items[i];
+    }
+    return NULL;
+}
+
+bool json_get_index(const JsonValue *value, size_t max, size_t *out) {
+    if (!value || value->type != JSON_NUMBER || value->number < 0 || value->number > (double)max ||
+        value->number != floor(value->number)) {
+        return false;
+    }
+    *out = (size_t)value->number;
+    return true;
+}
+
+// --- Writing ---
+
+void json_write_string(FILE *out, const char *text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    fputc('"', out);
+    size_t run = 0; // Characters written as they are, flushed in one fwrite
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        fwrite(text + run, 1, i - run, out);
+        run = i + 1;
+        switch (c) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\t': fputs("\\t", out); break;
+            default: fprintf(out, "\\u00%c%c", hex[c >> 4], hex[c & 15]); break;
+        }
+    }
+    fwrite(text + run, 1, length - run, out);
+    fputc('"', out);
+}
+
+void json_write_value(FILE *out, const JsonValue *value) {
+    switch (value->type) {
+        case JSON_NULL: fputs("null", out); break;
+        case JSON_BOOL: fputs(value->boolean ? "true" : "false", out); break;
+        case JSON_NUMBER:
+            if (value->number == floor(value->number) && fabs(value->number) < 1e15) {
+                fprintf(out, "%.0f", value->number);
+            } else {
+                fprintf(out, "%.17g", value->number);
+            }
+            break;
+        case JSON_STRING: json_write_string(out, value->string, value->string_length); break;
+        case JSON_ARRAY:
+        case JSON_OBJECT:
+            fputc(value->type == JSON_OBJECT ? '{' : '[', out);
+            for (size_t i = 0; i < value->count; i++) {
+                if (i) fputc(',', out);
+                if (value->type == JSON_OBJECT) {
+                    json_write_string(out, value->keys[i], strlen(value->keys[i]));
+                    fputc(':', out);
+                }
+                json_write_value(out, &value->items[i]);
+            }
+            fputc(value->type == JSON_OBJECT ? '}' : ']', out);
+            break;
+    }
+}
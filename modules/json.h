@@ -0,0 +1,51 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Just enough JSON for the --stdio-server messages: a parser into a tree of values
+// and writers for the pieces of a reply.
+
+#define JSON_MAX_DEPTH 64 // Deeper nesting is rejected rather than recursed into
+
+typedef enum {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} JsonType;
+
+typedef struct JsonValue {
+    JsonType type;
+    bool boolean;
+    double number;
+    char *string;             // JSON_STRING: decoded UTF-8, NUL-terminated (and may hold NULs)
+    size_t string_length;
+    struct JsonValue *items;  // JSON_ARRAY and JSON_OBJECT members, in order
+    char **keys;              // JSON_OBJECT: the key of each member
+    size_t count;
+} JsonValue;
+
+// Parses the JSON text text[0, size) into `out`, which must be freed with json_free.
+// Returns false with the reason in `error` if it is malformed or memory runs out.
+bool json_parse(const char *text, size_t size, JsonValue *out, char *error, size_t error_size);
+
+void json_free(JsonValue *value);
+
+// Member `key` of `object`, or NULL if it has none or is not an object
+const JsonValue *json_get(const JsonValue *object, const char *key);
+
+// Whether `value` is a number holding a whole value in [0, max]; stores it in *out
+bool json_get_index(const JsonValue *value, size_t max, size_t *out);
+
+// Writes text[0, length) as a JSON string literal
+void json_write_string(FILE *out, const char *text, size_t length);
+
+// Writes `value` back out as JSON
+void json_write_value(FILE *out, const JsonValue *value);
+
+#endif // JSON_H
@@ -5,9 +5,16 @@
 #include <stdbool.h>
 #include <math.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Include the API header for this library
 #include "libcodeimage.h"
+#include "arena.h"
+#include "line_index.h"
 
 // Define STB_IMAGE_WRITE_IMPLEMENTATION and STB_TRUETYPE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -32,6 +39,59 @@ static FontInfo *discovered_fonts = NULL; // static: local to this compilation u
 static int discovered_fonts_count = 0;
 static int discovered_fonts_capacity = 0;
 
+// Per-font lookup cache. Codepoint -> glyph index/advance is resolved through the
+// cmap once and then stored flat: the BMP is a dense table split into lazily
+// allocated pages, codepoints above it go into a small open-addressed table.
+// Kerning is cached per glyph pair the same way.
+typedef struct {
+    int32_t glyph;   // -1 until resolved
+    int32_t advance; // Advance width in font units
+} GlyphEntry;
+
+#define GLYPH_PAGE_BITS 8
+#define GLYPH_PAGE_SIZE (1 << GLYPH_PAGE_BITS)
+#define GLYPH_BMP_PAGES (0x10000 >> GLYPH_PAGE_BITS)
+
+typedef struct {
+    uint32_t codepoint; // 0 marks an empty slot (codepoints here are always > 0xFFFF)
+    GlyphEntry entry;
+} GlyphSparseSlot;
+
+typedef struct {
+    uint32_t key; // (glyph1 << 16 | glyph2) + 1, 0 marks an empty slot
+    int32_t kern;
+} KernSlot;
+
+// Rasterized glyph, cached per (glyph, subpixel phase) so each variant is rasterized once.
+typedef struct {
+    uint32_t key;    // (glyph << 4 | phase) + 1, 0 marks an empty slot
+    int width;
+    int height;
+    int x_offset;
+    int y_offset;
+    uint8_t *pixels; // NULL for glyphs without ink (e.g. space)
+} GlyphBitmapSlot;
+
+#define GLYPH_MAX_SUBPIXEL_PHASES 16
+
+typedef struct {
+    const stbtt_fontinfo *font;
+    float scale;
+    int subpixel_phases; // Quantized horizontal positions per pixel (1 = whole pixels only)
+    GlyphEntry *bmp_pages[GLYPH_BMP_PAGES];
+    GlyphSparseSlot *sparse;
+    size_t sparse_count;
+    size_t sparse_capacity;
+    KernSlot *kern;
+    size_t kern_count;
+    size_t kern_capacity;
+    GlyphBitmapSlot *bitmaps;
+    size_t bitmap_count;
+    size_t bitmap_capacity;
+    GlyphEntry scratch; // Used when a table cannot grow; lookups then fall back to the cmap
+    GlyphBitmapSlot scratch_bitmap;
+} GlyphCache;
+
 // --- Helper Functions ---
 
 static void hex_to_rgb(const char* hex_color, uint8_t* r, uint8_t* g, uint8_t* b) {
@@ -42,8 +102,245 @@ static void hex_to_rgb(const char* hex_color, uint8_t* r, uint8_t* g, uint8_t* b
     sscanf(hex_color + 1, "%2hhx%2hhx%2hhx", r, g, b);
 }
 
+// Decodes one UTF-8 sequence from `s` (at most `len` bytes). Invalid, overlong or
+// truncated sequences decode to U+FFFD and consume a single byte so rendering resyncs.
+static uint32_t utf8_decode(const char *s, size_t len, size_t *consumed) {
+    const unsigned char *p = (const unsigned char *)s;
+    uint32_t cp;
+    size_t need;
+
+    if (p[0] < 0x80) {
+        *consumed = 1;
+        return p[0];
+    } else if ((p[0] & 0xE0) == 0xC0) {
+        cp = p[0] & 0x1F;
+        need = 1;
+    } else if ((p[0] & 0xF0) == 0xE0) {
+        cp = p[0] & 0x0F;
+        need = 2;
+    } else if ((p[0] & 0xF8) == 0xF0) {
+        cp = p[0] & 0x07;
+        need = 3;
+    } else {
+        *consumed = 1;
+        return 0xFFFD;
+    }
+
+    if (need >= len) {
+        *consumed = 1;
+        return 0xFFFD;
+    }
+    for (size_t k = 1; k <= need; ++k) {
+        if ((p[k] & 0xC0) != 0x80) {
+            *consumed = 1;
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (p[k] & 0x3F);
+    }
+
+    static const uint32_t min_for_length[4] = {0, 0x80, 0x800, 0x10000};
+    if (cp < min_for_length[need] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        *consumed = 1;
+        return 0xFFFD;
+    }
+    *consumed = need + 1;
+    return cp;
+}
+
+static uint32_t hash_u32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static void glyph_cache_init(GlyphCache *cache, const stbtt_fontinfo *font, float scale, int subpixel_phases) {
+    memset(cache, 0, sizeof(*cache));
+    cache->font = font;
+    cache->scale = scale;
+    if (subpixel_phases < 1) subpixel_phases = 1;
+    if (subpixel_phases > GLYPH_MAX_SUBPIXEL_PHASES) subpixel_phases = GLYPH_MAX_SUBPIXEL_PHASES;
+    cache->subpixel_phases = subpixel_phases;
+}
+
+static void glyph_cache_free(GlyphCache *cache) {
+    for (int i = 0; i < GLYPH_BMP_PAGES; ++i) {
+        free(cache->bmp_pages[i]);
+    }
+    free(cache->sparse);
+    free(cache->kern);
+    for (size_t i = 0; i < cache->bitmap_capacity; ++i) {
+        free(cache->bitmaps[i].pixels);
+    }
+    free(cache->bitmaps);
+    free(cache->scratch_bitmap.pixels);
+    memset(cache, 0, sizeof(*cache));
+}
+
+static void glyph_resolve(const stbtt_fontinfo *font, uint32_t codepoint, GlyphEntry *entry) {
+    entry->glyph = stbtt_FindGlyphIndex(font, (int)codepoint);
+    int advance = 0;
+    stbtt_GetGlyphHMetrics(font, entry->glyph, &advance, NULL);
+    entry->advance = advance;
+}
+
+static bool glyph_sparse_grow(GlyphCache *cache) {
+    size_t new_capacity = cache->sparse_capacity ? cache->sparse_capacity * 2 : 64;
+    GlyphSparseSlot *slots = calloc(new_capacity, sizeof(GlyphSparseSlot));
+    if (!slots) return false;
+    for (size_t i = 0; i < cache->sparse_capacity; ++i) {
+        if (cache->sparse[i].codepoint == 0) continue;
+        size_t j = hash_u32(cache->sparse[i].codepoint) & (new_capacity - 1);
+        while (slots[j].codepoint != 0) j = (j + 1) & (new_capacity - 1);
+        slots[j] = cache->sparse[i];
+    }
+    free(cache->sparse);
+    cache->sparse = slots;
+    cache->sparse_capacity = new_capacity;
+    return true;
+}
+
+// Returns the cached glyph index and advance for `codepoint`, resolving it on first use.
+static const GlyphEntry *glyph_cache_lookup(GlyphCache *cache, uint32_t codepoint) {
+    if (codepoint < 0x10000) {
+        GlyphEntry **page = &cache->bmp_pages[codepoint >> GLYPH_PAGE_BITS];
+        if (!*page) {
+            *page = malloc(sizeof(GlyphEntry) * GLYPH_PAGE_SIZE);
+            if (!*page) {
+                glyph_resolve(cache->font, codepoint, &cache->scratch);
+                return &cache->scratch;
+            }
+            for (int i = 0; i < GLYPH_PAGE_SIZE; ++i) (*page)[i].glyph = -1;
+        }
+        GlyphEntry *entry = &(*page)[codepoint & (GLYPH_PAGE_SIZE - 1)];
+        if (entry->glyph < 0) glyph_resolve(cache->font, codepoint, entry);
+        return entry;
+    }
+
+    if (cache->sparse_capacity) {
+        size_t j = hash_u32(codepoint) & (cache->sparse_capacity - 1);
+        while (cache->sparse[j].codepoint != 0) {
+            if (cache->sparse[j].codepoint == codepoint) return &cache->sparse[j].entry;
+            j = (j + 1) & (cache->sparse_capacity - 1);
+        }
+    }
+
+    // Keep the load factor under 1/2
+    if ((cache->sparse_count + 1) * 2 > cache->sparse_capacity && !glyph_sparse_grow(cache)) {
+        glyph_resolve(cache->font, codepoint, &cache->scratch);
+        return &cache->scratch;
+    }
+    size_t j = hash_u32(codepoint) & (cache->sparse_capacity - 1);
+    while (cache->sparse[j].codepoint != 0) j = (j + 1) & (cache->sparse_capacity - 1);
+    cache->sparse[j].codepoint = codepoint;
+    glyph_resolve(cache->font, codepoint, &cache->sparse[j].entry);
+    cache->sparse_count++;
+    return &cache->sparse[j].entry;
+}
+
+static bool glyph_kern_grow(GlyphCache *cache) {
+    size_t new_capacity = cache->kern_capacity ? cache->kern_capacity * 2 : 256;
+    KernSlot *slots = calloc(new_capacity, sizeof(KernSlot));
+    if (!slots) return false;
+    for (size_t i = 0; i < cache->kern_capacity; ++i) {
+        if (cache->kern[i].key == 0) continue;
+        size_t j = hash_u32(cache->kern[i].key) & (new_capacity - 1);
+        while (slots[j].key != 0) j = (j + 1) & (new_capacity - 1);
+        slots[j] = cache->kern[i];
+    }
+    free(cache->kern);
+    cache->kern = slots;
+    cache->kern_capacity = new_capacity;
+    return true;
+}
+
+// Returns the kerning adjustment (font units) between two glyphs, cached per pair.
+static int glyph_cache_kern(GlyphCache *cache, int glyph1, int glyph2) {
+    uint32_t key = (((uint32_t)glyph1 << 16) | ((uint32_t)glyph2 & 0xFFFF)) + 1;
+
+    if (cache->kern_capacity) {
+        size_t j = hash_u32(key) & (cache->kern_capacity - 1);
+        while (cache->kern[j].key != 0) {
+            if (cache->kern[j].key == key) return cache->kern[j].kern;
+            j = (j + 1) & (cache->kern_capacity - 1);
+        }
+    }
+
+    int kern = stbtt_GetGlyphKernAdvance(cache->font, glyph1, glyph2);
+    if ((cache->kern_count + 1) * 2 > cache->kern_capacity && !glyph_kern_grow(cache)) {
+        return kern;
+    }
+    size_t j = hash_u32(key) & (cache->kern_capacity - 1);
+    while (cache->kern[j].key != 0) j = (j + 1) & (cache->kern_capacity - 1);
+    cache->kern[j].key = key;
+    cache->kern[j].kern = kern;
+    cache->kern_count++;
+    return kern;
+}
+
+static void glyph_rasterize(const GlyphCache *cache, int glyph, int phase, GlyphBitmapSlot *slot) {
+    float shift_x = (float)phase / cache->subpixel_phases;
+    int x0, y0, x1, y1;
+    stbtt_GetGlyphBitmapBoxSubpixel(cache->font, glyph, cache->scale, cache->scale, shift_x, 0.0f, &x0, &y0, &x1, &y1);
+
+    slot->width = x1 - x0;
+    slot->height = y1 - y0;
+    slot->x_offset = x0;
+    slot->y_offset = y0;
+    slot->pixels = NULL;
+    if (slot->width <= 0 || slot->height <= 0) return;
+
+    slot->pixels = malloc((size_t)slot->width * slot->height);
+    if (!slot->pixels) return;
+    stbtt_MakeGlyphBitmapSubpixel(cache->font, slot->pixels, slot->width, slot->height, slot->width,
+                                  cache->scale, cache->scale, shift_x, 0.0f, glyph);
+}
+
+static bool glyph_bitmap_grow(GlyphCache *cache) {
+    size_t new_capacity = cache->bitmap_capacity ? cache->bitmap_capacity * 2 : 256;
+    GlyphBitmapSlot *slots = calloc(new_capacity, sizeof(GlyphBitmapSlot));
+    if (!slots) return false;
+    for (size_t i = 0; i < cache->bitmap_capacity; ++i) {
+        if (cache->bitmaps[i].key == 0) continue;
+        size_t j = hash_u32(cache->bitmaps[i].key) & (new_capacity - 1);
+        while (slots[j].key != 0) j = (j + 1) & (new_capacity - 1);
+        slots[j] = cache->bitmaps[i];
+    }
+    free(cache->bitmaps);
+    cache->bitmaps = slots;
+    cache->bitmap_capacity = new_capacity;
+    return true;
+}
+
+// Returns the rasterized bitmap of `glyph` shifted right by phase/subpixel_phases of a pixel.
+static const GlyphBitmapSlot *glyph_cache_bitmap(GlyphCache *cache, int glyph, int phase) {
+    uint32_t key = (((uint32_t)glyph << 4) | (uint32_t)phase) + 1;
+
+    if (cache->bitmap_capacity) {
+        size_t j = hash_u32(key) & (cache->bitmap_capacity - 1);
+        while (cache->bitmaps[j].key != 0) {
+            if (cache->bitmaps[j].key == key) return &cache->bitmaps[j];
+            j = (j + 1) & (cache->bitmap_capacity - 1);
+        }
+    }
+
+    if ((cache->bitmap_count + 1) * 2 > cache->bitmap_capacity && !glyph_bitmap_grow(cache)) {
+        free(cache->scratch_bitmap.pixels);
+        glyph_rasterize(cache, glyph, phase, &cache->scratch_bitmap);
+        return &cache->scratch_bitmap;
+    }
+    size_t j = hash_u32(key) & (cache->bitmap_capacity - 1);
+    while (cache->bitmaps[j].key != 0) j = (j + 1) & (cache->bitmap_capacity - 1);
+    cache->bitmaps[j].key = key;
+    glyph_rasterize(cache, glyph, phase, &cache->bitmaps[j]);
+    cache->bitmap_count++;
+    return &cache->bitmaps[j];
+}
+
 static void draw_char_bitmap(uint8_t* img_pixels, int img_width, int img_height,
-                      uint8_t* char_pixels, int char_width, int char_height,
+                      const uint8_t* char_pixels, int char_width, int char_height,
                       int draw_x, int draw_y,
                       uint8_t r, uint8_t g, uint8_t b) {
     for (int cy = 0; cy < char_height; ++cy) {
@@ -66,38 +363,67 @@ static void draw_char_bitmap(uint8_t* img_pixels, int img_width, int img_height,
     }
 }
 
-static int draw_text(uint8_t* img_pixels, int img_width, int img_height,
-               int start_x, int start_y, const char* text,
-               stbtt_fontinfo* font, float scale, uint8_t r, uint8_t g, uint8_t b) {
+// Draws `text_len` bytes of `text`; the span does not need to be null-terminated.
+// The pen advances in fractional pixels; each glyph is drawn from the cached
+// bitmap for the nearest subpixel phase, so spacing doesn't drift at fractional sizes.
+// `pen_x` and `prev_glyph` (-1 at the start of a line) carry over between the
+// differently colored pieces of one line, so kerning works across them.
+static void draw_text(uint8_t* img_pixels, int img_width, int img_height,
+               float *pen, int *prev_glyph_io, int start_y, const char* text, size_t text_len,
+               const stbtt_fontinfo* font, GlyphCache* cache, uint8_t r, uint8_t g, uint8_t b) {
 
-    int x_cursor = start_x;
+    float scale = cache->scale;
+    int phases = cache->subpixel_phases;
+    float pen_x = *pen;
 
     int ascent, descent, lineGap;
     stbtt_GetFontVMetrics(font, &ascent, &descent, &lineGap);
     int baseline = (int)(ascent * scale);
 
-    for (int i = 0; text[i]; ++i) {
-        int codepoint = (unsigned char)text[i];
+    int prev_glyph = *prev_glyph_io;
 
-        int char_width, char_height, x_offset, y_offset;
-        uint8_t* char_bitmap = stbtt_GetCodepointBitmap(font, 0, scale, codepoint, &char_width, &char_height, &x_offset, &y_offset);
+    for (size_t i = 0; i < text_len; ) {
+        size_t consumed;
+        uint32_t codepoint = utf8_decode(text + i, text_len - i, &consumed);
+        i += consumed;
 
-        if (char_bitmap) {
-            int draw_x = x_cursor + x_offset;
-            int draw_y = start_y + baseline + y_offset;
+        if (codepoint == '\t') {
+            // Tabs occupy 4 cells, matching the width calculation in get_code_dimensions
+            pen_x += glyph_cache_lookup(cache, ' ')->advance * scale * 4;
+            prev_glyph = -1;
+            continue;
+        }
+
+        const GlyphEntry *entry = glyph_cache_lookup(cache, codepoint);
+        int glyph = entry->glyph;
+
+        if (prev_glyph >= 0) {
+            pen_x += glyph_cache_kern(cache, prev_glyph, glyph) * scale;
+        }
+
+        // Split the pen position into a whole pixel and a quantized phase
+        float pixel_x = floorf(pen_x);
+        int phase = (int)((pen_x - pixel_x) * phases + 0.5f);
+        if (phase >= phases) {
+            pixel_x += 1.0f;
+            phase = 0;
+        }
+
+        const GlyphBitmapSlot *bitmap = glyph_cache_bitmap(cache, glyph, phase);
+        if (bitmap->pixels) {
+            int draw_x = (int)pixel_x + bitmap->x_offset;
+            int draw_y = start_y + baseline + bitmap->y_offset;
 
             draw_char_bitmap(img_pixels, img_width, img_height,
-                             char_bitmap, char_width, char_height,
+                             bitmap->pixels, bitmap->width, bitmap->height,
                              draw_x, draw_y, r, g, b);
-
-            free(char_bitmap);
         }
 
-        int advance_width;
-        stbtt_GetCodepointHMetrics(font, codepoint, &advance_width, NULL);
-        x_cursor += (int)(advance_width * scale);
+        pen_x += entry->advance * scale;
+        prev_glyph = glyph;
     }
-    return x_cursor;
+    *pen = pen_x;
+    *prev_glyph_io = prev_glyph;
 }
 
 static void add_font(const char* name, const char* path) {
@@ -191,19 +517,16 @@ static char *load_file(const char *filename, size_t *out_size) {
     return buf;
 }
 
-static void get_code_dimensions(const char* code_buffer, stbtt_fontinfo* font, float scale, float font_pixel_height, float line_spacing_multiplier, int padding, int* out_max_width, int* out_total_height) {
+// Computes the image size for `line_count` lines of `lines` (a page may hold fewer than all lines).
+static void get_code_dimensions(const LineIndex* lines, size_t line_count, const stbtt_fontinfo* font, float scale, float font_pixel_height, float line_spacing_multiplier, int padding, int* out_max_width, int* out_total_height) {
     *out_max_width = 0;
     *out_total_height = 0;
 
-    if (!code_buffer || !font) {
-        fprintf(stderr, "DEBUG: get_code_dimensions received null code_buffer or font.\n");
+    if (!lines || !font) {
+        fprintf(stderr, "DEBUG: get_code_dimensions received null line index or font.\n");
         return;
     }
 
-    int line_count = 0;
-    int current_line_char_count = 0;
-    int max_line_char_count = 0;
-
     int ascent, descent, lineGap;
     stbtt_GetFontVMetrics(font, &ascent, &descent, &lineGap);
     float font_line_height_base = (ascent - descent + lineGap) * scale;
@@ -221,27 +544,7 @@ static void get_code_dimensions(const char* code_buffer, stbtt_fontinfo* font, f
     }
     // fprintf(stderr, "DEBUG: Assumed Char Width for calculation: %.2f pixels\n", assumed_char_width);
 
-
-    for (size_t i = 0; code_buffer[i] != '\0'; ++i) {
-        int codepoint = (unsigned char)code_buffer[i];
-        if (codepoint == '\n') {
-            if (current_line_char_count > max_line_char_count) {
-                max_line_char_count = current_line_char_count;
-            }
-            current_line_char_count = 0;
-            line_count++;
-        } else if (codepoint == '\t') {
-            current_line_char_count += 4;
-        } else {
-            current_line_char_count++;
-        }
-    }
-    if (current_line_char_count > max_line_char_count) {
-        max_line_char_count = current_line_char_count;
-    }
-    line_count++;
-
-    *out_max_width = (int)(max_line_char_count * assumed_char_width + 0.5f);
+    *out_max_width = (int)(lines->max_columns * assumed_char_width + 0.5f);
     *out_max_width += 2 * padding;
 
     *out_total_height = (int)(line_count * font_line_height_base * line_spacing_multiplier + 0.5f);
@@ -250,11 +553,255 @@ static void get_code_dimensions(const char* code_buffer, stbtt_fontinfo* font, f
     if (*out_max_width < (int)(font_pixel_height * 10)) *out_max_width = (int)(font_pixel_height * 10);
     if (*out_total_height < (int)(font_pixel_height * 3)) *out_total_height = (int)(font_pixel_height * 3);
 
-    // fprintf(stderr, "DEBUG: Lines: %d, Max Chars per line: %d\n", line_count, max_line_char_count);
+    // fprintf(stderr, "DEBUG: Lines: %zu, Max Chars per line: %zu\n", line_count, lines->max_columns);
     // fprintf(stderr, "DEBUG: Calculated Image Dimensions (before user override): %dx%d\n", *out_max_width, *out_total_height);
 }
 
+// --- Color Runs ---
+
+// Index of the first of the sorted `runs` that ends after byte `offset`
+static size_t first_color_run(const CodeImageColorRun *runs, size_t run_count, size_t offset) {
+    size_t run = 0, run_hi = run_count;
+    while (run < run_hi) {
+        size_t mid = run + (run_hi - run) / 2;
+        if (runs[mid].end <= offset) run = mid + 1;
+        else run_hi = mid;
+    }
+    return run;
+}
+
+// Splits a line into pieces of one color each. For the piece of the line starting at
+// `offset` (the line starts at byte `line_start` and is `line_len` bytes long), sets
+// *piece_end to the offset where it ends and returns its color, or NULL for the text
+// color. `*run` is the current run, advanced as the line is walked.
+static const uint8_t *next_color_piece(const CodeImageColorRun *runs, size_t run_count, size_t *run,
+                                       size_t line_start, size_t offset, size_t line_len, size_t *piece_end) {
+    while (*run < run_count && runs[*run].end <= line_start + offset) (*run)++;
+    *piece_end = line_len;
+    if (*run < run_count && runs[*run].start <= line_start + offset) {
+        if (runs[*run].end < line_start + line_len) *piece_end = runs[*run].end - line_start;
+        return runs[*run].rgb;
+    }
+    if (*run < run_count && runs[*run].start < line_start + line_len) *piece_end = runs[*run].start - line_start;
+    return NULL;
+}
+
+// --- Page Rendering ---
+
+// Shared state for rendering a file as one or more pages. Pages only read the
+// line index and font, so each one can be rendered on its own thread.
+typedef struct {
+    const stbtt_fontinfo *font;
+    const LineIndex *lines;
+    float scale;
+    float font_size;
+    float line_spacing_multiplier;
+    int inner_padding;
+    int img_width;
+    int fixed_height;        // User-provided height, 0 to fit each page's content
+    int subpixel_phases;
+    uint8_t code_background[3];
+    uint8_t text_color[3];
+    const CodeImageColorRun *color_runs;
+    size_t color_run_count;
+    size_t lines_per_page;
+    size_t page_count;
+    const char *output_path;
+    bool numbered;           // Pages are written as <name>-001.png, <name>-002.png, ...
+
+    char **page_paths;
+    int *page_heights;
+    int *page_status;
+
+    pthread_mutex_t lock;
+    size_t next_page;
+} PageJob;
+
+// Builds "<stem>-NNN<ext>" from the output path, e.g. out.png -> out-001.png.
+static char *page_path_for(const char *output_path, size_t page) {
+    const char *slash = strrchr(output_path, '/');
+    const char *dot = strrchr(output_path, '.');
+    if (!dot || (slash && dot < slash)) dot = output_path + strlen(output_path);
+
+    size_t stem_len = (size_t)(dot - output_path);
+    size_t size = strlen(output_path) + 32;
+    char *path = malloc(size);
+    if (!path) return NULL;
+    snprintf(path, size, "%.*s-%03zu%s", (int)stem_len, output_path, page + 1, dot);
+    return path;
+}
+
+static int render_page(PageJob *job, GlyphCache *glyph_cache, size_t page) {
+    const LineIndex *lines = job->lines;
+    size_t first_line = page * job->lines_per_page;
+    size_t last_line = first_line + job->lines_per_page;
+    if (last_line > lines->line_count) last_line = lines->line_count;
+
+    // Width is shared by all pages; only the height depends on this page's lines
+    int calculated_img_width, calculated_img_height;
+    get_code_dimensions(lines, last_line - first_line, job->font, job->scale, job->font_size, job->line_spacing_multiplier, job->inner_padding, &calculated_img_width, &calculated_img_height);
+
+    int img_width = job->img_width;
+    int img_height = (job->fixed_height > 0) ? job->fixed_height : calculated_img_height;
+    if (img_height < 100) img_height = 100;
+    job->page_heights[page] = img_height;
+
+    // Allocate memory for image pixels
+    uint8_t *pixels = (uint8_t *)malloc((size_t)img_width * img_height * CHANNELS);
+    if (!pixels) {
+        fprintf(stderr, "Failed to allocate pixel buffer memory!\n");
+        return 1;
+    }
+
+    // --- Define Colors ---
+    uint8_t bg_r, bg_g, bg_b;
+    uint8_t code_bg_r = job->code_background[0], code_bg_g = job->code_background[1], code_bg_b = job->code_background[2];
+    uint8_t default_text_r = job->text_color[0], default_text_g = job->text_color[1], default_text_b = job->text_color[2];
+
+    hex_to_rgb("#1a1a1a", &bg_r, &bg_g, &bg_b);
+
+
+    // --- 3. Fill Background ---
+    for (int y = 0; y < img_height; ++y) {
+        for (int x = 0; x < img_width; ++x) {
+            int index = (y * img_width + x) * CHANNELS;
+            pixels[index + 0] = bg_r;
+            pixels[index + 1] = bg_g;
+            pixels[index + 2] = bg_b;
+        }
+    }
+
+    // --- 4. Draw Code Block Background ---
+    int inner_padding = job->inner_padding;
+    int code_block_x = inner_padding;
+    int code_block_y = inner_padding;
+    int code_block_width = img_width - 2 * inner_padding;
+    int code_block_height = img_height - 2 * inner_padding;
+
+    for (int y = code_block_y; y < code_block_y + code_block_height; ++y) {
+        for (int x = code_block_x; x < code_block_x + code_block_width; ++x) {
+            if (x >=0 && x < img_width && y >= 0 && y < img_height) { // Safety check
+                int index = (y * img_width + x) * CHANNELS;
+                pixels[index + 0] = code_bg_r;
+                pixels[index + 1] = code_bg_g;
+                pixels[index + 2] = code_bg_b;
+            }
+        }
+    }
+
+    // --- 5. Draw Loaded Code Content ---
+    int current_line_y = code_block_y + (int)(job->font_size * 0.25);
+    float line_spacing_factor = 1.5f;
+    
+    int ascent_draw, descent_draw, lineGap_draw;
+    stbtt_GetFontVMetrics(job->font, &ascent_draw, &descent_draw, &lineGap_draw);
+    float actual_font_line_height = (ascent_draw - descent_draw + lineGap_draw) * job->scale * line_spacing_factor;
+
+    // First color run that ends after the start of the page
+    const CodeImageColorRun *runs = job->color_runs;
+    size_t run_count = runs ? job->color_run_count : 0;
+    size_t run = first_color_run(runs, run_count, lines->line_starts[first_line]);
+
+    for (size_t line = first_line; line < last_line && current_line_y < img_height; ++line) {
+        size_t line_len;
+        const char *line_text = line_index_line(lines, line, &line_len);
+        size_t line_start = (size_t)(line_text - lines->source);
+
+        // Draw the line in pieces of one color each
+        float pen_x = (float)(code_block_x + 10);
+        int prev_glyph = -1;
+        size_t offset = 0;
+        while (offset < line_len) {
+            size_t piece_end;
+            const uint8_t *rgb = next_color_piece(runs, run_count, &run, line_start, offset, line_len, &piece_end);
+            draw_text(pixels, img_width, img_height, &pen_x, &prev_glyph, current_line_y,
+                      line_text + offset, piece_end - offset, job->font, glyph_cache,
+                      rgb ? rgb[0] : default_text_r, rgb ? rgb[1] : default_text_g, rgb ? rgb[2] : default_text_b);
+            offset = piece_end;
+        }
+        current_line_y += (int)actual_font_line_height;
+    }
+
+
+    // --- 6. Save the Image ---
+    const char *page_path = job->numbered ? job->page_paths[page] : job->output_path;
+    int result = 0;
+    if (!stbi_write_png(page_path, img_width, img_height, CHANNELS, pixels, img_width * CHANNELS)) {
+        fprintf(stderr, "Failed to write PNG file '%s'!\n", page_path);
+        result = 1;
+    }
+    free(pixels);
+    return result;
+}
+
+static void *page_worker(void *arg) {
+    PageJob *job = (PageJob *)arg;
+    GlyphCache glyph_cache;
+    glyph_cache_init(&glyph_cache, job->font, job->scale, job->subpixel_phases);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t page = job->next_page++;
+        pthread_mutex_unlock(&job->lock);
+        if (page >= job->page_count) break;
+        job->page_status[page] = render_page(job, &glyph_cache, page);
+    }
+
+    glyph_cache_free(&glyph_cache);
+    return NULL;
+}
+
+static void json_write_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)str; *c; ++c) {
+        if (*c == '"' || *c == '\\') fprintf(out, "\\%c", *c);
+        else if (*c < 0x20) fprintf(out, "\\u%04x", *c);
+        else fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static int write_page_manifest(const PageJob *job, const char *manifest_path, const char *input_file_path) {
+    FILE *out = fopen(manifest_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open manifest file '%s'.\n", manifest_path);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"source\": ");
+    json_write_string(out, input_file_path);
+    fprintf(out, ",\n  \"line_count\": %zu,\n", job->lines->line_count);
+    fprintf(out, "  \"lines_per_page\": %zu,\n", job->lines_per_page);
+    fprintf(out, "  \"width\": %d,\n", job->img_width);
+    fprintf(out, "  \"pages\": [\n");
+    for (size_t page = 0; page < job->page_count; ++page) {
+        size_t first_line = page * job->lines_per_page;
+        size_t last_line = first_line + job->lines_per_page;
+        if (last_line > job->lines->line_count) last_line = job->lines->line_count;
+
+        fprintf(out, "    {\"file\": ");
+        json_write_string(out, job->numbered ? job->page_paths[page] : job->output_path);
+        fprintf(out, ", \"first_line\": %zu, \"last_line\": %zu, \"height\": %d}%s\n",
+                first_line + 1, last_line, job->page_heights[page], (page + 1 < job->page_count) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error: Failed to write manifest file '%s'.\n", manifest_path);
+        return 1;
+    }
+    return 0;
+}
+
 // --- Public API Function ---
+void code_image_options_init(CodeImageOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->font_size = 18.0f;
+    options->subpixel_phases = CODE_IMAGE_DEFAULT_SUBPIXEL_PHASES;
+    hex_to_rgb("#0d0d0d", &options->code_background[0], &options->code_background[1], &options->code_background[2]);
+    hex_to_rgb("#f8f8f2", &options->text_color[0], &options->text_color[1], &options->text_color[2]);
+}
+
 int code_to_image_generate(
     const char *input_file_path,
     const char *output_image_path,
@@ -263,36 +810,103 @@ int code_to_image_generate(
     int img_width_arg,
     int img_height_arg
 ) {
-    if (discovered_fonts) {
-        free_discovered_fonts_internal();
+    CodeImageOptions options;
+    code_image_options_init(&options);
+    options.font_name = font_name;
+    options.font_size = font_size;
+    options.img_width = img_width_arg;
+    options.img_height = img_height_arg;
+    return code_to_image_generate_ex(input_file_path, output_image_path, &options);
+}
+
+// Fonts mapped by code_image_preload_fonts, in discovery order, kept for the rest of the
+// process. They are mapped rather than read so that they take no heap and a fork copies
+// no page tables for them.
+typedef struct {
+    char *name;
+    const unsigned char *data;
+    size_t size;
+} PreloadedFont;
+
+static PreloadedFont *preloaded_fonts; // NULL until preloaded
+static int preloaded_fonts_count = 0;
+
+static pthread_mutex_t font_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const PreloadedFont *find_preloaded_font(const char *font_name) {
+    const PreloadedFont *font = NULL;
+    if (!font_name && preloaded_fonts_count > 0) {
+        font = &preloaded_fonts[0];
+        fprintf(stderr, "No font specified. Defaulting to '%s'.\n", font->name);
+    } else if (!font_name) {
+        fprintf(stderr, "Error: No fonts found in 'modules/Fonts/' directory. Cannot proceed without a font.\n");
+    } else {
+        for (int i = 0; i < preloaded_fonts_count && !font; ++i) {
+            if (strcmp(font_name, preloaded_fonts[i].name) == 0) font = &preloaded_fonts[i];
+        }
+        if (!font) fprintf(stderr, "Error: Specified font '%s' not found.\n", font_name);
     }
-    collect_fonts_recursive("modules/Fonts");
+    return font;
+}
 
-    char *code_content = NULL;
-    size_t code_content_size = 0;
-    
-    if (!input_file_path) {
-        fprintf(stderr, "Error: Input file path is NULL.\n");
+int code_image_preload_fonts(void) {
+    pthread_mutex_lock(&font_lock);
+    if (!preloaded_fonts) {
+        if (discovered_fonts) {
+            free_discovered_fonts_internal();
+        }
+        collect_fonts_recursive("modules/Fonts");
+        preloaded_fonts = calloc(discovered_fonts_count > 0 ? discovered_fonts_count : 1, sizeof(PreloadedFont));
+        for (int i = 0; preloaded_fonts && i < discovered_fonts_count; ++i) {
+            PreloadedFont *font = &preloaded_fonts[preloaded_fonts_count];
+            int fd = open(discovered_fonts[i].path, O_RDONLY);
+            struct stat font_stat;
+            void *data = MAP_FAILED;
+            if (fd >= 0 && fstat(fd, &font_stat) == 0 && font_stat.st_size > 0) {
+                data = mmap(NULL, (size_t)font_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            if (fd >= 0) close(fd);
+            font->name = data != MAP_FAILED ? strdup(discovered_fonts[i].name) : NULL;
+            if (font->name) {
+                font->data = data;
+                font->size = (size_t)font_stat.st_size;
+                preloaded_fonts_count++;
+            } else {
+                fprintf(stderr, "Error: Could not read font file '%s'.\n", discovered_fonts[i].path);
+                if (data != MAP_FAILED) munmap(data, (size_t)font_stat.st_size);
+            }
+        }
         free_discovered_fonts_internal();
-        return 1;
     }
+    int count = preloaded_fonts_count;
+    pthread_mutex_unlock(&font_lock);
+    return count;
+}
 
-    code_content = load_file(input_file_path, &code_content_size);
-    if (!code_content) {
-        fprintf(stderr, "Error: Could not read input file '%s'.\n", input_file_path);
+// Finds `font_name` (NULL = the first font found) under modules/Fonts, or among the
+// preloaded fonts, and returns its contents. A preloaded font is returned as mapped and
+// `*out_buffer` is NULL; otherwise the file is read into `*out_buffer`, which the caller
+// frees. The font list is shared, so images generated on several threads at once take
+// turns here.
+static const unsigned char *load_font(const char *font_name, unsigned char **out_buffer) {
+    *out_buffer = NULL;
+    pthread_mutex_lock(&font_lock);
+    if (preloaded_fonts) {
+        const PreloadedFont *font = find_preloaded_font(font_name);
+        pthread_mutex_unlock(&font_lock);
+        return font ? font->data : NULL;
+    }
+    if (discovered_fonts) {
         free_discovered_fonts_internal();
-        return 1;
     }
+    collect_fonts_recursive("modules/Fonts");
 
     const char* font_to_load_path = NULL;
     if (!font_name && discovered_fonts_count > 0) {
         font_to_load_path = discovered_fonts[0].path;
         fprintf(stderr, "No font specified. Defaulting to '%s'.\n", discovered_fonts[0].name);
-    } else if (!font_name && discovered_fonts_count == 0) {
-         fprintf(stderr, "Error: No fonts found in 'modules/Fonts/' directory. Cannot proceed without a font.\n");
-         free(code_content);
-         free_discovered_fonts_internal();
-         return 1;
+    } else if (!font_name) {
+        fprintf(stderr, "Error: No fonts found in 'modules/Fonts/' directory. Cannot proceed without a font.\n");
     } else {
         for (int i = 0; i < discovered_fonts_count; ++i) {
             if (strcmp(font_name, discovered_fonts[i].name) == 0) {
@@ -302,168 +916,689 @@ int code_to_image_generate(
         }
         if (!font_to_load_path) {
             fprintf(stderr, "Error: Specified font '%s' not found.\n", font_name);
-            free(code_content);
-            free_discovered_fonts_internal();
-            return 1;
         }
     }
 
-    long font_buffer_size;
     unsigned char* font_buffer = NULL;
-
-    FILE* font_file = fopen(font_to_load_path, "rb");
-    if (!font_file) {
+    FILE* font_file = font_to_load_path ? fopen(font_to_load_path, "rb") : NULL;
+    if (font_to_load_path && !font_file) {
         fprintf(stderr, "Error: Could not open font file '%s'. This should not happen if discovered correctly.\n", font_to_load_path);
-        free(code_content);
-        free_discovered_fonts_internal();
-        return 1;
+    }
+    if (font_file) {
+        fseek(font_file, 0, SEEK_END);
+        long font_buffer_size = ftell(font_file);
+        fseek(font_file, 0, SEEK_SET);
+
+        font_buffer = (font_buffer_size > 0) ? (unsigned char*)malloc(font_buffer_size) : NULL;
+        if (!font_buffer) {
+            fprintf(stderr, "Failed to allocate font buffer memory!\n");
+        } else if (fread(font_buffer, 1, font_buffer_size, font_file) != (size_t)font_buffer_size) {
+            fprintf(stderr, "Error: Could not read font file '%s'.\n", font_to_load_path);
+            free(font_buffer);
+            font_buffer = NULL;
+        }
+        fclose(font_file);
     }
 
-    fseek(font_file, 0, SEEK_END);
-    font_buffer_size = ftell(font_file);
-    fseek(font_file, 0, SEEK_SET);
+    free_discovered_fonts_internal();
+    pthread_mutex_unlock(&font_lock);
+    *out_buffer = font_buffer;
+    return font_buffer;
+}
 
-    font_buffer = (unsigned char*)malloc(font_buffer_size);
-    if (!font_buffer) {
-        fprintf(stderr, "Failed to allocate font buffer memory!\n");
-        fclose(font_file);
-        free(code_content);
-        free_discovered_fonts_internal();
-        return 1;
+// --- Source And Font ---
+
+// What drawing the code takes, shared by the PNG and SVG writers
+typedef struct {
+    char *code_content; // Read from the input file; NULL when drawing the caller's buffer
+    const char *code;
+    size_t code_size;
+    unsigned char *font_buffer; // The font read for this image; NULL when it is a preloaded mapping
+    stbtt_fontinfo font;
+    float scale;
+    LineIndex own_lines;
+    const LineIndex *lines;
+} CodeSource;
+
+static void code_source_close(CodeSource *source) {
+    if (source->lines == &source->own_lines) line_index_free(&source->own_lines);
+    free(source->font_buffer);
+    free(source->code_content);
+}
+
+// Loads the code (the caller's buffer, or the input file), the font and the line index
+// that `options` ask for. Prints the problem and returns false on failure.
+static bool code_source_open(CodeSource *source, const char *input_file_path, const CodeImageOptions *options) {
+    memset(source, 0, sizeof(*source));
+    source->code = options->code;
+    source->code_size = options->code_size;
+    if (!source->code) {
+        if (!input_file_path) {
+            fprintf(stderr, "Error: Input file path is NULL.\n");
+            return false;
+        }
+        source->code_content = load_file(input_file_path, &source->code_size);
+        if (!source->code_content) {
+            fprintf(stderr, "Error: Could not read input file '%s'.\n", input_file_path);
+            return false;
+        }
+        source->code = source->code_content;
     }
-    fread(font_buffer, 1, font_buffer_size, font_file);
-    fclose(font_file);
 
-    stbtt_fontinfo font_info;
-    if (!stbtt_InitFont(&font_info, font_buffer, 0)) {
-        fprintf(stderr, "Failed to initialize font from '%s'!\n", font_to_load_path);
-        free(font_buffer);
-        free(code_content);
-        free_discovered_fonts_internal();
-        return 1;
+    const unsigned char *font_data = load_font(options->font_name, &source->font_buffer);
+    if (!font_data) {
+        code_source_close(source);
+        return false;
+    }
+    if (!stbtt_InitFont(&source->font, font_data, 0)) {
+        fprintf(stderr, "Failed to initialize font '%s'!\n", options->font_name ? options->font_name : "(default)");
+        code_source_close(source);
+        return false;
     }
+    source->scale = stbtt_ScaleForPixelHeight(&source->font, options->font_size);
+
+    // The caller's index is used when it describes this very buffer
+    source->lines = options->lines;
+    if (!source->lines || source->lines->source != source->code || source->lines->source_size != source->code_size) {
+        source->lines = NULL;
+        if (!line_index_build(&source->own_lines, source->code, source->code_size)) {
+            fprintf(stderr, "Failed to allocate line index memory!\n");
+            code_source_close(source);
+            return false;
+        }
+        source->lines = &source->own_lines;
+    }
+    return true;
+}
 
-    float scale = stbtt_ScaleForPixelHeight(&font_info, font_size);
+int code_to_image_generate_ex(
+    const char *input_file_path,
+    const char *output_image_path,
+    const CodeImageOptions *options
+) {
+    float font_size = options->font_size;
+
+    CodeSource source;
+    if (!code_source_open(&source, input_file_path, options)) return 1;
+    const LineIndex *lines = source.lines;
+    const stbtt_fontinfo *font_info = &source.font;
+    float scale = source.scale;
 
     // --- Determine Image Dimensions ---
     int calculated_img_width, calculated_img_height;
     float line_spacing_multiplier = 1.5f;
     int inner_padding = 20;
 
-    get_code_dimensions(code_content, &font_info, scale, font_size, line_spacing_multiplier, inner_padding, &calculated_img_width, &calculated_img_height);
+    get_code_dimensions(lines, lines->line_count, font_info, scale, font_size, line_spacing_multiplier, inner_padding, &calculated_img_width, &calculated_img_height);
+
+    // Use user-provided width if available, otherwise use calculated one
+    int img_width = (options->img_width > 0) ? options->img_width : calculated_img_width;
 
-    // Use user-provided dimensions if available, otherwise use calculated ones
-    int img_width = (img_width_arg > 0) ? img_width_arg : calculated_img_width;
-    int img_height = (img_height_arg > 0) ? img_height_arg : calculated_img_height;
-    
     // Ensure minimums if calculated dimensions are too small or user provides tiny ones
     if (img_width < 200) img_width = 200;
-    if (img_height < 100) img_height = 100;
 
+    // --- Split Into Pages ---
+    PageJob job;
+    memset(&job, 0, sizeof(job));
+    job.font = font_info;
+    job.lines = lines;
+    job.scale = scale;
+    job.font_size = font_size;
+    job.line_spacing_multiplier = line_spacing_multiplier;
+    job.inner_padding = inner_padding;
+    job.img_width = img_width;
+    job.fixed_height = options->img_height;
+    job.subpixel_phases = (options->subpixel_phases > 0) ? options->subpixel_phases : CODE_IMAGE_DEFAULT_SUBPIXEL_PHASES;
+    memcpy(job.code_background, options->code_background, sizeof(job.code_background));
+    memcpy(job.text_color, options->text_color, sizeof(job.text_color));
+    job.color_runs = options->color_runs;
+    job.color_run_count = options->color_run_count;
+    job.output_path = output_image_path;
+    job.lines_per_page = lines->line_count;
+
+    if (options->max_lines_per_page > 0 && (size_t)options->max_lines_per_page < job.lines_per_page) {
+        job.lines_per_page = (size_t)options->max_lines_per_page;
+    }
+    if (options->max_page_height > 0) {
+        // Lines are drawn on an integer pixel grid below the top padding, see render_page
+        int ascent, descent, lineGap;
+        stbtt_GetFontVMetrics(font_info, &ascent, &descent, &lineGap);
+        int line_step = (int)((ascent - descent + lineGap) * scale * line_spacing_multiplier);
+        int usable = options->max_page_height - 2 * inner_padding - (int)(font_size * 0.25);
+        size_t fitting = (line_step > 0 && usable > line_step) ? (size_t)(usable / line_step) : 1;
+        if (fitting < job.lines_per_page) job.lines_per_page = fitting;
+        if (job.fixed_height <= 0 || job.fixed_height > options->max_page_height) {
+            job.fixed_height = 0;
+        }
+    }
+    if (job.lines_per_page == 0) job.lines_per_page = 1;
+
+    job.page_count = (lines->line_count + job.lines_per_page - 1) / job.lines_per_page;
+    job.numbered = options->max_lines_per_page > 0 || options->max_page_height > 0;
+
+    job.page_paths = calloc(job.page_count, sizeof(char *));
+    job.page_heights = calloc(job.page_count, sizeof(int));
+    job.page_status = calloc(job.page_count, sizeof(int));
+    bool setup_ok = job.page_paths && job.page_heights && job.page_status;
+    for (size_t page = 0; setup_ok && job.numbered && page < job.page_count; ++page) {
+        job.page_paths[page] = page_path_for(output_image_path, page);
+        if (!job.page_paths[page]) setup_ok = false;
+    }
 
-    // Allocate memory for image pixels
-    uint8_t *pixels = (uint8_t *)malloc(img_width * img_height * CHANNELS); 
-    if (!pixels) {
-        fprintf(stderr, "Failed to allocate pixel buffer memory!\n");
-        free(font_buffer);
-        free(code_content);
-        free_discovered_fonts_internal();
-        return 1;
+    int result = 0;
+    if (!setup_ok) {
+        fprintf(stderr, "Failed to allocate page table memory!\n");
+        result = 1;
+    } else {
+        // --- Render Pages ---
+        int thread_count = options->threads;
+        if (thread_count <= 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            thread_count = (cpus > 0) ? (int)cpus : 1;
+        }
+        if ((size_t)thread_count > job.page_count) thread_count = (int)job.page_count;
+
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_t *threads = (thread_count > 1) ? malloc(sizeof(pthread_t) * thread_count) : NULL;
+        int started = 0;
+        if (threads) {
+            for (; started < thread_count; ++started) {
+                if (pthread_create(&threads[started], NULL, page_worker, &job) != 0) break;
+            }
+        }
+        if (started == 0) {
+            page_worker(&job); // Single page, single CPU, or threads unavailable
+        }
+        for (int t = 0; t < started; ++t) {
+            pthread_join(threads[t], NULL);
+        }
+        free(threads);
+        pthread_mutex_destroy(&job.lock);
+
+        for (size_t page = 0; page < job.page_count; ++page) {
+            if (job.page_status[page] != 0) result = 1;
+        }
+
+        if (result == 0 && options->manifest_path) {
+            result = write_page_manifest(&job, options->manifest_path, input_file_path);
+        }
     }
 
+    // --- Cleanup ---
+    for (size_t page = 0; job.page_paths && page < job.page_count; ++page) {
+        free(job.page_paths[page]);
+    }
+    free(job.page_paths);
+    free(job.page_heights);
+    free(job.page_status);
+    code_source_close(&source);
+    return result;
+}
 
-    // --- Define Colors ---
-    uint8_t bg_r, bg_g, bg_b;
-    uint8_t code_bg_r, code_bg_g, code_bg_b;
-    uint8_t default_text_r, default_text_g, default_text_b;
+// --- SVG Output ---
 
-    hex_to_rgb("#1a1a1a", &bg_r, &bg_g, &bg_b);
-    hex_to_rgb("#0d0d0d", &code_bg_r, &code_bg_g, &code_bg_b);
-    hex_to_rgb("#f8f8f2", &default_text_r, &default_text_g, &default_text_b);
+// The SVG is laid out on the grid of a PNG from code_to_image_generate_ex. In glyph
+// mode each glyph outline is a <path> in <defs>, in font units with y flipped, and text
+// is drawn by placing it with <use> under one scale transform, so positions stay integers.
+// Words (runs of inked glyphs of one color between blanks) that recur are defined once
+// too, with their glyphs at their kerned offsets, and then placed whole.
 
+#define SVG_PAGE_BACKGROUND "#1a1a1a" // Around the code block, as in the PNG
 
-    // --- 3. Fill Background ---
-    for (int y = 0; y < img_height; ++y) {
-        for (int x = 0; x < img_width; ++x) {
-            int index = (y * img_width + x) * CHANNELS;
-            pixels[index + 0] = bg_r;
-            pixels[index + 1] = bg_g;
-            pixels[index + 2] = bg_b;
+// Positions in pixels
+typedef struct {
+    int width;
+    int height;
+    int padding;
+    int left;          // Where every line starts
+    int baseline;      // Baseline of the first line
+    int line_step;
+    size_t line_count; // Lines that start inside the image
+} SvgGeometry;
+
+// A glyph of a word, `x` font units after the word's first glyph
+typedef struct {
+    int32_t glyph;
+    int32_t x;
+} SvgWordGlyph;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t length;
+    size_t first; // Its glyphs are SvgLayout.glyphs[first, first + length)
+    size_t uses;
+} SvgWord;
+
+// A word placed on a line
+typedef struct {
+    size_t line;
+    uint32_t word;
+    int32_t x;      // Font units from the start of the line
+    uint32_t color; // Index into SvgLayout.colors
+} SvgPlacement;
+
+typedef struct {
+    const stbtt_fontinfo *font;
+    GlyphCache cache;
+    uint8_t *glyph_ink;   // Per glyph: 0 until seen, then 1 for blank glyphs and 2 for drawn ones
+    SvgWordGlyph *glyphs;
+    size_t glyph_count;
+    size_t glyph_capacity;
+    SvgWord *words;
+    size_t word_count;
+    size_t word_capacity;
+    uint32_t *word_slots; // Open-addressed word index + 1, 0 marks an empty slot
+    size_t slot_capacity;
+    SvgPlacement *placements;
+    size_t placement_count;
+    size_t placement_capacity;
+    uint8_t (*colors)[3]; // Distinct colors, the text color first
+    size_t color_count;
+    size_t color_capacity;
+} SvgLayout;
+
+static bool svg_grow(void **items, size_t *capacity, size_t count, size_t item_size) {
+    if (count <= *capacity) return true;
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < count) new_capacity *= 2;
+    void *grown = realloc(*items, new_capacity * item_size);
+    if (!grown) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Index of `rgb` in layout->colors, added if new; UINT32_MAX if memory runs out
+static uint32_t svg_color(SvgLayout *layout, const uint8_t rgb[3]) {
+    for (size_t i = 0; i < layout->color_count; ++i) {
+        if (memcmp(layout->colors[i], rgb, 3) == 0) return (uint32_t)i;
+    }
+    if (!svg_grow((void **)&layout->colors, &layout->color_capacity, layout->color_count + 1, sizeof(layout->colors[0]))) {
+        return UINT32_MAX;
+    }
+    memcpy(layout->colors[layout->color_count], rgb, 3);
+    return (uint32_t)layout->color_count++;
+}
+
+static bool svg_glyph_drawn(SvgLayout *layout, int glyph) {
+    if (glyph < 0 || glyph >= layout->font->numGlyphs) return false;
+    if (!layout->glyph_ink[glyph]) layout->glyph_ink[glyph] = stbtt_IsGlyphEmpty(layout->font, glyph) ? 1 : 2;
+    return layout->glyph_ink[glyph] == 2;
+}
+
+static bool svg_rehash_words(SvgLayout *layout) {
+    size_t new_capacity = layout->slot_capacity ? layout->slot_capacity * 2 : 1024;
+    uint32_t *slots = calloc(new_capacity, sizeof(uint32_t));
+    if (!slots) return false;
+    for (size_t i = 0; i < layout->word_count; ++i) {
+        size_t j = layout->words[i].hash & (new_capacity - 1);
+        while (slots[j] != 0) j = (j + 1) & (new_capacity - 1);
+        slots[j] = (uint32_t)i + 1;
+    }
+    free(layout->word_slots);
+    layout->word_slots = slots;
+    layout->slot_capacity = new_capacity;
+    return true;
+}
+
+// Ends the word whose glyphs were appended from *first on, if any: finds it among the
+// words seen before (dropping the copy) or adds it, and places it. *first then marks
+// where the next word starts.
+static bool svg_end_word(SvgLayout *layout, size_t *first, size_t line, int32_t x, uint32_t color) {
+    size_t length = layout->glyph_count - *first;
+    if (length == 0) return true;
+    const SvgWordGlyph *glyphs = &layout->glyphs[*first];
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (uint32_t)glyphs[i].glyph) * 16777619u;
+        hash = (hash ^ (uint32_t)glyphs[i].x) * 16777619u;
+    }
+
+    // Keep the load factor under 1/2
+    if ((layout->word_count + 1) * 2 > layout->slot_capacity && !svg_rehash_words(layout)) return false;
+    size_t j = hash & (layout->slot_capacity - 1);
+    uint32_t word = UINT32_MAX;
+    while (layout->word_slots[j] != 0) {
+        const SvgWord *seen = &layout->words[layout->word_slots[j] - 1];
+        if (seen->hash == hash && seen->length == length &&
+            memcmp(&layout->glyphs[seen->first], glyphs, length * sizeof(SvgWordGlyph)) == 0) {
+            word = layout->word_slots[j] - 1;
+            layout->glyph_count = *first;
+            break;
         }
+        j = (j + 1) & (layout->slot_capacity - 1);
     }
+    if (word == UINT32_MAX) {
+        if (!svg_grow((void **)&layout->words, &layout->word_capacity, layout->word_count + 1, sizeof(SvgWord))) return false;
+        word = (uint32_t)layout->word_count++;
+        layout->words[word] = (SvgWord){hash, (uint32_t)length, *first, 0};
+        layout->word_slots[j] = word + 1;
+    }
+    layout->words[word].uses++;
 
-    // --- 4. Draw Code Block Background ---
-    int code_block_x = inner_padding;
-    int code_block_y = inner_padding;
-    int code_block_width = img_width - 2 * inner_padding;
-    int code_block_height = img_height - 2 * inner_padding;
+    if (!svg_grow((void **)&layout->placements, &layout->placement_capacity, layout->placement_count + 1, sizeof(SvgPlacement))) {
+        return false;
+    }
+    layout->placements[layout->placement_count++] = (SvgPlacement){line, word, x, color};
+    *first = layout->glyph_count;
+    return true;
+}
 
-    for (int y = code_block_y; y < code_block_y + code_block_height; ++y) {
-        for (int x = code_block_x; x < code_block_x + code_block_width; ++x) {
-            if (x >=0 && x < img_width && y >= 0 && y < img_height) { // Safety check
-                int index = (y * img_width + x) * CHANNELS;
-                pixels[index + 0] = code_bg_r;
-                pixels[index + 1] = code_bg_g;
-                pixels[index + 2] = code_bg_b;
+// Lays out the first `line_count` lines as words, with the pen, kerning and tab widths of draw_text
+static bool svg_layout_lines(SvgLayout *layout, const LineIndex *lines, size_t line_count,
+                             const CodeImageColorRun *runs, size_t run_count, const uint8_t text_color[3]) {
+    int32_t tab_advance = glyph_cache_lookup(&layout->cache, ' ')->advance * 4;
+    size_t run = 0;
+    for (size_t line = 0; line < line_count; ++line) {
+        size_t line_len;
+        const char *line_text = line_index_line(lines, line, &line_len);
+        size_t line_start = (size_t)(line_text - lines->source);
+
+        int32_t pen = 0;
+        int prev_glyph = -1;
+        size_t word_first = layout->glyph_count;
+        int32_t word_x = 0;
+        uint32_t word_color = 0;
+        size_t offset = 0;
+        while (offset < line_len) {
+            size_t piece_end;
+            const uint8_t *rgb = next_color_piece(runs, run_count, &run, line_start, offset, line_len, &piece_end);
+            uint32_t color = svg_color(layout, rgb ? rgb : text_color);
+            if (color == UINT32_MAX) return false;
+
+            for (size_t i = offset; i < piece_end; ) {
+                size_t consumed;
+                uint32_t codepoint = utf8_decode(line_text + i, piece_end - i, &consumed);
+                i += consumed;
+                if (codepoint == '\t') {
+                    if (!svg_end_word(layout, &word_first, line, word_x, word_color)) return false;
+                    pen += tab_advance;
+                    prev_glyph = -1;
+                    continue;
+                }
+
+                const GlyphEntry *entry = glyph_cache_lookup(&layout->cache, codepoint);
+                int glyph = entry->glyph;
+                int32_t advance = entry->advance;
+                if (prev_glyph >= 0) pen += glyph_cache_kern(&layout->cache, prev_glyph, glyph);
+                bool drawn = svg_glyph_drawn(layout, glyph);
+                if (!drawn || color != word_color) {
+                    if (!svg_end_word(layout, &word_first, line, word_x, word_color)) return false;
+                }
+                if (drawn) {
+                    if (layout->glyph_count == word_first) {
+                        word_x = pen;
+                        word_color = color;
+                    }
+                    if (!svg_grow((void **)&layout->glyphs, &layout->glyph_capacity, layout->glyph_count + 1, sizeof(SvgWordGlyph))) {
+                        return false;
+                    }
+                    layout->glyphs[layout->glyph_count++] = (SvgWordGlyph){glyph, pen - word_x};
+                }
+                pen += advance;
+                prev_glyph = glyph;
             }
+            offset = piece_end;
         }
+        if (!svg_end_word(layout, &word_first, line, word_x, word_color)) return false;
     }
+    return true;
+}
 
-    // --- 5. Draw Loaded Code Content ---
-    int current_line_y = code_block_y + (int)(font_size * 0.25);
-    float line_spacing_factor = 1.5f;
-    
-    int ascent_draw, descent_draw, lineGap_draw;
-    stbtt_GetFontVMetrics(&font_info, &ascent_draw, &descent_draw, &lineGap_draw);
-    float actual_font_line_height = (ascent_draw - descent_draw + lineGap_draw) * scale * line_spacing_factor;
+static void svg_layout_free(SvgLayout *layout) {
+    glyph_cache_free(&layout->cache);
+    free(layout->glyph_ink);
+    free(layout->glyphs);
+    free(layout->words);
+    free(layout->word_slots);
+    free(layout->placements);
+    free(layout->colors);
+}
 
-    char *line_start = code_content;
-    char *line_end;
+static void svg_write_fill(FILE *out, const uint8_t rgb[3]) {
+    fprintf(out, " fill=\"#%02x%02x%02x\"", rgb[0], rgb[1], rgb[2]);
+}
 
-    char temp_line_buffer[2048];
+// The glyph's outline as <path id="gN">, in font units with y pointing down
+static void svg_write_glyph(FILE *out, const stbtt_fontinfo *font, int glyph) {
+    stbtt_vertex *vertices = NULL;
+    int count = stbtt_GetGlyphShape(font, glyph, &vertices);
+    fprintf(out, "<path id=\"g%d\" d=\"", glyph);
+    for (int i = 0; i < count; ++i) {
+        const stbtt_vertex *v = &vertices[i];
+        switch (v->type) {
+            case STBTT_vmove: fprintf(out, "%sM%d %d", i ? "Z" : "", v->x, -v->y); break;
+            case STBTT_vline: fprintf(out, "L%d %d", v->x, -v->y); break;
+            case STBTT_vcurve: fprintf(out, "Q%d %d %d %d", v->cx, -v->cy, v->x, -v->y); break;
+            case STBTT_vcubic: fprintf(out, "C%d %d %d %d %d %d", v->cx, -v->cy, v->cx1, -v->cy1, v->x, -v->y); break;
+        }
+    }
+    fputs(count > 0 ? "Z\"/>\n" : "\"/>\n", out);
+    if (vertices) stbtt_FreeShape(font, vertices);
+}
 
-    while (true) {
-        line_end = strchr(line_start, '\n');
-        size_t line_len;
+static void svg_write_start(FILE *out, const SvgGeometry *geometry, const uint8_t code_background[3]) {
+    fprintf(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" "
+                 "width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\">\n",
+            geometry->width, geometry->height, geometry->width, geometry->height);
+    fprintf(out, "<rect width=\"%d\" height=\"%d\" fill=\"%s\"/>\n", geometry->width, geometry->height, SVG_PAGE_BACKGROUND);
+    fprintf(out, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\"", geometry->padding, geometry->padding,
+            geometry->width - 2 * geometry->padding, geometry->height - 2 * geometry->padding);
+    svg_write_fill(out, code_background);
+    fputs("/>\n", out);
+}
 
-        if (line_end != NULL) {
-            line_len = line_end - line_start;
-        } else {
-            line_len = strlen(line_start);
+static bool svg_write_glyphs(FILE *out, const CodeSource *source, const CodeImageOptions *options, const SvgGeometry *geometry) {
+    SvgLayout layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.font = &source->font;
+    glyph_cache_init(&layout.cache, &source->font, source->scale, 1);
+    layout.glyph_ink = calloc(source->font.numGlyphs > 0 ? (size_t)source->font.numGlyphs : 1, 1);
+    bool ok = layout.glyph_ink && svg_color(&layout, options->text_color) == 0 &&
+              svg_layout_lines(&layout, source->lines, geometry->line_count, options->color_runs,
+                               options->color_runs ? options->color_run_count : 0, options->text_color);
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate SVG layout memory!\n");
+        svg_layout_free(&layout);
+        return false;
+    }
+
+    svg_write_start(out, geometry, options->code_background);
+    fputs("<defs>\n", out);
+    for (int glyph = 0; glyph < source->font.numGlyphs; ++glyph) {
+        if (layout.glyph_ink[glyph] == 2) svg_write_glyph(out, &source->font, glyph);
+    }
+    for (size_t i = 0; i < layout.word_count; ++i) {
+        const SvgWord *word = &layout.words[i];
+        if (word->uses < 2 || word->length < 2) continue;
+        fprintf(out, "<g id=\"w%zu\">", i);
+        for (uint32_t k = 0; k < word->length; ++k) {
+            const SvgWordGlyph *glyph = &layout.glyphs[word->first + k];
+            fprintf(out, k ? "<use xlink:href=\"#g%d\" x=\"%d\"/>" : "<use xlink:href=\"#g%d\"/>", glyph->glyph, glyph->x);
         }
-        
-        if (line_len >= sizeof(temp_line_buffer)) {
-            line_len = sizeof(temp_line_buffer) - 1;
+        fputs("</g>\n", out);
+    }
+    fputs("</defs>\n", out);
+
+    // One group per line, and within it one per run of placements in the same color
+    fprintf(out, "<g transform=\"translate(%d %d) scale(%.9g)\">\n", geometry->left, geometry->baseline, source->scale);
+    size_t line = SIZE_MAX;
+    uint32_t color = UINT32_MAX;
+    for (size_t i = 0; i < layout.placement_count; ++i) {
+        const SvgPlacement *placement = &layout.placements[i];
+        if (placement->line != line) {
+            if (line != SIZE_MAX) fputs("</g></g>\n", out);
+            line = placement->line;
+            color = UINT32_MAX;
+            fprintf(out, "<g transform=\"translate(0 %.0f)\">", line * geometry->line_step / source->scale);
         }
-        strncpy(temp_line_buffer, line_start, line_len);
-        temp_line_buffer[line_len] = '\0';
+        if (placement->color != color) {
+            if (color != UINT32_MAX) fputs("</g>", out);
+            color = placement->color;
+            fputs("<g", out);
+            svg_write_fill(out, layout.colors[color]);
+            fputc('>', out);
+        }
+        const SvgWord *word = &layout.words[placement->word];
+        if (word->uses >= 2 && word->length >= 2) {
+            fprintf(out, "<use xlink:href=\"#w%u\" x=\"%d\"/>", placement->word, placement->x);
+            continue;
+        }
+        for (uint32_t k = 0; k < word->length; ++k) {
+            const SvgWordGlyph *glyph = &layout.glyphs[word->first + k];
+            fprintf(out, "<use xlink:href=\"#g%d\" x=\"%d\"/>", glyph->glyph, placement->x + glyph->x);
+        }
+    }
+    if (line != SIZE_MAX) fputs("</g></g>\n", out);
+    fputs("</g>\n</svg>\n", out);
 
-        draw_text(pixels, img_width, img_height, code_block_x + 10, current_line_y, temp_line_buffer, &font_info, scale, default_text_r, default_text_g, default_text_b);
-        current_line_y += (int)actual_font_line_height;
+    svg_layout_free(&layout);
+    return true;
+}
 
-        if (line_end == NULL || *line_start == '\0') {
-            break;
+// Copies the characters of name[0, length), every `stride`th byte, that are safe inside
+// a quoted font-family attribute
+static void svg_copy_family(char *out, size_t size, const char *name, size_t length, size_t stride) {
+    size_t len = 0;
+    for (size_t i = 0; i < length && len + 1 < size; i += stride) {
+        char c = name[i];
+        if (c >= ' ' && c <= '~' && !strchr("\"'&<>;\\", c)) out[len++] = c;
+    }
+    out[len] = '\0';
+}
+
+// Family name of `font` from its name table, or else `fallback`
+static void svg_font_family(const stbtt_fontinfo *font, const char *fallback, char *out, size_t size) {
+    int length = 0;
+    const char *name = stbtt_GetFontNameString(font, &length, STBTT_PLATFORM_ID_MICROSOFT, STBTT_MS_EID_UNICODE_BMP,
+                                               STBTT_MS_LANG_ENGLISH, 1);
+    out[0] = '\0';
+    bool ascii = name && length > 1;
+    for (int i = 0; ascii && i < length; i += 2) ascii = name[i] == 0; // UTF-16BE
+    if (ascii) svg_copy_family(out, size, name + 1, (size_t)length - 1, 2);
+    if (!out[0] && fallback) svg_copy_family(out, size, fallback, strlen(fallback), 1);
+}
+
+// Writes text[0, length) as XML character data: tabs as 4 spaces, markup characters
+// escaped, and what XML cannot hold (invalid UTF-8, control characters) as U+FFFD
+static void svg_write_escaped(FILE *out, const char *text, size_t length) {
+    for (size_t i = 0; i < length; ) {
+        size_t consumed;
+        uint32_t codepoint = utf8_decode(text + i, length - i, &consumed);
+        if (codepoint == '\t') fputs("    ", out);
+        else if (codepoint == '&') fputs("&amp;", out);
+        else if (codepoint == '<') fputs("&lt;", out);
+        else if (codepoint == '>') fputs("&gt;", out);
+        else if (codepoint < 0x20 || codepoint == 0x7F || (codepoint >= 0xD800 && codepoint < 0xE000) ||
+                 codepoint == 0xFFFE || codepoint == 0xFFFF || codepoint > 0x10FFFF || (codepoint == 0xFFFD && consumed == 1)) {
+            fputs("\xEF\xBF\xBD", out);
+        } else {
+            fwrite(text + i, 1, consumed, out);
+        }
+        i += consumed;
+    }
+}
+
+static bool svg_blank(const char *text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (text[i] != ' ' && text[i] != '\t') return false;
+    }
+    return true;
+}
+
+// One <text> per line, at the pen position and baseline the PNG draws it at, with a
+// <tspan> per run of one color; blanks join whatever run they are in
+static bool svg_write_text(FILE *out, const CodeSource *source, const CodeImageOptions *options, const SvgGeometry *geometry) {
+    char family[128];
+    svg_font_family(&source->font, options->font_name, family, sizeof(family));
+
+    svg_write_start(out, geometry, options->code_background);
+    fputs("<g", out);
+    svg_write_fill(out, options->text_color);
+    if (family[0]) fprintf(out, " font-family=\"'%s', monospace\"", family);
+    else fputs(" font-family=\"monospace\"", out);
+    // font_size is the ascent-to-descent height (stbtt_ScaleForPixelHeight), while CSS
+    // sizes a font by its em, so give the em the size it has in the PNG
+    float em_size = source->scale / stbtt_ScaleForMappingEmToPixels(&source->font, 1.0f);
+    fprintf(out, " font-size=\"%.9g\" xml:space=\"preserve\" style=\"white-space:pre\">\n", em_size);
+
+    const CodeImageColorRun *runs = options->color_runs;
+    size_t run_count = runs ? options->color_run_count : 0;
+    size_t run = 0;
+    const LineIndex *lines = source->lines;
+    for (size_t line = 0; line < geometry->line_count; ++line) {
+        size_t line_len;
+        const char *line_text = line_index_line(lines, line, &line_len);
+        size_t line_start = (size_t)(line_text - lines->source);
+        if (svg_blank(line_text, line_len)) continue;
+
+        fprintf(out, "<text x=\"%d\" y=\"%zu\">", geometry->left, geometry->baseline + line * (size_t)geometry->line_step);
+        const uint8_t *open = NULL; // Color of the open <tspan>
+        size_t offset = 0;
+        while (offset < line_len) {
+            size_t piece_end;
+            const uint8_t *rgb = next_color_piece(runs, run_count, &run, line_start, offset, line_len, &piece_end);
+            if (rgb && memcmp(rgb, options->text_color, 3) == 0) rgb = NULL;
+            bool same = rgb == open || (rgb && open && memcmp(rgb, open, 3) == 0);
+            if (!same && !svg_blank(line_text + offset, piece_end - offset)) {
+                if (open) fputs("</tspan>", out);
+                open = rgb;
+                if (open) {
+                    fputs("<tspan", out);
+                    svg_write_fill(out, open);
+                    fputc('>', out);
+                }
+            }
+            svg_write_escaped(out, line_text + offset, piece_end - offset);
+            offset = piece_end;
         }
-        line_start = line_end + 1;
+        fputs(open ? "</tspan></text>\n" : "</text>\n", out);
     }
+    fputs("</g>\n</svg>\n", out);
+    return true;
+}
 
+int code_to_svg_generate(const char *input_file_path, const char *output_svg_path, const CodeImageOptions *options) {
+    CodeSource source;
+    if (!code_source_open(&source, input_file_path, options)) return 1;
+    const LineIndex *lines = source.lines;
 
-    // --- 6. Save the Image ---
-    if (stbi_write_png(output_image_path, img_width, img_height, CHANNELS, pixels, img_width * CHANNELS)) {
-        // printf("Successfully wrote '%s'\n", output_image_path); // Removed console output for library use
-    } else {
-        fprintf(stderr, "Failed to write PNG file '%s'!\n", output_image_path);
-        free(font_buffer);
-        free(pixels);
-        free(code_content);
-        free_discovered_fonts_internal();
-        return 1;
+    // The PNG's page size and line grid, see code_to_image_generate_ex and render_page
+    SvgGeometry geometry;
+    int calculated_img_width, calculated_img_height;
+    geometry.padding = 20;
+    get_code_dimensions(lines, lines->line_count, &source.font, source.scale, options->font_size, 1.5f, geometry.padding,
+                        &calculated_img_width, &calculated_img_height);
+    geometry.width = (options->img_width > 0) ? options->img_width : calculated_img_width;
+    if (geometry.width < 200) geometry.width = 200;
+    geometry.height = (options->img_height > 0) ? options->img_height : calculated_img_height;
+    if (geometry.height < 100) geometry.height = 100;
+
+    int ascent, descent, lineGap;
+    stbtt_GetFontVMetrics(&source.font, &ascent, &descent, &lineGap);
+    int top = geometry.padding + (int)(options->font_size * 0.25);
+    geometry.left = geometry.padding + 10;
+    geometry.baseline = top + (int)(ascent * source.scale);
+    geometry.line_step = (int)((ascent - descent + lineGap) * source.scale * 1.5f);
+    geometry.line_count = 0;
+    while (geometry.line_count < lines->line_count &&
+           top + (int64_t)geometry.line_count * geometry.line_step < geometry.height) {
+        geometry.line_count++;
     }
 
-    // --- Cleanup ---
-    free(font_buffer);
-    free(pixels);
-    free(code_content);
-    free_discovered_fonts_internal();
-    return 0;
+    FILE *out = fopen(output_svg_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open SVG file '%s' for writing.\n", output_svg_path);
+        code_source_close(&source);
+        return 1;
+    }
+    bool ok = (options->svg_mode == CODE_IMAGE_SVG_TEXT) ? svg_write_text(out, &source, options, &geometry)
+                                                        : svg_write_glyphs(out, &source, options, &geometry);
+    bool write_failed = ferror(out) != 0;
+    if ((fclose(out) != 0 || write_failed) && ok) {
+        fprintf(stderr, "Failed to write SVG file '%s'!\n", output_svg_path);
+        ok = false;
+    }
+    code_source_close(&source);
+    return ok ? 0 : 1;
 }
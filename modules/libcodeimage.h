@@ -20,6 +20,69 @@ int code_to_image_generate(
     int img_height
 );
 
+// A byte range of the input drawn in its own color
+typedef struct {
+    unsigned int start;
+    unsigned int end;
+    unsigned char rgb[3];
+} CodeImageColorRun;
+
+// How code_to_svg_generate draws the text
+typedef enum {
+    CODE_IMAGE_SVG_GLYPHS, // Glyph outlines from the font, each defined once and placed with <use>
+    CODE_IMAGE_SVG_TEXT    // <text> lines with a <tspan> per color run; shown in the font where it is viewed
+} CodeImageSvgMode;
+
+// Options for code_to_image_generate_ex. Initialize with code_image_options_init.
+typedef struct {
+    const char *font_name;     // NULL selects the first discovered font
+    float font_size;           // Font height in pixels (default 18)
+    int img_width;             // 0 for auto-calculation
+    int img_height;            // 0 for auto-calculation (per page when paginating)
+    int max_lines_per_page;    // Split output into numbered pages of at most N lines (0 = no limit)
+    int max_page_height;       // Split output so no page exceeds this many pixels (0 = no limit)
+    const char *manifest_path; // Write a JSON index of the pages here (NULL = no manifest)
+    int threads;               // Pages rendered concurrently (0 = one per online CPU)
+    int subpixel_phases;       // Horizontal glyph positions per pixel, 1-16 (1 = whole pixels)
+    unsigned char code_background[3]; // RGB behind the code (e.g. the theme background)
+    unsigned char text_color[3];      // RGB of the code text (e.g. the theme foreground)
+    const CodeImageColorRun *color_runs; // Sorted, non-overlapping colored ranges (NULL = all text_color)
+    size_t color_run_count;
+    const char *code;          // Source to draw instead of reading input_file_path (NULL = read the file)
+    size_t code_size;
+    const struct LineIndex *lines; // Line index of `code` (line_index.h) to reuse (NULL = build one)
+    CodeImageSvgMode svg_mode; // For code_to_svg_generate (default: glyph outlines)
+} CodeImageOptions;
+
+#define CODE_IMAGE_DEFAULT_SUBPIXEL_PHASES 4
+
+void code_image_options_init(CodeImageOptions *options);
+
+// Like code_to_image_generate, with pagination support. When a page limit is set,
+// pages are written as <output>-001.png, <output>-002.png, ... next to output_image_path.
+// Returns 0 on success, 1 on failure.
+int code_to_image_generate_ex(
+    const char *input_file_path,
+    const char *output_image_path,
+    const CodeImageOptions *options
+);
+
+// Writes the code as one SVG image with the layout, font and colors of a PNG from
+// code_to_image_generate_ex (the page, thread and subpixel options do not apply). Its
+// size grows with the distinct glyphs, words and color runs rather than the characters:
+// each glyph outline is defined once, and so is each word that recurs.
+// Returns 0 on success, 1 on failure.
+int code_to_svg_generate(
+    const char *input_file_path,
+    const char *output_svg_path,
+    const CodeImageOptions *options
+);
+
+// Reads every font under modules/Fonts into memory once, for long-running processes:
+// later images (in this process or ones forked from it) copy the font from memory
+// instead of scanning the directory and reading the file. Returns the number of fonts.
+int code_image_preload_fonts(void);
+
 #ifdef __cplusplus
 }
 #endif
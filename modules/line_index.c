@@ -0,0 +1,166 @@
+#include "line_index.h"
+#include "arena.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void line_index_free(LineIndex *index) {
+    arena_free(index->line_starts);
+    memset(index, 0, sizeof(*index));
+}
+
+// Makes room for `count` line starts
+static bool reserve_lines(LineIndex *index, size_t count) {
+    if (count <= index->line_capacity) return true;
+    size_t capacity = index->line_capacity ? index->line_capacity : 256;
+    while (capacity < count) capacity *= 2;
+    size_t *grown = arena_realloc(index->line_starts, sizeof(size_t) * capacity);
+    if (!grown) return false;
+    index->line_starts = grown;
+    index->line_capacity = capacity;
+    return true;
+}
+
+static bool push_line(LineIndex *index, size_t line_start) {
+    if (!reserve_lines(index, index->line_count + 1)) return false;
+    index->line_starts[index->line_count++] = line_start;
+    return true;
+}
+
+// Ends the line that started at *line_start with `columns` cells; the next starts at `next_start`
+static bool end_line(LineIndex *index, size_t *line_start, size_t next_start, size_t columns) {
+    if (columns > index->max_columns) index->max_columns = columns;
+    if (!push_line(index, *line_start)) return false;
+    *line_start = next_start;
+    return true;
+}
+
+bool line_index_build(LineIndex *index, const char *source, size_t source_size) {
+    memset(index, 0, sizeof(*index));
+    index->source = source;
+    index->source_size = source_size;
+
+    if (!reserve_lines(index, 256)) return false;
+
+    size_t line_start = 0;
+    size_t columns = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // 16 bytes at a time: one mask each for newlines, tabs and the bytes that take no
+    // cell (newline, CR and UTF-8 continuation bytes 0x80-0xBF, which are below -64 as
+    // signed bytes). A tab takes one cell like any character plus 3 more.
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    const __m128i continuation_limit = _mm_set1_epi8((char)0xC0);
+    for (; i + 16 <= source_size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(source + i));
+        unsigned newlines = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        unsigned tabs = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, tab));
+        unsigned no_cell = newlines | (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, carriage_return)) |
+                           (unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(block, continuation_limit));
+        unsigned cells = ~no_cell & 0xFFFFu;
+
+        while (newlines) {
+            unsigned bit = (unsigned)__builtin_ctz(newlines);
+            unsigned before = (1u << bit) - 1;
+            columns += (size_t)__builtin_popcount(cells & before) + 3 * (size_t)__builtin_popcount(tabs & before);
+            if (!end_line(index, &line_start, i + bit + 1, columns)) {
+                line_index_free(index);
+                return false;
+            }
+            columns = 0;
+            unsigned done = (2u << bit) - 1;
+            cells &= ~done;
+            tabs &= ~done;
+            newlines &= newlines - 1;
+        }
+        columns += (size_t)__builtin_popcount(cells) + 3 * (size_t)__builtin_popcount(tabs);
+    }
+#endif
+    for (; i < source_size; ++i) {
+        unsigned char c = (unsigned char)source[i];
+        if (c == '\n') {
+            if (!end_line(index, &line_start, i + 1, columns)) {
+                line_index_free(index);
+                return false;
+            }
+            columns = 0;
+        } else if (c == '\t') {
+            columns += 4;
+        } else if ((c & 0xC0) != 0x80 && c != '\r') { // UTF-8 continuation bytes don't start a new character
+            columns++;
+        }
+    }
+    if (!end_line(index, &line_start, source_size, columns)) {
+        line_index_free(index);
+        return false;
+    }
+    return true;
+}
+
+// Cells of text[0, length), counted as line_index_build counts them
+static size_t count_columns(const char *text, size_t length) {
+    size_t columns = 0;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\t') columns += 4;
+        else if ((c & 0xC0) != 0x80 && c != '\r') columns++;
+    }
+    return columns;
+}
+
+bool line_index_edit(LineIndex *index, const char *source, size_t source_size,
+                     size_t start, size_t old_end, size_t new_end) {
+    // Lines first + 1 .. last started inside the replaced text and are gone
+    size_t first = line_index_line_at(index, start);
+    size_t last = line_index_line_at(index, old_end);
+    size_t inserted = 0;
+    for (const char *p = source + start, *end = source + new_end; (p = memchr(p, '\n', (size_t)(end - p))); p++) {
+        inserted++;
+    }
+    size_t line_count = index->line_count - (last - first) + inserted;
+    if (!reserve_lines(index, line_count)) return false;
+
+    size_t *starts = index->line_starts;
+    size_t later = index->line_count - (last + 1);
+    memmove(starts + first + 1 + inserted, starts + last + 1, later * sizeof(size_t));
+    for (size_t i = first + 1 + inserted; i < line_count; i++) starts[i] = starts[i] - old_end + new_end;
+    size_t line = first;
+    for (size_t i = start; i < new_end; i++) {
+        if (source[i] == '\n') starts[++line] = i + 1;
+    }
+    index->line_count = line_count;
+    index->source = source;
+    index->source_size = source_size;
+
+    for (line = first; line <= first + inserted; line++) {
+        size_t length;
+        const char *text = line_index_line(index, line, &length);
+        size_t columns = count_columns(text, length);
+        if (columns > index->max_columns) index->max_columns = columns;
+    }
+    return true;
+}
+
+const char *line_index_line(const LineIndex *index, size_t line, size_t *out_length) {
+    size_t start = index->line_starts[line];
+    size_t end = (line + 1 < index->line_count) ? index->line_starts[line + 1] - 1 : index->source_size;
+    if (end > start && index->source[end - 1] == '\r') end--;
+    *out_length = end - start;
+    return index->source + start;
+}
+
+size_t line_index_line_at(const LineIndex *index, size_t offset) {
+    size_t low = 0;
+    size_t high = index->line_count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (index->line_starts[mid] <= offset) low = mid;
+        else high = mid;
+    }
+    return low;
+}
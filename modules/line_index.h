@@ -0,0 +1,42 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Line structure of a source buffer, built in one pass and shared by everything that
+// needs it: gutter widths, line numbers of ranges, virtual page chunks and image
+// sizing. Lines are addressed as (pointer, length) spans into the source, which must
+// outlive the index. line_starts lives in the arenas (arena.h) of the building thread;
+// any thread may read the index.
+typedef struct LineIndex {
+    const char *source;
+    size_t source_size;
+    size_t *line_starts; // Byte offset of the first character of each line
+    size_t line_count;   // Newlines + 1, so a trailing newline ends with an empty line
+    size_t line_capacity; // Entries allocated for line_starts
+    size_t max_columns;  // Widest line in character cells (a tab counts as 4)
+} LineIndex;
+
+// Builds the index with a vectorized newline scan (SSE2 where available). Returns
+// false on allocation failure.
+bool line_index_build(LineIndex *index, const char *source, size_t source_size);
+
+void line_index_free(LineIndex *index);
+
+// Updates the index after source[start, old_end) was replaced, giving `source` (which
+// may have moved) with the new text at [start, new_end). Only the new text is scanned
+// and the starts of later lines are shifted, so an edit costs no full rescan.
+// max_columns takes in the edited lines but is never lowered, so after text is removed
+// it may overstate the widest line. Returns false on allocation failure, leaving the
+// index as it was.
+bool line_index_edit(LineIndex *index, const char *source, size_t source_size,
+                     size_t start, size_t old_end, size_t new_end);
+
+// Returns the span of line `line` (0-based), excluding its line terminator.
+const char *line_index_line(const LineIndex *index, size_t line, size_t *out_length);
+
+// 0-based line holding byte `offset`, in O(log n)
+size_t line_index_line_at(const LineIndex *index, size_t offset);
+
+#endif // LINE_INDEX_H
@@ -0,0 +1,189 @@
+#include "parallel.h"
+#include "highlight.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// One line-aligned piece of the file, queried and rendered by a worker thread
+typedef struct {
+    const TSTree *tree;
+    const TSQuery *query;
+    const uint8_t *capture_styles;
+    const QueryPredicates *predicates;
+    const InjectionSet *injections;
+    const char *code;
+    size_t code_size;
+    uint32_t from;
+    uint32_t to;
+    Renderer renderer; // Renderer state at `from`; holds the state at `to` once done
+
+    char *buffer;          // Rendered output of code[from, to)
+    size_t buffer_len;
+    uint32_t current_byte; // End of the last span collected (see highlight_collect)
+    SpanList carry;        // Parts of spans reaching past `to`
+    bool ok;
+} RangeJob;
+
+unsigned parallel_range_count(size_t code_size, int jobs) {
+    if (jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = (cpus > 0) ? (int)cpus : 1;
+    }
+    size_t by_size = code_size / PARALLEL_MIN_RANGE_BYTES;
+    if (by_size < (size_t)jobs) return by_size ? (unsigned)by_size : 1;
+    return (unsigned)jobs;
+}
+
+static uint32_t line_start_before(const LineIndex *lines, uint32_t offset) {
+    return (uint32_t)lines->line_starts[line_index_line_at(lines, offset)];
+}
+
+// Line start of the top-level node that contains `target`. When that node begins at or
+// before `previous` (one node covering several ranges), the line of `target` is used instead.
+static uint32_t range_boundary(TSNode root, const LineIndex *lines, uint32_t target, uint32_t previous) {
+    TSNode child = ts_node_first_child_for_byte(root, target);
+    uint32_t boundary = ts_node_is_null(child) ? target : ts_node_start_byte(child);
+    boundary = line_start_before(lines, boundary);
+    if (boundary <= previous) boundary = line_start_before(lines, target);
+    return boundary;
+}
+
+static void *range_worker(void *arg) {
+    RangeJob *job = arg;
+    FILE *out = open_memstream(&job->buffer, &job->buffer_len);
+    TSTree *tree = ts_tree_copy(job->tree); // A tree must not be shared between threads; copies are cheap
+    TSQueryCursor *cursor = ts_query_cursor_new();
+    SpanList spans = {0};
+    SpanList scratch = {0};
+
+    job->current_byte = job->from;
+    job->ok = out && tree && cursor &&
+              highlight_collect_window(cursor, job->query, ts_tree_root_node(tree), job->capture_styles, job->predicates,
+                                       job->code, job->code_size, job->from, job->to, &job->current_byte, &job->carry, &spans) &&
+              (!job->injections || injection_apply(job->injections, job->from, job->to, &spans, &scratch));
+    if (job->ok) {
+        job->renderer.out = out;
+        job->renderer.writer = NULL;
+        render_spans(&job->renderer, job->code, job->from, job->to, spans.items, spans.count);
+    }
+    if (out && fclose(out) != 0) job->ok = false;
+
+    span_list_free(&spans);
+    span_list_free(&scratch);
+    if (cursor) ts_query_cursor_delete(cursor);
+    if (tree) ts_tree_delete(tree);
+    return NULL;
+}
+
+bool render_parallel(Renderer *renderer, const TSTree *tree, const TSQuery *query, TSQueryCursor *cursor,
+                     const uint8_t *capture_styles, const QueryPredicates *predicates,
+                     const InjectionSet *injections, const char *code, size_t code_size, const LineIndex *lines,
+                     unsigned range_count) {
+    TSNode root = ts_tree_root_node(tree);
+    if (range_count == 0) range_count = 1;
+
+    RangeJob *jobs = calloc(range_count, sizeof(RangeJob));
+    pthread_t *threads = calloc(range_count, sizeof(pthread_t));
+    bool *started = calloc(range_count, sizeof(bool));
+    if (!jobs || !threads || !started) {
+        fprintf(stderr, "Failed to allocate highlight ranges\n");
+        free(jobs);
+        free(threads);
+        free(started);
+        return false;
+    }
+
+    // --- Split Into Ranges ---
+    size_t count = 0;
+    uint32_t from = 0;
+    for (unsigned i = 1; i <= range_count; i++) {
+        uint32_t to = (uint32_t)code_size;
+        if (i < range_count) {
+            to = range_boundary(root, lines, (uint32_t)(code_size * i / range_count), from);
+            if (to <= from) continue;
+        }
+
+        RangeJob *job = &jobs[count++];
+        job->tree = tree;
+        job->query = query;
+        job->capture_styles = capture_styles;
+        job->predicates = predicates;
+        job->injections = injections;
+        job->code = code;
+        job->code_size = code_size;
+        job->from = from;
+        job->to = to;
+        if (from == 0) {
+            job->renderer = *renderer;
+        } else {
+            // Ranges start on a fresh line, where the renderer carries nothing over but the line number
+            renderer_init(&job->renderer, NULL, renderer->format, renderer->show_line_numbers, renderer->line_num_padding);
+            renderer_set_theme(&job->renderer, renderer->theme);
+            job->renderer.line = renderer->line + (uint32_t)line_index_line_at(lines, from);
+        }
+        from = to;
+    }
+
+    for (size_t i = 1; i < count; i++) { // Range 0 runs on this thread
+        started[i] = pthread_create(&threads[i], NULL, range_worker, &jobs[i]) == 0;
+    }
+
+    // --- Write Ranges In Order ---
+    FILE *out = renderer->out;
+    Writer *writer = renderer->writer;
+    uint32_t current_byte = 0;
+    SpanList carry = {0};
+    SpanList spans = {0};
+    SpanList scratch = {0};
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        RangeJob *job = &jobs[i];
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            range_worker(job); // Range 0, or threads unavailable
+        }
+        if (!ok) {
+            // Keep joining the remaining workers
+        } else if (current_byte > job->from) {
+            // A span of the previous range runs into this one, which was therefore
+            // queried from the wrong starting point; redo it after the previous range
+            ok = highlight_collect_window(cursor, query, root, capture_styles, predicates, code, code_size,
+                                          job->from, job->to, &current_byte, &carry, &spans) &&
+                 (!injections || injection_apply(injections, job->from, job->to, &spans, &scratch));
+            if (ok) render_spans(renderer, code, job->from, job->to, spans.items, spans.count);
+        } else if (job->ok) {
+            if (writer) {
+                // Out before the buffer is freed and before the renderer (whose escapes
+                // the writer may still reference) is overwritten
+                writer_ref(writer, job->buffer, job->buffer_len);
+                writer_flush(writer);
+            } else {
+                fwrite(job->buffer, 1, job->buffer_len, out);
+            }
+            *renderer = job->renderer;
+            renderer->out = out;
+            renderer->writer = writer;
+            current_byte = job->current_byte;
+            span_list_free(&carry);
+            carry = job->carry;
+            job->carry = (SpanList){0};
+        } else {
+            ok = false;
+        }
+        free(job->buffer);
+        span_list_free(&job->carry);
+    }
+    if (!ok) fprintf(stderr, "Failed to allocate highlight spans\n");
+
+    span_list_free(&spans);
+    span_list_free(&scratch);
+    span_list_free(&carry);
+    free(jobs);
+    free(threads);
+    free(started);
+    return ok;
+}
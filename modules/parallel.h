@@ -0,0 +1,34 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "injection.h"
+#include "line_index.h"
+#include "render.h"
+
+// Files are split into ranges of at least this size; smaller files are rendered serially
+#define PARALLEL_MIN_RANGE_BYTES (256 * 1024)
+
+// Number of ranges render_parallel would split a file of `code_size` bytes into with
+// `jobs` threads (0 = one per online CPU). 1 means the serial path is just as good.
+unsigned parallel_range_count(size_t code_size, int jobs);
+
+// Renders the whole file with `renderer` (after renderer_begin, before renderer_finish),
+// producing the same bytes as highlight_collect + render_spans. The file is cut into
+// `range_count` line-aligned ranges at top-level node boundaries of `tree`; each range
+// is queried with its own cursor and rendered into its own buffer on a worker thread,
+// and the buffers are written out in order. `cursor` is used on the calling thread for
+// the rare range that has to be redone because a span from the previous one runs into it.
+// Embedded code from `injections` (may be NULL) is merged into each range. `lines`
+// indexes `code` and places the range boundaries and their line numbers.
+// Returns false on failure.
+bool render_parallel(Renderer *renderer, const TSTree *tree, const TSQuery *query, TSQueryCursor *cursor,
+                     const uint8_t *capture_styles, const QueryPredicates *predicates,
+                     const InjectionSet *injections, const char *code, size_t code_size, const LineIndex *lines,
+                     unsigned range_count);
+
+#endif // PARALLEL_H
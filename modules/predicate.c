@@ -0,0 +1,550 @@
+#include "predicate.h"
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCANNER_MAX_CLASSES 8
+#define STRING_SET_MAX_SLOTS (1u << 20)
+
+typedef enum {
+    MATCHER_LITERAL, // Text equals a string
+    MATCHER_SET,     // Text is one of several strings
+    MATCHER_SCANNER, // Text starts with (or is) a run of byte classes
+    MATCHER_REGEX,   // Anything else #match? accepts
+    MATCHER_CAPTURE, // Text equals another capture's (#eq? @a @b)
+} MatcherKind;
+
+typedef struct {
+    const char *text;
+    uint32_t len;
+} PredicateString;
+
+// Strings that each own a slot of the table under `seed`, so a lookup is one hash
+// and one comparison
+typedef struct {
+    PredicateString *slots; // mask + 1 of them; empty ones have no text
+    uint32_t mask;
+    uint32_t seed;
+    uint32_t min_len;
+    uint32_t max_len;
+} StringSet;
+
+// "^" followed by single-byte classes, the last of which may repeat, and an optional
+// "$". Only the last class repeating means a greedy scan never has to backtrack.
+typedef struct {
+    uint8_t classes[SCANNER_MAX_CLASSES][32]; // Bytes each position accepts, one bit per byte
+    uint32_t class_count;
+    uint32_t tail_min; // Repeats of the last class
+    uint32_t tail_max;
+    bool anchored_end;
+} Scanner;
+
+typedef struct {
+    MatcherKind kind;
+    bool negate; // #not-match?, #not-eq?, #not-any-of?
+    bool by_line; // A #match? word list, which any line of the text may match
+    uint32_t capture;
+    union {
+        PredicateString literal;
+        StringSet set;
+        Scanner scanner;
+        regex_t regex;
+        uint32_t other_capture;
+    } as;
+} Predicate;
+
+struct QueryPredicates {
+    uint32_t pattern_count;
+    uint32_t *first; // Predicates of pattern p: items[first[p], first[p + 1])
+    Predicate *items;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+// --- String Sets ---
+
+// FNV-1a, varied by `seed`
+static uint32_t string_hash(const char *text, uint32_t len, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+// Looks for a seed that gives every distinct string its own slot, growing the table
+// until one does
+static bool string_set_build(StringSet *set, const PredicateString *strings, uint32_t count) {
+    memset(set, 0, sizeof(*set));
+    set->min_len = UINT32_MAX;
+    for (uint32_t i = 0; i < count; i++) {
+        if (strings[i].len < set->min_len) set->min_len = strings[i].len;
+        if (strings[i].len > set->max_len) set->max_len = strings[i].len;
+    }
+
+    uint32_t size = 8;
+    while (size < count * 4) size *= 2;
+    for (; size <= STRING_SET_MAX_SLOTS; size *= 2) {
+        PredicateString *slots = malloc(size * sizeof(PredicateString));
+        if (!slots) return false;
+        for (uint32_t seed = 1; seed <= 1024; seed++) {
+            memset(slots, 0, size * sizeof(PredicateString));
+            bool collided = false;
+            for (uint32_t i = 0; i < count && !collided; i++) {
+                PredicateString *slot = &slots[string_hash(strings[i].text, strings[i].len, seed) & (size - 1)];
+                if (!slot->text) {
+                    *slot = strings[i];
+                } else if (slot->len != strings[i].len || memcmp(slot->text, strings[i].text, slot->len) != 0) {
+                    collided = true; // Repeated strings land on themselves and are fine
+                }
+            }
+            if (!collided) {
+                set->slots = slots;
+                set->mask = size - 1;
+                set->seed = seed;
+                return true;
+            }
+        }
+        free(slots);
+    }
+    return false;
+}
+
+static bool string_set_contains(const StringSet *set, const char *text, uint32_t len) {
+    if (len < set->min_len || len > set->max_len) return false;
+    const PredicateString *slot = &set->slots[string_hash(text, len, set->seed) & set->mask];
+    return slot->text && slot->len == len && memcmp(slot->text, text, len) == 0;
+}
+
+// --- Regex Shapes ---
+
+static bool is_regex_special(char c) {
+    return c != '\0' && strchr(".[]()*+?{}|^$\\", c) != NULL;
+}
+
+// "^abc$" or "^(abc|def|...)$" with no special characters in the words: the strings
+// it accepts, pointing into `pattern`. Returns the number of them, or 0 for any other
+// shape. `strings` must have room for one more than the number of '|' in the pattern.
+static uint32_t literal_alternatives(const char *pattern, size_t len, PredicateString *strings) {
+    if (len < 2 || pattern[0] != '^' || pattern[len - 1] != '$') return 0;
+    const char *p = pattern + 1;
+    const char *end = pattern + len - 1;
+    if (p < end && *p == '(') {
+        if (end[-1] != ')') return 0;
+        p++;
+        end--;
+    }
+
+    uint32_t count = 0;
+    const char *word = p;
+    for (; p <= end; p++) {
+        if (p < end && *p == '\n') return 0; // Left to the regex, which knows where lines end
+        if (p < end && !is_regex_special(*p)) continue;
+        if (p < end && *p != '|') return 0;
+        if (p == word) return 0;
+        strings[count++] = (PredicateString){word, (uint32_t)(p - word)};
+        word = p + 1;
+    }
+    // A bare "^a|b$" means (^a)|(b$); only the parenthesized form is a word list
+    if (count > 1 && pattern[1] != '(') return 0;
+    return count;
+}
+
+static void class_add(uint8_t bits[32], unsigned char c) {
+    bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static bool class_has(const uint8_t bits[32], unsigned char c) {
+    return bits[c >> 3] & (1u << (c & 7));
+}
+
+static void class_add_range(uint8_t bits[32], unsigned char from, unsigned char to) {
+    for (unsigned c = from; c <= to; c++) class_add(bits, (unsigned char)c);
+}
+
+// \d, \w, \s, or an escaped character taken literally
+static bool class_add_escape(uint8_t bits[32], char c) {
+    if (c == 'd') {
+        class_add_range(bits, '0', '9');
+    } else if (c == 'w') {
+        class_add_range(bits, 'a', 'z');
+        class_add_range(bits, 'A', 'Z');
+        class_add_range(bits, '0', '9');
+        class_add(bits, '_');
+    } else if (c == 's') {
+        for (const char *s = " \t\n\r\f\v"; *s; s++) class_add(bits, (unsigned char)*s);
+    } else if (is_regex_special(c) || c == '-' || c == '/' || c == '"') {
+        class_add(bits, (unsigned char)c);
+    } else {
+        return false; // \b, \D and the like are left to the regex
+    }
+    return true;
+}
+
+// One position of a scanner at *p: a byte, '.', an escape or a bracket expression
+static bool parse_class(const char **p, uint8_t bits[32]) {
+    const char *s = *p;
+    memset(bits, 0, 32);
+    if (*s == '\\') {
+        if (!class_add_escape(bits, s[1])) return false;
+        *p = s + 2;
+        return true;
+    }
+    if (*s == '.') {
+        memset(bits, 0xFF, 32); // Any byte but a line break, as in regexes under REG_NEWLINE
+        bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+        *p = s + 1;
+        return true;
+    }
+    if (*s != '[') {
+        if (is_regex_special(*s)) return false;
+        class_add(bits, (unsigned char)*s);
+        *p = s + 1;
+        return true;
+    }
+
+    s++;
+    bool negated = *s == '^';
+    if (negated) s++;
+    bool first = true;
+    while (*s && (*s != ']' || first)) {
+        if (*s == '[') return false; // [:alpha:] and friends
+        if (*s == '\\') {
+            if (!class_add_escape(bits, s[1])) return false;
+            s += 2;
+        } else if (s[1] == '-' && s[2] && s[2] != ']') {
+            if ((unsigned char)s[2] < (unsigned char)s[0]) return false;
+            class_add_range(bits, (unsigned char)s[0], (unsigned char)s[2]);
+            s += 3;
+        } else {
+            class_add(bits, (unsigned char)*s);
+            s++;
+        }
+        first = false;
+    }
+    if (*s != ']') return false;
+    if (negated) {
+        for (int i = 0; i < 32; i++) bits[i] = (uint8_t)~bits[i];
+        bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+    }
+    *p = s + 1;
+    return true;
+}
+
+static bool scanner_compile(const char *pattern, Scanner *scanner) {
+    memset(scanner, 0, sizeof(*scanner));
+    if (pattern[0] != '^') return false;
+    scanner->tail_min = 1;
+    scanner->tail_max = 1;
+
+    const char *p = pattern + 1;
+    while (*p && *p != '$') {
+        if (scanner->class_count == SCANNER_MAX_CLASSES) return false;
+        if (!parse_class(&p, scanner->classes[scanner->class_count])) return false;
+        scanner->class_count++;
+        if (*p == '*' || *p == '+' || *p == '?') {
+            char quantifier = *p++;
+            if (*p && strcmp(p, "$") != 0) return false;
+            scanner->tail_min = quantifier == '+';
+            scanner->tail_max = quantifier == '?' ? 1 : UINT32_MAX;
+        }
+    }
+    if (*p == '$') {
+        if (p[1]) return false;
+        scanner->anchored_end = true;
+    }
+    return scanner->class_count > 0;
+}
+
+// Matches from `start`, the start of a line. "$" matches where a line ends, as with
+// REG_NEWLINE, so the tail stops at the first point where the match may end.
+static bool scanner_match_at(const Scanner *scanner, const unsigned char *text, uint32_t len, uint32_t start) {
+    uint32_t fixed = scanner->class_count - 1;
+    if (len - start < fixed) return false;
+    for (uint32_t i = 0; i < fixed; i++) {
+        if (!class_has(scanner->classes[i], text[start + i])) return false;
+    }
+    uint32_t pos = start + fixed;
+    uint32_t run = 0;
+    while (true) {
+        if (run >= scanner->tail_min && (!scanner->anchored_end || pos == len || text[pos] == '\n')) return true;
+        if (pos == len || run == scanner->tail_max || !class_has(scanner->classes[fixed], text[pos])) return false;
+        pos++;
+        run++;
+    }
+}
+
+// "^" matches at the start of every line, as with REG_NEWLINE
+static bool scanner_match(const Scanner *scanner, const unsigned char *text, uint32_t len) {
+    uint32_t start = 0;
+    while (!scanner_match_at(scanner, text, len, start)) {
+        const unsigned char *newline = memchr(text + start, '\n', len - start);
+        if (!newline) return false;
+        start = (uint32_t)(newline - text) + 1;
+    }
+    return true;
+}
+
+// POSIX extended syntax has no \d, \w or \s; they become bracket expressions
+static bool regex_compile(const char *pattern, regex_t *regex) {
+    size_t len = strlen(pattern);
+    char *translated = malloc(len * 12 + 1);
+    if (!translated) return false;
+
+    size_t out = 0;
+    bool in_bracket = false;
+    for (size_t i = 0; i < len; i++) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < len) {
+            char next = pattern[++i];
+            const char *inner = next == 'd' ? "0-9" : next == 'w' ? "A-Za-z0-9_" : next == 's' ? "[:space:]" : NULL;
+            if (inner) {
+                out += (size_t)sprintf(translated + out, in_bracket ? "%s" : "[%s]", inner);
+            } else if (in_bracket) {
+                translated[out++] = next; // Backslashes are literal inside POSIX brackets
+            } else {
+                translated[out++] = '\\';
+                translated[out++] = next;
+            }
+            continue;
+        }
+        if (c == '[' && !in_bracket) {
+            in_bracket = true;
+            translated[out++] = c;
+            if (pattern[i + 1] == '^') translated[out++] = pattern[++i];
+            if (pattern[i + 1] == ']') translated[out++] = pattern[++i];
+            continue;
+        }
+        if (c == ']' && in_bracket) in_bracket = false;
+        translated[out++] = c;
+    }
+    translated[out] = '\0';
+
+    // REG_NEWLINE: "." and [^...] stop at line breaks, as in tree-sitter's #match?
+    int error = regcomp(regex, translated, REG_EXTENDED | REG_NOSUB | REG_NEWLINE);
+    free(translated);
+    return error == 0;
+}
+
+static bool regex_match(const regex_t *regex, const char *text, uint32_t len) {
+    regmatch_t range = {0, (regoff_t)len}; // REG_STARTEND: no copy to terminate the text
+    return regexec(regex, text, 1, &range, REG_STARTEND) == 0;
+}
+
+// --- Compiling ---
+
+static bool push_predicate(QueryPredicates *predicates, const Predicate *predicate) {
+    if (predicates->count == predicates->capacity) {
+        uint32_t new_capacity = predicates->capacity ? predicates->capacity * 2 : 8;
+        Predicate *grown = realloc(predicates->items, new_capacity * sizeof(Predicate));
+        if (!grown) return false;
+        predicates->items = grown;
+        predicates->capacity = new_capacity;
+    }
+    predicates->items[predicates->count++] = *predicate;
+    return true;
+}
+
+static void predicate_free(Predicate *predicate) {
+    if (predicate->kind == MATCHER_SET) free(predicate->as.set.slots);
+    else if (predicate->kind == MATCHER_REGEX) regfree(&predicate->as.regex);
+}
+
+// Picks the matcher for (#match? @capture "pattern")
+static bool compile_match(Predicate *predicate, const char *pattern, uint32_t len) {
+    uint32_t alternatives = 1;
+    for (uint32_t i = 0; i < len; i++) alternatives += pattern[i] == '|';
+    PredicateString *strings = malloc(alternatives * sizeof(PredicateString));
+    if (!strings) {
+        fprintf(stderr, "Failed to allocate query predicates\n");
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t count = literal_alternatives(pattern, len, strings);
+    predicate->by_line = count > 0;
+    if (count == 1) {
+        predicate->kind = MATCHER_LITERAL;
+        predicate->as.literal = strings[0];
+    } else if (count > 1) {
+        predicate->kind = MATCHER_SET;
+        ok = string_set_build(&predicate->as.set, strings, count);
+        if (!ok) fprintf(stderr, "Failed to allocate query predicates\n");
+    } else if (scanner_compile(pattern, &predicate->as.scanner)) {
+        predicate->kind = MATCHER_SCANNER;
+    } else {
+        predicate->kind = MATCHER_REGEX;
+        ok = regex_compile(pattern, &predicate->as.regex);
+        if (!ok) fprintf(stderr, "Invalid regex in query predicate: \"%s\"\n", pattern);
+    }
+    free(strings);
+    return ok;
+}
+
+// Adds the predicate made of steps[0, step_count) if it tests text
+static bool compile_predicate(QueryPredicates *predicates, const TSQuery *query,
+                              const TSQueryPredicateStep *steps, uint32_t step_count) {
+    if (step_count < 3 || steps[0].type != TSQueryPredicateStepTypeString ||
+        steps[1].type != TSQueryPredicateStepTypeCapture) {
+        return true;
+    }
+    uint32_t len;
+    const char *op = ts_query_string_value_for_id(query, steps[0].value_id, &len);
+    if (!op) return true;
+    bool negate = strncmp(op, "not-", 4) == 0;
+    const char *name = negate ? op + 4 : op;
+
+    Predicate predicate;
+    memset(&predicate, 0, sizeof(predicate));
+    predicate.negate = negate;
+    predicate.capture = steps[1].value_id;
+
+    if (strcmp(name, "eq?") == 0 && step_count == 3) {
+        if (steps[2].type == TSQueryPredicateStepTypeCapture) {
+            predicate.kind = MATCHER_CAPTURE;
+            predicate.as.other_capture = steps[2].value_id;
+        } else {
+            predicate.kind = MATCHER_LITERAL;
+            predicate.as.literal.text = ts_query_string_value_for_id(query, steps[2].value_id, &predicate.as.literal.len);
+        }
+    } else if (strcmp(name, "match?") == 0 && step_count == 3 && steps[2].type == TSQueryPredicateStepTypeString) {
+        const char *pattern = ts_query_string_value_for_id(query, steps[2].value_id, &len);
+        if (!compile_match(&predicate, pattern, len)) {
+            predicate_free(&predicate);
+            return false;
+        }
+    } else if (strcmp(name, "any-of?") == 0) {
+        PredicateString *strings = malloc((step_count - 2) * sizeof(PredicateString));
+        uint32_t count = 0;
+        bool ok = strings != NULL;
+        for (uint32_t i = 2; ok && i < step_count; i++) {
+            if (steps[i].type != TSQueryPredicateStepTypeString) continue;
+            strings[count].text = ts_query_string_value_for_id(query, steps[i].value_id, &strings[count].len);
+            count++;
+        }
+        predicate.kind = MATCHER_SET;
+        ok = ok && string_set_build(&predicate.as.set, strings, count);
+        free(strings);
+        if (!ok) {
+            fprintf(stderr, "Failed to allocate query predicates\n");
+            return false;
+        }
+    } else {
+        return true;
+    }
+
+    if (!push_predicate(predicates, &predicate)) {
+        fprintf(stderr, "Failed to allocate query predicates\n");
+        predicate_free(&predicate);
+        return false;
+    }
+    return true;
+}
+
+QueryPredicates *query_predicates_new(const TSQuery *query) {
+    QueryPredicates *predicates = calloc(1, sizeof(QueryPredicates));
+    uint32_t pattern_count = ts_query_pattern_count(query);
+    if (predicates) predicates->first = malloc((pattern_count + 1) * sizeof(uint32_t));
+    if (!predicates || !predicates->first) {
+        fprintf(stderr, "Failed to allocate query predicates\n");
+        free(predicates);
+        return NULL;
+    }
+    predicates->pattern_count = pattern_count;
+
+    for (uint32_t pattern = 0; pattern < pattern_count; pattern++) {
+        predicates->first[pattern] = predicates->count;
+        uint32_t step_count;
+        const TSQueryPredicateStep *steps = ts_query_predicates_for_pattern(query, pattern, &step_count);
+        uint32_t i = 0;
+        while (i < step_count) {
+            uint32_t end = i;
+            while (end < step_count && steps[end].type != TSQueryPredicateStepTypeDone) end++;
+            if (!compile_predicate(predicates, query, steps + i, end - i)) {
+                query_predicates_free(predicates);
+                return NULL;
+            }
+            i = end + 1;
+        }
+    }
+    predicates->first[pattern_count] = predicates->count;
+    return predicates;
+}
+
+void query_predicates_free(QueryPredicates *predicates) {
+    if (!predicates) return;
+    for (uint32_t i = 0; i < predicates->count; i++) predicate_free(&predicates->items[i]);
+    free(predicates->items);
+    free(predicates->first);
+    free(predicates);
+}
+
+// --- Matching ---
+
+static PredicateString node_text(TSNode node, const char *code, size_t code_size) {
+    uint32_t start = ts_node_start_byte(node);
+    uint32_t end = ts_node_end_byte(node);
+    if (end > code_size) end = (uint32_t)code_size;
+    if (start > end) start = end;
+    return (PredicateString){code + start, end - start};
+}
+
+static bool word_test(const Predicate *predicate, const char *text, uint32_t len) {
+    if (predicate->kind == MATCHER_LITERAL) {
+        return len == predicate->as.literal.len && memcmp(text, predicate->as.literal.text, len) == 0;
+    }
+    return string_set_contains(&predicate->as.set, text, len);
+}
+
+// "^(word|...)$" matches if any line is one of the words, as the regex would with REG_NEWLINE
+static bool word_test_by_line(const Predicate *predicate, PredicateString text) {
+    const char *line = text.text;
+    const char *end = text.text + text.len;
+    while (true) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = newline ? newline : end;
+        if (word_test(predicate, line, (uint32_t)(line_end - line))) return true;
+        if (!newline) return false;
+        line = newline + 1;
+    }
+}
+
+static bool predicate_test(const Predicate *predicate, const TSQueryMatch *match, PredicateString text,
+                           const char *code, size_t code_size) {
+    if (predicate->by_line) return word_test_by_line(predicate, text);
+    switch (predicate->kind) {
+        case MATCHER_LITERAL:
+        case MATCHER_SET:
+            return word_test(predicate, text.text, text.len);
+        case MATCHER_SCANNER:
+            return scanner_match(&predicate->as.scanner, (const unsigned char *)text.text, text.len);
+        case MATCHER_REGEX:
+            return regex_match(&predicate->as.regex, text.text, text.len);
+        case MATCHER_CAPTURE:
+            for (uint16_t i = 0; i < match->capture_count; i++) {
+                if (match->captures[i].index != predicate->as.other_capture) continue;
+                PredicateString other = node_text(match->captures[i].node, code, code_size);
+                return other.len == text.len && memcmp(other.text, text.text, text.len) == 0;
+            }
+            return true;
+    }
+    return true;
+}
+
+bool query_predicates_accept(const QueryPredicates *predicates, const TSQueryMatch *match,
+                             const char *code, size_t code_size) {
+    if (!predicates || match->pattern_index >= predicates->pattern_count) return true;
+    uint32_t end = predicates->first[match->pattern_index + 1];
+    for (uint32_t p = predicates->first[match->pattern_index]; p < end; p++) {
+        const Predicate *predicate = &predicates->items[p];
+        for (uint16_t i = 0; i < match->capture_count; i++) {
+            if (match->captures[i].index != predicate->capture) continue;
+            PredicateString text = node_text(match->captures[i].node, code, code_size);
+            if (predicate_test(predicate, match, text, code, code_size) == predicate->negate) return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+// Text predicates of a query's patterns (#match?, #eq?, #any-of? and their #not-
+// forms), compiled once so matches can be filtered as they stream out of a cursor.
+// Each is turned into the cheapest matcher that gives the same answer:
+//
+//   #eq? @a "x", "^x$"               string comparison
+//   #any-of? @a ..., "^(x|y|z)$"     perfect-hash set lookup
+//   "^[A-Z]", "^[A-Z][A-Z_]*$", "^-" scan of an anchored run of byte classes
+//   any other regex                  POSIX extended regex (\d, \w and \s translated)
+//
+// Other predicates (#set!, #is-not? ...) do not test text and are left to their users.
+// Compiled predicates point into the query's strings and must not outlive it; they
+// are read-only, so one set can serve any number of threads.
+typedef struct QueryPredicates QueryPredicates;
+
+// Compiles the text predicates of every pattern of `query`. Prints the problem and
+// returns NULL if a regex is invalid or on allocation failure.
+QueryPredicates *query_predicates_new(const TSQuery *query);
+
+void query_predicates_free(QueryPredicates *predicates);
+
+// Whether `match` passes every text predicate of its pattern, reading the captured
+// nodes' text from code[0, code_size). A NULL `predicates` accepts everything.
+bool query_predicates_accept(const QueryPredicates *predicates, const TSQueryMatch *match,
+                             const char *code, size_t code_size);
+
+#endif // PREDICATE_H
@@ -0,0 +1,124 @@
+#include "progressive.h"
+#include "highlight.h"
+
+#include <stdio.h>
+#include <string.h>
+
+uint32_t progressive_line_end_after(const char *code, size_t code_size, size_t offset) {
+    if (offset >= code_size) return (uint32_t)code_size;
+    const char *newline = memchr(code + offset, '\n', code_size - offset);
+    return newline ? (uint32_t)(newline - code + 1) : (uint32_t)code_size;
+}
+
+static uint32_t line_start_before(const char *code, uint32_t offset) {
+    while (offset > 0 && code[offset - 1] != '\n') offset--;
+    return offset;
+}
+
+static TSPoint point_at(const char *code, uint32_t offset) {
+    TSPoint point = {0, 0};
+    const char *line = code;
+    const char *end = code + offset;
+    const char *newline;
+    while ((newline = memchr(line, '\n', (size_t)(end - line))) != NULL) {
+        point.row++;
+        line = newline + 1;
+    }
+    point.column = (uint32_t)(end - line);
+    return point;
+}
+
+// Highlights and renders code[from, to) one line-aligned window at a time, flushing after each
+static bool render_windows(Renderer *renderer, TSQueryCursor *cursor, const TSQuery *query, TSNode root,
+                           const uint8_t *capture_styles, const QueryPredicates *predicates,
+                           const InjectionSet *injections, const char *code, size_t tree_size,
+                           uint32_t from, uint32_t to, uint32_t window_bytes,
+                           uint32_t *current_byte, SpanList *carry, SpanList *spans, SpanList *scratch) {
+    while (from < to) {
+        uint32_t window_end = progressive_line_end_after(code, to, (size_t)from + window_bytes);
+        if (!highlight_collect_window(cursor, query, root, capture_styles, predicates, code, tree_size,
+                                      from, window_end, current_byte, carry, spans) ||
+            (injections && !injection_apply(injections, from, window_end, spans, scratch))) {
+            fprintf(stderr, "Failed to allocate highlight spans\n");
+            return false;
+        }
+        render_spans(renderer, code, from, window_end, spans->items, spans->count);
+        renderer_flush(renderer);
+        from = window_end;
+    }
+    return true;
+}
+
+bool render_progressive(Renderer *renderer, TSParser *parser, TSTree **tree,
+                        const TSQuery *query, TSQueryCursor *cursor, const uint8_t *capture_styles,
+                        const QueryPredicates *predicates, const InjectionSet *injections,
+                        const char *code, size_t code_size, uint32_t parse_size, uint32_t window_bytes) {
+    SpanList spans = {0};
+    SpanList carry = {0};
+    SpanList scratch = {0};
+    uint32_t current_byte = 0;
+    uint32_t shown = 0;
+    bool ok = true;
+
+    if (parse_size < code_size) {
+        // First screen from the partial tree. Every top-level node but the last one is
+        // complete, so the rest of the file will not change how it is highlighted.
+        TSNode root = ts_tree_root_node(*tree);
+        uint32_t child_count = ts_node_child_count(root);
+        if (child_count > 1) {
+            shown = line_start_before(code, ts_node_start_byte(ts_node_child(root, child_count - 1)));
+        }
+        if (shown == 0) shown = parse_size; // One node spans the whole prefix; show it as parsed
+
+        ts_query_cursor_set_byte_range(cursor, 0, shown);
+        ts_query_cursor_exec(cursor, query, root);
+        ok = highlight_collect(cursor, capture_styles, predicates, code, parse_size, &current_byte, &spans);
+        if (!ok) fprintf(stderr, "Failed to allocate highlight spans\n");
+
+        // A span running past the first screen may end elsewhere in the full tree; stop before it
+        size_t count = 0;
+        while (ok) {
+            while (count < spans.count && spans.items[count].end <= shown) count++;
+            if (count == spans.count || spans.items[count].start >= shown) break;
+            shown = line_start_before(code, spans.items[count].start);
+            count = 0;
+        }
+        if (ok) {
+            render_spans(renderer, code, 0, shown, spans.items, count);
+            renderer_flush(renderer);
+        }
+        current_byte = shown;
+
+        // Extend the partial tree to the whole file so the reparse reuses its nodes
+        if (ok) {
+            TSInputEdit edit = {
+                .start_byte = parse_size,
+                .old_end_byte = parse_size,
+                .new_end_byte = (uint32_t)code_size,
+                .start_point = point_at(code, parse_size),
+                .old_end_point = point_at(code, parse_size),
+                .new_end_point = point_at(code, (uint32_t)code_size),
+            };
+            ts_tree_edit(*tree, &edit);
+            TSTree *full_tree = ts_parser_parse_string(parser, *tree, code, (uint32_t)code_size);
+            if (full_tree) {
+                ts_tree_delete(*tree);
+                *tree = full_tree;
+            } else {
+                fprintf(stderr, "Failed to parse code\n");
+                ok = false;
+            }
+        }
+    }
+
+    if (ok) {
+        ok = render_windows(renderer, cursor, query, ts_tree_root_node(*tree), capture_styles, predicates, injections,
+                            code, code_size, shown, (uint32_t)code_size, window_bytes,
+                            &current_byte, &carry, &spans, &scratch);
+    }
+
+    span_list_free(&spans);
+    span_list_free(&carry);
+    span_list_free(&scratch);
+    return ok;
+}
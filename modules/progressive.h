@@ -0,0 +1,29 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tree_sitter/api.h>
+
+#include "injection.h"
+#include "render.h"
+
+#define PROGRESSIVE_DEFAULT_WINDOW_KB 64
+
+// Start of the line following `offset` (or `code_size`), so that code[0, result) ends on a line break
+uint32_t progressive_line_end_after(const char *code, size_t code_size, size_t offset);
+
+// Renders the whole file for interactive use. `*tree` holds only code[0, parse_size)
+// (a line-aligned prefix, see progressive_line_end_after): the part of it that the rest
+// of the file cannot change is highlighted and flushed first, then the tree is extended
+// to the whole file and the remainder is queried and flushed one window at a time.
+// On return `*tree` is the tree of the whole file. Embedded code from `injections` (may
+// be NULL; it needs the tree of the whole file, so `parse_size` must then be `code_size`)
+// is merged into each window. Returns false on failure.
+bool render_progressive(Renderer *renderer, TSParser *parser, TSTree **tree,
+                        const TSQuery *query, TSQueryCursor *cursor, const uint8_t *capture_styles,
+                        const QueryPredicates *predicates, const InjectionSet *injections,
+                        const char *code, size_t code_size, uint32_t parse_size, uint32_t window_bytes);
+
+#endif // PROGRESSIVE_H
@@ -0,0 +1,437 @@
+#include "render.h"
+#include "theme.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void ansi_build_escapes(Renderer *r);
+
+void renderer_init(Renderer *r, FILE *out, OutputFormat format, bool show_line_numbers, int line_num_padding) {
+    memset(r, 0, sizeof(*r));
+    r->out = out;
+    r->format = format;
+    r->show_line_numbers = show_line_numbers;
+    r->line_num_padding = line_num_padding;
+    r->line = 1;
+    r->at_line_start = true;
+    r->open_style = HL_NONE;
+
+    r->ansi_state = ANSI_STATE_PLAIN;
+    r->theme = selected_theme;
+    if (format == OUTPUT_ANSI) ansi_build_escapes(r);
+}
+
+void renderer_set_theme(Renderer *r, const ColorTheme *theme) {
+    r->theme = theme;
+    if (r->format == OUTPUT_ANSI) ansi_build_escapes(r);
+}
+
+// --- Output ---
+//
+// Code, theme escapes and markup literals are passed to the writer by reference;
+// only what is formatted on the fly (line numbers) is copied.
+
+static void out_ref(Renderer *r, const char *data, size_t len) {
+    if (r->writer) writer_ref(r->writer, data, len);
+    else fwrite(data, 1, len, r->out);
+}
+
+#define OUT_LITERAL(r, text) out_ref((r), (text), sizeof(text) - 1)
+
+static void out_printf(Renderer *r, const char *format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len <= 0) return;
+    if ((size_t)len >= sizeof(buffer)) len = sizeof(buffer) - 1;
+    if (r->writer) writer_copy(r->writer, buffer, (size_t)len);
+    else fwrite(buffer, 1, (size_t)len, r->out);
+}
+
+// Writes text[0, len) with &, < and > replaced by entities
+static void out_escaped(Renderer *r, const char *text, size_t len) {
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = text[i];
+        if (c != '&' && c != '<' && c != '>') continue;
+        out_ref(r, text + run, i - run);
+        if (c == '&') OUT_LITERAL(r, "&amp;");
+        else if (c == '<') OUT_LITERAL(r, "&lt;");
+        else OUT_LITERAL(r, "&gt;");
+        run = i + 1;
+    }
+    out_ref(r, text + run, len - run);
+}
+
+// --- ANSI ---
+//
+// The renderer tracks the attributes the terminal currently has and only writes
+// the SGR parameters that change; the escape for every pair of states is worked
+// out once, when the renderer is set up. Whitespace is written in whatever style is
+// active, since color does not show on it. Styles are reset before each line
+// break, so every line (and every piece rendered separately) starts from the
+// default attributes.
+
+// Terminal attributes set by one of the theme's ANSI escape sequences
+typedef struct {
+    char fg[24];    // Foreground SGR parameters (e.g. "38;5;142"); empty for the default color
+    bool bold;
+    char extra[24]; // Any other SGR parameters; changing these goes through a reset
+} AnsiState;
+
+// Adds `param` to the ';'-separated list in dst[size]. Returns false, leaving the
+// list as it was, if it does not fit.
+static bool append_param(char *dst, size_t size, const char *param) {
+    size_t len = strlen(dst);
+    size_t separator = len ? 1 : 0;
+    size_t param_len = strlen(param);
+    if (len + separator + param_len >= size) return false;
+    if (separator) dst[len] = ';';
+    memcpy(dst + len + separator, param, param_len + 1);
+    return true;
+}
+
+// Splits a theme escape such as "\x1b[38;5;167;1m" into foreground, bold and other attributes
+static void ansi_parse(const char *escape, AnsiState *state) {
+    memset(state, 0, sizeof(*state));
+    if (!escape || strncmp(escape, "\x1b[", 2) != 0) return;
+
+    const char *p = escape + 2;
+    bool dropped = false; // Attributes that did not fit in `extra`
+    while (*p && *p != 'm') {
+        char *end;
+        long code = strtol(p, &end, 10);
+        if (end == p) code = 0; // Empty parameter means reset
+
+        if (code == 38 && *end == ';') {
+            // Extended color: 38;5;N or 38;2;R;G;B
+            const char *color_end = end + 1;
+            int fields = strtol(color_end, NULL, 10) == 2 ? 4 : 2;
+            for (int f = 0; f < fields && *color_end && *color_end != 'm'; f++) {
+                color_end += strcspn(color_end, ";m");
+                if (*color_end == ';' && f + 1 < fields) color_end++;
+            }
+            snprintf(state->fg, sizeof(state->fg), "%.*s", (int)(color_end - p), p);
+            end = (char *)color_end;
+        } else if ((code >= 30 && code <= 37) || (code >= 90 && code <= 97)) {
+            snprintf(state->fg, sizeof(state->fg), "%ld", code);
+        } else if (code == 39) {
+            state->fg[0] = '\0';
+        } else if (code == 1) {
+            state->bold = true;
+        } else if (code == 22) {
+            state->bold = false;
+        } else if (code == 0) {
+            memset(state, 0, sizeof(*state));
+        } else {
+            char param[16];
+            snprintf(param, sizeof(param), "%ld", code);
+            if (!append_param(state->extra, sizeof(state->extra), param)) dropped = true;
+        }
+
+        p = end;
+        if (*p == ';') p++;
+        else if (*p != 'm') break; // Not an SGR sequence we understand
+    }
+    if (dropped) {
+        fprintf(stderr, "Warning: Too many attributes in theme escape \"\\x1b[%s\", ignoring those that do not fit\n", escape + 2);
+    }
+}
+
+// Shortest escape that takes the terminal from `current` to `target`
+static void ansi_escape_between(const AnsiState *current, const AnsiState *target, AnsiEscape *escape) {
+    bool same_fg = strcmp(current->fg, target->fg) == 0;
+    bool same_extra = strcmp(current->extra, target->extra) == 0;
+    escape->len = 0;
+    if (same_fg && same_extra && current->bold == target->bold) return;
+
+    // From a reset: everything the target sets. Both lists hold a whole AnsiState, so
+    // the appends below always fit.
+    char reset[64] = "0";
+    if (target->fg[0]) append_param(reset, sizeof(reset), target->fg);
+    if (target->bold) append_param(reset, sizeof(reset), "1");
+    if (target->extra[0]) append_param(reset, sizeof(reset), target->extra);
+
+    const char *params = reset;
+    char delta[64] = "";
+    if (same_extra) {
+        if (!same_fg) append_param(delta, sizeof(delta), target->fg[0] ? target->fg : "39");
+        if (current->bold != target->bold) append_param(delta, sizeof(delta), target->bold ? "1" : "22");
+        if (strlen(delta) < strlen(reset)) params = delta;
+    }
+    int len = snprintf(escape->text, sizeof(escape->text), "\x1b[%sm", params);
+    escape->len = (uint8_t)((size_t)len < sizeof(escape->text) ? len : (int)sizeof(escape->text) - 1);
+}
+
+static void ansi_build_escapes(Renderer *r) {
+    AnsiState states[ANSI_STATE_COUNT];
+    for (int style = 0; style < HL_STYLE_COUNT; style++) {
+        ansi_parse(get_style_ansi(r->theme, (HighlightStyle)style), &states[style]);
+    }
+    ansi_parse(r->theme->ansi_line_number, &states[ANSI_STATE_LINE_NUMBER]);
+    memset(&states[ANSI_STATE_PLAIN], 0, sizeof(AnsiState));
+
+    for (int from = 0; from < ANSI_STATE_COUNT; from++) {
+        for (int to = 0; to < ANSI_STATE_COUNT; to++) {
+            ansi_escape_between(&states[from], &states[to], &r->ansi_escapes[from][to]);
+        }
+    }
+}
+
+static void ansi_set(Renderer *r, uint8_t state) {
+    const AnsiEscape *escape = &r->ansi_escapes[r->ansi_state][state];
+    if (escape->len) out_ref(r, escape->text, escape->len);
+    r->ansi_state = state;
+}
+
+static bool is_blank(const char *text, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (text[i] != ' ' && text[i] != '\t' && text[i] != '\r') return false;
+    }
+    return true;
+}
+
+static void ansi_piece(Renderer *r, const char *code, size_t from, size_t to, uint8_t style) {
+    while (from < to) {
+        if (r->show_line_numbers && r->at_line_start) {
+            ansi_set(r, ANSI_STATE_LINE_NUMBER);
+            out_printf(r, "%*u │ ", r->line_num_padding, r->line);
+            r->at_line_start = false;
+        }
+
+        const char *newline = memchr(code + from, '\n', to - from);
+        size_t line_end = newline ? (size_t)(newline - code) : to;
+        if (line_end > from) {
+            if (!is_blank(code + from, line_end - from)) ansi_set(r, style);
+            out_ref(r, code + from, line_end - from);
+        }
+        if (!newline) break;
+
+        ansi_set(r, ANSI_STATE_PLAIN);
+        out_ref(r, code + line_end, 1);
+        r->line++;
+        r->at_line_start = true;
+        from = line_end + 1;
+    }
+}
+
+static void render_spans_ansi(Renderer *r, const char *code, size_t from, size_t to,
+                              const HighlightSpan *spans, size_t span_count) {
+    size_t current_byte = from;
+    for (size_t i = 0; i < span_count; i++) {
+        ansi_piece(r, code, current_byte, spans[i].start, HL_NONE);
+        ansi_piece(r, code, spans[i].start, spans[i].end, spans[i].style);
+        current_byte = spans[i].end;
+    }
+    ansi_piece(r, code, current_byte, to, HL_NONE);
+}
+
+// --- Classic HTML ---
+//
+// Highlight spans are closed before each line break and reopened on the next line,
+// so they always sit inside the line's markup and every line starts with nothing open.
+
+// Opens the markup for a new line if line numbers are on and it is still pending
+static void html_line_start(Renderer *r) {
+    if (!r->show_line_numbers || !r->at_line_start) return;
+    if (r->line > 1) {
+        OUT_LITERAL(r, "</span></div>\n");
+    }
+    out_printf(r, "<div class=\"line\" id=\"L%u\"><span class=\"line-number\">%*u</span>",
+               r->line, r->line_num_padding, r->line);
+    OUT_LITERAL(r, "<span class=\"code-line-content\">");
+    r->at_line_start = false;
+}
+
+// Helper function to print a section of text, handling line numbers and HTML escaping
+static void print_code_section(Renderer *r, const char *code_buffer, size_t start_byte, size_t end_byte) {
+    while (start_byte < end_byte) {
+        html_line_start(r);
+
+        const char *newline = memchr(code_buffer + start_byte, '\n', end_byte - start_byte);
+        size_t line_end = newline ? (size_t)(newline - code_buffer) + 1 : end_byte;
+        out_escaped(r, code_buffer + start_byte, line_end - start_byte);
+        if (!newline) break;
+
+        r->line++;
+        r->at_line_start = true;
+        start_byte = line_end;
+    }
+}
+
+static void html_piece(Renderer *r, const char *code, size_t from, size_t to, const char *cls) {
+    while (from < to) {
+        const char *newline = memchr(code + from, '\n', to - from);
+        size_t line_end = newline ? (size_t)(newline - code) : to;
+
+        if (cls && line_end > from) {
+            html_line_start(r);
+            OUT_LITERAL(r, "<span class=\"");
+            out_ref(r, cls, strlen(cls));
+            OUT_LITERAL(r, "\">");
+            print_code_section(r, code, from, line_end);
+            OUT_LITERAL(r, "</span>");
+        } else {
+            print_code_section(r, code, from, line_end);
+        }
+        if (!newline) break;
+
+        print_code_section(r, code, line_end, line_end + 1);
+        from = line_end + 1;
+    }
+}
+
+static void render_spans_html(Renderer *r, const char *code, size_t from, size_t to,
+                              const HighlightSpan *spans, size_t span_count) {
+    size_t current_byte = from;
+
+    for (size_t i = 0; i < span_count; i++) {
+        const HighlightSpan *span = &spans[i];
+        print_code_section(r, code, current_byte, span->start);
+        html_piece(r, code, span->start, span->end, get_style_html_class((HighlightStyle)span->style));
+        current_byte = span->end;
+    }
+
+    print_code_section(r, code, current_byte, to);
+}
+
+// --- Compact HTML ---
+//
+// Adjacent pieces with the same style become one run, whitespace between them is
+// folded into the run, unstyled text is written without any tag and class names
+// are the short generated ones. Runs never cross a line break. With line numbers,
+// each line is a single <span class=l> whose gutter is drawn by a CSS counter.
+
+static void compact_flush_pending(Renderer *r) {
+    if (r->pending_ws_len) {
+        out_ref(r, r->pending_ws, r->pending_ws_len);
+        r->pending_ws_len = 0;
+    }
+}
+
+static void compact_close_run(Renderer *r) {
+    if (r->open_style != HL_NONE) {
+        OUT_LITERAL(r, "</span>");
+        r->open_style = HL_NONE;
+    }
+    compact_flush_pending(r);
+}
+
+static void compact_open_line(Renderer *r) {
+    if (r->show_line_numbers && r->at_line_start) {
+        out_printf(r, "<span class=l id=L%u>", r->line);
+    }
+    r->at_line_start = false;
+}
+
+// Writes text[0, len) with `style`; the text contains no line breaks.
+static void compact_write(Renderer *r, const char *text, size_t len, uint8_t style) {
+    if (len == 0) return;
+    compact_open_line(r);
+
+    if (style == HL_NONE) {
+        bool blank = true;
+        for (size_t i = 0; i < len && blank; ++i) {
+            blank = (text[i] == ' ' || text[i] == '\t' || text[i] == '\r');
+        }
+        if (blank && r->open_style != HL_NONE) {
+            // Decide later whether this belongs to the open run
+            if (r->pending_ws_len == 0) r->pending_ws = text;
+            r->pending_ws_len += len;
+            return;
+        }
+        compact_close_run(r);
+        out_escaped(r, text, len);
+        return;
+    }
+
+    if (r->open_style == style) {
+        compact_flush_pending(r); // Whitespace between same-style pieces joins the run
+    } else {
+        compact_close_run(r);
+        const char *cls = get_style_html_short_class((HighlightStyle)style);
+        OUT_LITERAL(r, "<span class=");
+        out_ref(r, cls, strlen(cls));
+        OUT_LITERAL(r, ">");
+        r->open_style = style;
+    }
+    out_escaped(r, text, len);
+}
+
+static void compact_piece(Renderer *r, const char *code, size_t from, size_t to, uint8_t style) {
+    while (from < to) {
+        const char *newline = memchr(code + from, '\n', to - from);
+        size_t line_end = newline ? (size_t)(newline - code) : to;
+
+        compact_write(r, code + from, line_end - from, style);
+        if (!newline) break;
+
+        compact_open_line(r);
+        compact_close_run(r);
+        out_ref(r, code + line_end, 1);
+        if (r->show_line_numbers) OUT_LITERAL(r, "</span>");
+        r->line++;
+        r->at_line_start = true;
+        from = line_end + 1;
+    }
+}
+
+static void render_spans_compact(Renderer *r, const char *code, size_t from, size_t to,
+                                 const HighlightSpan *spans, size_t span_count) {
+    size_t current_byte = from;
+    for (size_t i = 0; i < span_count; i++) {
+        compact_piece(r, code, current_byte, spans[i].start, HL_NONE);
+        compact_piece(r, code, spans[i].start, spans[i].end, spans[i].style);
+        current_byte = spans[i].end;
+    }
+    compact_piece(r, code, current_byte, to, HL_NONE);
+}
+
+// --- Public Entry Points ---
+
+void renderer_begin(Renderer *r) {
+    // Initial line div for the very first line if line numbers are enabled
+    if (r->format == OUTPUT_HTML && r->show_line_numbers) {
+        html_line_start(r); // at_line_start is false from here on: the first line number is out
+    }
+}
+
+void render_spans(Renderer *r, const char *code, size_t from, size_t to,
+                  const HighlightSpan *spans, size_t span_count) {
+    if (r->format == OUTPUT_ANSI) {
+        render_spans_ansi(r, code, from, to, spans, span_count);
+    } else if (r->format == OUTPUT_HTML_COMPACT) {
+        render_spans_compact(r, code, from, to, spans, span_count);
+    } else {
+        render_spans_html(r, code, from, to, spans, span_count);
+    }
+}
+
+void renderer_write_markup(Renderer *r, const char *text, size_t len) {
+    if (r->format == OUTPUT_ANSI) ansi_set(r, ANSI_STATE_PLAIN);
+    else if (r->format == OUTPUT_HTML_COMPACT) compact_close_run(r);
+    if (r->writer) writer_copy(r->writer, text, len);
+    else fwrite(text, 1, len, r->out);
+}
+
+void renderer_finish(Renderer *r) {
+    if (r->format == OUTPUT_ANSI) {
+        ansi_set(r, ANSI_STATE_PLAIN);
+    } else if (r->format == OUTPUT_HTML_COMPACT) {
+        compact_close_run(r);
+        if (r->show_line_numbers && !r->at_line_start) OUT_LITERAL(r, "</span>");
+        r->at_line_start = true;
+    } else if (r->format == OUTPUT_HTML && r->show_line_numbers) {
+        if (!r->at_line_start || r->line == 1) { // line == 1 implies it was possibly a single-line file
+            OUT_LITERAL(r, "</span></div>\n");
+        }
+    }
+}
+
+void renderer_flush(Renderer *r) {
+    if (r->writer) writer_flush(r->writer);
+    else fflush(r->out);
+}
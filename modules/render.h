@@ -0,0 +1,81 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "highlight.h"
+#include "theme.h"
+#include "writer.h"
+
+typedef enum {
+    OUTPUT_ANSI,
+    OUTPUT_HTML,
+    OUTPUT_HTML_COMPACT // Merged runs, short class names, one element per line
+} OutputFormat;
+
+// ANSI attribute states: one per highlight style, then the gutter and the default attributes
+#define ANSI_STATE_LINE_NUMBER HL_STYLE_COUNT
+#define ANSI_STATE_PLAIN (HL_STYLE_COUNT + 1)
+#define ANSI_STATE_COUNT (HL_STYLE_COUNT + 2)
+#define ANSI_ESCAPE_MAX 64
+
+// Shortest escape sequence that takes the terminal from one state to another
+typedef struct {
+    char text[ANSI_ESCAPE_MAX];
+    uint8_t len; // 0 when both states have the same attributes
+} AnsiEscape;
+
+// Streaming renderer for the body of ANSI/HTML output. State carries across
+// render_spans calls, so a file can be rendered in consecutive pieces.
+typedef struct {
+    FILE *out;
+    // When set, output goes here instead of `out`. The writer keeps references to the
+    // code passed to render_spans and to the escapes below, so the code must stay
+    // unchanged and the renderer alive until the writer is flushed.
+    Writer *writer;
+    OutputFormat format;
+    bool show_line_numbers;
+    int line_num_padding;
+
+    uint32_t line;      // Line number of the next byte written
+    bool at_line_start;
+
+    // ANSI: escapes between every pair of theme states, and the state the terminal is in
+    const ColorTheme *theme;
+    AnsiEscape ansi_escapes[ANSI_STATE_COUNT][ANSI_STATE_COUNT];
+    uint8_t ansi_state;
+
+    // Compact HTML: the open run and whitespace not yet assigned to a run
+    uint8_t open_style;
+    const char *pending_ws;
+    size_t pending_ws_len;
+} Renderer;
+
+// Colors come from the selected theme until renderer_set_theme picks another.
+void renderer_init(Renderer *r, FILE *out, OutputFormat format, bool show_line_numbers, int line_num_padding);
+
+// Renders in `theme` from now on (ANSI; HTML pages carry the colors of every theme).
+void renderer_set_theme(Renderer *r, const ColorTheme *theme);
+
+// Writes anything the body needs before the first byte of code.
+void renderer_begin(Renderer *r);
+
+// Renders code[from, to). `spans` must be sorted, non-overlapping and inside [from, to).
+void render_spans(Renderer *r, const char *code, size_t from, size_t to,
+                  const HighlightSpan *spans, size_t span_count);
+
+// Writes text[0, len) unchanged (copied, so it may be temporary) between rendered
+// pieces, e.g. markup around lines. ANSI attributes and compact runs still open are
+// closed first; ANSI escapes in `text` must leave the default attributes behind.
+void renderer_write_markup(Renderer *r, const char *text, size_t len);
+
+// Closes whatever the body still has open.
+void renderer_finish(Renderer *r);
+
+// Pushes everything rendered so far to the output.
+void renderer_flush(Renderer *r);
+
+#endif // RENDER_H
@@ -0,0 +1,173 @@
+#include "span_file.h"
+#include "theme.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// --- Writing ---
+
+typedef struct {
+    FILE *out;
+    unsigned char buffer[64 * 1024];
+    size_t len;
+    bool failed;
+} SpanFileWriter;
+
+static void put_bytes(SpanFileWriter *w, const void *data, size_t len) {
+    if (w->len + len > sizeof(w->buffer)) {
+        if (fwrite(w->buffer, 1, w->len, w->out) != w->len) w->failed = true;
+        w->len = 0;
+    }
+    if (len > sizeof(w->buffer)) {
+        if (fwrite(data, 1, len, w->out) != len) w->failed = true;
+        return;
+    }
+    memcpy(w->buffer + w->len, data, len);
+    w->len += len;
+}
+
+static void put_varint(SpanFileWriter *w, uint64_t value) {
+    unsigned char bytes[10];
+    size_t n = 0;
+    do {
+        bytes[n] = value & 0x7F;
+        value >>= 7;
+        if (value) bytes[n] |= 0x80;
+        n++;
+    } while (value);
+    put_bytes(w, bytes, n);
+}
+
+// FNV-1a
+uint64_t span_file_source_hash(const char *code, size_t code_size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < code_size; i++) {
+        hash ^= (unsigned char)code[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool span_file_write(FILE *out, const char *code, size_t code_size, const HighlightSpan *spans, size_t span_count) {
+    SpanFileWriter *w = malloc(sizeof(SpanFileWriter));
+    if (!w) {
+        fprintf(stderr, "Failed to allocate span file buffer\n");
+        return false;
+    }
+    w->out = out;
+    w->len = 0;
+    w->failed = false;
+
+    put_bytes(w, SPAN_FILE_MAGIC, sizeof(SPAN_FILE_MAGIC) - 1);
+    unsigned char version = SPAN_FILE_VERSION;
+    put_bytes(w, &version, 1);
+
+    put_varint(w, code_size);
+    uint64_t hash = span_file_source_hash(code, code_size);
+    unsigned char hash_bytes[8];
+    for (int i = 0; i < 8; i++) hash_bytes[i] = (unsigned char)(hash >> (8 * i));
+    put_bytes(w, hash_bytes, sizeof(hash_bytes));
+
+    // Name table: one entry per style, indexed by HighlightStyle
+    put_varint(w, HL_STYLE_COUNT);
+    for (int style = 0; style < HL_STYLE_COUNT; style++) {
+        const char *name = get_style_capture_name((HighlightStyle)style);
+        put_varint(w, strlen(name));
+        put_bytes(w, name, strlen(name));
+    }
+
+    put_varint(w, span_count);
+    uint32_t previous_end = 0;
+    for (size_t i = 0; i < span_count; i++) {
+        put_varint(w, spans[i].start - previous_end);
+        put_varint(w, spans[i].end - spans[i].start);
+        put_varint(w, spans[i].style);
+        previous_end = spans[i].end;
+    }
+
+    if (w->len && fwrite(w->buffer, 1, w->len, out) != w->len) w->failed = true;
+    bool ok = !w->failed;
+    free(w);
+    return ok;
+}
+
+// --- Reading ---
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} SpanFileReader;
+
+static bool get_varint(SpanFileReader *r, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char byte = *r->p++;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static bool malformed(void) {
+    fprintf(stderr, "Malformed span file\n");
+    return false;
+}
+
+bool span_file_read(const unsigned char *data, size_t size, const char *code, size_t code_size, SpanList *spans) {
+    SpanFileReader r = {data, data + size};
+    size_t magic_len = sizeof(SPAN_FILE_MAGIC) - 1;
+    if (size < magic_len + 1 || memcmp(data, SPAN_FILE_MAGIC, magic_len) != 0) {
+        fprintf(stderr, "Not a span file\n");
+        return false;
+    }
+    if (data[magic_len] != SPAN_FILE_VERSION) {
+        fprintf(stderr, "Unsupported span file version %u\n", data[magic_len]);
+        return false;
+    }
+    r.p += magic_len + 1;
+
+    uint64_t source_size;
+    if (!get_varint(&r, &source_size) || r.end - r.p < 8) return malformed();
+    uint64_t hash = 0;
+    for (int i = 0; i < 8; i++) hash |= (uint64_t)r.p[i] << (8 * i);
+    r.p += 8;
+    if (source_size != code_size || hash != span_file_source_hash(code, code_size)) {
+        fprintf(stderr, "Span file was made from different source (size %llu, %zu now)\n",
+                (unsigned long long)source_size, code_size);
+        return false;
+    }
+
+    // Names resolve to this build's styles; unknown ones render unstyled
+    uint64_t name_count;
+    if (!get_varint(&r, &name_count) || name_count > SPAN_FILE_MAX_NAMES) return malformed();
+    uint8_t name_styles[SPAN_FILE_MAX_NAMES];
+    for (uint64_t i = 0; i < name_count; i++) {
+        uint64_t len;
+        if (!get_varint(&r, &len) || len >= 256 || (uint64_t)(r.end - r.p) < len) return malformed();
+        char name[256];
+        memcpy(name, r.p, len);
+        name[len] = '\0';
+        r.p += len;
+        name_styles[i] = (uint8_t)get_highlight_style(name);
+    }
+
+    uint64_t span_count;
+    if (!get_varint(&r, &span_count)) return malformed();
+    uint64_t position = 0;
+    for (uint64_t i = 0; i < span_count; i++) {
+        uint64_t delta, length, name;
+        if (!get_varint(&r, &delta) || !get_varint(&r, &length) || !get_varint(&r, &name)) return malformed();
+        if (name >= name_count || length == 0 || delta > code_size - position || length > code_size - position - delta) {
+            return malformed();
+        }
+        uint32_t start = (uint32_t)(position + delta);
+        uint32_t end = (uint32_t)(start + length);
+        if (!span_list_push(spans, start, end, (uint16_t)name, name_styles[name])) {
+            fprintf(stderr, "Failed to allocate highlight spans\n");
+            return false;
+        }
+        position = end;
+    }
+    if (r.p != r.end) return malformed();
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef SPAN_FILE_H
+#define SPAN_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "highlight.h"
+
+// Highlight spans saved apart from the source, so a file parsed once can be rendered
+// again in any theme or format without tree-sitter. Layout (integers are LEB128
+// varints unless noted):
+//
+//   "CTSPANS" magic, version byte
+//   source size, FNV-1a 64-bit hash of the source (8 bytes, little-endian)
+//   name count, then per name: length, bytes   (capture names, e.g. "keyword.control")
+//   span count, then per span: start - previous end, length, name index
+//
+// Spans are sorted and do not overlap, so every delta is non-negative.
+
+#define SPAN_FILE_MAGIC "CTSPANS"
+#define SPAN_FILE_VERSION 1
+#define SPAN_FILE_MAX_NAMES 256
+
+uint64_t span_file_source_hash(const char *code, size_t code_size);
+
+// Writes `spans` of code[0, code_size) to `out`. Returns false on a write error.
+bool span_file_write(FILE *out, const char *code, size_t code_size, const HighlightSpan *spans, size_t span_count);
+
+// Reads a span file from data[0, size) into `spans` (appended), checking that it was
+// made from exactly code[0, code_size). Each span's capture is its name index and its
+// style is resolved from the name. Prints the problem and returns false if the file
+// is malformed or belongs to other source.
+bool span_file_read(const unsigned char *data, size_t size, const char *code, size_t code_size, SpanList *spans);
+
+#endif // SPAN_FILE_H
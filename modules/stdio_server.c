@@ -0,0 +1,621 @@
+#include "stdio_server.h"
+#include "arena.h"
+#include "highlight.h"
+#include "json.h"
+#include "line_index.h"
+#include "theme.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// JSON-RPC 2.0 error codes
+#define RPC_PARSE_ERROR -32700
+#define RPC_INVALID_REQUEST -32600
+#define RPC_METHOD_NOT_FOUND -32601
+#define RPC_INVALID_PARAMS -32602
+#define RPC_INTERNAL_ERROR -32603
+
+// An open document: its text, kept current with every edit, and its syntax tree
+typedef struct Document {
+    struct Document *next;
+    char *uri;
+    ServerLanguage language;
+    char *text;
+    size_t size;
+    size_t capacity;
+    TSParser *parser;
+    TSTree *tree;
+    LineIndex lines;               // Updated by every edit
+    InjectionDocument injections;  // Brought up to date when spans are next asked for after a change
+} Document;
+
+// A byte range of a document
+typedef struct {
+    size_t start;
+    size_t end;
+} ByteRange;
+
+// Lines [first, last] of a document
+typedef struct {
+    size_t first;
+    size_t last;
+} LineRange;
+
+typedef struct {
+    FILE *in;
+    FILE *out;
+    bool framed;        // Content-Length headers rather than one message per line
+    bool framing_known; // Set by the first message
+    bool done;
+    ServerLanguageLookup lookup_language;
+    InjectionLookup lookup_injection;
+    const ColorTheme *theme;
+    Document *documents;
+
+    char *message;      // The message being handled
+    size_t message_capacity;
+    TSQueryCursor *cursor;
+    SpanList spans;
+    SpanList scratch;
+    ByteRange *edited;  // Ranges written by the edits of the current request
+    size_t edited_count;
+    size_t edited_capacity;
+    LineRange *changed;
+    size_t changed_count;
+    size_t changed_capacity;
+
+    int error_code;     // Set when a method fails
+    char error[256];
+} Server;
+
+// Records why the current request failed; returns false for the handler to return
+static bool rpc_error(Server *server, int code, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(server->error, sizeof(server->error), format, args);
+    va_end(args);
+    server->error_code = code;
+    return false;
+}
+
+// Grows *items (of `item_size` bytes each) to hold at least `count` of them
+static bool reserve(void **items, size_t *capacity, size_t count, size_t item_size) {
+    if (count <= *capacity) return true;
+    size_t new_capacity = *capacity ? *capacity * 2 : 16;
+    while (new_capacity < count) new_capacity *= 2;
+    void *grown = realloc(*items, new_capacity * item_size);
+    if (!grown) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// --- Documents ---
+
+static Document *find_document(Server *server, const JsonValue *params) {
+    const JsonValue *uri = json_get(params, "uri");
+    if (!uri || uri->type != JSON_STRING) {
+        rpc_error(server, RPC_INVALID_PARAMS, "Missing 'uri'");
+        return NULL;
+    }
+    for (Document *doc = server->documents; doc; doc = doc->next) {
+        if (strcmp(doc->uri, uri->string) == 0) return doc;
+    }
+    rpc_error(server, RPC_INVALID_PARAMS, "Document '%s' is not open", uri->string);
+    return NULL;
+}
+
+static void document_free(Document *doc) {
+    injection_document_free(&doc->injections);
+    line_index_free(&doc->lines);
+    if (doc->tree) ts_tree_delete(doc->tree);
+    if (doc->parser) ts_parser_delete(doc->parser);
+    free(doc->text);
+    free(doc->uri);
+    free(doc);
+}
+
+// Unlinks and frees the document named by params.uri; false if there is none
+static bool close_document(Server *server, const JsonValue *params) {
+    Document *doc = find_document(server, params);
+    if (!doc) return false;
+    Document **link = &server->documents;
+    while (*link != doc) link = &(*link)->next;
+    *link = doc->next;
+    document_free(doc);
+    return true;
+}
+
+// Point of byte `offset`, with the line index of the current text
+static TSPoint point_at(const Document *doc, size_t offset) {
+    size_t line = line_index_line_at(&doc->lines, offset);
+    return (TSPoint){(uint32_t)line, (uint32_t)(offset - doc->lines.line_starts[line])};
+}
+
+// Resolves a position: a byte offset, or [line, column] with the column in bytes
+static bool position_of(Server *server, const Document *doc, const JsonValue *value, size_t *out) {
+    size_t line;
+    size_t column;
+    if (value && value->type == JSON_ARRAY && value->count == 2 &&
+        json_get_index(&value->items[0], doc->lines.line_count - 1, &line) &&
+        json_get_index(&value->items[1], doc->size, &column)) {
+        size_t line_length;
+        line_index_line(&doc->lines, line, &line_length);
+        if (column <= line_length) {
+            *out = doc->lines.line_starts[line] + column;
+            return true;
+        }
+    } else if (json_get_index(value, doc->size, out)) {
+        return true;
+    }
+    return rpc_error(server, RPC_INVALID_PARAMS, "Position outside the document");
+}
+
+// Lines [first, last] named by params.viewport, clipped to the document; the whole
+// document without one. An empty viewport has first > last.
+static bool viewport_of(Server *server, const Document *doc, const JsonValue *params, LineRange *out) {
+    const JsonValue *viewport = json_get(params, "viewport");
+    *out = (LineRange){0, doc->lines.line_count - 1};
+    if (!viewport) return true;
+    size_t first;
+    size_t last;
+    if (viewport->type != JSON_ARRAY || viewport->count != 2 || !json_get_index(&viewport->items[0], SIZE_MAX, &first) ||
+        !json_get_index(&viewport->items[1], SIZE_MAX, &last)) {
+        return rpc_error(server, RPC_INVALID_PARAMS, "'viewport' must be [first_line, last_line]");
+    }
+    out->first = first;
+    if (last < out->last) out->last = last;
+    return true;
+}
+
+// Replaces doc->text[start, end) with text[0, length), edits the syntax tree to match
+// and the line index
+static bool apply_edit(Server *server, Document *doc, size_t start, size_t end, const char *text, size_t length) {
+    size_t new_size = doc->size - (end - start) + length;
+    if (new_size > UINT32_MAX) return rpc_error(server, RPC_INVALID_PARAMS, "Documents are limited to 4 GB");
+    if (!reserve((void **)&doc->text, &doc->capacity, new_size + 1, 1)) {
+        return rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    }
+
+    TSInputEdit edit = {
+        .start_byte = (uint32_t)start,
+        .old_end_byte = (uint32_t)end,
+        .new_end_byte = (uint32_t)(start + length),
+        .start_point = point_at(doc, start),
+        .old_end_point = point_at(doc, end),
+        .new_end_point = point_at(doc, start),
+    };
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            edit.new_end_point.row++;
+            edit.new_end_point.column = 0;
+        } else {
+            edit.new_end_point.column++;
+        }
+    }
+    memmove(doc->text + start + length, doc->text + end, doc->size - end);
+    memcpy(doc->text + start, text, length);
+    doc->size = new_size;
+    doc->text[new_size] = '\0';
+    ts_tree_edit(doc->tree, &edit);
+    injection_document_edit(&doc->injections, &edit);
+
+    if (!line_index_edit(&doc->lines, doc->text, doc->size, start, end, start + length)) {
+        return rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    }
+
+    // Earlier edited ranges move with the text; what this edit deleted from them is gone
+    for (size_t i = 0; i < server->edited_count; i++) {
+        ByteRange *range = &server->edited[i];
+        range->start = (range->start <= start) ? range->start : (range->start >= end) ? range->start - (end - start) + length : start + length;
+        range->end = (range->end <= start) ? range->end : (range->end >= end) ? range->end - (end - start) + length : start + length;
+    }
+    if (!reserve((void **)&server->edited, &server->edited_capacity, server->edited_count + 1, sizeof(ByteRange))) {
+        return rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    }
+    server->edited[server->edited_count++] = (ByteRange){start, start + length};
+    return true;
+}
+
+// --- Spans ---
+
+// Writes the spans of lines [first, last] as [line, start_column, end_column, style]
+// quadruples, a comma before each unless it is the first one written (*any false)
+static bool write_spans(Server *server, Document *doc, LineRange lines, FILE *out, bool *any) {
+    if (lines.first > lines.last) return true;
+    const LineIndex *index = &doc->lines;
+    uint32_t from = (uint32_t)index->line_starts[lines.first];
+    uint32_t to = (uint32_t)((lines.last + 1 < index->line_count) ? index->line_starts[lines.last + 1] : doc->size);
+
+    TSNode root = ts_tree_root_node(doc->tree);
+    const ServerLanguage *language = &doc->language;
+    bool ok = highlight_collect_range(server->cursor, language->query, root, language->capture_styles,
+                                      language->predicates, doc->text, doc->size, from, to, &server->spans);
+    if (ok && language->injection_query) {
+        ok = injection_document_update(&doc->injections, doc->tree, language->injection_query, doc->text, doc->size,
+                                       server->lookup_injection) &&
+             injection_apply(&doc->injections.set, from, to, &server->spans, &server->scratch);
+    }
+    if (!ok) return rpc_error(server, RPC_INTERNAL_ERROR, "Failed to highlight '%s'", doc->uri);
+
+    // Spans over several lines are split into one piece per line
+    for (size_t i = 0; i < server->spans.count; i++) {
+        const HighlightSpan *span = &server->spans.items[i];
+        if (span->style == HL_NONE) continue;
+        size_t line = line_index_line_at(index, span->start);
+        for (size_t start = span->start; start < span->end && line <= lines.last; start = index->line_starts[++line]) {
+            size_t line_start = index->line_starts[line];
+            size_t line_length;
+            line_index_line(index, line, &line_length);
+            size_t end = (span->end < line_start + line_length) ? span->end : line_start + line_length;
+            if (end > start) {
+                fprintf(out, "%s%zu,%zu,%zu,%u", *any ? "," : "", line, start - line_start, end - line_start, span->style);
+                *any = true;
+            }
+            if (line + 1 >= index->line_count) break;
+        }
+    }
+    return true;
+}
+
+static int compare_line_ranges(const void *a, const void *b) {
+    const LineRange *x = a;
+    const LineRange *y = b;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+// Adds the lines of doc->text[start, end) to server->changed
+static bool add_changed(Server *server, const Document *doc, size_t start, size_t end) {
+    if (!reserve((void **)&server->changed, &server->changed_capacity, server->changed_count + 1, sizeof(LineRange))) {
+        return rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    }
+    size_t first = line_index_line_at(&doc->lines, start);
+    size_t last = (end > start) ? line_index_line_at(&doc->lines, end - 1) : first;
+    server->changed[server->changed_count++] = (LineRange){first, last};
+    return true;
+}
+
+// Sorts server->changed and merges the ranges that overlap or touch
+static void merge_changed(Server *server) {
+    qsort(server->changed, server->changed_count, sizeof(LineRange), compare_line_ranges);
+    size_t merged = 0;
+    for (size_t i = 0; i < server->changed_count; i++) {
+        LineRange range = server->changed[i];
+        if (merged > 0 && range.first <= server->changed[merged - 1].last + 1) {
+            if (range.last > server->changed[merged - 1].last) server->changed[merged - 1].last = range.last;
+        } else {
+            server->changed[merged++] = range;
+        }
+    }
+    server->changed_count = merged;
+}
+
+// --- Methods ---
+
+// Each writes its result to `result`, or returns false after rpc_error
+typedef bool (*MethodHandler)(Server *server, const JsonValue *params, FILE *result);
+
+static bool method_initialize(Server *server, const JsonValue *params, FILE *result) {
+    const JsonValue *theme_name = json_get(params, "theme");
+    if (theme_name && theme_name->type == JSON_STRING) {
+        server->theme = find_theme(theme_name->string);
+        if (!server->theme) return rpc_error(server, RPC_INVALID_PARAMS, "Unknown theme '%s'", theme_name->string);
+    }
+    const ColorTheme *theme = server->theme;
+
+    fputs("{\"styles\":[", result);
+    for (int style = 0; style < HL_STYLE_COUNT; style++) {
+        const char *name = get_style_capture_name((HighlightStyle)style);
+        if (style) fputc(',', result);
+        json_write_string(result, name, strlen(name));
+    }
+    fputs("],\"theme\":{\"name\":", result);
+    json_write_string(result, theme->name, strlen(theme->name));
+    fprintf(result, ",\"background\":\"%s\",\"foreground\":\"%s\",\"colors\":[", theme->html_background, theme->html_foreground);
+    for (int style = 0; style < HL_STYLE_COUNT; style++) {
+        const char *color = get_style_html_color(theme, (HighlightStyle)style);
+        fprintf(result, "%s\"%s\"", style ? "," : "", color ? color : theme->html_foreground);
+    }
+    fputs("]},\"themes\":[", result);
+    for (size_t i = 0; i < THEMES_COUNT; i++) {
+        if (i) fputc(',', result);
+        json_write_string(result, themes[i].name, strlen(themes[i].name));
+    }
+    fputs("]}", result);
+    return true;
+}
+
+static bool method_open(Server *server, const JsonValue *params, FILE *result) {
+    const JsonValue *uri = json_get(params, "uri");
+    const JsonValue *text = json_get(params, "text");
+    const JsonValue *language_name = json_get(params, "language");
+    const JsonValue *path = json_get(params, "path");
+    if (!uri || uri->type != JSON_STRING || !text || text->type != JSON_STRING) {
+        return rpc_error(server, RPC_INVALID_PARAMS, "'open' needs 'uri' and 'text'");
+    }
+    if (text->string_length > UINT32_MAX) return rpc_error(server, RPC_INVALID_PARAMS, "Documents are limited to 4 GB");
+
+    // The language comes from its name, the path given, or else the uri's file name
+    ServerLanguage language;
+    const char *name = (language_name && language_name->type == JSON_STRING) ? language_name->string : NULL;
+    const char *file_name = (path && path->type == JSON_STRING) ? path->string : uri->string;
+    if (!server->lookup_language(name, file_name, &language)) {
+        return rpc_error(server, RPC_INVALID_PARAMS, "No language for '%s'", name ? name : file_name);
+    }
+
+    // Reopening a document replaces it
+    for (Document *doc = server->documents; doc; doc = doc->next) {
+        if (strcmp(doc->uri, uri->string) == 0) {
+            close_document(server, params);
+            break;
+        }
+    }
+
+    Document *doc = calloc(1, sizeof(Document));
+    if (!doc || !(doc->uri = strdup(uri->string)) || !(doc->text = malloc(text->string_length + 1))) {
+        if (doc) document_free(doc);
+        return rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    }
+    doc->language = language;
+    memcpy(doc->text, text->string, text->string_length + 1);
+    doc->size = text->string_length;
+    doc->capacity = doc->size + 1;
+    doc->parser = ts_parser_new();
+    bool ok = doc->parser && ts_parser_set_language(doc->parser, language.language) &&
+              (doc->tree = ts_parser_parse_string(doc->parser, NULL, doc->text, (uint32_t)doc->size)) != NULL &&
+              line_index_build(&doc->lines, doc->text, doc->size);
+    if (!ok) {
+        document_free(doc);
+        return rpc_error(server, RPC_INTERNAL_ERROR, "Failed to parse '%s'", uri->string);
+    }
+    doc->next = server->documents;
+    server->documents = doc;
+
+    LineRange viewport;
+    if (!viewport_of(server, doc, params, &viewport)) return false;
+    bool any = false;
+    fprintf(result, "{\"lines\":%zu,\"spans\":[", doc->lines.line_count);
+    if (!write_spans(server, doc, viewport, result, &any)) return false;
+    fputs("]}", result);
+    return true;
+}
+
+static bool method_edit(Server *server, const JsonValue *params, FILE *result) {
+    Document *doc = find_document(server, params);
+    if (!doc) return false;
+    const JsonValue *edits = json_get(params, "edits");
+    if (!edits || edits->type != JSON_ARRAY) return rpc_error(server, RPC_INVALID_PARAMS, "'edit' needs 'edits'");
+
+    // An edit that cannot be applied ends the request; the ones before it stay applied
+    server->edited_count = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < edits->count; i++) {
+        const JsonValue *text = json_get(&edits->items[i], "text");
+        size_t start;
+        size_t end;
+        ok = position_of(server, doc, json_get(&edits->items[i], "start"), &start) &&
+             position_of(server, doc, json_get(&edits->items[i], "end"), &end);
+        if (ok && (start > end || (text && text->type != JSON_STRING))) {
+            ok = rpc_error(server, RPC_INVALID_PARAMS, "Edit %zu is not a range and a 'text'", i);
+        }
+        ok = ok && apply_edit(server, doc, start, end, text ? text->string : "", text ? text->string_length : 0);
+    }
+    if (server->edited_count == 0) return ok;
+
+    // Reparsing against the edited tree reuses everything the edits left alone
+    TSTree *old_tree = doc->tree;
+    TSTree *tree = ts_parser_parse_string(doc->parser, old_tree, doc->text, (uint32_t)doc->size);
+    if (!tree) return rpc_error(server, RPC_INTERNAL_ERROR, "Failed to parse '%s'", doc->uri);
+    uint32_t range_count;
+    TSRange *ranges = ts_tree_get_changed_ranges(old_tree, tree, &range_count);
+    ts_tree_delete(old_tree);
+    doc->tree = tree;
+    for (uint32_t i = 0; i < range_count; i++) {
+        injection_document_invalidate(&doc->injections, ranges[i].start_byte, ranges[i].end_byte);
+    }
+    if (!ok) {
+        arena_free(ranges);
+        return false;
+    }
+
+    server->changed_count = 0;
+    for (size_t i = 0; ok && i < server->edited_count; i++) {
+        ok = add_changed(server, doc, server->edited[i].start, server->edited[i].end);
+    }
+    for (uint32_t i = 0; ok && i < range_count; i++) {
+        ok = add_changed(server, doc, ranges[i].start_byte, ranges[i].end_byte);
+    }
+    arena_free(ranges); // Allocated by tree-sitter, whose allocator is the arenas (arena_install)
+    if (!ok) return false;
+    merge_changed(server);
+
+    LineRange viewport;
+    if (!viewport_of(server, doc, params, &viewport)) return false;
+    fprintf(result, "{\"lines\":%zu,\"changed\":[", doc->lines.line_count);
+    for (size_t i = 0; i < server->changed_count; i++) {
+        fprintf(result, "%s[%zu,%zu]", i ? "," : "", server->changed[i].first, server->changed[i].last);
+    }
+    fputs("],\"spans\":[", result);
+    bool any = false;
+    for (size_t i = 0; i < server->changed_count; i++) {
+        LineRange lines = server->changed[i];
+        if (lines.first < viewport.first) lines.first = viewport.first;
+        if (lines.last > viewport.last) lines.last = viewport.last;
+        if (!write_spans(server, doc, lines, result, &any)) return false;
+    }
+    fputs("]}", result);
+    return true;
+}
+
+static bool method_highlight(Server *server, const JsonValue *params, FILE *result) {
+    Document *doc = find_document(server, params);
+    LineRange viewport;
+    if (!doc || !viewport_of(server, doc, params, &viewport)) return false;
+    bool any = false;
+    fprintf(result, "{\"lines\":%zu,\"spans\":[", doc->lines.line_count);
+    if (!write_spans(server, doc, viewport, result, &any)) return false;
+    fputs("]}", result);
+    return true;
+}
+
+static bool method_close(Server *server, const JsonValue *params, FILE *result) {
+    if (!close_document(server, params)) return false;
+    fputs("null", result);
+    return true;
+}
+
+static bool method_shutdown(Server *server, const JsonValue *params, FILE *result) {
+    (void)params;
+    server->done = true;
+    fputs("null", result);
+    return true;
+}
+
+static const struct {
+    const char *name;
+    MethodHandler handler;
+} methods[] = {
+    {"initialize", method_initialize},
+    {"open", method_open},
+    {"edit", method_edit},
+    {"highlight", method_highlight},
+    {"close", method_close},
+    {"shutdown", method_shutdown},
+    {"exit", method_shutdown},
+};
+
+// --- Messages ---
+
+// Reads the next message into server->message. Returns its length, or -1 at the end of input.
+static long read_message(Server *server) {
+    while (true) {
+        ssize_t len = getline(&server->message, &server->message_capacity, server->in);
+        if (len < 0) return -1;
+        while (len > 0 && (server->message[len - 1] == '\n' || server->message[len - 1] == '\r')) len--;
+        server->message[len] = '\0';
+        if (len == 0) continue;
+
+        bool framed = strncasecmp(server->message, "Content-Length:", 15) == 0;
+        if (!server->framing_known) {
+            server->framed = framed;
+            server->framing_known = true;
+        }
+        if (!framed) return (long)len;
+
+        // Headers end at an empty line; the body is the Content-Length bytes after it
+        size_t body_size = strtoul(server->message + 15, NULL, 10);
+        while ((len = getline(&server->message, &server->message_capacity, server->in)) > 0 &&
+               strcmp(server->message, "\r\n") != 0 && strcmp(server->message, "\n") != 0) {
+        }
+        if (len < 0 || !reserve((void **)&server->message, &server->message_capacity, body_size + 1, 1) ||
+            fread(server->message, 1, body_size, server->in) != body_size) {
+            return -1;
+        }
+        server->message[body_size] = '\0';
+        return (long)body_size;
+    }
+}
+
+static void send_message(Server *server, const char *data, size_t size) {
+    if (server->framed) fprintf(server->out, "Content-Length: %zu\r\n\r\n", size);
+    fwrite(data, 1, size, server->out);
+    if (!server->framed) fputc('\n', server->out);
+    fflush(server->out);
+}
+
+// Sends the reply to request `id`: `result`, or the error recorded by rpc_error
+static void send_reply(Server *server, const JsonValue *id, const char *result, size_t result_size) {
+    char *reply = NULL;
+    size_t reply_size = 0;
+    FILE *out = open_memstream(&reply, &reply_size);
+    if (!out) return;
+    fputs("{\"jsonrpc\":\"2.0\",\"id\":", out);
+    if (id) json_write_value(out, id);
+    else fputs("null", out);
+    if (result) {
+        fputs(",\"result\":", out);
+        fwrite(result, 1, result_size, out);
+    } else {
+        fprintf(out, ",\"error\":{\"code\":%d,\"message\":", server->error_code);
+        json_write_string(out, server->error, strlen(server->error));
+        fputc('}', out);
+    }
+    fputc('}', out);
+    if (fclose(out) == 0) send_message(server, reply, reply_size);
+    free(reply);
+}
+
+static void handle_message(Server *server, size_t size) {
+    JsonValue request;
+    char parse_error[128];
+    if (!json_parse(server->message, size, &request, parse_error, sizeof(parse_error))) {
+        rpc_error(server, RPC_PARSE_ERROR, "%s", parse_error);
+        send_reply(server, NULL, NULL, 0);
+        return;
+    }
+    if (request.type != JSON_OBJECT) { // Batches included
+        rpc_error(server, RPC_INVALID_REQUEST, "A request must be an object");
+        send_reply(server, NULL, NULL, 0);
+        json_free(&request);
+        return;
+    }
+
+    // Requests without an id are notifications, which get no reply, not even an error
+    const JsonValue *id = json_get(&request, "id");
+    const JsonValue *method = json_get(&request, "method");
+    const JsonValue *params = json_get(&request, "params");
+    MethodHandler handler = NULL;
+    if (!method || method->type != JSON_STRING) {
+        rpc_error(server, RPC_INVALID_REQUEST, "Missing 'method'");
+    } else {
+        for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]) && !handler; i++) {
+            if (strcmp(methods[i].name, method->string) == 0) handler = methods[i].handler;
+        }
+        if (!handler) rpc_error(server, RPC_METHOD_NOT_FOUND, "Unknown method '%s'", method->string);
+    }
+
+    char *result = NULL;
+    size_t result_size = 0;
+    FILE *out = handler ? open_memstream(&result, &result_size) : NULL;
+    bool ok = out && handler(server, params, out);
+    if (out && fclose(out) != 0 && ok) ok = rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    if (handler && !out) rpc_error(server, RPC_INTERNAL_ERROR, "Out of memory");
+    if (id) send_reply(server, id, ok ? result : NULL, result_size);
+    free(result);
+    json_free(&request);
+}
+
+int stdio_server_run(FILE *in, FILE *out, ServerLanguageLookup lookup_language, InjectionLookup lookup_injection) {
+    Server server = {
+        .in = in,
+        .out = out,
+        .lookup_language = lookup_language,
+        .lookup_injection = lookup_injection,
+        .theme = selected_theme,
+        .cursor = ts_query_cursor_new(),
+    };
+    if (!server.cursor) {
+        fprintf(stderr, "Failed to create a query cursor\n");
+        return 1;
+    }
+
+    long size;
+    while (!server.done && (size = read_message(&server)) >= 0) {
+        handle_message(&server, (size_t)size);
+    }
+
+    while (server.documents) {
+        Document *doc = server.documents;
+        server.documents = doc->next;
+        document_free(doc);
+    }
+    span_list_free(&server.spans);
+    span_list_free(&server.scratch);
+    free(server.edited);
+    free(server.changed);
+    free(server.message);
+    ts_query_cursor_delete(server.cursor);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef STDIO_SERVER_H
+#define STDIO_SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <tree_sitter/api.h>
+
+#include "injection.h"
+#include "predicate.h"
+
+// A document's grammar and the compiled queries that highlight it, shared and
+// read-only like an InjectionLanguage
+typedef struct {
+    const TSLanguage *language;
+    const TSQuery *query;
+    const uint8_t *capture_styles;
+    const QueryPredicates *predicates;
+    const TSQuery *injection_query; // Regions written in other languages, or NULL
+} ServerLanguage;
+
+// Resolves a document's language from its name (`name`, e.g. "python") or, when that
+// is NULL, from its file name (`path`). Prints the problem to stderr and returns false
+// if there is none.
+typedef bool (*ServerLanguageLookup)(const char *name, const char *path, ServerLanguage *out);
+
+// Serves an editor over JSON-RPC 2.0 on `in` and `out` until `shutdown` or the end of
+// `in`. Messages are either one per line or framed with Content-Length headers as in
+// LSP; replies use the framing of the first request. The editor opens documents,
+// sends its edits as they are made and asks for the spans of the lines it shows:
+//
+//   initialize {theme?}                      -> {styles, theme: {name, background, foreground, colors}, themes}
+//   open       {uri, text, language?, path?, viewport?} -> {lines, spans}
+//   edit       {uri, edits: [{start, end, text}], viewport?} -> {lines, changed, spans}
+//   highlight  {uri, viewport?}              -> {lines, spans}
+//   close      {uri}, shutdown               -> null
+//
+// Positions are byte offsets into the document or [line, column] pairs (column in
+// bytes); the edits of one request are applied one after another. Each edit goes to
+// the document's syntax tree (ts_tree_edit) before the document is reparsed against it,
+// so only what the edit touched is parsed again. A viewport is [first_line, last_line]
+// (0-based, inclusive); without one the whole document is meant. `spans` is a flat array
+// of [line, start_column, end_column, style] quadruples, style indexing `styles`.
+// An edit replies with the line ranges whose spans may have changed (`changed`: the
+// edited text and the ranges tree-sitter reports as changed, in the new document) and
+// the spans of those lines that are in the viewport; lines elsewhere keep their spans,
+// moved along by the edits. Returns 0 after `shutdown` or the end of input, 1 if it
+// cannot start.
+int stdio_server_run(FILE *in, FILE *out, ServerLanguageLookup lookup_language, InjectionLookup lookup_injection);
+
+#endif // STDIO_SERVER_H
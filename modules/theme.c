@@ -1,437 +1,612 @@
 #include "theme.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h> // For strcmp
 
 // Color themes definitions
-ColorTheme themes[] = {
+static ColorTheme builtin_themes[] = {
     {
-        "default",
+        .name = "default",
         // ANSI escape codes
-        "\x1b[35m",       // ansi_function.builtin
-        "\x1b[34m",       // ansi_function
-        "\x1b[32m",       // ansi_string
-        "\x1b[90m",       // ansi_comment
-        "\x1b[31m",       // ansi_keyword
-        "\x1b[31;1m",     // ansi_keyword.control
-        "\x1b[36m",       // ansi_type
-        "\x1b[33m",       // ansi_variable
-        "\x1b[35;1m",     // ansi_constant
-        "\x1b[32;1m",     // ansi_literal
-        "\x1b[90m",       // ansi_line_number
-        "\x1b[0m",        // ansi_reset (note: now the reset is also part of struct, so removed from main logic)
+        .ansi_function_builtin = "\x1b[35m",
+        .ansi_function = "\x1b[34m",
+        .ansi_string = "\x1b[32m",
+        .ansi_comment = "\x1b[90m",
+        .ansi_keyword = "\x1b[31m",
+        .ansi_keyword_control = "\x1b[31;1m",
+        .ansi_type = "\x1b[36m",
+        .ansi_variable = "\x1b[33m",
+        .ansi_constant = "\x1b[35;1m",
+        .ansi_literal = "\x1b[32;1m",
+        .ansi_line_number = "\x1b[90m",
+        .ansi_reset = "\x1b[0m", // note: now the reset is also part of struct, so removed from main logic
 
         // HTML (hex) color codes
-        "#B28CFF",       // html_function.builtin
-        "#66B2FF",       // html_function
-        "#9CCC65",       // html_string
-        "#7F7F7F",       // html_comment
-        "#CC7832",       // html_keyword
-        "#CC7832",       // html_keyword_control (same as keyword, or a bolder variant)
-        "#DA70D6",       // html_type
-        "#FFFFFF",       // html_variable
-        "#9C9CFF",       // html_constant
-        "#6A8759",       // html_literal
-        "#7F7F7F"        // html_line_number
+        .html_function_builtin = "#B28CFF",
+        .html_function = "#66B2FF",
+        .html_string = "#9CCC65",
+        .html_comment = "#7F7F7F",
+        .html_keyword = "#CC7832",
+        .html_keyword_control = "#CC7832", // same as keyword, or a bolder variant
+        .html_type = "#DA70D6",
+        .html_variable = "#FFFFFF",
+        .html_constant = "#9C9CFF",
+        .html_literal = "#6A8759",
+        .html_line_number = "#7F7F7F",
+        .html_background = "#1e1e1e",
+        .html_foreground = "#d4d4d4"
     },
     {
-        "gruvbox",
+        .name = "gruvbox",
         // ANSI escape codes
-        "\x1b[38;5;142m", // ansi_function.builtin
-        "\x1b[38;5;109m", // ansi_function
-        "\x1b[38;5;108m", // ansi_string
-        "\x1b[38;5;245m", // ansi_comment
-        "\x1b[38;5;167m", // ansi_keyword
-        "\x1b[38;5;167;1m",// ansi_keyword.control
-        "\x1b[38;5;142m", // ansi_type
-        "\x1b[38;5;223m", // ansi_variable
-        "\x1b[38;5;175m", // ansi_constant
-        "\x1b[38;5;208m", // ansi_literal
-        "\x1b[38;5;245m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;142m",
+        .ansi_function = "\x1b[38;5;109m",
+        .ansi_string = "\x1b[38;5;108m",
+        .ansi_comment = "\x1b[38;5;245m",
+        .ansi_keyword = "\x1b[38;5;167m",
+        .ansi_keyword_control = "\x1b[38;5;167;1m",
+        .ansi_type = "\x1b[38;5;142m",
+        .ansi_variable = "\x1b[38;5;223m",
+        .ansi_constant = "\x1b[38;5;175m",
+        .ansi_literal = "\x1b[38;5;208m",
+        .ansi_line_number = "\x1b[38;5;245m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#A9B665",    // html_function.builtin
-        "#89B482",    // html_function
-        "#A9B665",    // html_string
-        "#928374",    // html_comment
-        "#FE8019",    // html_keyword
-        "#FE8019",    // html_keyword.control
-        "#D3869B",    // html_type
-        "#EBDBB2",    // html_variable
-        "#D8A657",    // html_constant
-        "#FABD2F",    // html_literal
-        "#928374"     // html_line_number
+        .html_function_builtin = "#A9B665",
+        .html_function = "#89B482",
+        .html_string = "#A9B665",
+        .html_comment = "#928374",
+        .html_keyword = "#FE8019",
+        .html_keyword_control = "#FE8019",
+        .html_type = "#D3869B",
+        .html_variable = "#EBDBB2",
+        .html_constant = "#D8A657",
+        .html_literal = "#FABD2F",
+        .html_line_number = "#928374",
+        .html_background = "#282828",
+        .html_foreground = "#ebdbb2"
     },
     {
-        "tokyonight-night",
+        .name = "tokyonight-night",
         // ANSI escape codes
-        "\x1b[38;5;73m",  // ansi_function.builtin
-        "\x1b[38;5;110m", // ansi_function
-        "\x1b[38;5;158m", // ansi_string
-        "\x1b[38;5;102m", // ansi_comment
-        "\x1b[38;5;175m", // ansi_keyword
-        "\x1b[38;5;175;1m",// ansi_keyword.control
-        "\x1b[38;5;117m", // ansi_type
-        "\x1b[38;5;188m", // ansi_variable
-        "\x1b[38;5;215m", // ansi_constant
-        "\x1b[38;5;215m", // ansi_literal
-        "\x1b[38;5;102m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;73m",
+        .ansi_function = "\x1b[38;5;110m",
+        .ansi_string = "\x1b[38;5;158m",
+        .ansi_comment = "\x1b[38;5;102m",
+        .ansi_keyword = "\x1b[38;5;175m",
+        .ansi_keyword_control = "\x1b[38;5;175;1m",
+        .ansi_type = "\x1b[38;5;117m",
+        .ansi_variable = "\x1b[38;5;188m",
+        .ansi_constant = "\x1b[38;5;215m",
+        .ansi_literal = "\x1b[38;5;215m",
+        .ansi_line_number = "\x1b[38;5;102m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#7DCFFF",    // html_function.builtin
-        "#7AA87B",    // html_function
-        "#9ECCBB",    // html_string
-        "#565F89",    // html_comment
-        "#BB9AFD",    // html_keyword
-        "#BB9AFD",    // html_keyword.control
-        "#73DACA",    // html_type
-        "#C0CAF5",    // html_variable
-        "#BB9AFD",    // html_constant
-        "#FF9E64",    // html_literal
-        "#565F89"     // html_line_number
+        .html_function_builtin = "#7DCFFF",
+        .html_function = "#7AA87B",
+        .html_string = "#9ECCBB",
+        .html_comment = "#565F89",
+        .html_keyword = "#BB9AFD",
+        .html_keyword_control = "#BB9AFD",
+        .html_type = "#73DACA",
+        .html_variable = "#C0CAF5",
+        .html_constant = "#BB9AFD",
+        .html_literal = "#FF9E64",
+        .html_line_number = "#565F89",
+        .html_background = "#1a1b26",
+        .html_foreground = "#a9b1d6"
     },
     {
-        "tokyonight-storm",
+        .name = "tokyonight-storm",
         // ANSI escape codes
-        "\x1b[38;5;73m",  // ansi_function.builtin
-        "\x1b[38;5;75m",  // ansi_function
-        "\x1b[38;5;114m", // ansi_string
-        "\x1b[38;5;102m", // ansi_comment
-        "\x1b[38;5;176m", // ansi_keyword
-        "\x1b[38;5;176;1m",// ansi_keyword.control
-        "\x1b[38;5;117m", // ansi_type
-        "\x1b[38;5;188m", // ansi_variable
-        "\x1b[38;5;215m", // ansi_constant
-        "\x1b[38;5;215m", // ansi_literal
-        "\x1b[38;5;102m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;73m",
+        .ansi_function = "\x1b[38;5;75m",
+        .ansi_string = "\x1b[38;5;114m",
+        .ansi_comment = "\x1b[38;5;102m",
+        .ansi_keyword = "\x1b[38;5;176m",
+        .ansi_keyword_control = "\x1b[38;5;176;1m",
+        .ansi_type = "\x1b[38;5;117m",
+        .ansi_variable = "\x1b[38;5;188m",
+        .ansi_constant = "\x1b[38;5;215m",
+        .ansi_literal = "\x1b[38;5;215m",
+        .ansi_line_number = "\x1b[38;5;102m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#7DCFFF",    // html_function.builtin
-        "#7AA87B",    // html_function
-        "#9ECCBB",    // html_string
-        "#565F89",    // html_comment
-        "#BB9AFD",    // html_keyword
-        "#BB9AFD",    // html_keyword.control
-        "#73DACA",    // html_type
-        "#C0CAF5",    // html_variable
-        "#BB9AFD",    // html_constant
-        "#FF9E64",    // html_literal
-        "#565F89"     // html_line_number
+        .html_function_builtin = "#7DCFFF",
+        .html_function = "#7AA87B",
+        .html_string = "#9ECCBB",
+        .html_comment = "#565F89",
+        .html_keyword = "#BB9AFD",
+        .html_keyword_control = "#BB9AFD",
+        .html_type = "#73DACA",
+        .html_variable = "#C0CAF5",
+        .html_constant = "#BB9AFD",
+        .html_literal = "#FF9E64",
+        .html_line_number = "#565F89",
+        .html_background = "#24283b",
+        .html_foreground = "#c0caf5"
     },
     {
-        "catppuccin-mocha",
+        .name = "catppuccin-mocha",
         // ANSI escape codes
-        "\x1b[38;5;117m", // ansi_function.builtin
-        "\x1b[38;5;75m",  // ansi_function
-        "\x1b[38;5;114m", // ansi_string
-        "\x1b[38;5;102m", // ansi_comment
-        "\x1b[38;5;176m", // ansi_keyword
-        "\x1b[38;5;176;1m",// ansi_keyword.control
-        "\x1b[38;5;117m", // ansi_type
-        "\x1b[38;5;188m", // ansi_variable
-        "\x1b[38;5;215m", // ansi_constant
-        "\x1b[38;5;215m", // ansi_literal
-        "\x1b[38;5;102m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;117m",
+        .ansi_function = "\x1b[38;5;75m",
+        .ansi_string = "\x1b[38;5;114m",
+        .ansi_comment = "\x1b[38;5;102m",
+        .ansi_keyword = "\x1b[38;5;176m",
+        .ansi_keyword_control = "\x1b[38;5;176;1m",
+        .ansi_type = "\x1b[38;5;117m",
+        .ansi_variable = "\x1b[38;5;188m",
+        .ansi_constant = "\x1b[38;5;215m",
+        .ansi_literal = "\x1b[38;5;215m",
+        .ansi_line_number = "\x1b[38;5;102m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#89B4FA",    // html_function.builtin (sky)
-        "#89B4FA",    // html_function (sky)
-        "#A6E3A1",    // html_string (green)
-        "#6C7086",    // html_comment (subtext0)
-        "#CBA6F7",    // html_keyword (mauve)
-        "#CBA6F7",    // html_keyword.control
-        "#F5C2E7",    // html_type (pink)
-        "#CDD6F4",    // html_variable (text)
-        "#F38BA8",    // html_constant (red)
-        "#FAB387",    // html_literal (peach)
-        "#6C7086"     // html_line_number (subtext0)
+        .html_function_builtin = "#89B4FA", // sky
+        .html_function = "#89B4FA", // sky
+        .html_string = "#A6E3A1", // green
+        .html_comment = "#6C7086", // subtext0
+        .html_keyword = "#CBA6F7", // mauve
+        .html_keyword_control = "#CBA6F7",
+        .html_type = "#F5C2E7", // pink
+        .html_variable = "#CDD6F4", // text
+        .html_constant = "#F38BA8", // red
+        .html_literal = "#FAB387", // peach
+        .html_line_number = "#6C7086", // subtext0
+        .html_background = "#1E1E2E",
+        .html_foreground = "#CDD6F4"
     },
     {
-        "dracula",
+        .name = "dracula",
         // ANSI escape codes
-        "\x1b[38;5;141m", // ansi_function.builtin (purple)
-        "\x1b[38;5;117m", // ansi_function (green)
-        "\x1b[38;5;228m", // ansi_string (yellow)
-        "\x1b[38;5;102m", // ansi_comment (gray)
-        "\x1b[38;5;212m", // ansi_keyword (pink)
-        "\x1b[38;5;212;1m",// ansi_keyword.control (pink bold)
-        "\x1b[38;5;117m", // ansi_type (cyan)
-        "\x1b[38;5;255m", // ansi_variable (white)
-        "\x1b[38;5;141m", // ansi_constant (purple)
-        "\x1b[38;5;215m", // ansi_literal (orange)
-        "\x1b[38;5;102m", // ansi_line_number (gray)
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;141m", // purple
+        .ansi_function = "\x1b[38;5;117m", // green
+        .ansi_string = "\x1b[38;5;228m", // yellow
+        .ansi_comment = "\x1b[38;5;102m", // gray
+        .ansi_keyword = "\x1b[38;5;212m", // pink
+        .ansi_keyword_control = "\x1b[38;5;212;1m", // pink bold
+        .ansi_type = "\x1b[38;5;117m", // cyan
+        .ansi_variable = "\x1b[38;5;255m", // white
+        .ansi_constant = "\x1b[38;5;141m", // purple
+        .ansi_literal = "\x1b[38;5;215m", // orange
+        .ansi_line_number = "\x1b[38;5;102m", // gray
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#BD93F9",    // html_function.builtin
-        "#50FA7B",    // html_function
-        "#F1FA8C",    // html_string
-        "#6272A4",    // html_comment
-        "#FF79C6",    // html_keyword
-        "#FF79C6",    // html_keyword.control
-        "#8BE9FD",    // html_type
-        "#F8F8F2",    // html_variable
-        "#BD93F9",    // html_constant
-        "#FFB86C",    // html_literal
-        "#6272A4"     // html_line_number
+        .html_function_builtin = "#BD93F9",
+        .html_function = "#50FA7B",
+        .html_string = "#F1FA8C",
+        .html_comment = "#6272A4",
+        .html_keyword = "#FF79C6",
+        .html_keyword_control = "#FF79C6",
+        .html_type = "#8BE9FD",
+        .html_variable = "#F8F8F2",
+        .html_constant = "#BD93F9",
+        .html_literal = "#FFB86C",
+        .html_line_number = "#6272A4",
+        .html_background = "#282a36",
+        .html_foreground = "#f8f8f2"
     },
     {
-        "nord",
+        .name = "nord",
         // ANSI escape codes
-        "\x1b[38;5;116m", // ansi_function.builtin
-        "\x1b[38;5;81m",  // ansi_function
-        "\x1b[38;5;108m", // ansi_string
-        "\x1b[38;5;59m",  // ansi_comment
-        "\x1b[38;5;81m",  // ansi_keyword
-        "\x1b[38;5;81;1m",// ansi_keyword.control
-        "\x1b[38;5;116m", // ansi_type
-        "\x1b[38;5;188m", // ansi_variable
-        "\x1b[38;5;180m", // ansi_constant
-        "\x1b[38;5;209m", // ansi_literal
-        "\x1b[38;5;59m",  // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;116m",
+        .ansi_function = "\x1b[38;5;81m",
+        .ansi_string = "\x1b[38;5;108m",
+        .ansi_comment = "\x1b[38;5;59m",
+        .ansi_keyword = "\x1b[38;5;81m",
+        .ansi_keyword_control = "\x1b[38;5;81;1m",
+        .ansi_type = "\x1b[38;5;116m",
+        .ansi_variable = "\x1b[38;5;188m",
+        .ansi_constant = "\x1b[38;5;180m",
+        .ansi_literal = "\x1b[38;5;209m",
+        .ansi_line_number = "\x1b[38;5;59m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#88C0D0",    // html_function.builtin (polar night 4)
-        "#88C0D0",    // html_function (polar night 4)
-        "#A3BE8C",    // html_string (frost green)
-        "#4C566A",    // html_comment (polar night 3)
-        "#81A1C1",    // html_keyword (frost blue)
-        "#81A1C1",    // html_keyword.control
-        "#8FBCBB",    // html_type (frost cyan)
-        "#D8DEE9",    // html_variable (snow storm 2)
-        "#B48EAD",    // html_constant (frost purple)
-        "#D08770",    // html_literal (aurora red)
-        "#4C566A"     // html_line_number (polar night 3)
+        .html_function_builtin = "#88C0D0", // polar night 4
+        .html_function = "#88C0D0", // polar night 4
+        .html_string = "#A3BE8C", // frost green
+        .html_comment = "#4C566A", // polar night 3
+        .html_keyword = "#81A1C1", // frost blue
+        .html_keyword_control = "#81A1C1",
+        .html_type = "#8FBCBB", // frost cyan
+        .html_variable = "#D8DEE9", // snow storm 2
+        .html_constant = "#B48EAD", // frost purple
+        .html_literal = "#D08770", // aurora red
+        .html_line_number = "#4C566A", // polar night 3
+        .html_background = "#2E3440",
+        .html_foreground = "#D8DEE9"
     },
     {
-        "solarized-dark",
+        .name = "solarized-dark",
         // ANSI escape codes
-        "\x1b[38;5;37m",  // ansi_function.builtin
-        "\x1b[38;5;33m",  // ansi_function
-        "\x1b[38;5;37m",  // ansi_string
-        "\x1b[38;5;240m", // ansi_comment
-        "\x1b[38;5;64m",  // ansi_keyword
-        "\x1b[38;5;64;1m",// ansi_keyword.control
-        "\x1b[38;5;136m", // ansi_type
-        "\x1b[38;5;254m", // ansi_variable
-        "\x1b[38;5;125m", // ansi_constant
-        "\x1b[38;5;166m", // ansi_literal
-        "\x1b[38;5;240m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;37m",
+        .ansi_function = "\x1b[38;5;33m",
+        .ansi_string = "\x1b[38;5;37m",
+        .ansi_comment = "\x1b[38;5;240m",
+        .ansi_keyword = "\x1b[38;5;64m",
+        .ansi_keyword_control = "\x1b[38;5;64;1m",
+        .ansi_type = "\x1b[38;5;136m",
+        .ansi_variable = "\x1b[38;5;254m",
+        .ansi_constant = "\x1b[38;5;125m",
+        .ansi_literal = "\x1b[38;5;166m",
+        .ansi_line_number = "\x1b[38;5;240m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#268BD2",    // html_function.builtin
-        "#268BD2",    // html_function
-        "#859900",    // html_string
-        "#586E75",    // html_comment
-        "#CB4B16",    // html_keyword
-        "#CB4B16",    // html_keyword.control
-        "#B58900",    // html_type
-        "#93A1A1",    // html_variable
-        "#6C71C4",    // html_constant
-        "#DC322F",    // html_literal
-        "#586E75"     // html_line_number
+        .html_function_builtin = "#268BD2",
+        .html_function = "#268BD2",
+        .html_string = "#859900",
+        .html_comment = "#586E75",
+        .html_keyword = "#CB4B16",
+        .html_keyword_control = "#CB4B16",
+        .html_type = "#B58900",
+        .html_variable = "#93A1A1",
+        .html_constant = "#6C71C4",
+        .html_literal = "#DC322F",
+        .html_line_number = "#586E75",
+        .html_background = "#002b36",
+        .html_foreground = "#839496"
     },
     {
-        "solarized-light",
+        .name = "solarized-light",
         // ANSI escape codes
-        "\x1b[38;5;37m",  // ansi_function.builtin
-        "\x1b[38;5;33m",  // ansi_function
-        "\x1b[38;5;37m",  // ansi_string
-        "\x1b[38;5;244m", // ansi_comment
-        "\x1b[38;5;64m",  // ansi_keyword
-        "\x1b[38;5;64;1m",// ansi_keyword.control
-        "\x1b[38;5;136m", // ansi_type
-        "\x1b[38;5;235m", // ansi_variable
-        "\x1b[38;5;125m", // ansi_constant
-        "\x1b[38;5;166m", // ansi_literal
-        "\x1b[38;5;244m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;37m",
+        .ansi_function = "\x1b[38;5;33m",
+        .ansi_string = "\x1b[38;5;37m",
+        .ansi_comment = "\x1b[38;5;244m",
+        .ansi_keyword = "\x1b[38;5;64m",
+        .ansi_keyword_control = "\x1b[38;5;64;1m",
+        .ansi_type = "\x1b[38;5;136m",
+        .ansi_variable = "\x1b[38;5;235m",
+        .ansi_constant = "\x1b[38;5;125m",
+        .ansi_literal = "\x1b[38;5;166m",
+        .ansi_line_number = "\x1b[38;5;244m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#268BD2",    // html_function.builtin
-        "#268BD2",    // html_function
-        "#859900",    // html_string
-        "#93A1A1",    // html_comment
-        "#CB4B16",    // html_keyword
-        "#CB4B16",    // html_keyword.control
-        "#B58900",    // html_type
-        "#586E75",    // html_variable
-        "#6C71C4",    // html_constant
-        "#DC322F",    // html_literal
-        "#93A1A1"     // html_line_number
+        .html_function_builtin = "#268BD2",
+        .html_function = "#268BD2",
+        .html_string = "#859900",
+        .html_comment = "#93A1A1",
+        .html_keyword = "#CB4B16",
+        .html_keyword_control = "#CB4B16",
+        .html_type = "#B58900",
+        .html_variable = "#586E75",
+        .html_constant = "#6C71C4",
+        .html_literal = "#DC322F",
+        .html_line_number = "#93A1A1",
+        .html_background = "#fdf6e3",
+        .html_foreground = "#586e75"
     },
     {
-        "one-dark",
+        .name = "one-dark",
         // ANSI escape codes
-        "\x1b[38;5;39m",  // ansi_function.builtin
-        "\x1b[38;5;75m",  // ansi_function
-        "\x1b[38;5;114m", // ansi_string
-        "\x1b[38;5;59m",  // ansi_comment
-        "\x1b[38;5;176m", // ansi_keyword
-        "\x1b[38;5;176;1m",// ansi_keyword.control
-        "\x1b[38;5;39m",  // ansi_type
-        "\x1b[38;5;145m", // ansi_variable
-        "\x1b[38;5;215m", // ansi_constant
-        "\x1b[38;5;215m", // ansi_literal
-        "\x1b[38;5;59m",  // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;39m",
+        .ansi_function = "\x1b[38;5;75m",
+        .ansi_string = "\x1b[38;5;114m",
+        .ansi_comment = "\x1b[38;5;59m",
+        .ansi_keyword = "\x1b[38;5;176m",
+        .ansi_keyword_control = "\x1b[38;5;176;1m",
+        .ansi_type = "\x1b[38;5;39m",
+        .ansi_variable = "\x1b[38;5;145m",
+        .ansi_constant = "\x1b[38;5;215m",
+        .ansi_literal = "\x1b[38;5;215m",
+        .ansi_line_number = "\x1b[38;5;59m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#61AFEF",    // html_function.builtin
-        "#61AFEF",    // html_function
-        "#98C379",    // html_string
-        "#5C6370",    // html_comment
-        "#C678DD",    // html_keyword
-        "#C678DD",    // html_keyword.control
-        "#E5C07B",    // html_type
-        "#ABB2BF",    // html_variable
-        "#D19A66",    // html_constant
-        "#E06C75",    // html_literal
-        "#5C6370"     // html_line_number
+        .html_function_builtin = "#61AFEF",
+        .html_function = "#61AFEF",
+        .html_string = "#98C379",
+        .html_comment = "#5C6370",
+        .html_keyword = "#C678DD",
+        .html_keyword_control = "#C678DD",
+        .html_type = "#E5C07B",
+        .html_variable = "#ABB2BF",
+        .html_constant = "#D19A66",
+        .html_literal = "#E06C75",
+        .html_line_number = "#5C6370",
+        .html_background = "#282C34",
+        .html_foreground = "#ABB2BF"
     },
     {
-        "monokai",
+        .name = "monokai",
         // ANSI escape codes
-        "\x1b[38;5;81m",  // ansi_function.builtin
-        "\x1b[38;5;148m", // ansi_function
-        "\x1b[38;5;186m", // ansi_string
-        "\x1b[38;5;102m", // ansi_comment
-        "\x1b[38;5;197m", // ansi_keyword
-        "\x1b[38;5;197;1m",// ansi_keyword.control
-        "\x1b[38;5;81m",  // ansi_type
-        "\x1b[38;5;255m", // ansi_variable
-        "\x1b[38;5;141m", // ansi_constant
-        "\x1b[38;5;208m", // ansi_literal
-        "\x1b[38;5;102m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;81m",
+        .ansi_function = "\x1b[38;5;148m",
+        .ansi_string = "\x1b[38;5;186m",
+        .ansi_comment = "\x1b[38;5;102m",
+        .ansi_keyword = "\x1b[38;5;197m",
+        .ansi_keyword_control = "\x1b[38;5;197;1m",
+        .ansi_type = "\x1b[38;5;81m",
+        .ansi_variable = "\x1b[38;5;255m",
+        .ansi_constant = "\x1b[38;5;141m",
+        .ansi_literal = "\x1b[38;5;208m",
+        .ansi_line_number = "\x1b[38;5;102m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#A6E22E",    // html_function.builtin
-        "#A6E22E",    // html_function
-        "#E6DB74",    // html_string
-        "#75715E",    // html_comment
-        "#F92672",    // html_keyword
-        "#F92672",    // html_keyword.control
-        "#66D9EF",    // html_type
-        "#F8F8F2",    // html_variable
-        "#AE81FF",    // html_constant
-        "#FD971F",    // html_literal
-        "#75715E"     // html_line_number
+        .html_function_builtin = "#A6E22E",
+        .html_function = "#A6E22E",
+        .html_string = "#E6DB74",
+        .html_comment = "#75715E",
+        .html_keyword = "#F92672",
+        .html_keyword_control = "#F92672",
+        .html_type = "#66D9EF",
+        .html_variable = "#F8F8F2",
+        .html_constant = "#AE81FF",
+        .html_literal = "#FD971F",
+        .html_line_number = "#75715E",
+        .html_background = "#272822",
+        .html_foreground = "#F8F8F2"
     },
     {
-        "github-dark",
+        .name = "github-dark",
         // ANSI escape codes
-        "\x1b[38;5;117m", // ansi_function.builtin
-        "\x1b[38;5;183m", // ansi_function
-        "\x1b[38;5;150m", // ansi_string
-        "\x1b[38;5;102m", // ansi_comment
-        "\x1b[38;5;204m", // ansi_keyword
-        "\x1b[38;5;204;1m",// ansi_keyword.control
-        "\x1b[38;5;117m", // ansi_type
-        "\x1b[38;5;188m", // ansi_variable
-        "\x1b[38;5;117m", // ansi_constant
-        "\x1b[38;5;215m", // ansi_literal
-        "\x1b[38;5;102m", // ansi_line_number
-        "\x1b[0m",        // ansi_reset
+        .ansi_function_builtin = "\x1b[38;5;117m",
+        .ansi_function = "\x1b[38;5;183m",
+        .ansi_string = "\x1b[38;5;150m",
+        .ansi_comment = "\x1b[38;5;102m",
+        .ansi_keyword = "\x1b[38;5;204m",
+        .ansi_keyword_control = "\x1b[38;5;204;1m",
+        .ansi_type = "\x1b[38;5;117m",
+        .ansi_variable = "\x1b[38;5;188m",
+        .ansi_constant = "\x1b[38;5;117m",
+        .ansi_literal = "\x1b[38;5;215m",
+        .ansi_line_number = "\x1b[38;5;102m",
+        .ansi_reset = "\x1b[0m",
 
         // HTML (hex) color codes
-        "#88B0EF",    // html_function.builtin (blue)
-        "#88B0EF",    // html_function (blue)
-        "#7BB97F",    // html_string (green)
-        "#6A737D",    // html_comment (gray)
-        "#D19A66",    // html_keyword (orange)
-        "#D19A66",    // html_keyword.control
-        "#E6C07B",    // html_type (yellow)
-        "#C0CAF5",    // html_variable (text)
-        "#D19A66",    // html_constant (orange)
-        "#F8F8F2",    // html_literal (white/light)
-        "#6A737D"     // html_line_number (gray)
+        .html_function_builtin = "#88B0EF", // blue
+        .html_function = "#88B0EF", // blue
+        .html_string = "#7BB97F", // green
+        .html_comment = "#6A737D", // gray
+        .html_keyword = "#D19A66", // orange
+        .html_keyword_control = "#D19A66",
+        .html_type = "#E6C07B", // yellow
+        .html_variable = "#C0CAF5", // text
+        .html_constant = "#D19A66", // orange
+        .html_literal = "#F8F8F2", // white/light
+        .html_line_number = "#6A737D", // gray
+        .html_background = "#22272E",
+        .html_foreground = "#ADBAC7"
     }
 };
 
-const size_t THEMES_COUNT = sizeof(themes) / sizeof(ColorTheme);
+#define BUILTIN_THEMES_COUNT (sizeof(builtin_themes) / sizeof(ColorTheme))
+
+ColorTheme *themes = builtin_themes;
+size_t THEMES_COUNT = BUILTIN_THEMES_COUNT;
 
 // Initialize selected_theme to the default theme
-ColorTheme *selected_theme = &themes[0];
+ColorTheme *selected_theme = &builtin_themes[0];
+
+// Maps a capture name to its highlight style
+HighlightStyle get_highlight_style(const char *capture_name) {
+    if (strcmp(capture_name, "function.builtin") == 0) return HL_FUNCTION_BUILTIN;
+    if (strcmp(capture_name, "function") == 0) return HL_FUNCTION;
+    if (strcmp(capture_name, "function.call") == 0) return HL_FUNCTION;
+    if (strcmp(capture_name, "string") == 0) return HL_STRING;
+    if (strcmp(capture_name, "comment") == 0) return HL_COMMENT;
+    if (strcmp(capture_name, "keyword.control") == 0) return HL_KEYWORD_CONTROL;
+    if (strcmp(capture_name, "keyword") == 0) return HL_KEYWORD;
+    if (strcmp(capture_name, "keyword.function") == 0) return HL_KEYWORD;
+    if (strcmp(capture_name, "keyword.type") == 0) return HL_TYPE; // Changed from keyword
+    if (strcmp(capture_name, "keyword.import") == 0) return HL_KEYWORD;
+    if (strcmp(capture_name, "keyword.return") == 0) return HL_KEYWORD;
+    if (strcmp(capture_name, "type") == 0) return HL_TYPE;
+    if (strcmp(capture_name, "variable") == 0) return HL_VARIABLE;
+    if (strcmp(capture_name, "constant") == 0) return HL_CONSTANT;
+    if (strcmp(capture_name, "constant.builtin") == 0) return HL_CONSTANT;
+    if (strcmp(capture_name, "literal") == 0) return HL_LITERAL;
+    if (strcmp(capture_name, "number") == 0) return HL_LITERAL;
+    return HL_NONE;
+}
+
+const char *get_style_ansi(const ColorTheme *theme, HighlightStyle style) {
+    switch (style) {
+        case HL_FUNCTION_BUILTIN: return theme->ansi_function_builtin;
+        case HL_FUNCTION: return theme->ansi_function;
+        case HL_STRING: return theme->ansi_string;
+        case HL_COMMENT: return theme->ansi_comment;
+        case HL_KEYWORD: return theme->ansi_keyword;
+        case HL_KEYWORD_CONTROL: return theme->ansi_keyword_control;
+        case HL_TYPE: return theme->ansi_type;
+        case HL_VARIABLE: return theme->ansi_variable;
+        case HL_CONSTANT: return theme->ansi_constant;
+        case HL_LITERAL: return theme->ansi_literal;
+        default: return theme->ansi_reset; // default reset
+    }
+}
+
+const char *get_style_html_color(const ColorTheme *theme, HighlightStyle style) {
+    switch (style) {
+        case HL_FUNCTION_BUILTIN: return theme->html_function_builtin;
+        case HL_FUNCTION: return theme->html_function;
+        case HL_STRING: return theme->html_string;
+        case HL_COMMENT: return theme->html_comment;
+        case HL_KEYWORD: return theme->html_keyword;
+        case HL_KEYWORD_CONTROL: return theme->html_keyword_control;
+        case HL_TYPE: return theme->html_type;
+        case HL_VARIABLE: return theme->html_variable;
+        case HL_CONSTANT: return theme->html_constant;
+        case HL_LITERAL: return theme->html_literal;
+        default: return NULL; // For HTML, if no specific color, we rely on parent styles or default
+    }
+}
+
+static const char *const style_html_classes[HL_STYLE_COUNT] = {
+    NULL, "function-builtin", "function", "string", "comment", "keyword",
+    "keyword-control", "type", "variable", "constant", "literal"
+};
+
+// Compact class names are single letters assigned in style order
+static const char *const style_html_short_classes[HL_STYLE_COUNT] = {
+    NULL, "a", "b", "c", "d", "e", "f", "g", "h", "i", "j"
+};
+
+const char *get_style_html_class(HighlightStyle style) {
+    return (style < HL_STYLE_COUNT) ? style_html_classes[style] : NULL;
+}
+
+const char *get_style_html_short_class(HighlightStyle style) {
+    return (style < HL_STYLE_COUNT) ? style_html_short_classes[style] : NULL;
+}
+
+// Capture names that get_highlight_style maps back to each style
+static const char *const style_capture_names[HL_STYLE_COUNT] = {
+    "none", "function.builtin", "function", "string", "comment", "keyword",
+    "keyword.control", "type", "variable", "constant", "literal"
+};
+
+const char *get_style_capture_name(HighlightStyle style) {
+    return (style < HL_STYLE_COUNT) ? style_capture_names[style] : style_capture_names[HL_NONE];
+}
 
 // This function now returns ANSI codes from the selected theme's ANSI fields
 const char *get_ansi_color(const char *capture_name) {
-    if (strcmp(capture_name, "function.builtin") == 0) return selected_theme->ansi_function_builtin;
-    if (strcmp(capture_name, "function") == 0) return selected_theme->ansi_function;
-    if (strcmp(capture_name, "function.call") == 0) return selected_theme->ansi_function;
-    if (strcmp(capture_name, "string") == 0) return selected_theme->ansi_string;
-    if (strcmp(capture_name, "comment") == 0) return selected_theme->ansi_comment;
-    if (strcmp(capture_name, "keyword.control") == 0) return selected_theme->ansi_keyword_control;
-    if (strcmp(capture_name, "keyword") == 0) return selected_theme->ansi_keyword;
-    if (strcmp(capture_name, "keyword.function") == 0) return selected_theme->ansi_keyword;
-    if (strcmp(capture_name, "keyword.type") == 0) return selected_theme->ansi_keyword;
-    if (strcmp(capture_name, "keyword.import") == 0) return selected_theme->ansi_keyword;
-    if (strcmp(capture_name, "keyword.return") == 0) return selected_theme->ansi_keyword;
-    if (strcmp(capture_name, "type") == 0) return selected_theme->ansi_type;
-    if (strcmp(capture_name, "variable") == 0) return selected_theme->ansi_variable;
-    if (strcmp(capture_name, "constant") == 0) return selected_theme->ansi_constant;
-    if (strcmp(capture_name, "constant.builtin") == 0) return selected_theme->ansi_constant;
-    if (strcmp(capture_name, "literal") == 0) return selected_theme->ansi_literal;
-    if (strcmp(capture_name, "number") == 0) return selected_theme->ansi_literal;
-    return selected_theme->ansi_reset; // default reset
+    return get_style_ansi(selected_theme, get_highlight_style(capture_name));
 }
 
-// This function maps capture names to HTML class names (unchanged)
+// This function maps capture names to HTML class names
 const char *get_html_class(const char *capture_name) {
-    if (strcmp(capture_name, "function.builtin") == 0) return "function-builtin";
-    if (strcmp(capture_name, "function") == 0) return "function";
-    if (strcmp(capture_name, "function.call") == 0) return "function";
-    if (strcmp(capture_name, "string") == 0) return "string";
-    if (strcmp(capture_name, "comment") == 0) return "comment";
-    if (strcmp(capture_name, "keyword.control") == 0) return "keyword-control";
-    if (strcmp(capture_name, "keyword") == 0) return "keyword";
-    if (strcmp(capture_name, "keyword.function") == 0) return "keyword";
-    if (strcmp(capture_name, "keyword.type") == 0) return "type"; // Changed from keyword
-    if (strcmp(capture_name, "keyword.import") == 0) return "keyword";
-    if (strcmp(capture_name, "keyword.return") == 0) return "keyword";
-    if (strcmp(capture_name, "type") == 0) return "type";
-    if (strcmp(capture_name, "variable") == 0) return "variable";
-    if (strcmp(capture_name, "constant") == 0) return "constant";
-    if (strcmp(capture_name, "constant.builtin") == 0) return "constant";
-    if (strcmp(capture_name, "literal") == 0) return "literal";
-    if (strcmp(capture_name, "number") == 0) return "literal";
-    return NULL;
+    return get_style_html_class(get_highlight_style(capture_name));
 }
 
 // NEW: This function returns HTML color codes from the selected theme's HTML fields
 const char *get_html_color(const char *capture_name) {
-    if (strcmp(capture_name, "function.builtin") == 0) return selected_theme->html_function_builtin;
-    if (strcmp(capture_name, "function") == 0) return selected_theme->html_function;
-    if (strcmp(capture_name, "function.call") == 0) return selected_theme->html_function;
-    if (strcmp(capture_name, "string") == 0) return selected_theme->html_string;
-    if (strcmp(capture_name, "comment") == 0) return selected_theme->html_comment;
-    if (strcmp(capture_name, "keyword.control") == 0) return selected_theme->html_keyword_control;
-    if (strcmp(capture_name, "keyword") == 0) return selected_theme->html_keyword;
-    if (strcmp(capture_name, "keyword.function") == 0) return selected_theme->html_keyword;
-    if (strcmp(capture_name, "keyword.type") == 0) return selected_theme->html_type; // Changed from keyword
-    if (strcmp(capture_name, "keyword.import") == 0) return selected_theme->html_keyword;
-    if (strcmp(capture_name, "keyword.return") == 0) return selected_theme->html_keyword;
-    if (strcmp(capture_name, "type") == 0) return selected_theme->html_type;
-    if (strcmp(capture_name, "variable") == 0) return selected_theme->html_variable;
-    if (strcmp(capture_name, "constant") == 0) return selected_theme->html_constant;
-    if (strcmp(capture_name, "constant.builtin") == 0) return selected_theme->html_constant;
-    if (strcmp(capture_name, "literal") == 0) return selected_theme->html_literal;
-    if (strcmp(capture_name, "number") == 0) return selected_theme->html_literal;
-    return NULL; // For HTML, if no specific color, we rely on parent styles or default
+    return get_style_html_color(selected_theme, get_highlight_style(capture_name));
 }
 
 
-// Function to set the globally selected theme (unchanged)
-bool set_selected_theme(const char *theme_name) {
+// --- Theme Registry ---
+
+// Open-addressing index from name hash to theme, rebuilt whenever the list changes
+static uint32_t *theme_index;  // Theme position + 1; 0 marks an empty slot
+static size_t theme_index_size; // Power of two, at least twice THEMES_COUNT
+static bool builtins_ready;
+
+// FNV-1a
+uint32_t theme_name_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)name; *c; ++c) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool hex_color_to_rgb(const char *hex, uint8_t rgb[3]) {
+    rgb[0] = rgb[1] = rgb[2] = 0;
+    if (!hex || strlen(hex) != 7 || hex[0] != '#') return false;
+    for (int i = 1; i < 7; i++) {
+        if (!strchr("0123456789abcdefABCDEF", hex[i])) return false;
+    }
+    return sscanf(hex + 1, "%2hhx%2hhx%2hhx", &rgb[0], &rgb[1], &rgb[2]) == 3;
+}
+
+void theme_fill_derived(ColorTheme *theme) {
+    theme->name_hash = theme_name_hash(theme->name);
+    hex_color_to_rgb(theme->html_foreground, theme->rgb[HL_NONE]);
+    for (int style = HL_NONE + 1; style < HL_STYLE_COUNT; style++) {
+        hex_color_to_rgb(get_style_html_color(theme, (HighlightStyle)style), theme->rgb[style]);
+    }
+    hex_color_to_rgb(theme->html_background, theme->rgb_background);
+    hex_color_to_rgb(theme->html_line_number, theme->rgb_line_number);
+}
+
+static bool theme_index_rebuild(void) {
+    size_t size = 16;
+    while (size < THEMES_COUNT * 2) size *= 2;
+    uint32_t *index = calloc(size, sizeof(uint32_t));
+    if (!index) return false;
+
     for (size_t t = 0; t < THEMES_COUNT; t++) {
-        if (strcmp(themes[t].name, theme_name) == 0) {
-            selected_theme = &themes[t];
-            return true;
+        size_t slot = themes[t].name_hash & (size - 1);
+        while (index[slot]) slot = (slot + 1) & (size - 1);
+        index[slot] = (uint32_t)t + 1;
+    }
+    free(theme_index);
+    theme_index = index;
+    theme_index_size = size;
+    return true;
+}
+
+void themes_init(void) {
+    if (builtins_ready) return;
+    for (size_t t = 0; t < BUILTIN_THEMES_COUNT; t++) {
+        theme_fill_derived(&builtin_themes[t]);
+    }
+    builtins_ready = true;
+}
+
+ColorTheme *find_theme(const char *theme_name) {
+    themes_init();
+    if (!theme_index && !theme_index_rebuild()) return NULL;
+
+    uint32_t hash = theme_name_hash(theme_name);
+    for (size_t slot = hash & (theme_index_size - 1); theme_index[slot]; slot = (slot + 1) & (theme_index_size - 1)) {
+        ColorTheme *theme = &themes[theme_index[slot] - 1];
+        if (theme->name_hash == hash && strcmp(theme->name, theme_name) == 0) return theme;
+    }
+    return NULL;
+}
+
+bool themes_register(ColorTheme *list, size_t count) {
+    themes_init();
+
+    // Built-in themes keep their positions, with a loaded theme of the same name taking their place
+    ColorTheme *merged = malloc(sizeof(ColorTheme) * (BUILTIN_THEMES_COUNT + count));
+    bool *used = calloc(count ? count : 1, sizeof(bool));
+    if (!merged || !used) {
+        free(merged);
+        free(used);
+        return false;
+    }
+    size_t merged_count = 0;
+    for (size_t b = 0; b < BUILTIN_THEMES_COUNT; b++) {
+        merged[merged_count] = builtin_themes[b];
+        for (size_t i = 0; i < count; i++) {
+            if (list[i].name_hash == builtin_themes[b].name_hash && strcmp(list[i].name, builtin_themes[b].name) == 0) {
+                merged[merged_count] = list[i];
+                used[i] = true;
+            }
         }
+        merged_count++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!used[i]) merged[merged_count++] = list[i];
     }
-    return false; // Theme not found
+    free(used);
+
+    const char *selected_name = selected_theme->name;
+    ColorTheme *previous = themes;
+    size_t previous_count = THEMES_COUNT;
+    themes = merged;
+    THEMES_COUNT = merged_count;
+    if (!theme_index_rebuild()) {
+        themes = previous;
+        THEMES_COUNT = previous_count;
+        free(merged);
+        return false;
+    }
+    if (previous != builtin_themes) free(previous);
+
+    selected_theme = find_theme(selected_name);
+    if (!selected_theme) selected_theme = &themes[0];
+    return true;
+}
+
+// Function to set the globally selected theme
+bool set_selected_theme(const char *theme_name) {
+    ColorTheme *theme = find_theme(theme_name);
+    if (!theme) return false; // Theme not found
+    selected_theme = theme;
+    return true;
 }
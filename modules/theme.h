@@ -3,6 +3,24 @@
 
 #include <stdbool.h> // For bool type
 #include <stddef.h>
+#include <stdint.h>
+
+// Highlight styles shared by every output format. Capture names resolve to one of
+// these once per query capture, so renderers never compare capture names themselves.
+typedef enum {
+    HL_NONE = 0, // Captured, but rendered without a color
+    HL_FUNCTION_BUILTIN,
+    HL_FUNCTION,
+    HL_STRING,
+    HL_COMMENT,
+    HL_KEYWORD,
+    HL_KEYWORD_CONTROL,
+    HL_TYPE,
+    HL_VARIABLE,
+    HL_CONSTANT,
+    HL_LITERAL,
+    HL_STYLE_COUNT
+} HighlightStyle;
 
 // Color themes
 typedef struct {
@@ -35,11 +53,21 @@ typedef struct {
     const char *html_literal;
     const char *html_line_number;
 
+    // Page colors for HTML and image output
+    const char *html_background;
+    const char *html_foreground;
+
+    // Filled in from the fields above when the theme is registered
+    uint32_t name_hash;
+    uint8_t rgb[HL_STYLE_COUNT][3]; // Image colors per style; HL_NONE holds the foreground
+    uint8_t rgb_background[3];
+    uint8_t rgb_line_number[3];
+
 } ColorTheme;
 
-// Extern declaration for the themes array and THEMES_COUNT
-extern ColorTheme themes[];
-extern const size_t THEMES_COUNT;
+// All available themes: the built-in ones, plus any loaded from theme files (theme_cache.h)
+extern ColorTheme *themes;
+extern size_t THEMES_COUNT;
 
 // Global selected theme pointer
 extern ColorTheme *selected_theme;
@@ -50,5 +78,22 @@ const char *get_html_class(const char *capture_name); // Still returns HTML clas
 // NEW: Function to get HTML color directly from the selected theme
 const char *get_html_color(const char *capture_name);
 bool set_selected_theme(const char *theme_name);
+ColorTheme *find_theme(const char *theme_name); // NULL if no theme has that name
+
+// Theme registry
+uint32_t theme_name_hash(const char *name);
+bool hex_color_to_rgb(const char *hex, uint8_t rgb[3]); // "#RRGGBB"; false (and black) if malformed
+void theme_fill_derived(ColorTheme *theme);           // Computes name_hash and the RGB triples
+void themes_init(void);                              // Fills in the built-in themes (done by themes_load_dir)
+// Replaces the theme list (built-in themes stay available unless `list` redefines them by name)
+bool themes_register(ColorTheme *list, size_t count);
+
+// Style-based lookups
+HighlightStyle get_highlight_style(const char *capture_name);
+const char *get_style_ansi(const ColorTheme *theme, HighlightStyle style);
+const char *get_style_html_color(const ColorTheme *theme, HighlightStyle style);
+const char *get_style_html_class(HighlightStyle style);       // e.g. "keyword-control", NULL for HL_NONE
+const char *get_style_html_short_class(HighlightStyle style); // Generated compact name, e.g. "f", NULL for HL_NONE
+const char *get_style_capture_name(HighlightStyle style);     // Canonical capture name, e.g. "keyword.control"
 
 #endif // THEME_H
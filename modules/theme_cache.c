@@ -0,0 +1,527 @@
+#include "theme_cache.h"
+#include "theme.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --- Theme File Keys ---
+//
+// A theme file is a list of `key = value` lines; lines starting with '#' are comments.
+//
+//   name = corporate
+//   background = #1e1e1e
+//   foreground = #d4d4d4
+//   keyword = #cc7832
+//   ansi.keyword = 31;1      (optional SGR parameters; default is the 24-bit hex color)
+//
+// Colors that are not given fall back to the foreground.
+
+#define NO_ANSI ((size_t)-1)
+
+typedef struct {
+    const char *key;
+    size_t html_offset; // Offset of the hex color field in ColorTheme
+    size_t ansi_offset; // Offset of the ANSI field in ColorTheme, or NO_ANSI
+} ThemeColorKey;
+
+static const ThemeColorKey color_keys[] = {
+    {"function.builtin", offsetof(ColorTheme, html_function_builtin), offsetof(ColorTheme, ansi_function_builtin)},
+    {"function", offsetof(ColorTheme, html_function), offsetof(ColorTheme, ansi_function)},
+    {"string", offsetof(ColorTheme, html_string), offsetof(ColorTheme, ansi_string)},
+    {"comment", offsetof(ColorTheme, html_comment), offsetof(ColorTheme, ansi_comment)},
+    {"keyword", offsetof(ColorTheme, html_keyword), offsetof(ColorTheme, ansi_keyword)},
+    {"keyword.control", offsetof(ColorTheme, html_keyword_control), offsetof(ColorTheme, ansi_keyword_control)},
+    {"type", offsetof(ColorTheme, html_type), offsetof(ColorTheme, ansi_type)},
+    {"variable", offsetof(ColorTheme, html_variable), offsetof(ColorTheme, ansi_variable)},
+    {"constant", offsetof(ColorTheme, html_constant), offsetof(ColorTheme, ansi_constant)},
+    {"literal", offsetof(ColorTheme, html_literal), offsetof(ColorTheme, ansi_literal)},
+    {"line_number", offsetof(ColorTheme, html_line_number), offsetof(ColorTheme, ansi_line_number)},
+    {"background", offsetof(ColorTheme, html_background), NO_ANSI},
+    {"foreground", offsetof(ColorTheme, html_foreground), NO_ANSI},
+};
+
+#define COLOR_KEY_COUNT (sizeof(color_keys) / sizeof(color_keys[0]))
+#define FOREGROUND_KEY (COLOR_KEY_COUNT - 1)
+
+static const char **theme_field(ColorTheme *theme, size_t offset) {
+    return (const char **)((char *)theme + offset);
+}
+
+// --- Binary Cache Layout ---
+//
+// Header, then one record per theme, then a pool of NUL-terminated strings that the
+// records refer to by offset. Offset 0 is the empty string. The file is written in
+// host byte order and is only read back by the build that wrote it (record_size
+// and version guard against layout changes).
+
+#define THEME_CACHE_MAGIC "CTTHEME"
+#define THEME_CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t theme_count;
+    uint32_t string_pool_size;
+    uint64_t source_signature; // Hash of the theme files' names, sizes and modification times
+} ThemeCacheHeader;
+
+typedef struct {
+    uint32_t name_hash;
+    uint32_t name;
+    uint32_t html[COLOR_KEY_COUNT];
+    uint32_t ansi[COLOR_KEY_COUNT];
+    uint32_t ansi_reset;
+    uint8_t rgb[HL_STYLE_COUNT][3];
+    uint8_t rgb_background[3];
+    uint8_t rgb_line_number[3];
+} ThemeCacheRecord;
+
+// The cache the registered themes point into; stays mapped for the life of the process
+static void *loaded_cache;
+
+// --- Theme Files ---
+
+typedef struct {
+    char *path;
+    char *stem; // File name without ".theme"
+} ThemeSource;
+
+typedef struct {
+    char name[128];
+    char html[COLOR_KEY_COUNT][8];
+    char ansi[COLOR_KEY_COUNT][64]; // Empty: derive from the hex color
+} ThemeSpec;
+
+static char *trim(char *str) {
+    while (*str == ' ' || *str == '\t') str++;
+    size_t len = strlen(str);
+    while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t' || str[len - 1] == '\r' || str[len - 1] == '\n')) {
+        str[--len] = '\0';
+    }
+    return str;
+}
+
+static int find_color_key(const char *key) {
+    for (size_t k = 0; k < COLOR_KEY_COUNT; k++) {
+        if (strcmp(color_keys[k].key, key) == 0) return (int)k;
+    }
+    return -1;
+}
+
+static bool is_sgr_params(const char *value) {
+    if (!*value) return false;
+    for (const char *c = value; *c; ++c) {
+        if ((*c < '0' || *c > '9') && *c != ';') return false;
+    }
+    return true;
+}
+
+static int parse_theme_file(const ThemeSource *source, ThemeSpec *spec) {
+    FILE *fp = fopen(source->path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open theme file '%s': %s\n", source->path, strerror(errno));
+        return 1;
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    snprintf(spec->name, sizeof(spec->name), "%s", source->stem);
+
+    char line[512];
+    int line_number = 0;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), fp)) {
+        line_number++;
+        char *text = trim(line);
+        if (*text == '\0' || *text == '#') continue;
+
+        char *equals = strchr(text, '=');
+        if (!equals) {
+            fprintf(stderr, "Error: %s:%d: expected 'key = value'.\n", source->path, line_number);
+            result = 1;
+            break;
+        }
+        *equals = '\0';
+        char *key = trim(text);
+        char *value = trim(equals + 1);
+
+        bool is_ansi = strncmp(key, "ansi.", 5) == 0;
+        int color = find_color_key(is_ansi ? key + 5 : key);
+        uint8_t rgb[3];
+
+        if (strcmp(key, "name") == 0 && *value && strlen(value) < sizeof(spec->name)) {
+            snprintf(spec->name, sizeof(spec->name), "%s", value);
+        } else if (color >= 0 && !is_ansi && hex_color_to_rgb(value, rgb)) {
+            snprintf(spec->html[color], sizeof(spec->html[color]), "%s", value);
+        } else if (color >= 0 && is_ansi && color_keys[color].ansi_offset != NO_ANSI &&
+                   is_sgr_params(value) && strlen(value) < sizeof(spec->ansi[color])) {
+            snprintf(spec->ansi[color], sizeof(spec->ansi[color]), "%s", value);
+        } else {
+            fprintf(stderr, "Error: %s:%d: invalid entry '%s = %s'.\n", source->path, line_number, key, value);
+            result = 1;
+        }
+    }
+    fclose(fp);
+    if (result != 0) return result;
+
+    if (!spec->html[FOREGROUND_KEY][0]) snprintf(spec->html[FOREGROUND_KEY], sizeof(spec->html[0]), "#d4d4d4");
+    for (size_t k = 0; k < COLOR_KEY_COUNT; k++) {
+        if (spec->html[k][0]) continue;
+        const char *fallback = strcmp(color_keys[k].key, "background") == 0 ? "#1e1e1e" : spec->html[FOREGROUND_KEY];
+        snprintf(spec->html[k], sizeof(spec->html[k]), "%s", fallback);
+    }
+    return 0;
+}
+
+// --- Cache Building ---
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} ByteBuf;
+
+static void buf_append(ByteBuf *buf, const void *bytes, size_t n) {
+    if (buf->failed) return;
+    if (buf->len + n > buf->cap) {
+        size_t new_cap = buf->cap ? buf->cap : 4096;
+        while (new_cap < buf->len + n) new_cap *= 2;
+        char *grown = realloc(buf->data, new_cap);
+        if (!grown) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = grown;
+        buf->cap = new_cap;
+    }
+    memcpy(buf->data + buf->len, bytes, n);
+    buf->len += n;
+}
+
+static uint32_t pool_add(ByteBuf *pool, const char *str) {
+    uint32_t offset = (uint32_t)pool->len;
+    buf_append(pool, str, strlen(str) + 1);
+    return offset;
+}
+
+// Compiles the parsed themes into a cache blob. Returns NULL on allocation failure.
+static char *build_cache(const ThemeSpec *specs, size_t count, uint64_t signature, size_t *out_len) {
+    ByteBuf pool = {0};
+    pool_add(&pool, "");
+    uint32_t reset = pool_add(&pool, "\x1b[0m");
+
+    ThemeCacheRecord *records = calloc(count ? count : 1, sizeof(ThemeCacheRecord));
+    if (!records) return NULL;
+
+    for (size_t t = 0; t < count; t++) {
+        const ThemeSpec *spec = &specs[t];
+        ThemeCacheRecord *record = &records[t];
+        record->name_hash = theme_name_hash(spec->name);
+        record->name = pool_add(&pool, spec->name);
+        record->ansi_reset = reset;
+
+        for (size_t k = 0; k < COLOR_KEY_COUNT; k++) {
+            record->html[k] = pool_add(&pool, spec->html[k]);
+            if (color_keys[k].ansi_offset == NO_ANSI) continue;
+
+            char ansi[80];
+            if (spec->ansi[k][0]) {
+                snprintf(ansi, sizeof(ansi), "\x1b[%sm", spec->ansi[k]);
+            } else {
+                uint8_t rgb[3];
+                hex_color_to_rgb(spec->html[k], rgb);
+                snprintf(ansi, sizeof(ansi), "\x1b[38;2;%u;%u;%um", rgb[0], rgb[1], rgb[2]);
+            }
+            record->ansi[k] = pool_add(&pool, ansi);
+        }
+
+        // The same triples theme_fill_derived computes for built-in themes
+        ColorTheme view = {0};
+        view.name = spec->name;
+        for (size_t k = 0; k < COLOR_KEY_COUNT; k++) {
+            *theme_field(&view, color_keys[k].html_offset) = spec->html[k];
+        }
+        theme_fill_derived(&view);
+        memcpy(record->rgb, view.rgb, sizeof(record->rgb));
+        memcpy(record->rgb_background, view.rgb_background, 3);
+        memcpy(record->rgb_line_number, view.rgb_line_number, 3);
+    }
+
+    ThemeCacheHeader header = {0};
+    memcpy(header.magic, THEME_CACHE_MAGIC, sizeof(header.magic));
+    header.version = THEME_CACHE_VERSION;
+    header.record_size = sizeof(ThemeCacheRecord);
+    header.theme_count = (uint32_t)count;
+    header.string_pool_size = (uint32_t)pool.len;
+    header.source_signature = signature;
+
+    ByteBuf blob = {0};
+    buf_append(&blob, &header, sizeof(header));
+    buf_append(&blob, records, sizeof(ThemeCacheRecord) * count);
+    buf_append(&blob, pool.data, pool.len);
+    free(records);
+
+    bool failed = pool.failed || blob.failed;
+    free(pool.data);
+    if (failed) {
+        free(blob.data);
+        return NULL;
+    }
+    *out_len = blob.len;
+    return blob.data;
+}
+
+// Writes the cache next to its final path and renames it into place
+static void write_cache(const char *cache_path, const char *data, size_t len) {
+    char tmp_path[PATH_MAX];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", cache_path, (long)getpid());
+    if (n < 0 || (size_t)n >= sizeof(tmp_path)) return;
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) return; // A read-only theme directory just means compiling again next time
+    size_t written = fwrite(data, 1, len, out);
+    if (fclose(out) != 0 || written != len || rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+// --- Cache Loading ---
+
+// Checks the blob and returns its header, or NULL if it is not a usable cache
+static const ThemeCacheHeader *validate_cache(const char *data, size_t len, uint64_t signature) {
+    if (len < sizeof(ThemeCacheHeader)) return NULL;
+    const ThemeCacheHeader *header = (const ThemeCacheHeader *)data;
+    if (memcmp(header->magic, THEME_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != THEME_CACHE_VERSION ||
+        header->record_size != sizeof(ThemeCacheRecord) ||
+        header->source_signature != signature) {
+        return NULL;
+    }
+
+    size_t records_size = (size_t)header->theme_count * sizeof(ThemeCacheRecord);
+    if (len != sizeof(ThemeCacheHeader) + records_size + header->string_pool_size) return NULL;
+    const char *pool = data + sizeof(ThemeCacheHeader) + records_size;
+    if (header->string_pool_size == 0 || pool[header->string_pool_size - 1] != '\0') return NULL;
+
+    // Every offset must land inside the pool, whose last byte is a terminator
+    const ThemeCacheRecord *records = (const ThemeCacheRecord *)(data + sizeof(ThemeCacheHeader));
+    for (uint32_t t = 0; t < header->theme_count; t++) {
+        const ThemeCacheRecord *record = &records[t];
+        if (record->name >= header->string_pool_size || record->ansi_reset >= header->string_pool_size) return NULL;
+        for (size_t k = 0; k < COLOR_KEY_COUNT; k++) {
+            if (record->html[k] >= header->string_pool_size || record->ansi[k] >= header->string_pool_size) return NULL;
+        }
+    }
+    return header;
+}
+
+// Registers themes that point straight into the cache blob
+static int register_cache(const char *data) {
+    const ThemeCacheHeader *header = (const ThemeCacheHeader *)data;
+    const ThemeCacheRecord *records = (const ThemeCacheRecord *)(data + sizeof(ThemeCacheHeader));
+    const char *pool = (const char *)(records + header->theme_count);
+
+    ColorTheme *list = calloc(header->theme_count ? header->theme_count : 1, sizeof(ColorTheme));
+    if (!list) {
+        fprintf(stderr, "Failed to allocate memory for themes!\n");
+        return 1;
+    }
+    for (uint32_t t = 0; t < header->theme_count; t++) {
+        const ThemeCacheRecord *record = &records[t];
+        ColorTheme *theme = &list[t];
+        theme->name = pool + record->name;
+        theme->ansi_reset = pool + record->ansi_reset;
+        for (size_t k = 0; k < COLOR_KEY_COUNT; k++) {
+            *theme_field(theme, color_keys[k].html_offset) = pool + record->html[k];
+            if (color_keys[k].ansi_offset != NO_ANSI) {
+                *theme_field(theme, color_keys[k].ansi_offset) = pool + record->ansi[k];
+            }
+        }
+        theme->name_hash = record->name_hash;
+        memcpy(theme->rgb, record->rgb, sizeof(theme->rgb));
+        memcpy(theme->rgb_background, record->rgb_background, 3);
+        memcpy(theme->rgb_line_number, record->rgb_line_number, 3);
+    }
+
+    bool registered = themes_register(list, header->theme_count);
+    free(list); // themes_register copies the entries
+    if (!registered) {
+        fprintf(stderr, "Failed to allocate memory for themes!\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Maps the cache file if it exists and matches `signature`. Returns the mapping or NULL.
+static void *map_cache(const char *cache_path, uint64_t signature) {
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else if (!validate_cache(data, (size_t)st.st_size, signature)) {
+            munmap(data, (size_t)st.st_size);
+            data = NULL;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+// --- Directory Scan ---
+
+static int compare_sources(const void *a, const void *b) {
+    return strcmp(((const ThemeSource *)a)->stem, ((const ThemeSource *)b)->stem);
+}
+
+static void free_sources(ThemeSource *sources, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(sources[i].path);
+        free(sources[i].stem);
+    }
+    free(sources);
+}
+
+static uint64_t hash64(uint64_t hash, const void *bytes, size_t n) {
+    const unsigned char *p = bytes;
+    for (size_t i = 0; i < n; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Lists the *.theme files of `dir` in name order and hashes their names, sizes and mtimes
+static int scan_theme_dir(const char *dir, ThemeSource **out_sources, size_t *out_count, uint64_t *signature) {
+    DIR *handle = opendir(dir);
+    if (!handle) return -1;
+
+    ThemeSource *sources = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t combined = 1469598103934665603ull;
+    int result = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        if (name_len <= 6 || strcmp(entry->d_name + name_len - 6, ".theme") != 0) continue;
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 16;
+            ThemeSource *grown = realloc(sources, sizeof(ThemeSource) * new_capacity);
+            if (!grown) {
+                result = 1;
+                break;
+            }
+            sources = grown;
+            capacity = new_capacity;
+        }
+        sources[count].path = strdup(path);
+        sources[count].stem = strndup(entry->d_name, name_len - 6);
+        if (!sources[count].path || !sources[count].stem) {
+            free(sources[count].path);
+            free(sources[count].stem);
+            result = 1;
+            break;
+        }
+        count++;
+
+        // Order-independent combination of per-file hashes
+        int64_t stamp[3] = {(int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec};
+        uint64_t file_hash = hash64(1469598103934665603ull, entry->d_name, name_len);
+        file_hash = hash64(file_hash, stamp, sizeof(stamp));
+        combined ^= file_hash;
+    }
+    closedir(handle);
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to allocate memory for theme files!\n");
+        free_sources(sources, count);
+        return 1;
+    }
+    qsort(sources, count, sizeof(ThemeSource), compare_sources);
+    *out_sources = sources;
+    *out_count = count;
+    *signature = hash64(combined, &count, sizeof(count));
+    return 0;
+}
+
+int themes_load_dir(const char *dir, const char *cache_path, bool required) {
+    ThemeSource *sources = NULL;
+    size_t count = 0;
+    uint64_t signature = 0;
+
+    themes_init(); // The default theme is used as is when no theme is loaded or selected
+
+    int scanned = scan_theme_dir(dir, &sources, &count, &signature);
+    if (scanned < 0) {
+        if (!required) return 0;
+        fprintf(stderr, "Error: Could not open theme directory '%s': %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (scanned > 0) return 1;
+    if (count == 0) {
+        free(sources);
+        return 0;
+    }
+
+    char default_cache_path[PATH_MAX];
+    if (!cache_path) {
+        snprintf(default_cache_path, sizeof(default_cache_path), "%s/%s", dir, THEME_CACHE_FILE_NAME);
+        cache_path = default_cache_path;
+    }
+
+    // Fast path: the compiled cache is up to date
+    void *mapped = map_cache(cache_path, signature);
+    if (mapped) {
+        free_sources(sources, count);
+        loaded_cache = mapped;
+        return register_cache(mapped);
+    }
+
+    ThemeSpec *specs = malloc(sizeof(ThemeSpec) * count);
+    if (!specs) {
+        fprintf(stderr, "Failed to allocate memory for themes!\n");
+        free_sources(sources, count);
+        return 1;
+    }
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        result = parse_theme_file(&sources[i], &specs[i]);
+    }
+    free_sources(sources, count);
+    if (result != 0) {
+        free(specs);
+        return result;
+    }
+
+    size_t blob_len = 0;
+    char *blob = build_cache(specs, count, signature, &blob_len);
+    free(specs);
+    if (!blob) {
+        fprintf(stderr, "Failed to allocate memory for the theme cache!\n");
+        return 1;
+    }
+    write_cache(cache_path, blob, blob_len);
+
+    loaded_cache = blob;
+    return register_cache(blob);
+}
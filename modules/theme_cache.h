@@ -0,0 +1,16 @@
+#ifndef THEME_CACHE_H
+#define THEME_CACHE_H
+
+#include <stdbool.h>
+
+#define THEME_DEFAULT_DIR "themes"
+#define THEME_CACHE_FILE_NAME "themes.cache"
+
+// Loads every *.theme file in `dir` and registers the themes next to the built-in ones.
+// The files are compiled into a binary cache (by default `dir`/themes.cache, or
+// `cache_path`) that later runs map straight into memory; it is rebuilt whenever a
+// theme file is added, removed or modified. A missing directory is only an error
+// when `required` is set. Returns 0 on success, 1 on failure.
+int themes_load_dir(const char *dir, const char *cache_path, bool required);
+
+#endif // THEME_CACHE_H
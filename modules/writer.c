@@ -0,0 +1,108 @@
+#include "writer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+void writer_init(Writer *w, int fd) {
+    w->fd = fd;
+    w->sink = NULL;
+    w->sink_context = NULL;
+    w->failed = false;
+    w->iov_count = 0;
+    w->buffer_len = 0;
+    w->bytes_referenced = 0;
+    w->bytes_copied = 0;
+    w->writev_calls = 0;
+}
+
+void writer_init_sink(Writer *w, WriterSink sink, void *context) {
+    writer_init(w, -1);
+    w->sink = sink;
+    w->sink_context = context;
+}
+
+bool writer_flush(Writer *w) {
+    if (w->sink) {
+        if (w->iov_count > 0 && !w->failed) {
+            w->writev_calls++;
+            if (!w->sink(w->sink_context, w->iov, w->iov_count)) w->failed = true;
+        }
+        w->iov_count = 0;
+        w->buffer_len = 0;
+        return !w->failed;
+    }
+
+    struct iovec *iov = w->iov;
+    int count = w->iov_count;
+    while (count > 0 && !w->failed) {
+        ssize_t written = writev(w->fd, iov, count);
+        w->writev_calls++;
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            w->failed = true;
+            break;
+        }
+        // Skip what went out; a short write leaves the rest of one iovec
+        size_t left = (size_t)written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    w->iov_count = 0;
+    w->buffer_len = 0;
+    return !w->failed;
+}
+
+static bool writer_extends_last(const Writer *w, const void *data);
+
+static void writer_push(Writer *w, const void *data, size_t len) {
+    if (writer_extends_last(w, data)) {
+        w->iov[w->iov_count - 1].iov_len += len;
+        return;
+    }
+    if (w->iov_count == WRITER_IOV_COUNT) writer_flush(w);
+    w->iov[w->iov_count].iov_base = (void *)data;
+    w->iov[w->iov_count].iov_len = len;
+    w->iov_count++;
+}
+
+static bool writer_extends_last(const Writer *w, const void *data) {
+    if (w->iov_count == 0) return false;
+    const struct iovec *last = &w->iov[w->iov_count - 1];
+    return (const char *)last->iov_base + last->iov_len == (const char *)data;
+}
+
+void writer_ref(Writer *w, const void *data, size_t len) {
+    if (len == 0) return;
+    if (len < WRITER_MIN_REF && !writer_extends_last(w, data)) {
+        // An iovec of its own costs the kernel more than copying a few bytes
+        writer_copy(w, data, len);
+        return;
+    }
+    w->bytes_referenced += len;
+    writer_push(w, data, len);
+}
+
+void writer_copy(Writer *w, const void *data, size_t len) {
+    if (len == 0) return;
+    w->bytes_copied += len;
+    if (len > WRITER_BUFFER_SIZE) {
+        // Too big to keep; write out everything before it and then the data itself
+        writer_push(w, data, len);
+        writer_flush(w);
+        return;
+    }
+    // Flush first if either the buffer or the iovecs are full, as a flush empties the buffer
+    if (w->buffer_len + len > WRITER_BUFFER_SIZE || w->iov_count == WRITER_IOV_COUNT) writer_flush(w);
+    char *dst = w->buffer + w->buffer_len;
+    memcpy(dst, data, len);
+    w->buffer_len += len;
+    writer_push(w, dst, len);
+}
@@ -0,0 +1,49 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define WRITER_IOV_COUNT 1024          // iovecs per writev (the usual IOV_MAX)
+#define WRITER_BUFFER_SIZE (64 * 1024) // Bytes that had to be copied, e.g. formatted line numbers
+#define WRITER_MIN_REF 64               // Shorter references are copied unless they extend the last iovec
+
+// Output that is gathered as references rather than copied: writer_ref queues a
+// pointer to bytes that stay valid until the next flush (the source buffer, theme
+// escapes, string literals), writer_copy keeps formatted bytes in a small buffer,
+// and everything goes out with writev in large batches. Adjacent references, as
+// consecutive pieces of the source are, share one iovec; short isolated ones are
+// copied, so markup and escapes between code pieces pack into the buffer.
+// Takes a batch instead of writev, e.g. to compress it; returns false on failure
+typedef bool (*WriterSink)(void *context, const struct iovec *iov, int count);
+
+typedef struct {
+    int fd;
+    WriterSink sink; // When set, batches go here instead of to `fd`
+    void *sink_context;
+    bool failed;
+    int iov_count;
+    struct iovec iov[WRITER_IOV_COUNT];
+    size_t buffer_len;
+    char buffer[WRITER_BUFFER_SIZE];
+
+    // Diagnostics
+    size_t bytes_referenced;
+    size_t bytes_copied;
+    size_t writev_calls;
+} Writer;
+
+void writer_init(Writer *w, int fd);
+void writer_init_sink(Writer *w, WriterSink sink, void *context);
+
+// Queues data[0, len), which must stay unchanged until the next writer_flush
+void writer_ref(Writer *w, const void *data, size_t len);
+
+// Queues a copy of data[0, len)
+void writer_copy(Writer *w, const void *data, size_t len);
+
+// Writes everything queued. Returns false if the output failed (also on any earlier failure).
+bool writer_flush(Writer *w);
+
+#endif // WRITER_H
@@ -0,0 +1,127 @@
+; Identifier naming conventions
+
+(identifier) @variable
+
+((identifier) @constant
+ (#match? @constant "^[A-Z][A-Z_0-9]*$"))
+
+((identifier) @variable.builtin
+ (#eq? @variable.builtin "self"))
+
+; Builtin functions
+
+((function_call
+  name: (identifier) @function.builtin)
+ (#any-of?
+   @function.builtin
+   "assert" "collectgarbage" "dofile" "error" "getmetatable" "ipairs" "load" "loadfile" "next" "pairs"
+   "pcall" "print" "rawequal" "rawget" "rawlen" "rawset" "require" "select" "setmetatable" "tonumber"
+   "tostring" "type" "xpcall"))
+
+; Function calls
+
+(function_call
+  name: (identifier) @function)
+(function_call
+  name: (dot_index_expression field: (identifier) @function))
+(function_call
+  name: (method_index_expression method: (identifier) @function.method))
+
+; Function definitions
+
+(function_declaration
+  name: (identifier) @function)
+(function_declaration
+  name: (dot_index_expression field: (identifier) @function))
+(function_declaration
+  name: (method_index_expression method: (identifier) @function.method))
+
+(parameters (identifier) @variable.parameter)
+
+; Fields
+
+(field name: (identifier) @property)
+(dot_index_expression field: (identifier) @property)
+
+; Labels
+
+(label_statement (identifier) @label)
+(goto_statement (identifier) @label)
+
+; Literals
+
+[
+  (nil)
+  (true)
+  (false)
+  (vararg_expression)
+] @constant.builtin
+
+(number) @number
+(string) @string
+(escape_sequence) @escape
+
+(comment) @comment
+(hash_bang_line) @comment
+
+; Keywords
+
+[
+  "and"
+  "break"
+  "do"
+  "else"
+  "elseif"
+  "end"
+  "for"
+  "function"
+  "goto"
+  "if"
+  "in"
+  "local"
+  "not"
+  "or"
+  "repeat"
+  "return"
+  "then"
+  "until"
+  "while"
+] @keyword
+
+; Operators and punctuation
+
+[
+  "+"
+  "-"
+  "*"
+  "/"
+  "//"
+  "%"
+  "^"
+  "#"
+  ".."
+  "=="
+  "~="
+  "<"
+  "<="
+  ">"
+  ">="
+  "="
+] @operator
+
+[
+  "("
+  ")"
+  "["
+  "]"
+  "{"
+  "}"
+] @punctuation.bracket
+
+[
+  ","
+  "."
+  ":"
+  ";"
+  "::"
+] @punctuation.delimiter